@@ -1,7 +1,18 @@
 #include "ViewerApplication.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <numeric>
+#include <sstream>
+#include <tuple>
+#include <unordered_map>
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
@@ -9,8 +20,13 @@
 #include <glm/gtx/io.hpp>
 
 #include "utils/cameras.hpp"
+#include "utils/gl_state.hpp"
 #include "utils/gltf.hpp"
+#include "utils/ibl.hpp"
+#include "utils/frustum.hpp"
 #include "utils/images.hpp"
+#include "utils/mesh_optimization.hpp"
+#include "utils/texture_cache.hpp"
 
 #include <stb_image.h>
 #include <stb_image_write.h>
@@ -19,10 +35,40 @@
 #define VERTEX_ATTRIB_POSITION_IDX 0
 #define VERTEX_ATTRIB_NORMAL_IDX 1
 #define VERTEX_ATTRIB_TEXCOORD0_IDX 2
+#define VERTEX_ATTRIB_NODE_IDX 3
 #define SKYBOX_SIZE 512
-#define IRRADIANCEMAP_SIZE 32
 #define PREFILTERMAP_SIZE 128
-#define BRDF_LUT_SIZE 512
+#define PREFILTERMAP_LEVELS 5
+#define PREFILTER_SAMPLE_COUNT 1024
+// Most texture data streamed in by frame, see TextureStreamer::update
+#define STREAMING_UPLOAD_BYTES_PER_FRAME (16 << 20)
+// Work group size of prefilter.cs.glsl
+#define IBL_GROUP_SIZE 8
+
+// Optional parts of the forward fragment shader, each compiled in by a #define
+// (SHADER_FEATURE_DEFINES) in the program variant of a material
+#define SHADER_FEATURE_BASE_COLOR_TEXTURE (1u << 0)
+#define SHADER_FEATURE_METALLIC_ROUGHNESS_TEXTURE (1u << 1)
+#define SHADER_FEATURE_EMISSIVE_TEXTURE (1u << 2)
+#define SHADER_FEATURE_OCCLUSION_TEXTURE (1u << 3)
+#define SHADER_FEATURE_NORMAL_TEXTURE (1u << 4)
+#define SHADER_FEATURE_IBL (1u << 5)
+// Without it, the split sum terms of IBL come from an analytic fit instead of
+// the BRDF LUT: one texture unit and fetch less
+#define SHADER_FEATURE_BRDF_LUT (1u << 6)
+// Clustered KHR_lights_punctual lights, only for scenes that have some
+#define SHADER_FEATURE_PUNCTUAL_LIGHTS (1u << 7)
+#define SHADER_FEATURE_COUNT 8
+
+static const char *const SHADER_FEATURE_DEFINES[SHADER_FEATURE_COUNT] = {
+	"HAS_BASE_COLOR_TEXTURE",
+	"HAS_METALLIC_ROUGHNESS_TEXTURE",
+	"HAS_EMISSIVE_TEXTURE",
+	"HAS_OCCLUSION_TEXTURE",
+	"HAS_NORMAL_TEXTURE",
+	"USE_IBL",
+	"HAS_BRDF_LUT",
+	"HAS_PUNCTUAL_LIGHTS"};
 
 void keyCallback(
     GLFWwindow *window, int key, int scancode, int action, int mods)
@@ -32,24 +78,831 @@ void keyCallback(
   }
 }
 
-bool ViewerApplication::loadGltfFile(tinygltf::Model& model)
+std::unique_ptr<EGLHandle> ViewerApplication::createHeadlessContext() const
 {
-	std::string err;
-	std::string warn;
+	if (m_OutputPath.empty() && m_BatchFilePath.empty())
+	{
+		return nullptr;
+	}
+
+	try
+	{
+		auto handle = std::make_unique<EGLHandle>();
+
+		std::clog << "Rendering with a headless EGL context" << std::endl;
+
+		return handle;
+	}
+	catch (const std::runtime_error& e)
+	{
+		std::clog
+			<< "No headless context (" << e.what()
+			<< "), rendering with a hidden window" << std::endl;
+
+		return nullptr;
+	}
+}
+
+bool ViewerApplication::loadGltfFile(
+	const fs::path& path,
+	tinygltf::Model& model)
+{
+	std::vector<DeferredImage> deferredImages;
+
+	return loadGltfModel(path, model, deferredImages)
+		&& decodeDeferredImages(model, deferredImages, m_threadPool);
+}
+
+bool ViewerApplication::loadModel(const fs::path& path, LoadedModel& scene)
+{
+	if (!loadGltfFile(path, scene.model))
+	{
+		return false;
+	}
+
+	if (m_optimizeMeshes)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		const auto optimizations = optimizeMeshes(scene.model, m_threadPool);
+
+		if (!optimizations.empty())
+		{
+			VertexCacheStatistics before;
+			VertexCacheStatistics after;
+			sumMeshOptimizations(optimizations, before, after);
+
+			std::clog << "Optimized " << optimizations.size()
+				<< " primitives in "
+				<< std::chrono::duration<double, std::milli>(
+					std::chrono::steady_clock::now() - start).count()
+				<< " ms: ACMR " << before.acmr() << " -> " << after.acmr()
+				<< ", ATVR " << before.atvr() << " -> " << after.atvr()
+				<< std::endl;
+		}
+	}
+
+	scene.sceneGraph.build(scene.model, scene.model.defaultScene);
+	scene.sceneGraph.update();
+	scene.lights = collectPunctualLights(scene.model, scene.sceneGraph);
+
+	computeSceneBounds(
+		scene.model,
+		scene.sceneGraph,
+		scene.bboxMin,
+		scene.bboxMax,
+		&m_threadPool);
+
+	// Only the interactive viewer streams textures, images rendered to files
+	// need every level from their first frame
+	scene.textures.init(
+		scene.model,
+		m_threadPool,
+		m_textureBudgetMiB > 0 && m_OutputPath.empty() && m_BatchFilePath.empty());
+	scene.bufferObjects = createBufferObjects(scene.model);
+	scene.vertexArrayObjects = createVertexArrayObjects(
+		scene.model,
+		scene.bufferObjects,
+		scene.meshIndexToVaoRange);
+
+	createInstancing(scene);
+	buildDrawList(scene);
+	createIndirectDraws(scene);
+	createMaterialUniforms(scene);
+	uploadNodeUniforms(scene);
+	updateDrawBounds(scene);
+
+	// The scene bounds only know about nodes, not about their instances
+	for (size_t i = 0; i < scene.drawList.size(); ++i)
+	{
+		if (scene.drawList[i].transform >= scene.sceneGraph.size()
+			&& scene.drawList[i].hasBounds)
+		{
+			scene.bboxMin = glm::min(scene.bboxMin, scene.drawBoundsMin[i]);
+			scene.bboxMax = glm::max(scene.bboxMax, scene.drawBoundsMax[i]);
+		}
+	}
+
+	return true;
+}
+
+void ViewerApplication::createInstancing(LoadedModel& scene) const
+{
+	const auto &model = scene.model;
+	const auto &graph = scene.sceneGraph;
+
+	scene.instanceNodes.clear();
+	scene.instanceMatrices.clear();
+
+	for (const auto nodeIdx : graph.meshNodes())
+	{
+		const auto matrices = getMeshGpuInstances(
+			model,
+			model.nodes[graph.nodeIndices()[nodeIdx]]);
+
+		scene.instanceNodes.insert(
+			scene.instanceNodes.end(),
+			matrices.size(),
+			nodeIdx);
+		scene.instanceMatrices.insert(
+			scene.instanceMatrices.end(),
+			matrices.begin(),
+			matrices.end());
+	}
+
+	if (!scene.instanceNodes.empty())
+	{
+		std::clog << "Loaded " << scene.instanceNodes.size()
+			<< " EXT_mesh_gpu_instancing instances" << std::endl;
+	}
+
+	// Filled by the draw loop, one transform index per instance
+	glGenBuffers(1, &scene.instanceTransformBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, scene.instanceTransformBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+
+	for (const auto vertexArray : scene.vertexArrayObjects)
+	{
+		glBindVertexArray(vertexArray);
+		glEnableVertexAttribArray(VERTEX_ATTRIB_NODE_IDX);
+		glVertexAttribIPointer(
+			VERTEX_ATTRIB_NODE_IDX,
+			1,
+			GL_UNSIGNED_INT,
+			sizeof(GLuint),
+			nullptr);
+		glVertexAttribDivisor(VERTEX_ATTRIB_NODE_IDX, 1);
+	}
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ViewerApplication::buildDrawList(LoadedModel& scene) const
+{
+	const auto &model = scene.model;
+	const auto &graph = scene.sceneGraph;
+
+	scene.drawList.clear();
+
+	// Local bounds of each primitive, computed once per mesh
+	std::vector<std::vector<DrawItem>> meshItems(model.meshes.size());
+	size_t instanceEnd = 0;
+
+	for (const auto nodeIdx : graph.meshNodes())
+	{
+		// Instances of the node, if it has some
+		const auto instanceBegin = instanceEnd;
+		while (instanceEnd < scene.instanceNodes.size()
+			&& scene.instanceNodes[instanceEnd] == nodeIdx)
+		{
+			++instanceEnd;
+		}
+
+		const auto meshIdx = graph.meshes()[nodeIdx];
+		const tinygltf::Mesh& mesh = model.meshes[meshIdx];
+		const VaoRange& range = scene.meshIndexToVaoRange[meshIdx];
+		auto &items = meshItems[meshIdx];
+
+		if (items.empty())
+		{
+			items.resize(range.count);
+
+			for (GLsizei i = 0; i < range.count; ++i)
+			{
+				items[i].hasBounds = computePrimitiveBounds(
+					model,
+					mesh.primitives[i],
+					items[i].localMin,
+					items[i].localMax);
+			}
+		}
+
+		for (GLsizei i = 0; i < range.count; ++i)
+		{
+			const tinygltf::Primitive& primitive = mesh.primitives[i];
+			DrawItem item = items[i];
+
+			item.node = nodeIdx;
+			item.transform = nodeIdx;
+			item.primitive = i;
+			item.indirectCommand = -1;
+			item.material = primitive.material;
+			item.vertexArray = scene.vertexArrayObjects[range.begin + i];
+			item.mode = primitive.mode;
+
+			if (primitive.indices >= 0)
+			{
+				const auto& accessor = model.accessors[primitive.indices];
+				const auto& bufferView = model.bufferViews[accessor.bufferView];
+
+				item.count = accessor.count;
+				item.indexType = accessor.componentType;
+				item.indexByteOffset = bufferView.byteOffset + accessor.byteOffset;
+			}
+			else
+			{
+				const auto accessorIdx = (*begin(primitive.attributes)).second;
+				const auto &accessor = model.accessors[accessorIdx];
+
+				item.count = accessor.count;
+				item.indexType = 0;
+				item.indexByteOffset = 0;
+			}
+
+			if (instanceBegin == instanceEnd)
+			{
+				scene.drawList.push_back(item);
+				continue;
+			}
+
+			for (auto j = instanceBegin; j < instanceEnd; ++j)
+			{
+				item.transform = uint32_t(graph.size() + j);
+				scene.drawList.push_back(item);
+			}
+		}
+	}
+
+	// Every primitive is drawn with the same program, so the material is the
+	// most expensive state change (up to 8 textures and 12 uniforms), then
+	// the vertex array. Nodes last so that draws of a node stay together
+	// when they share a material. Draws of the same primitive end up next to
+	// each other, which makes them instanced draws.
+	std::stable_sort(
+		scene.drawList.begin(),
+		scene.drawList.end(),
+		[](const DrawItem& lhs, const DrawItem& rhs)
+		{
+			return std::tie(lhs.material, lhs.vertexArray, lhs.node, lhs.transform)
+				< std::tie(rhs.material, rhs.vertexArray, rhs.node, rhs.transform);
+		});
+}
+
+void ViewerApplication::updateDrawBounds(LoadedModel& scene)
+{
+	const auto &transformMatrices = scene.transformMatrices;
+	const auto count = scene.drawList.size();
+
+	scene.drawSpheres.resize(count);
+	scene.drawBoundsMin.resize(count);
+	scene.drawBoundsMax.resize(count);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const auto &item = scene.drawList[i];
+
+		// Unknown bounds are never culled
+		if (!item.hasBounds)
+		{
+			const auto infinity = std::numeric_limits<float>::infinity();
+
+			scene.drawSpheres[i] = glm::vec4(0, 0, 0, infinity);
+			scene.drawBoundsMin[i] = glm::vec3(-infinity);
+			scene.drawBoundsMax[i] = glm::vec3(infinity);
+
+			continue;
+		}
+
+		const auto &matrix = transformMatrices[item.transform];
+
+		transformBounds(
+			matrix,
+			item.localMin,
+			item.localMax,
+			scene.drawBoundsMin[i],
+			scene.drawBoundsMax[i]);
+
+		// The local sphere scaled by the largest axis scale is usually
+		// tighter than the sphere around the world box
+		const auto localCenter = 0.5f * (item.localMin + item.localMax);
+		const auto localRadius =
+			0.5f * glm::length(item.localMax - item.localMin);
+		const auto maxScale = std::sqrt(std::max({
+			glm::dot(glm::vec3(matrix[0]), glm::vec3(matrix[0])),
+			glm::dot(glm::vec3(matrix[1]), glm::vec3(matrix[1])),
+			glm::dot(glm::vec3(matrix[2]), glm::vec3(matrix[2]))}));
+
+		scene.drawSpheres[i] = glm::vec4(
+			glm::vec3(matrix * glm::vec4(localCenter, 1)),
+			localRadius * maxScale);
+	}
+
+	// Infinite boxes end up as unbounded primitives of the BVH
+	scene.bvh.build(scene.drawBoundsMin, scene.drawBoundsMax, &m_threadPool);
+}
+
+void ViewerApplication::createMaterialUniforms(LoadedModel& scene) const
+{
+	const auto &model = scene.model;
+
+	MaterialUniforms defaultMaterial;
+	defaultMaterial.baseColorFactor = glm::vec4(1);
+	defaultMaterial.emissiveFactor = glm::vec4(0);
+	defaultMaterial.metallicFactor = 0;
+	defaultMaterial.roughnessFactor = 0;
+	defaultMaterial.occlusionStrength = 1;
+	defaultMaterial.normalScale = 1;
+
+	const auto stride = getUniformBlockStride(sizeof(MaterialUniforms));
+	std::vector<unsigned char> data(
+		(model.materials.size() + 1) * stride, 0);
+
+	scene.materialShaderFeatures.assign(
+		model.materials.size() + 1,
+		SHADER_FEATURE_IBL | SHADER_FEATURE_BRDF_LUT
+			| SHADER_FEATURE_PUNCTUAL_LIGHTS);
+
+	for (size_t i = 0; i <= model.materials.size(); ++i)
+	{
+		auto block = defaultMaterial;
+
+		// Materials are ignored for models without textures
+		if (i < model.materials.size() && !model.textures.empty())
+		{
+			const auto &material = model.materials[i];
+			const auto &pbrMetallicRoughness = material.pbrMetallicRoughness;
+			const auto &baseColorFactor = pbrMetallicRoughness.baseColorFactor;
+			const auto &emissiveFactor = material.emissiveFactor;
+
+			block.baseColorFactor = glm::vec4(
+				baseColorFactor[0],
+				baseColorFactor[1],
+				baseColorFactor[2],
+				baseColorFactor[3]);
+			block.emissiveFactor = glm::vec4(
+				emissiveFactor[0],
+				emissiveFactor[1],
+				emissiveFactor[2],
+				0);
+			block.metallicFactor = pbrMetallicRoughness.metallicFactor;
+			block.roughnessFactor = pbrMetallicRoughness.roughnessFactor;
+			block.occlusionStrength = material.occlusionTexture.strength;
+			block.normalScale = material.normalTexture.scale;
+
+			// Only the textures the material references are sampled
+			const std::pair<int, uint32_t> textureFeatures[] = {
+				{pbrMetallicRoughness.baseColorTexture.index,
+					SHADER_FEATURE_BASE_COLOR_TEXTURE},
+				{pbrMetallicRoughness.metallicRoughnessTexture.index,
+					SHADER_FEATURE_METALLIC_ROUGHNESS_TEXTURE},
+				{material.emissiveTexture.index,
+					SHADER_FEATURE_EMISSIVE_TEXTURE},
+				{material.occlusionTexture.index,
+					SHADER_FEATURE_OCCLUSION_TEXTURE},
+				{material.normalTexture.index,
+					SHADER_FEATURE_NORMAL_TEXTURE}};
+
+			for (const auto &textureFeature : textureFeatures)
+			{
+				if (textureFeature.first >= 0
+					&& size_t(textureFeature.first) < model.textures.size())
+				{
+					scene.materialShaderFeatures[i] |= textureFeature.second;
+				}
+			}
+		}
+
+		std::memcpy(&data[i * stride], &block, sizeof(block));
+	}
+
+	glGenBuffers(1, &scene.materialUniformBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, scene.materialUniformBuffer);
+	glBufferStorage(GL_UNIFORM_BUFFER, data.size(), data.data(), 0);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	scene.materialUniformStride = stride;
+}
+
+void ViewerApplication::createIndirectDraws(LoadedModel& scene) const
+{
+	const auto &model = scene.model;
+
+	std::vector<MergedVertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<GLuint> nodeIndices;
+
+	// Each primitive is merged once, whatever the number of nodes using its
+	// mesh. mergedPrimitives[mesh][primitive].indexCount == 0 means that it
+	// has not been visited, mergeFailed that it cannot be merged.
+	std::vector<std::vector<MergedPrimitive>> mergedPrimitives(
+		model.meshes.size());
+	std::vector<std::vector<bool>> mergeFailed(model.meshes.size());
+
+	scene.indirectBuckets.clear();
+
+	for (auto &item : scene.drawList)
+	{
+		const auto meshIdx = scene.sceneGraph.meshes()[item.node];
+		const auto &mesh = model.meshes[meshIdx];
+		const auto primitiveIdx = item.primitive;
+
+		auto &merged = mergedPrimitives[meshIdx];
+		auto &failed = mergeFailed[meshIdx];
+
+		if (merged.empty())
+		{
+			merged.resize(mesh.primitives.size(), MergedPrimitive{0, 0, 0});
+			failed.resize(mesh.primitives.size(), false);
+		}
+
+		if (failed[primitiveIdx])
+		{
+			continue;
+		}
+
+		auto &range = merged[primitiveIdx];
+
+		if (range.indexCount == 0
+			&& !appendMergedPrimitive(
+				model,
+				mesh.primitives[primitiveIdx],
+				vertices,
+				indices,
+				range))
+		{
+			failed[primitiveIdx] = true;
+			continue;
+		}
+
+		// The draw list is sorted by material, so are the commands
+		if (scene.indirectBuckets.empty()
+			|| scene.indirectBuckets.back().material != item.material)
+		{
+			scene.indirectBuckets.push_back(
+				IndirectBucket{item.material, GLsizei(commands.size()), 0});
+		}
+
+		// baseInstance selects the transform index of the command, see
+		// forward_indirect.vs.glsl
+		commands.push_back(DrawElementsIndirectCommand{
+			range.indexCount,
+			1,
+			range.firstIndex,
+			range.baseVertex,
+			GLuint(commands.size())});
+		nodeIndices.push_back(item.transform);
+
+		++scene.indirectBuckets.back().commandCount;
+		item.indirectCommand = GLint(commands.size() - 1);
+	}
+
+	if (commands.empty())
+	{
+		return;
+	}
+
+	scene.indirectCommands = commands;
+
+	const auto createBuffer = [](
+		GLenum target,
+		GLsizeiptr size,
+		const void* data,
+		GLbitfield flags = 0)
+	{
+		GLuint buffer;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(target, buffer);
+		glBufferStorage(target, size, data, flags);
+
+		return buffer;
+	};
+
+	scene.indirectVertexBuffer = createBuffer(
+		GL_ARRAY_BUFFER,
+		vertices.size() * sizeof(MergedVertex),
+		vertices.data());
+	scene.indirectNodeIndexBuffer = createBuffer(
+		GL_ARRAY_BUFFER,
+		nodeIndices.size() * sizeof(GLuint),
+		nodeIndices.data());
+	// Culling rewrites the instance counts every frame
+	scene.indirectCommandBuffer = createBuffer(
+		GL_DRAW_INDIRECT_BUFFER,
+		commands.size() * sizeof(DrawElementsIndirectCommand),
+		commands.data(),
+		GL_DYNAMIC_STORAGE_BIT);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	glGenVertexArrays(1, &scene.indirectVertexArray);
+	glBindVertexArray(scene.indirectVertexArray);
+
+	scene.indirectIndexBuffer = createBuffer(
+		GL_ELEMENT_ARRAY_BUFFER,
+		indices.size() * sizeof(uint32_t),
+		indices.data());
+
+	glBindBuffer(GL_ARRAY_BUFFER, scene.indirectVertexBuffer);
+
+	glEnableVertexAttribArray(VERTEX_ATTRIB_POSITION_IDX);
+	glVertexAttribPointer(
+		VERTEX_ATTRIB_POSITION_IDX,
+		3,
+		GL_FLOAT,
+		GL_FALSE,
+		sizeof(MergedVertex),
+		(const GLvoid*) offsetof(MergedVertex, position));
+
+	glEnableVertexAttribArray(VERTEX_ATTRIB_NORMAL_IDX);
+	glVertexAttribPointer(
+		VERTEX_ATTRIB_NORMAL_IDX,
+		3,
+		GL_FLOAT,
+		GL_FALSE,
+		sizeof(MergedVertex),
+		(const GLvoid*) offsetof(MergedVertex, normal));
+
+	glEnableVertexAttribArray(VERTEX_ATTRIB_TEXCOORD0_IDX);
+	glVertexAttribPointer(
+		VERTEX_ATTRIB_TEXCOORD0_IDX,
+		2,
+		GL_FLOAT,
+		GL_FALSE,
+		sizeof(MergedVertex),
+		(const GLvoid*) offsetof(MergedVertex, texCoords));
+
+	glBindBuffer(GL_ARRAY_BUFFER, scene.indirectNodeIndexBuffer);
+
+	glEnableVertexAttribArray(VERTEX_ATTRIB_NODE_IDX);
+	glVertexAttribIPointer(
+		VERTEX_ATTRIB_NODE_IDX,
+		1,
+		GL_UNSIGNED_INT,
+		sizeof(GLuint),
+		nullptr);
+	glVertexAttribDivisor(VERTEX_ATTRIB_NODE_IDX, 1);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	std::clog << "Merged " << commands.size() << " of "
+		<< scene.drawList.size() << " draws in "
+		<< scene.indirectBuckets.size() << " indirect buckets ("
+		<< vertices.size() << " vertices, " << indices.size()
+		<< " indices)" << std::endl;
+}
+
+void ViewerApplication::uploadNodeUniforms(LoadedModel& scene) const
+{
+	const auto &graph = scene.sceneGraph;
+	const auto stride = getUniformBlockStride(sizeof(NodeUniforms));
+	const auto transformCount = graph.size() + scene.instanceNodes.size();
+
+	// Only the transforms of mesh nodes and instances are used, at least one
+	// element since glBufferData does not like empty buffers
+	std::vector<NodeUniforms> transforms(
+		std::max(transformCount, size_t(1)));
+	scene.transformMatrices = graph.worldMatrices();
+	scene.transformMatrices.resize(transformCount);
+
+	for (const auto nodeIdx : graph.meshNodes())
+	{
+		transforms[nodeIdx].modelMatrix = graph.worldMatrices()[nodeIdx];
+		transforms[nodeIdx].normalMatrix = graph.normalMatrices()[nodeIdx];
+	}
+
+	for (size_t i = 0; i < scene.instanceNodes.size(); ++i)
+	{
+		const auto matrix = graph.worldMatrices()[scene.instanceNodes[i]]
+			* scene.instanceMatrices[i];
+
+		scene.transformMatrices[graph.size() + i] = matrix;
+		transforms[graph.size() + i].modelMatrix = matrix;
+		transforms[graph.size() + i].normalMatrix =
+			glm::transpose(glm::inverse(matrix));
+	}
+
+	std::vector<unsigned char> data(transforms.size() * stride, 0);
+
+	for (size_t i = 0; i < transforms.size(); ++i)
+	{
+		std::memcpy(&data[i * stride], &transforms[i], sizeof(NodeUniforms));
+	}
+
+	if (!scene.nodeUniformBuffer)
+	{
+		glGenBuffers(1, &scene.nodeUniformBuffer);
+	}
+
+	// Orphan the previous storage, frames in flight may still read it
+	glBindBuffer(GL_UNIFORM_BUFFER, scene.nodeUniformBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	scene.nodeUniformStride = stride;
+
+	// Same data without padding for the shader storage block of the
+	// indirect and instanced draws
+	if (!scene.nodeStorageBuffer)
+	{
+		glGenBuffers(1, &scene.nodeStorageBuffer);
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, scene.nodeStorageBuffer);
+	glBufferData(
+		GL_SHADER_STORAGE_BUFFER,
+		transforms.size() * sizeof(NodeUniforms),
+		transforms.data(),
+		GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+glm::mat4 ViewerApplication::computeProjectionMatrix(
+	const LoadedModel& scene) const
+{
+	const glm::vec3 diag = scene.bboxMax - scene.bboxMin;
+
+	auto maxDistance = glm::length(diag);
+	maxDistance = maxDistance > 0.f ? maxDistance : 100.f;
+
+	return glm::perspective(
+		70.f,
+		float(m_nWindowWidth) / m_nWindowHeight,
+		0.001f * maxDistance,
+		1.5f * maxDistance);
+}
+
+Camera ViewerApplication::computeDefaultCamera(const LoadedModel& scene) const
+{
+	const glm::vec3 diag = scene.bboxMax - scene.bboxMin;
+	const glm::vec3 up(0, 1, 0);
+	const glm::vec3 center = scene.bboxMin + (0.5f * diag);
+	glm::vec3 eye;
+
+	if (diag.z > 0)
+	{
+		eye = center + diag;
+	}
+	else
+	{
+		eye = center + 2.f * glm::cross(diag, up);
+	}
+
+	return Camera{eye, center, up};
+}
+
+// A line of a batch job file:
+// <model> <eye_x,...,up_z | -> <width> <height> <output.png>
+struct BatchJob
+{
+	fs::path modelPath;
+	bool hasCamera = false;
+	Camera camera;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	fs::path outputPath;
+};
+
+// Returns false for blank and comment lines, throws on malformed ones
+static bool parseBatchJob(const std::string& line, BatchJob& job)
+{
+	std::istringstream input(line);
+	std::string modelPath;
+
+	if (!(input >> modelPath) || modelPath[0] == '#')
+	{
+		return false;
+	}
+
+	std::string lookat;
+	std::string outputPath;
+
+	if (!(input >> lookat >> job.width >> job.height >> outputPath)
+		|| job.width == 0
+		|| job.height == 0)
+	{
+		throw std::runtime_error(
+			"expected <model> <lookat|-> <width> <height> <output>");
+	}
+
+	job.modelPath = modelPath;
+	job.outputPath = outputPath;
+	job.hasCamera = (lookat != "-");
+
+	if (job.hasCamera)
+	{
+		std::replace(lookat.begin(), lookat.end(), ',', ' ');
+		std::istringstream lookatInput(lookat);
+		float v[9];
+
+		for (auto& value : v)
+		{
+			if (!(lookatInput >> value))
+			{
+				throw std::runtime_error(
+					"unable to parse lookat (expected 9 numbers)");
+			}
+		}
+
+		job.camera = Camera{
+			glm::vec3(v[0], v[1], v[2]),
+			glm::vec3(v[3], v[4], v[5]),
+			glm::vec3(v[6], v[7], v[8])};
+	}
+
+	return true;
+}
+
+int ViewerApplication::runBatch(
+	const std::function<void(
+		const LoadedModel&,
+		const Camera&,
+		const fs::path&)>& renderToFile,
+	const std::function<size_t()>& flushImages)
+{
+	using clock = std::chrono::steady_clock;
 
-	bool ret = m_gltfLoader.LoadASCIIFromFile(&model, &err, &warn, m_gltfFilePath.string());
+	std::ifstream input(m_BatchFilePath.string());
 
-	if (!err.empty())
+	if (!input)
 	{
-		std::cerr << "Error: " << err << std::endl;
+		std::cerr << "Unable to open job file " << m_BatchFilePath << std::endl;
+
+		return -1;
 	}
 
-	if (!warn.empty())
+	// programs and IBL maps are shared by every job, uploaded models are
+	// kept for the whole batch
+	std::unordered_map<std::string, std::unique_ptr<LoadedModel>> models;
+	size_t imageCount = 0;
+	size_t failureCount = 0;
+	size_t lineNumber = 0;
+	std::string line;
+
+	const auto start = clock::now();
+
+	while (std::getline(input, line))
 	{
-		std::cerr << "Warning: " << warn << std::endl;
+		++lineNumber;
+		BatchJob job;
+
+		try
+		{
+			if (!parseBatchJob(line, job))
+			{
+				continue;
+			}
+		}
+		catch (const std::runtime_error& e)
+		{
+			std::cerr << m_BatchFilePath.string() << ":" << lineNumber
+				<< ": " << e.what() << std::endl;
+			++failureCount;
+
+			continue;
+		}
+
+		const auto jobStart = clock::now();
+		auto& scene = models[job.modelPath.string()];
+
+		if (!scene)
+		{
+			scene = std::make_unique<LoadedModel>();
+
+			if (!loadModel(job.modelPath, *scene))
+			{
+				std::cerr << "Failed to load glTF model "
+					<< job.modelPath << std::endl;
+				models.erase(job.modelPath.string());
+				++failureCount;
+
+				continue;
+			}
+		}
+
+		m_nWindowWidth = job.width;
+		m_nWindowHeight = job.height;
+
+		const auto camera =
+			job.hasCamera ? job.camera : computeDefaultCamera(*scene);
+
+		renderToFile(*scene, camera, job.outputPath);
+
+		++imageCount;
+
+		std::clog << "Submitted " << job.outputPath << " ("
+			<< job.width << "x" << job.height << ") in "
+			<< std::chrono::duration<double, std::milli>(
+				clock::now() - jobStart).count()
+			<< " ms" << std::endl;
 	}
 
-	return ret;
+	// Wait for the last images to be encoded before measuring throughput
+	const auto writeFailureCount = flushImages();
+	imageCount -= writeFailureCount;
+	failureCount += writeFailureCount;
+
+	const auto seconds =
+		std::chrono::duration<double>(clock::now() - start).count();
+
+	std::clog << "Rendered " << imageCount << " images of "
+		<< models.size() << " models in " << seconds << " s ("
+		<< imageCount / seconds << " images/s), "
+		<< failureCount << " failed" << std::endl;
+
+	return failureCount ? -1 : 0;
 }
 
 GLuint ViewerApplication::loadEnvTexture()
@@ -97,6 +950,9 @@ GLuint ViewerApplication::loadEnvTexture()
 		{
 			std::cerr << "Failed to load cubemap" << std::endl;
 		}
+
+		// the flag is global, glTF images loaded later must not be flipped
+		stbi_set_flip_vertically_on_load(false);
 	}
 
 	return envTexture;
@@ -141,8 +997,8 @@ GLuint ViewerApplication::loadCorrectedEnvTexture()
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
 	// cubemap-correction shaders
-	const auto glslCubemapProgram =
-		compileProgram({
+	const auto &glslCubemapProgram =
+		m_programCache.get({
 			m_ShadersRootPath / m_AppName / m_cubemapVertexShader,
 			m_ShadersRootPath / m_AppName / m_cubemapFragmentShader});
 
@@ -195,228 +1051,178 @@ GLuint ViewerApplication::loadCorrectedEnvTexture()
 	return envTexture;
 }
 
-GLuint ViewerApplication::computeIrradianceMap(GLuint envCubemap)
+void ViewerApplication::computeIrradianceSH(
+	GLuint envCubemap,
+	const fs::path& cachePath,
+	uint64_t key,
+	EnvironmentUniforms& uniforms)
 {
-	GLuint irradianceMap;
-	glGenTextures(1, &irradianceMap);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
+	const auto start = std::chrono::steady_clock::now();
+
+	glm::vec3 coefficients[9];
+
+	// saves reading back the whole cube map
+	if (!cachePath.empty() && loadIrradianceSH(cachePath, key, coefficients))
+	{
+		for (size_t i = 0; i < 9; ++i)
+		{
+			uniforms.irradianceSH[i] = glm::vec4(coefficients[i], 0);
+		}
+
+		std::clog << "Loaded irradiance SH from " << cachePath << std::endl;
+
+		return;
+	}
+
+	// read back every face, converted to floats
+	const size_t faceSize = size_t(SKYBOX_SIZE) * SKYBOX_SIZE * 3;
+	std::vector<float> faces(6 * faceSize);
+
+	GLint previousPackAlignment = 0;
+	glGetIntegerv(GL_PACK_ALIGNMENT, &previousPackAlignment);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
 
 	for (GLuint i = 0; i < 6; ++i)
 	{
-		glTexImage2D(
+		glGetTexImage(
 			GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
 			0,
-			GL_RGB16F,
-			IRRADIANCEMAP_SIZE,
-			IRRADIANCEMAP_SIZE,
-			0, 
 			GL_RGB,
 			GL_FLOAT,
-			nullptr);
+			faces.data() + i * faceSize);
 	}
 
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	// prepare framebuffer to render to texture
-	GLuint captureFBO;
-	GLuint captureRBO;
-	glGenFramebuffers(1, &captureFBO);
-	glGenRenderbuffers(1, &captureRBO);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-	glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-
-	glRenderbufferStorage(
-		GL_RENDERBUFFER,
-		GL_DEPTH_COMPONENT24,
-		IRRADIANCEMAP_SIZE,
-		IRRADIANCEMAP_SIZE);
-
-	glFramebufferRenderbuffer(
-		GL_FRAMEBUFFER,
-		GL_DEPTH_ATTACHMENT,
-		GL_RENDERBUFFER,
-		captureRBO);
-
-	// irradiance convolution shader
-	const auto glslIrradianceProgram =
-		compileProgram({
-			m_ShadersRootPath / m_AppName / m_cubemapVertexShader,
-			m_ShadersRootPath / m_AppName / m_irradianceFragmentShader});
-
-	const auto irradianceEnvironmentMapLocation =
-		glGetUniformLocation(glslIrradianceProgram.glId(), "uEnvironmentMap");
-	const auto irradianceModelProjMatrixLocation =
-		glGetUniformLocation(glslIrradianceProgram.glId(), "uModelProjMatrix");
-	const auto irradianceModelViewMatrixLocation =
-		glGetUniformLocation(glslIrradianceProgram.glId(), "uModelViewMatrix");
-
-	glslIrradianceProgram.use();
-	glUniform1i(irradianceEnvironmentMapLocation, 0);
-	glUniformMatrix4fv(
-		irradianceModelProjMatrixLocation,
-		1,
-		GL_FALSE,
-		glm::value_ptr(m_captureProjection));
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, previousPackAlignment);
 
-	glViewport(0, 0, IRRADIANCEMAP_SIZE, IRRADIANCEMAP_SIZE);
-	glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+	projectIrradianceSH(faces.data(), SKYBOX_SIZE, coefficients, &m_threadPool);
 
-	for (unsigned int i = 0; i < 6; ++i)
+	if (!cachePath.empty())
 	{
-		glUniformMatrix4fv(
-			irradianceModelViewMatrixLocation,
-			1,
-			GL_FALSE,
-			glm::value_ptr(m_captureViews[i]));
-
-		glFramebufferTexture2D(
-			GL_FRAMEBUFFER,
-			GL_COLOR_ATTACHMENT0, 
-			GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-			irradianceMap,
-			0);
-
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		renderCube();
+		saveIrradianceSH(cachePath, key, coefficients);
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	for (size_t i = 0; i < 9; ++i)
+	{
+		uniforms.irradianceSH[i] = glm::vec4(coefficients[i], 0);
+	}
 
-	return irradianceMap;
+	std::clog << "Projected irradiance SH in "
+		<< std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count()
+		<< " ms" << std::endl;
 }
 
 GLuint ViewerApplication::prefilterEnvironmentMap(GLuint envCubemap)
 {
+	// immutable storage for every mip level, each bound as one image
 	GLuint prefilterMap;
 	glGenTextures(1, &prefilterMap);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
-
-	for (GLuint i = 0; i < 6; ++i)
-	{
-		glTexImage2D(
-			GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-			0,
-			GL_RGB16F,
-			PREFILTERMAP_SIZE,
-			PREFILTERMAP_SIZE,
-			0,
-			GL_RGB,
-			GL_FLOAT,
-			nullptr);
-	}
+	glTexStorage2D(
+		GL_TEXTURE_CUBE_MAP,
+		PREFILTERMAP_LEVELS,
+		GL_RGBA16F,
+		PREFILTERMAP_SIZE,
+		PREFILTERMAP_SIZE);
 
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 
-	// this is how we tell opengl to render to mipmaps too
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); 
+	// GGX samples of every roughness, packed in a single buffer
+	std::vector<glm::vec4> samples;
+	GLint sampleOffsets[PREFILTERMAP_LEVELS + 1];
 
-	// automatic allocation
-	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-
-	// prepare framebuffer to render to texture
-	GLuint captureFBO;
-	GLuint captureRBO;
-	glGenFramebuffers(1, &captureFBO);
-	glGenRenderbuffers(1, &captureRBO);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-	glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
+	for (GLuint mip = 0; mip < PREFILTERMAP_LEVELS; ++mip)
+	{
+		const auto mipSamples =
+			computePrefilterSamples(
+				(float) mip / (float) (PREFILTERMAP_LEVELS - 1),
+				PREFILTER_SAMPLE_COUNT,
+				SKYBOX_SIZE);
+
+		sampleOffsets[mip] = samples.size();
+		samples.insert(samples.end(), mipSamples.begin(), mipSamples.end());
+	}
 
-	glRenderbufferStorage(
-		GL_RENDERBUFFER,
-		GL_DEPTH_COMPONENT24,
-		PREFILTERMAP_SIZE,
-		PREFILTERMAP_SIZE);
+	sampleOffsets[PREFILTERMAP_LEVELS] = samples.size();
 
-	glFramebufferRenderbuffer(
-		GL_FRAMEBUFFER,
-		GL_DEPTH_ATTACHMENT,
-		GL_RENDERBUFFER,
-		captureRBO);
+	GLuint sampleBuffer;
+	glGenBuffers(1, &sampleBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, sampleBuffer);
+	glBufferData(
+		GL_SHADER_STORAGE_BUFFER,
+		samples.size() * sizeof(samples[0]),
+		samples.data(),
+		GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
 	// pre-filtering shader
-	const auto glslIrradianceProgram =
-		compileProgram({
-			m_ShadersRootPath / m_AppName / m_cubemapVertexShader,
-			m_ShadersRootPath / m_AppName / m_prefilterFragmentShader});
+	const auto &glslPrefilterProgram =
+		m_programCache.get({
+			m_ShadersRootPath / m_AppName / m_prefilterComputeShader});
 
 	const auto prefilterEnvironmentMapLocation =
-		glGetUniformLocation(glslIrradianceProgram.glId(), "uEnvironmentMap");
-	const auto prefilterModelProjMatrixLocation =
-		glGetUniformLocation(glslIrradianceProgram.glId(), "uModelProjMatrix");
-	const auto prefilterModelViewMatrixLocation =
-		glGetUniformLocation(glslIrradianceProgram.glId(), "uModelViewMatrix");
-	const auto prefilterRoughnessLocation =
-		glGetUniformLocation(glslIrradianceProgram.glId(), "uRoughness");
-	const auto prefilterResolutionLocation =
-		glGetUniformLocation(glslIrradianceProgram.glId(), "uResolution");
-
-	glslIrradianceProgram.use();
+		glGetUniformLocation(glslPrefilterProgram.glId(), "uEnvironmentMap");
+	const auto prefilterSampleOffsetLocation =
+		glGetUniformLocation(glslPrefilterProgram.glId(), "uSampleOffset");
+	const auto prefilterSampleCountLocation =
+		glGetUniformLocation(glslPrefilterProgram.glId(), "uSampleCount");
+
+	glslPrefilterProgram.use();
 	glUniform1i(prefilterEnvironmentMapLocation, 0);
-	glUniform1f(prefilterResolutionLocation, SKYBOX_SIZE);
-	glUniformMatrix4fv(
-		prefilterModelProjMatrixLocation,
-		1,
-		GL_FALSE,
-		glm::value_ptr(m_captureProjection));
 
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-	glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-
-	GLuint maxMipLevels = 5;
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sampleBuffer);
 
-	for (GLuint mip = 0; mip < maxMipLevels; ++mip)
+	// one dispatch per mip level, covering all six faces
+	for (GLuint mip = 0; mip < PREFILTERMAP_LEVELS; ++mip)
 	{
-		GLuint mipWidth = PREFILTERMAP_SIZE * std::pow(0.5, mip);
-		GLuint mipHeight = PREFILTERMAP_SIZE * std::pow(0.5, mip);
+		const GLuint mipSize = std::max(PREFILTERMAP_SIZE >> mip, 1);
 
-		glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipWidth, mipHeight);
-		glViewport(0, 0, mipWidth, mipHeight);
+		glUniform1i(prefilterSampleOffsetLocation, sampleOffsets[mip]);
+		glUniform1i(
+			prefilterSampleCountLocation,
+			sampleOffsets[mip + 1] - sampleOffsets[mip]);
 
-		glUniform1f(
-			prefilterRoughnessLocation,
-			(float) mip / (float) (maxMipLevels - 1));
-
-		for (GLuint i = 0; i < 6; ++i)
-		{
-			glUniformMatrix4fv(
-				prefilterModelViewMatrixLocation,
-				1,
-				GL_FALSE,
-				glm::value_ptr(m_captureViews[i]));
-
-			glFramebufferTexture2D(
-				GL_FRAMEBUFFER,
-				GL_COLOR_ATTACHMENT0, 
-				GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-				prefilterMap,
-				mip);
+		glBindImageTexture(
+			0,
+			prefilterMap,
+			mip,
+			GL_TRUE,
+			0,
+			GL_WRITE_ONLY,
+			GL_RGBA16F);
 
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-			renderCube();
-		}
+		glDispatchCompute(
+			(mipSize + IBL_GROUP_SIZE - 1) / IBL_GROUP_SIZE,
+			(mipSize + IBL_GROUP_SIZE - 1) / IBL_GROUP_SIZE,
+			6);
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	// the map is sampled next, or read back by the texture cache
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+	glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+	glDeleteBuffers(1, &sampleBuffer);
 
 	return prefilterMap;
 }
 
 GLuint ViewerApplication::integrateBRDF()
 {
+	const auto lut =
+		computeBRDFLUT(
+			BRDF_LUT_SIZE,
+			BRDF_LUT_SAMPLE_COUNT,
+			&m_threadPool);
+
 	GLuint brdfLUTTexture;
 	glGenTextures(1, &brdfLUTTexture);
 
@@ -431,47 +1237,73 @@ GLuint ViewerApplication::integrateBRDF()
 		0,
 		GL_RG,
 		GL_FLOAT,
-		0);
+		lut.data());
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-	GLuint captureFBO;
-	GLuint captureRBO;
-	glGenFramebuffers(1, &captureFBO);
-	glGenRenderbuffers(1, &captureRBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-	glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
+	return brdfLUTTexture;
+}
 
-	glRenderbufferStorage(
-		GL_RENDERBUFFER,
-		GL_DEPTH_COMPONENT24,
-		BRDF_LUT_SIZE,
-		BRDF_LUT_SIZE);
+uint64_t ViewerApplication::hashShaders(
+	const std::vector<std::string>& shaders,
+	uint64_t seed) const
+{
+	uint64_t hash = seed;
 
-	glFramebufferTexture2D(
-		GL_FRAMEBUFFER,
-		GL_COLOR_ATTACHMENT0,
-		GL_TEXTURE_2D,
-		brdfLUTTexture,
-		0);
+	for (const auto& shader : shaders)
+	{
+		const auto source =
+			loadShaderSource(m_ShadersRootPath / m_AppName / shader);
 
-	glViewport(0, 0, BRDF_LUT_SIZE, BRDF_LUT_SIZE);
+		hash = hashBytes(source.data(), source.size(), hash);
+	}
 
-	const auto glslIntegrateProgram =
-		compileProgram({
-			m_ShadersRootPath / m_AppName / m_integrateVertexShader,
-			m_ShadersRootPath / m_AppName / m_integrateFragmentShader});
+	return hash;
+}
 
-	glslIntegrateProgram.use();
+GLuint ViewerApplication::loadCachedTexture(
+	const std::string& name,
+	uint64_t key,
+	GLenum target,
+	GLsizei levelCount,
+	const std::function<GLuint()>& bake)
+{
+	const auto path =
+		m_CacheRootPath / (name + "_" + hashToString(key) + ".bin");
+	const auto start = std::chrono::steady_clock::now();
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	renderQuad();
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLuint texture = loadTextureCache(path, key);
 
-	return brdfLUTTexture;
+	if (texture)
+	{
+		std::clog << "Loaded " << name << " from " << path;
+	}
+	else
+	{
+		texture = bake();
+
+		if (saveTextureCache(path, key, target, texture, levelCount))
+		{
+			std::clog << "Baked " << name << " to " << path;
+		}
+		else
+		{
+			std::clog << "Baked " << name << " (not cached)";
+		}
+	}
+
+	// wait for the GPU so that the timing means something
+	glFinish();
+
+	std::clog << " in "
+		<< std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count()
+		<< " ms" << std::endl;
+
+	return texture;
 }
 
 std::vector<GLuint> ViewerApplication::createBufferObjects(const tinygltf::Model& model)
@@ -596,34 +1428,6 @@ void ViewerApplication::renderCube()
     glBindVertexArray(0);
 }
 
-void ViewerApplication::initQuad()
-{
-	float quadVertices[] =
-	{
-		-1.0f,  1.0f, 0.0f, 0.0f, 1.0f,
-		-1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
-		 1.0f,  1.0f, 0.0f, 1.0f, 1.0f,
-		 1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
-	};
-
-	glGenVertexArrays(1, &m_quadVAO);
-	glGenBuffers(1, &m_quadVBO);
-	glBindVertexArray(m_quadVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof (quadVertices), &quadVertices, GL_STATIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof (float), (void*) 0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof (float), (void*) (3 * (sizeof (float))));
-}
-
-void ViewerApplication::renderQuad()
-{
-    glBindVertexArray(m_quadVAO);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glBindVertexArray(0);
-}
-
 void vao_init(
 	const tinygltf::Model& model,
 	const tinygltf::Primitive& primitive,
@@ -722,181 +1526,143 @@ std::vector<GLuint> ViewerApplication::createVertexArrayObjects(
 	return vertexArrayObjects;
 }
 
-std::vector<GLuint> ViewerApplication::createTextureObjects(const tinygltf::Model &model) const
+int ViewerApplication::run()
 {
-	size_t count = model.textures.size();
-	std::vector<GLuint> textureObjects(count);
+  glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
-	for (size_t i = 0; i < count; ++i)
-	{
-		glGenTextures(1, &(textureObjects[i]));
-		glBindTexture(GL_TEXTURE_2D, textureObjects[i]);
+  // Per-frame, per-node and per-material values are read from uniform
+  // buffers, only samplers remain plain uniforms
+  const auto setupForwardProgram = [&](const GLProgram &program)
+  {
+    const auto bindUniformBlock = [&](const char *name, GLuint binding)
+    {
+      const auto blockIndex = glGetUniformBlockIndex(program.glId(), name);
+      if (blockIndex != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program.glId(), blockIndex, binding);
+      }
+    };
+
+    bindUniformBlock("FrameUniforms", UNIFORM_BLOCK_FRAME_BINDING);
+    bindUniformBlock("NodeUniforms", UNIFORM_BLOCK_NODE_BINDING);
+    bindUniformBlock("MaterialUniforms", UNIFORM_BLOCK_MATERIAL_BINDING);
+    bindUniformBlock("EnvironmentUniforms", UNIFORM_BLOCK_ENVIRONMENT_BINDING);
+    bindUniformBlock("ClusterUniforms", UNIFORM_BLOCK_CLUSTER_BINDING);
+
+    // Each material texture has its own unit, set once
+    program.use();
+    glUniform1i(program.getUniformLocation("uBaseColorTexture"), 0);
+    glUniform1i(program.getUniformLocation("uMetallicRoughnessTexture"), 1);
+    glUniform1i(program.getUniformLocation("uEmissiveTexture"), 2);
+    glUniform1i(program.getUniformLocation("uOcclusionTexture"), 3);
+    glUniform1i(program.getUniformLocation("uNormalTexture"), 4);
+    glUniform1i(program.getUniformLocation("uPrefilterMap"), 6);
+    glUniform1i(program.getUniformLocation("uBrdfLUT"), 7);
+    glUniform1i(program.getUniformLocation("uClusterTexture"), 8);
+    glUniform1i(program.getUniformLocation("uClusterLightIndices"), 9);
+    glUniform1i(program.getUniformLocation("uLights"), 10);
+    glUseProgram(0);
+  };
+
+  // Forward program variants, built on first use: one for each combination
+  // of SHADER_FEATURE_* bits, with the regular vertex shader and with the
+  // multi-draw indirect one (which fetches node transforms from a shader
+  // storage buffer, also used by instanced draws). They come from
+  // m_programCache, which recompiles them when the shaders are edited.
+  std::vector<const GLProgram*> forwardPrograms(
+      size_t(2) << SHADER_FEATURE_COUNT,
+      nullptr);
+
+  const auto getForwardProgram = [&](uint32_t features, bool indirect)
+      -> const GLProgram&
+  {
+    auto &pProgram = forwardPrograms[(features << 1) | (indirect ? 1 : 0)];
 
-		// get texture
-		const auto& texture = model.textures[i];
+    if (!pProgram)
+    {
+      std::vector<std::string> defines;
+      for (size_t i = 0; i < SHADER_FEATURE_COUNT; ++i)
+      {
+        if (features & (1u << i))
+        {
+          defines.emplace_back(SHADER_FEATURE_DEFINES[i]);
+        }
+      }
 
-		// make image
-		assert(texture.source >= 0);
-		const auto& image = model.images[texture.source];
+      pProgram = &m_programCache.get(
+          {m_ShadersRootPath / m_AppName
+                  / (indirect ? m_indirectVertexShader : m_vertexShader),
+              m_ShadersRootPath / m_AppName / m_fragmentShader},
+          defines);
+      setupForwardProgram(*pProgram);
+    }
 
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_RGBA,
-			image.width,
-			image.height,
-			0,
-			GL_RGBA,
-			image.pixel_type,
-			image.image.data());
-
-		// sampler
-		tinygltf::Sampler defaultSampler;
-		defaultSampler.minFilter = GL_LINEAR;
-		defaultSampler.magFilter = GL_LINEAR;
-		defaultSampler.wrapS = GL_REPEAT;
-		defaultSampler.wrapT = GL_REPEAT;
-		defaultSampler.wrapR = GL_REPEAT;
-
-		const auto &sampler =
-			(texture.sampler >= 0) ?
-				model.samplers[texture.sampler] : defaultSampler;
-
-		// parameters
-		glTexParameteri(
-			GL_TEXTURE_2D,
-			GL_TEXTURE_MIN_FILTER,
-			(sampler.minFilter != -1) ?
-				sampler.minFilter : GL_LINEAR);
-		glTexParameteri(
-			GL_TEXTURE_2D,
-			GL_TEXTURE_MAG_FILTER,
-			(sampler.magFilter != -1) ?
-				sampler.magFilter : GL_LINEAR);
-		glTexParameteri(
-			GL_TEXTURE_2D,
-			GL_TEXTURE_WRAP_S,
-			sampler.wrapS);
-		glTexParameteri(
-			GL_TEXTURE_2D,
-			GL_TEXTURE_WRAP_T,
-			sampler.wrapT);
-		glTexParameteri(
-			GL_TEXTURE_2D,
-			GL_TEXTURE_WRAP_R,
-			sampler.wrapR);
-
-		if((sampler.minFilter == GL_NEAREST_MIPMAP_NEAREST)
-		|| (sampler.minFilter == GL_NEAREST_MIPMAP_LINEAR)
-		|| (sampler.minFilter == GL_LINEAR_MIPMAP_NEAREST)
-		|| (sampler.minFilter == GL_LINEAR_MIPMAP_LINEAR))
-		{
-			glGenerateMipmap(GL_TEXTURE_2D);
-		}
-	}
+    return *pProgram;
+  };
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+  // Position only programs, same vertex shaders as the forward ones: the
+  // depth prepass writes no color, the overdraw view adds a constant color
+  // for every fragment it shades
+  std::vector<const GLProgram*> positionOnlyPrograms(4, nullptr);
 
-	return textureObjects;
-}
+  const auto getPositionOnlyProgram = [&](bool overdraw, bool indirect)
+      -> const GLProgram&
+  {
+    auto &pProgram =
+        positionOnlyPrograms[(overdraw ? 2 : 0) | (indirect ? 1 : 0)];
 
-int ViewerApplication::run()
-{
-  glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    if (!pProgram)
+    {
+      pProgram = &m_programCache.get(
+          {m_ShadersRootPath / m_AppName
+                  / (indirect ? m_indirectVertexShader : m_vertexShader),
+              m_ShadersRootPath / m_AppName
+                  / (overdraw ? m_overdrawFragmentShader
+                              : m_depthFragmentShader)},
+          {"POSITION_ONLY"});
+      setupForwardProgram(*pProgram);
+    }
 
-  // Loader shaders
-  const auto glslProgram =
-      compileProgram({
-		  m_ShadersRootPath / m_AppName / m_vertexShader,
-          m_ShadersRootPath / m_AppName / m_fragmentShader});
-
-  const auto modelViewProjMatrixLocation =
-      glGetUniformLocation(glslProgram.glId(), "uModelViewProjMatrix");
-  const auto modelViewMatrixLocation =
-      glGetUniformLocation(glslProgram.glId(), "uModelViewMatrix");
-  const auto modelMatrixLocation =
-      glGetUniformLocation(glslProgram.glId(), "uModelMatrix");
-  const auto normalMatrixLocation =
-      glGetUniformLocation(glslProgram.glId(), "uNormalMatrix");
-  const auto lightDirectionLocation =
-      glGetUniformLocation(glslProgram.glId(), "uLightDirection");
-  const auto lightRadianceLocation =
-      glGetUniformLocation(glslProgram.glId(), "uLightIntensity");
-  const auto baseColorLocation =
-      glGetUniformLocation(glslProgram.glId(), "uBaseColorTexture");
-  const auto baseColorFactorLocation =
-      glGetUniformLocation(glslProgram.glId(), "uBaseColorFactor");
-
-  const auto metallicFactorLocation =
-      glGetUniformLocation(glslProgram.glId(), "uMetallicFactor");
-  const auto roughnessFactorLocation =
-      glGetUniformLocation(glslProgram.glId(), "uRoughnessFactor");
-  const auto metallicRoughnessTextureLocation =
-      glGetUniformLocation(glslProgram.glId(), "uMetallicRoughnessTexture");
-
-  const auto emissiveTextureLocation =
-      glGetUniformLocation(glslProgram.glId(), "uEmissiveTexture");
-  const auto emissiveFactorLocation =
-      glGetUniformLocation(glslProgram.glId(), "uEmissiveFactor");
-
-  const auto occlusionTextureLocation =
-      glGetUniformLocation(glslProgram.glId(), "uOcclusionTexture");
-  const auto occlusionStrengthLocation =
-      glGetUniformLocation(glslProgram.glId(), "uOcclusionStrength");
-
-  const auto normalTextureLocation =
-      glGetUniformLocation(glslProgram.glId(), "uNormalTexture");
-  const auto normalScaleLocation =
-      glGetUniformLocation(glslProgram.glId(), "uNormalScale");
-
-  const auto irradianceTextureLocation =
-      glGetUniformLocation(glslProgram.glId(), "uIrradianceMap");
-  const auto prefilterTextureLocation =
-      glGetUniformLocation(glslProgram.glId(), "uPrefilterMap");
-  const auto brdfLUTLocation =
-      glGetUniformLocation(glslProgram.glId(), "uBrdfLUT");
-  const auto camDirLocation =
-      glGetUniformLocation(glslProgram.glId(), "uCamDir");
+    return *pProgram;
+  };
+
+  GLuint frameUniformBuffer;
+  glGenBuffers(1, &frameUniformBuffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+  glBufferData(
+      GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+  // Light lists of the view frustum, rebuilt every frame for scenes with
+  // punctual lights
+  LightClusters lightClusters;
+  GLuint clusterUniformBuffer;
+  glGenBuffers(1, &clusterUniformBuffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, clusterUniformBuffer);
+  glBufferData(
+      GL_UNIFORM_BUFFER, sizeof(ClusterUniforms), nullptr, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
   // Skybox
-  const auto glslSkyboxProgram =
-      compileProgram({
+  const auto &glslSkyboxProgram =
+      m_programCache.get({
 		  m_ShadersRootPath / m_AppName / m_skyboxVertexShader,
           m_ShadersRootPath / m_AppName / m_skyboxFragmentShader});
 
-  const auto skyboxEquirectangularMapLocation =
-      glGetUniformLocation(glslSkyboxProgram.glId(), "uEquirectangularMap");
-  const auto skyboxModelProjMatrixLocation =
-      glGetUniformLocation(glslSkyboxProgram.glId(), "uModelProjMatrix");
-  const auto skyboxModelViewMatrixLocation =
-      glGetUniformLocation(glslSkyboxProgram.glId(), "uModelViewMatrix");
+  GLint skyboxEquirectangularMapLocation;
+  GLint skyboxModelProjMatrixLocation;
+  GLint skyboxModelViewMatrixLocation;
 
-  // TODO Loading the glTF file
-  tinygltf::Model model;
-
-  if (!loadGltfFile(model)) {
-	  std::cerr << "Failed to load glTF model" << std::endl;
-
-	  return -1;
-  }
-
-  // TODO Implement a new CameraController model and use it instead.
-  glm::vec3 bboxMin;
-  glm::vec3 bboxMax;
-
-  computeSceneBounds(model, bboxMin, bboxMax);
-
-  glm::vec3 diag = bboxMax - bboxMin;
-
-  // Build projection matrix
-  auto maxDistance = glm::length(diag);
-  maxDistance = maxDistance > 0.f ? maxDistance : 100.f;
+  const auto getSkyboxLocations = [&]()
+  {
+    skyboxEquirectangularMapLocation =
+        glGetUniformLocation(glslSkyboxProgram.glId(), "uEquirectangularMap");
+    skyboxModelProjMatrixLocation =
+        glGetUniformLocation(glslSkyboxProgram.glId(), "uModelProjMatrix");
+    skyboxModelViewMatrixLocation =
+        glGetUniformLocation(glslSkyboxProgram.glId(), "uModelViewMatrix");
+  };
 
-  const auto projMatrix = glm::perspective(
-		  70.f,
-		  float(m_nWindowWidth) / m_nWindowHeight,
-          0.001f * maxDistance,
-		  1.5f * maxDistance);
+  getSkyboxLocations();
 
   // Config (IMGUI)
   int controlsType = 0;
@@ -904,85 +1670,62 @@ int ViewerApplication::run()
   float lightAngleH = 1.55f;
   float lightAngleV = 2.0f;
   bool featureTexture = true;
-  bool featureMetallicRoughness = true;
-  bool featureOcclusion = true;
-  bool featureEmission = true;
-  bool featureNormal = true;
-  bool featureEnvironment = true;
-
-  glm::vec3 lightDirectionRaw = glm::vec3(1.0f, 1.0f, 1.0f);
-  glm::vec3 lightRadiance = glm::vec3(1.0f, 1.0f, 1.0f);
-
-  std::unique_ptr<CameraController> cameraController(
-	  std::make_unique<TrackballCameraController>(
-		  m_GLFWHandle.window()));
-
-  if (m_hasUserCamera)
-  {
-    cameraController->setCamera(m_userCamera);
-  }
-  else
-  {
-    // TODO Use scene bounds to compute a better default camera
-	glm::vec3 eye;
-	glm::vec3 up(0, 1, 0);
-	glm::vec3 center = bboxMin + (0.5f * diag);
-
-	if (diag.z > 0)
-	{
-		eye = center + diag;
-	}
-	else
-	{
-		eye = center + 2.f * glm::cross(diag, up);
-	}
-
-    cameraController->setCamera(Camera{eye, center, up});
+  bool featureMetallicRoughness = true;
+  bool featureOcclusion = true;
+  bool featureEmission = true;
+  bool featureNormal = true;
+  bool featureEnvironment = true;
+  bool featureBRDFLUT = true;
+  bool featurePunctualLights = true;
+  bool indirectDraw = m_useIndirectDraw;
+  bool instancing = !m_customVertexShader;
+  if (m_customVertexShader)
+  {
+    std::clog << "Instancing disabled: " << m_vertexShader
+        << " has no instanced variant, every draw uses it" << std::endl;
   }
+  bool depthPrepass = false;
+  bool overdrawHeatmap = false;
+  int textureBudgetMiB = int(m_textureBudgetMiB);
+  bool frustumCulling = true;
+  bool bvhCulling = true;
+  double cullingTime = 0; // In microseconds
+  double lightClusteringTime = 0; // In microseconds
+  int pickedItem = -1; // In the draw list
+  float pickedDistance = 0;
+  double pickingTime = 0; // In microseconds
+  size_t drawCallCount = 0;
+  size_t visibleCount = 0;
+  size_t culledCount = 0;
+
+  // Fragments that passed the depth test in the shading pass, counted by an
+  // occlusion query read back once the GPU is done with it (no stall)
+  GLuint shadedFragmentsQuery;
+  glGenQueries(1, &shadedFragmentsQuery);
+  bool shadedFragmentsPending = false;
+  GLuint64 shadedFragmentCount = 0;
+
+  // Visible draws of the same primitive, drawn with a single instanced call:
+  // the first one in the draw list, and the range of their transform indices
+  // in instanceTransforms
+  struct InstancedDraw
+  {
+    size_t item;
+    GLuint baseInstance;
+    GLsizei instanceCount;
+  };
+
+  // Per-frame scratch buffers of the draw loop
+  std::vector<uint8_t> drawVisibility;
+  std::vector<DrawElementsIndirectCommand> culledCommands;
+  std::vector<InstancedDraw> instancedDraws;
+  std::vector<GLuint> instanceTransforms;
 
-  // Physically-Based Materials
-  const std::vector<GLuint> textureObjects = createTextureObjects(model);
-  GLuint whiteTexture;
-  float white[] = {1, 1, 1, 1};
-  glGenTextures(1, &whiteTexture);
-  glBindTexture(GL_TEXTURE_2D, whiteTexture);
-  glTexImage2D(
-	  GL_TEXTURE_2D,
-	  0,
-	  GL_RGBA,
-	  1,
-	  1,
-	  0,
-	  GL_RGBA,
-	  GL_FLOAT,
-	  white);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_REPEAT);
-
-  GLuint greyTexture;
-  float grey[] = {0.5f, 0.5f, 0.5f, 1};
-  glGenTextures(1, &greyTexture);
-  glBindTexture(GL_TEXTURE_2D, greyTexture);
-  glTexImage2D(
-	  GL_TEXTURE_2D,
-	  0,
-	  GL_RGBA,
-	  1,
-	  1,
-	  0,
-	  GL_RGBA,
-	  GL_FLOAT,
-	  grey);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+  glm::vec3 lightDirectionRaw = glm::vec3(1.0f, 1.0f, 1.0f);
+  glm::vec3 lightRadiance = glm::vec3(1.0f, 1.0f, 1.0f);
 
 	// dummy cubemap
+	float white[] = {1, 1, 1, 1};
 	GLuint whiteCube;
 	glGenTextures(1, &whiteCube);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, whiteCube);
@@ -1008,267 +1751,242 @@ int ViewerApplication::run()
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
   // Cubemap
-  initQuad();
-  GLuint brdfLUT = integrateBRDF();
   initCube();
-  GLuint envTexture = loadCorrectedEnvTexture();
-  GLuint irradianceMap = computeIrradianceMap(envTexture);
-  GLuint prefilterMap = prefilterEnvironmentMap(envTexture);
 
-  // Reset
-  glBindTexture(GL_TEXTURE_2D, 0);
+  // IBL maps are baked once and then loaded from the on-disk cache. The
+  // baking shaders and sample counts are part of the keys.
+  const uint32_t iblSizes[] = {SKYBOX_SIZE, PREFILTERMAP_SIZE,
+      PREFILTERMAP_LEVELS, PREFILTER_SAMPLE_COUNT};
+  const uint64_t sizesHash = hashBytes(iblSizes, sizeof(iblSizes));
+
+  // The BRDF LUT does not depend on the scene: it is shipped precomputed and
+  // only computed (then cached) when the asset is missing or outdated
+  const uint64_t brdfLUTKey = getBRDFLUTKey();
+  const auto brdfLUTPath = m_AssetsRootPath / m_AppName / "brdf_lut.bin";
+
+  GLuint brdfLUT = loadTextureCache(brdfLUTPath, brdfLUTKey);
+  if (!brdfLUT)
+  {
+    std::cerr << "Unable to load " << brdfLUTPath
+        << ", run the bake-brdf-lut command to regenerate it" << std::endl;
+
+    brdfLUT = loadCachedTexture("brdf_lut", brdfLUTKey, GL_TEXTURE_2D, 1,
+        [&]() { return integrateBRDF(); });
+  }
+
+  GLuint envTexture;
+  GLuint prefilterMap;
+  uint64_t hdrHash;
+  uint64_t envKey = 0;
+  fs::path irradianceSHPath;
+
+  if (hashFile(m_cubeMapFilePath, hdrHash, sizesHash))
+  {
+    envKey = hashShaders(
+        {m_cubemapVertexShader, m_cubemapFragmentShader}, hdrHash);
+    const uint64_t prefilterKey =
+        hashShaders({m_prefilterComputeShader}, envKey);
+
+    envTexture = loadCachedTexture("environment", envKey,
+        GL_TEXTURE_CUBE_MAP, 1, [&]() { return loadCorrectedEnvTexture(); });
+    prefilterMap = loadCachedTexture("prefilter", prefilterKey,
+        GL_TEXTURE_CUBE_MAP, PREFILTERMAP_LEVELS,
+        [&]() { return prefilterEnvironmentMap(envTexture); });
+    irradianceSHPath =
+        m_CacheRootPath / ("irradiance_sh_" + hashToString(envKey) + ".bin");
+  }
+  else
+  {
+    envTexture = loadCorrectedEnvTexture();
+    prefilterMap = prefilterEnvironmentMap(envTexture);
+  }
 
-  // Creation of Buffer Objects
-  const std::vector<GLuint> bufferObjects = createBufferObjects(model);
+  // Diffuse environment lighting: 9 SH coefficients instead of an irradiance
+  // cube map, cached along with the environment cube map they come from
+  EnvironmentUniforms environmentUniforms;
+  computeIrradianceSH(
+      envTexture, irradianceSHPath, envKey, environmentUniforms);
 
-  // Creation of Vertex Array Objects
-  std::vector<VaoRange> meshIndexToVaoRange;
+  GLuint environmentUniformBuffer;
+  glGenBuffers(1, &environmentUniformBuffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, environmentUniformBuffer);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(environmentUniforms),
+      &environmentUniforms, GL_STATIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BLOCK_ENVIRONMENT_BINDING,
+      environmentUniformBuffer);
 
-  const std::vector<GLuint> vertexArrayObjects = createVertexArrayObjects(
-		model,
-		bufferObjects,
-		meshIndexToVaoRange);
+  // Every startup program is ready: cold vs warm shader cache
+  m_programCache.logStatistics();
+
+  // Reset
+  glBindTexture(GL_TEXTURE_2D, 0);
 
   // Setup OpenGL state for rendering
   glEnable(GL_DEPTH_TEST);
   glDepthFunc(GL_LEQUAL);
 
-	const auto bindMaterial = [&](const auto materialIndex)
+	// Skips every bind and uniform upload that would not change anything,
+	// the draw loop feeds it draws sorted by material and vertex array
+	GLStateTracker glState;
+
+	const auto bindMaterial = [&](
+		const LoadedModel &scene,
+		const auto materialIndex,
+		bool indirect)
 	{
-		if (materialIndex >= 0)
+		const auto &model = scene.model;
+		const auto &textures = scene.textures;
+
+		// Factors have been uploaded at load time, select the block of the
+		// material (the last one holds the defaults)
+		const auto blockIndex = materialIndex >= 0
+			? size_t(materialIndex)
+			: model.materials.size();
+
+		glState.bindUniformBufferRange(
+			UNIFORM_BLOCK_MATERIAL_BINDING,
+			scene.materialUniformBuffer,
+			blockIndex * scene.materialUniformStride,
+			sizeof(MaterialUniforms));
+
+		// Disabled features are compiled out, as textures the material
+		// does not have
+		const uint32_t enabledFeatures =
+			(featureTexture ? SHADER_FEATURE_BASE_COLOR_TEXTURE : 0)
+			| (featureMetallicRoughness
+				? SHADER_FEATURE_METALLIC_ROUGHNESS_TEXTURE : 0)
+			| (featureEmission ? SHADER_FEATURE_EMISSIVE_TEXTURE : 0)
+			| (featureOcclusion ? SHADER_FEATURE_OCCLUSION_TEXTURE : 0)
+			| (featureNormal ? SHADER_FEATURE_NORMAL_TEXTURE : 0)
+			| (featureEnvironment ? SHADER_FEATURE_IBL : 0)
+			| (featureBRDFLUT ? SHADER_FEATURE_BRDF_LUT : 0)
+			| (featurePunctualLights && !scene.lights.empty()
+				? SHADER_FEATURE_PUNCTUAL_LIGHTS : 0);
+		const auto features =
+			scene.materialShaderFeatures[blockIndex] & enabledFeatures;
+
+		glState.useProgram(getForwardProgram(features, indirect).glId());
+
+		if (features & SHADER_FEATURE_IBL)
 		{
-			const auto &material =
-				model.materials[materialIndex];
+			glState.bindTexture(6, GL_TEXTURE_CUBE_MAP, prefilterMap);
 
-			const auto &pbrMetallicRoughness =
-				material.pbrMetallicRoughness;
-
-			const auto &emissiveTexture =
-				material.emissiveTexture;
-
-			const auto &emissiveFactor =
-				material.emissiveFactor;
+			if (features & SHADER_FEATURE_BRDF_LUT)
+			{
+				glState.bindTexture(7, GL_TEXTURE_2D, brdfLUT);
+			}
+		}
 
-			const auto &occlusionTexture =
-				material.occlusionTexture;
+		if (materialIndex < 0)
+		{
+			return;
+		}
 
-			const auto &normalTexture =
-				material.normalTexture;
+		const auto &material = model.materials[materialIndex];
+		const auto &pbrMetallicRoughness = material.pbrMetallicRoughness;
 
-			if (model.textures.size() > 0)
-			{
-				const auto &texture = model.textures[
-					pbrMetallicRoughness.baseColorTexture.index];
+		// Units of the samplers the variant does not declare are left as
+		// they are
+		if (features & SHADER_FEATURE_BASE_COLOR_TEXTURE)
+		{
+			glState.bindTexture(
+				0,
+				GL_TEXTURE_2D,
+				textures.texture(pbrMetallicRoughness.baseColorTexture.index));
+		}
 
-				// base color
-				if (featureTexture)
-				{
-					glActiveTexture(GL_TEXTURE0);
-					glBindTexture(
-						GL_TEXTURE_2D,
-						textureObjects[texture.source]);
-				}
-				else
-				{
-					glActiveTexture(GL_TEXTURE0);
-					glBindTexture(
-						GL_TEXTURE_2D,
-						whiteTexture);
-				}
+		if (features & SHADER_FEATURE_METALLIC_ROUGHNESS_TEXTURE)
+		{
+			glState.bindTexture(
+				1,
+				GL_TEXTURE_2D,
+				textures.texture(
+					pbrMetallicRoughness.metallicRoughnessTexture.index));
+		}
 
-				glUniform1i(baseColorLocation, 0);
+		if (features & SHADER_FEATURE_EMISSIVE_TEXTURE)
+		{
+			glState.bindTexture(
+				2,
+				GL_TEXTURE_2D,
+				textures.texture(material.emissiveTexture.index));
+		}
 
-				// metallic roughness
-				if (featureMetallicRoughness)
-				{
-					glActiveTexture(GL_TEXTURE1);
-					glBindTexture(
-						GL_TEXTURE_2D,
-						textureObjects[
-							pbrMetallicRoughness
-								.metallicRoughnessTexture
-								.index]);
-
-					glUniform4f(
-						baseColorFactorLocation,
-						pbrMetallicRoughness.baseColorFactor[0],
-						pbrMetallicRoughness.baseColorFactor[1],
-						pbrMetallicRoughness.baseColorFactor[2],
-						pbrMetallicRoughness.baseColorFactor[3]);
-					glUniform1f(
-						metallicFactorLocation,
-						pbrMetallicRoughness.metallicFactor);
-					glUniform1f(
-						roughnessFactorLocation,
-						pbrMetallicRoughness.roughnessFactor);
-				}
-				else
-				{
-					glActiveTexture(GL_TEXTURE1);
-					glBindTexture(GL_TEXTURE_2D, 0);
-
-					glUniform4f(
-						baseColorFactorLocation,
-						1,
-						1,
-						1,
-						1);
-					glUniform1f(
-						metallicFactorLocation,
-						0);
-					glUniform1f(
-						roughnessFactorLocation,
-						0);
-				}
+		if (features & SHADER_FEATURE_OCCLUSION_TEXTURE)
+		{
+			glState.bindTexture(
+				3,
+				GL_TEXTURE_2D,
+				textures.texture(material.occlusionTexture.index));
+		}
 
-				glUniform1i(metallicRoughnessTextureLocation, 1);
+		if (features & SHADER_FEATURE_NORMAL_TEXTURE)
+		{
+			glState.bindTexture(
+				4,
+				GL_TEXTURE_2D,
+				textures.texture(material.normalTexture.index));
+		}
+	};
 
-				// emissive
-				if (featureEmission)
-				{
-					glActiveTexture(GL_TEXTURE2);
-					glBindTexture(
-						GL_TEXTURE_2D,
-						textureObjects[emissiveTexture.index]);
-					glUniform3f(
-						emissiveFactorLocation,
-						emissiveFactor[0],
-						emissiveFactor[1],
-						emissiveFactor[2]);
-				}
-				else
-				{
-					glActiveTexture(GL_TEXTURE2);
-					glBindTexture(
-						GL_TEXTURE_2D,
-						0);
-					glUniform3f(
-						emissiveFactorLocation,
-						0,
-						0,
-						0);
-				}
 
-				glUniform1i(emissiveTextureLocation, 2);
 
-				// occlusion
-				if (featureOcclusion)
-				{
-					GLuint occlusion = textureObjects[occlusionTexture.index];
+	// Texture level of detail: each textured primitive drawn in the last frame
+	// asks for its textures at the size it covers on screen, a bounding sphere
+	// of diameter d at distance z covering d * P[1][1] / z half viewports
+	const auto requestTextureLevels = [&](
+		LoadedModel &scene,
+		const Camera &camera,
+		const glm::mat4 &projMatrix)
+	{
+		const auto &model = scene.model;
+		const auto eye = camera.getEye();
+		const auto pixelScale = projMatrix[1][1] * 0.5f * m_nWindowHeight;
 
-					if (occlusion == 0)
-					{
-						occlusion = whiteTexture;
-					}
+		for (size_t i = 0; i < scene.drawList.size(); ++i)
+		{
+			const auto materialIndex = scene.drawList[i].material;
 
-					glActiveTexture(GL_TEXTURE3);
-					glBindTexture(GL_TEXTURE_2D, occlusion);
-					glUniform1f(
-						occlusionStrengthLocation,
-						occlusionTexture.strength);
-				}
-				else
-				{
-					glActiveTexture(GL_TEXTURE3);
-					glBindTexture(GL_TEXTURE_2D, whiteTexture);
-					glUniform1f(
-						occlusionStrengthLocation,
-						1);
-				}
+			if (!drawVisibility[i] || materialIndex < 0)
+			{
+				continue;
+			}
 
-				glUniform1i(occlusionTextureLocation, 3);
+			const auto &sphere = scene.drawSpheres[i];
+			const auto distance = glm::length(glm::vec3(sphere) - eye) - sphere.w;
 
-				// normal map
-				if (featureNormal)
-				{
-					glActiveTexture(GL_TEXTURE4);
-					glBindTexture(
-						GL_TEXTURE_2D,
-						textureObjects[normalTexture.index]);
-					glUniform1f(
-						normalScaleLocation,
-						normalTexture.scale);
-				}
-				else
-				{
-					glActiveTexture(GL_TEXTURE4);
-					glBindTexture(GL_TEXTURE_2D, greyTexture);
-					glUniform1f(normalScaleLocation, 1);
-				}
+			// Unbounded primitives, or the camera is inside the sphere
+			const auto pixelSize = (std::isfinite(sphere.w) && distance > 0.f)
+				? 2.f * sphere.w * pixelScale / distance
+				: std::numeric_limits<float>::infinity();
 
-				glUniform1i(normalTextureLocation, 4);
+			const auto &material = model.materials[materialIndex];
+			const int textureIndices[] = {
+				material.pbrMetallicRoughness.baseColorTexture.index,
+				material.pbrMetallicRoughness.metallicRoughnessTexture.index,
+				material.emissiveTexture.index,
+				material.occlusionTexture.index,
+				material.normalTexture.index};
 
-				// environment map
-				if (featureEnvironment)
-				{
-					// irradiance map
-					glActiveTexture(GL_TEXTURE5);
-					glBindTexture(
-						GL_TEXTURE_CUBE_MAP,
-						irradianceMap);
-
-					// prefilter map
-					glActiveTexture(GL_TEXTURE6);
-					glBindTexture(
-						GL_TEXTURE_CUBE_MAP,
-						prefilterMap);
-
-					// brdf lut
-					glActiveTexture(GL_TEXTURE7);
-					glBindTexture(
-						GL_TEXTURE_2D,
-						brdfLUT);
-				}
-				else
+			for (const auto textureIndex : textureIndices)
+			{
+				if (textureIndex >= 0)
 				{
-					// irradiance map
-					glActiveTexture(GL_TEXTURE5);
-					glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-
-					// prefilter map
-					glActiveTexture(GL_TEXTURE6);
-					glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-
-					// brdf lut
-					glActiveTexture(GL_TEXTURE7);
-					glBindTexture(GL_TEXTURE_2D, 0);
+					scene.textures.request(textureIndex, pixelSize);
 				}
-
-				glUniform1i(irradianceTextureLocation, 5);
-				glUniform1i(prefilterTextureLocation, 6);
-				glUniform1i(brdfLUTLocation, 7);
-
-				return;
 			}
 		}
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, whiteTexture);
-		glUniform1i(baseColorLocation, 0);
-
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		glUniform1i(metallicRoughnessTextureLocation, 1);
-		glUniform4f(baseColorFactorLocation, 1, 1, 1, 1);
-		glUniform1f(metallicFactorLocation, 0);
-		glUniform1f(roughnessFactorLocation, 0);
-
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		glUniform3f(emissiveFactorLocation, 0, 0, 0);
-
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		glUniform1f(occlusionStrengthLocation, 1);
-
-		glActiveTexture(GL_TEXTURE4);
-		glBindTexture(GL_TEXTURE_2D, greyTexture);
-		glUniform1f(normalScaleLocation, 1);
 	};
 
 	// Lambda function to draw the scene
-	const auto drawScene = [&](const Camera &camera)
+	const auto drawScene = [&](
+		const LoadedModel &scene,
+		const Camera &camera,
+		const glm::mat4 &projMatrix)
 	{
+		const auto &model = scene.model;
+
 		glViewport(0, 0, m_nWindowWidth, m_nWindowHeight);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -1300,163 +2018,632 @@ int ViewerApplication::run()
 			renderCube();
 		};
 
-		// The recursive function that should draw a node
-		// We use a std::function because a simple lambda cannot be recursive
-		const std::function<void(int, const glm::mat4 &)> drawNode =
-		[&](int nodeIdx, const glm::mat4 &parentMatrix)
+		// Submit the sorted draw list of the scene, every draw only selects
+		// the uniform buffer ranges of its node and material
+		const auto drawNodes = [&]()
 		{
-			// TODO The drawNode function
-			tinygltf::Node& node = model.nodes[nodeIdx];
-			glm::mat4 modelMatrix = getLocalToWorldMatrix(
-				node,
-				parentMatrix);
+			// The skybox pass has bound its own program, vertex array and
+			// texture behind the tracker's back
+			glState.invalidateBindings();
+			glState.resetCounters();
+
+			FrameUniforms frameUniforms;
+			frameUniforms.viewMatrix = viewMatrix;
+			frameUniforms.projMatrix = projMatrix;
+			frameUniforms.viewProjMatrix = projMatrix * viewMatrix;
+			frameUniforms.camDir = glm::vec4(camera.getDirection(), 0);
+			frameUniforms.lightDirection = glm::vec4(
+				glm::normalize(lightFromCamera
+					? camera.getDirection()
+					: lightDirectionRaw),
+				0);
+			frameUniforms.lightIntensity = glm::vec4(lightRadiance, 0);
+			frameUniforms.metallicRoughnessEnabled = featureMetallicRoughness;
+			frameUniforms.emissionEnabled = featureEmission;
+			frameUniforms.occlusionEnabled = featureOcclusion;
+			frameUniforms.normalMapEnabled = featureNormal;
+
+			glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+			glBufferSubData(
+				GL_UNIFORM_BUFFER,
+				0,
+				sizeof(frameUniforms),
+				&frameUniforms);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+			glState.bindUniformBufferRange(
+				UNIFORM_BLOCK_FRAME_BINDING,
+				frameUniformBuffer,
+				0,
+				sizeof(FrameUniforms));
+
+			// Bin the punctual lights in the clusters of this view, on the
+			// pool
+			if (featurePunctualLights && !scene.lights.empty())
+			{
+				const auto clusteringStart = std::chrono::steady_clock::now();
+
+				lightClusters.update(
+					scene.lights,
+					viewMatrix,
+					projMatrix,
+					m_nWindowWidth,
+					m_nWindowHeight,
+					m_threadPool);
+
+				ClusterUniforms clusterUniforms;
+				clusterUniforms.gridSize = glm::uvec4(
+					LIGHT_CLUSTER_COUNT_X,
+					LIGHT_CLUSTER_COUNT_Y,
+					LIGHT_CLUSTER_COUNT_Z,
+					0);
+				clusterUniforms.depthScale = lightClusters.depthScale();
+				clusterUniforms.depthBias = lightClusters.depthBias();
+				clusterUniforms.tileSize = lightClusters.tileSize();
+
+				glBindBuffer(GL_UNIFORM_BUFFER, clusterUniformBuffer);
+				glBufferSubData(
+					GL_UNIFORM_BUFFER,
+					0,
+					sizeof(clusterUniforms),
+					&clusterUniforms);
+				glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+				glState.bindUniformBufferRange(
+					UNIFORM_BLOCK_CLUSTER_BINDING,
+					clusterUniformBuffer,
+					0,
+					sizeof(ClusterUniforms));
+				glState.bindTexture(
+					8,
+					GL_TEXTURE_BUFFER,
+					lightClusters.clusterTexture());
+				glState.bindTexture(
+					9,
+					GL_TEXTURE_BUFFER,
+					lightClusters.lightIndexTexture());
+				glState.bindTexture(
+					10,
+					GL_TEXTURE_BUFFER,
+					lightClusters.lightTexture());
+
+				lightClusteringTime = std::chrono::duration<double, std::micro>(
+					std::chrono::steady_clock::now() - clusteringStart).count();
+			}
+
+			drawCallCount = 0;
 
-			if (node.mesh >= 0)
+			const auto frustum = extractFrustum(projMatrix * viewMatrix);
+			const auto cullingStart = std::chrono::steady_clock::now();
+
+			if (frustumCulling && bvhCulling && !scene.bvh.empty())
+			{
+				// Whole subtrees are accepted or rejected at once
+				visibleCount = scene.bvh.cullFrustum(frustum, drawVisibility);
+			}
+			else
 			{
-				glm::mat4 modelViewMatrix =
-					viewMatrix * modelMatrix;
-				glm::mat4 modelViewProjectionMatrix =
-					projMatrix * modelViewMatrix;
-				glm::mat4 normalMatrix =
-					glm::inverse(glm::transpose(modelViewMatrix));
-				glm::vec3 lightDirection;
-
-				if (lightFromCamera)
+				// Frustum culling of each draw, bounding sphere first then box
+				drawVisibility.resize(scene.drawList.size());
+				visibleCount = 0;
+
+				for (size_t i = 0; i < scene.drawList.size(); ++i)
 				{
-					lightDirection = glm::normalize(camera.getDirection());
+					const auto &sphere = scene.drawSpheres[i];
+					const bool visible = !frustumCulling
+						|| (intersectsFrustum(frustum, glm::vec3(sphere), sphere.w)
+							&& intersectsFrustum(
+								frustum,
+								scene.drawBoundsMin[i],
+								scene.drawBoundsMax[i]));
+
+					drawVisibility[i] = visible;
+					visibleCount += visible;
 				}
-				else
+			}
+
+			cullingTime = std::chrono::duration<double, std::micro>(
+				std::chrono::steady_clock::now() - cullingStart).count();
+			culledCount = scene.drawList.size() - visibleCount;
+
+			// Merged primitives: a single call per material
+			const auto drawIndirect =
+				indirectDraw && scene.indirectVertexArray;
+			std::vector<GLsizei> bucketVisibleCounts;
+
+			if (drawIndirect)
+			{
+				// Culled commands draw 0 instances
+				culledCommands = scene.indirectCommands;
+				bucketVisibleCounts.assign(scene.indirectBuckets.size(), 0);
+				size_t bucketIdx = 0;
+
+				for (size_t i = 0; i < scene.drawList.size(); ++i)
 				{
-					lightDirection = glm::normalize(lightDirectionRaw);
+					const auto commandIdx = scene.drawList[i].indirectCommand;
+
+					if (commandIdx < 0)
+					{
+						continue;
+					}
+
+					while (commandIdx >= scene.indirectBuckets[bucketIdx].firstCommand
+						+ scene.indirectBuckets[bucketIdx].commandCount)
+					{
+						++bucketIdx;
+					}
+
+					culledCommands[commandIdx].instanceCount = drawVisibility[i];
+					bucketVisibleCounts[bucketIdx] += drawVisibility[i];
 				}
 
-				glUniformMatrix4fv(
-					modelMatrixLocation,
-					1,
-					GL_FALSE,
-					glm::value_ptr(modelMatrix));
-				glUniformMatrix4fv(
-					modelViewMatrixLocation,
-					1,
-					GL_FALSE,
-					glm::value_ptr(modelViewMatrix));
-				glUniformMatrix4fv(
-					modelViewProjMatrixLocation,
-					1,
-					GL_FALSE,
-					glm::value_ptr(modelViewProjectionMatrix));
-				glUniformMatrix4fv(
-					normalMatrixLocation,
-					1,
-					GL_FALSE,
-					glm::value_ptr(normalMatrix));
-				glUniform3fv(
-					camDirLocation,
-					1,
-					glm::value_ptr(camera.getDirection()));
-
-				if (lightDirectionLocation >= 0)
+				glBindBuffer(
+					GL_DRAW_INDIRECT_BUFFER,
+					scene.indirectCommandBuffer);
+				glBufferSubData(
+					GL_DRAW_INDIRECT_BUFFER,
+					0,
+					culledCommands.size() * sizeof(DrawElementsIndirectCommand),
+					culledCommands.data());
+				glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			}
+
+			// Group the remaining visible draws by primitive, the draw list
+			// is sorted so that they are next to each other
+			instancedDraws.clear();
+			instanceTransforms.clear();
+
+			if (instancing)
+			{
+				for (size_t i = 0; i < scene.drawList.size(); ++i)
 				{
-					glUniform3f(lightDirectionLocation,
-						lightDirection[0],
-						lightDirection[1],
-						lightDirection[2]);
+					const auto &item = scene.drawList[i];
+
+					if (!drawVisibility[i]
+						|| (drawIndirect && item.indirectCommand >= 0))
+					{
+						continue;
+					}
+
+					if (instancedDraws.empty()
+						|| scene.drawList[instancedDraws.back().item].vertexArray
+							!= item.vertexArray
+						|| scene.drawList[instancedDraws.back().item].material
+							!= item.material)
+					{
+						instancedDraws.push_back(InstancedDraw{
+							i,
+							GLuint(instanceTransforms.size()),
+							0});
+					}
+
+					++instancedDraws.back().instanceCount;
+					instanceTransforms.push_back(item.transform);
 				}
 
-				if (lightRadianceLocation >= 0)
+				if (!instanceTransforms.empty())
 				{
-					glUniform3f(lightRadianceLocation,
-						lightRadiance[0],
-						lightRadiance[1],
-						lightRadiance[2]);
+					glBindBuffer(GL_ARRAY_BUFFER, scene.instanceTransformBuffer);
+					glBufferData(
+						GL_ARRAY_BUFFER,
+						instanceTransforms.size() * sizeof(GLuint),
+						instanceTransforms.data(),
+						GL_STREAM_DRAW);
+					glBindBuffer(GL_ARRAY_BUFFER, 0);
 				}
 			}
 
-			tinygltf::Mesh& mesh = model.meshes[node.mesh];
-			struct VaoRange& range = meshIndexToVaoRange[node.mesh];
-
-			for (size_t i = 0; i < range.count; ++i)
+			// Submit the visible primitives, with the program of their
+			// material or, if positionOnly, with the depth prepass or
+			// overdraw program. Those do not depend on the material: every
+			// merged primitive is drawn by a single call.
+			const auto submitDraws = [&](bool positionOnly, bool overdraw)
 			{
-				bindMaterial(mesh.primitives[i].material);
-				glBindVertexArray(vertexArrayObjects[range.begin + i]);
-				tinygltf::Primitive& primitive = mesh.primitives[i];
+				if (drawIndirect)
+				{
+					glState.bindVertexArray(scene.indirectVertexArray);
+
+					glBindBufferBase(
+						GL_SHADER_STORAGE_BUFFER,
+						STORAGE_BLOCK_NODES_BINDING,
+						scene.nodeStorageBuffer);
+					glBindBuffer(
+						GL_DRAW_INDIRECT_BUFFER,
+						scene.indirectCommandBuffer);
+
+					if (positionOnly)
+					{
+						glState.useProgram(
+							getPositionOnlyProgram(overdraw, true).glId());
+
+						glMultiDrawElementsIndirect(
+							GL_TRIANGLES,
+							GL_UNSIGNED_INT,
+							nullptr,
+							GLsizei(culledCommands.size()),
+							0);
+						++drawCallCount;
+					}
+					else
+					{
+						for (size_t i = 0; i < scene.indirectBuckets.size(); ++i)
+						{
+							const auto &bucket = scene.indirectBuckets[i];
+
+							if (!bucketVisibleCounts[i])
+							{
+								continue;
+							}
+
+							bindMaterial(scene, bucket.material, true);
+
+							glMultiDrawElementsIndirect(
+								GL_TRIANGLES,
+								GL_UNSIGNED_INT,
+								(const GLvoid*) (bucket.firstCommand
+									* sizeof(DrawElementsIndirectCommand)),
+								bucket.commandCount,
+								0);
+							++drawCallCount;
+						}
+					}
 
-				if (primitive.indices >= 0)
+					glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+				}
+
+				// Instances read their transform index from
+				// instanceTransformBuffer, starting at baseInstance, and the
+				// transforms from the same storage buffer as the indirect path
+				if (instancing)
 				{
-					const auto& accessor = model.accessors[primitive.indices];
-					const auto& bufferView = model.bufferViews[accessor.bufferView];
-					const auto byteOffset = bufferView.byteOffset + accessor.byteOffset;
+					glBindBufferBase(
+						GL_SHADER_STORAGE_BUFFER,
+						STORAGE_BLOCK_NODES_BINDING,
+						scene.nodeStorageBuffer);
 
-					glDrawElements(primitive.mode, accessor.count, accessor.componentType, (const GLvoid*) byteOffset);
+					for (const auto &draw : instancedDraws)
+					{
+						const auto &item = scene.drawList[draw.item];
+
+						if (positionOnly)
+						{
+							glState.useProgram(
+								getPositionOnlyProgram(overdraw, true).glId());
+						}
+						else
+						{
+							bindMaterial(scene, item.material, true);
+						}
+						glState.bindVertexArray(item.vertexArray);
+
+						if (item.indexType)
+						{
+							glDrawElementsInstancedBaseInstance(
+								item.mode,
+								item.count,
+								item.indexType,
+								(const GLvoid*) item.indexByteOffset,
+								draw.instanceCount,
+								draw.baseInstance);
+						}
+						else
+						{
+							glDrawArraysInstancedBaseInstance(
+								item.mode,
+								0,
+								item.count,
+								draw.instanceCount,
+								draw.baseInstance);
+						}
+
+						++drawCallCount;
+					}
 				}
 				else
 				{
-					const auto accessorIdx = (*begin(primitive.attributes)).second;
-					const auto &accessor = model.accessors[accessorIdx];
+					for (size_t i = 0; i < scene.drawList.size(); ++i)
+					{
+						const auto &item = scene.drawList[i];
+
+						if (!drawVisibility[i]
+							|| (drawIndirect && item.indirectCommand >= 0))
+						{
+							continue;
+						}
+
+						glState.bindUniformBufferRange(
+							UNIFORM_BLOCK_NODE_BINDING,
+							scene.nodeUniformBuffer,
+							item.transform * scene.nodeUniformStride,
+							sizeof(NodeUniforms));
+
+						if (positionOnly)
+						{
+							glState.useProgram(
+								getPositionOnlyProgram(overdraw, false).glId());
+						}
+						else
+						{
+							bindMaterial(scene, item.material, false);
+						}
+						glState.bindVertexArray(item.vertexArray);
+
+						if (item.indexType)
+						{
+							glDrawElements(item.mode, item.count, item.indexType, (const GLvoid*) item.indexByteOffset);
+						}
+						else
+						{
+							glDrawArrays(item.mode, 0, item.count);
+						}
+
+						++drawCallCount;
+					}
+				}
+			};
+
+			// Depth prepass: the shading pass then only runs the fragment
+			// shader of the closest surface of each pixel, whatever the
+			// draw order
+			if (depthPrepass)
+			{
+				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+				submitDraws(true, false);
+				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+				glDepthFunc(GL_EQUAL);
+				glDepthMask(GL_FALSE);
+			}
+
+			if (overdrawHeatmap)
+			{
+				glEnable(GL_BLEND);
+				glBlendFunc(GL_ONE, GL_ONE);
+			}
+
+			if (shadedFragmentsPending)
+			{
+				GLuint available = 0;
+				glGetQueryObjectuiv(
+					shadedFragmentsQuery,
+					GL_QUERY_RESULT_AVAILABLE,
+					&available);
 
-					glDrawArrays(primitive.mode, 0, accessor.count);
+				if (available)
+				{
+					glGetQueryObjectui64v(
+						shadedFragmentsQuery,
+						GL_QUERY_RESULT,
+						&shadedFragmentCount);
+					shadedFragmentsPending = false;
 				}
 			}
+
+			const auto countFragments = !shadedFragmentsPending;
+			if (countFragments)
+			{
+				glBeginQuery(GL_SAMPLES_PASSED, shadedFragmentsQuery);
+			}
+
+			submitDraws(overdrawHeatmap, overdrawHeatmap);
+
+			if (countFragments)
+			{
+				glEndQuery(GL_SAMPLES_PASSED);
+				shadedFragmentsPending = true;
+			}
+
+			if (overdrawHeatmap)
+			{
+				glDisable(GL_BLEND);
+			}
+
+			if (depthPrepass)
+			{
+				glDepthFunc(GL_LEQUAL);
+				glDepthMask(GL_TRUE);
+			}
 		};
 
+
 		// Draw the scene referenced by gltf file
 		if (model.defaultScene >= 0)
 		{
-			// Draw skybox
-			glslSkyboxProgram.use();
-			drawSkybox();
-
-			// Draw all nodes
-			glslProgram.use();
-
-			for (size_t i = 0; i < model.scenes[model.defaultScene].nodes.size(); ++i)
+			// Draw skybox, the overdraw heatmap starts from black
+			if (!overdrawHeatmap)
 			{
-				drawNode(model.scenes[model.defaultScene].nodes[i], glm::mat4(1));
+				glslSkyboxProgram.use();
+				drawSkybox();
 			}
+
+			// Draw all nodes
+			drawNodes();
 		}
 
 		glBindVertexArray(0);
 	};
 
-	if (!m_OutputPath.empty())
+	// Offscreen rendering of the scene to png files. Images are read back
+	// asynchronously and encoded on the thread pool while the next ones are
+	// rendered, flushImages() waits for all of them and returns the number
+	// of images that could not be written.
+	std::atomic<size_t> writeFailureCount{0};
+	AsyncImageRenderer imageRenderer(m_threadPool);
+
+	const auto renderToFile = [&](
+		const LoadedModel &scene,
+		const Camera &camera,
+		const fs::path &outputPath)
 	{
-		const auto strPath = m_OutputPath.string();
-		std::vector<unsigned char> pixels(m_nWindowWidth * m_nWindowHeight * 3, 0);
-
-		renderToImage(
-			m_nWindowWidth,
-			m_nWindowHeight,
-			3,
-			pixels.data(),
+		const auto projMatrix = computeProjectionMatrix(scene);
+		const size_t width = m_nWindowWidth;
+		const size_t height = m_nWindowHeight;
+
+		imageRenderer.render(
+			width,
+			height,
 			[&]()
 			{
-				drawScene(cameraController->getCamera());
+				drawScene(scene, camera, projMatrix);
+			},
+			[&writeFailureCount, strPath = outputPath.string(), width, height](
+				std::vector<unsigned char> &pixels)
+			{
+				if (!stbi_write_png(
+					strPath.c_str(),
+					int(width),
+					int(height),
+					3,
+					pixels.data(),
+					0))
+				{
+					std::cerr << "Failed to write " << strPath << std::endl;
+					++writeFailureCount;
+				}
 			});
+	};
 
-		flipImageYAxis(
-			m_nWindowWidth,
-			m_nWindowHeight,
-			3,
-			pixels.data());
-
-		stbi_write_png(
-			strPath.c_str(),
-			m_nWindowWidth,
-			m_nWindowHeight,
-			3,
-			pixels.data(),
-			0);
+	const auto flushImages = [&]()
+	{
+		imageRenderer.flush();
+
+		return writeFailureCount.exchange(0);
+	};
+
+	if (!m_BatchFilePath.empty())
+	{
+		return runBatch(renderToFile, flushImages);
+	}
+
+	// Loading the glTF file
+	LoadedModel scene;
+
+	if (!loadModel(m_gltfFilePath, scene))
+	{
+		std::cerr << "Failed to load glTF model" << std::endl;
+
+		return -1;
+	}
+
+	const auto projMatrix = computeProjectionMatrix(scene);
+
+	const auto initialCamera =
+		m_hasUserCamera ? m_userCamera : computeDefaultCamera(scene);
 
-		return 0;
+	if (!m_OutputPath.empty())
+	{
+		renderToFile(scene, initialCamera, m_OutputPath);
+
+		return flushImages() ? -1 : 0;
 	}
 
+	std::unique_ptr<CameraController> cameraController(
+		std::make_unique<TrackballCameraController>(
+			m_GLFWHandle->window()));
+
+	cameraController->setCamera(initialCamera);
+
   // Loop until the user closes the window
-  for (auto iterationCount = 0u; !m_GLFWHandle.shouldClose();
+  for (auto iterationCount = 0u; !m_GLFWHandle->shouldClose();
        ++iterationCount) {
     const auto seconds = glfwGetTime();
 
+    // Edited shaders are recompiled between frames, reloaded programs have
+    // new GL names and default uniform values
+    if (m_programCache.update())
+    {
+      for (const auto pProgram : forwardPrograms)
+      {
+        if (pProgram)
+        {
+          setupForwardProgram(*pProgram);
+        }
+      }
+      for (const auto pProgram : positionOnlyPrograms)
+      {
+        if (pProgram)
+        {
+          setupForwardProgram(*pProgram);
+        }
+      }
+      getSkyboxLocations();
+      glState.invalidate();
+    }
+
     const auto camera = cameraController->getCamera();
-    drawScene(camera);
+    if (scene.sceneGraph.update()) // No-op unless a node has been moved
+    {
+      uploadNodeUniforms(scene);
+      updateDrawBounds(scene);
+      scene.lights = collectPunctualLights(scene.model, scene.sceneGraph);
+    }
+    drawScene(scene, camera, projMatrix);
+
+    if (scene.textures.streaming())
+    {
+      requestTextureLevels(scene, camera, projMatrix);
+
+      if (scene.textures.update(
+              size_t(textureBudgetMiB) << 20,
+              STREAMING_UPLOAD_BYTES_PER_FRAME))
+      {
+        // Recreated textures can get the GL names of deleted ones
+        glState.invalidateBindings();
+      }
+    }
+
+    // Hover picking: closest primitive under the cursor, on the CPU
+    if (!ImGui::GetIO().WantCaptureMouse) {
+      const auto pickingStart = std::chrono::steady_clock::now();
+
+      double cursorX, cursorY;
+      int windowWidth, windowHeight;
+      glfwGetCursorPos(m_GLFWHandle->window(), &cursorX, &cursorY);
+      glfwGetWindowSize(m_GLFWHandle->window(), &windowWidth, &windowHeight);
+
+      // Ray from the near plane (t = 0) to the far plane (t = 1)
+      const auto ndc = glm::vec2(2 * cursorX / std::max(windowWidth, 1) - 1,
+          1 - 2 * cursorY / std::max(windowHeight, 1));
+      const auto invViewProj =
+          glm::inverse(projMatrix * camera.getViewMatrix());
+      const auto unproject = [&](float z) {
+        const auto position = invViewProj * glm::vec4(ndc, z, 1);
+        return glm::vec3(position) / position.w;
+      };
+      const auto rayOrigin = unproject(-1);
+      const auto rayDirection = unproject(1) - rayOrigin;
+
+      const auto &meshes = scene.sceneGraph.meshes();
+
+      // Affine transforms keep t unchanged, test in the local space of the
+      // primitive
+      const auto intersectItem = [&](uint32_t itemIdx, float &t) {
+        const auto &item = scene.drawList[itemIdx];
+        const auto &primitive =
+            scene.model.meshes[meshes[item.node]].primitives[item.primitive];
+        const auto worldToLocal =
+            glm::inverse(scene.transformMatrices[item.transform]);
+
+        return intersectPrimitive(scene.model, primitive,
+            glm::vec3(worldToLocal * glm::vec4(rayOrigin, 1)),
+            glm::vec3(worldToLocal * glm::vec4(rayDirection, 0)), t);
+      };
+
+      uint32_t itemIdx;
+      float t;
+      if (scene.bvh.intersectRay(
+              rayOrigin, rayDirection, 1.f, intersectItem, itemIdx, t)) {
+        pickedItem = int(itemIdx);
+        pickedDistance =
+            glm::distance(camera.eye(), rayOrigin + t * rayDirection);
+      } else {
+        pickedItem = -1;
+      }
+
+      pickingTime = std::chrono::duration<double, std::micro>(
+          std::chrono::steady_clock::now() - pickingStart)
+                        .count();
+    }
 
     // GUI code:
     imguiNewFrame();
@@ -1485,7 +2672,7 @@ int ViewerApplication::run()
              << camera.center().y << "," << camera.center().z << ","
              << camera.up().x << "," << camera.up().y << "," << camera.up().z;
           const auto str = ss.str();
-          glfwSetClipboardString(m_GLFWHandle.window(), str.c_str());
+          glfwSetClipboardString(m_GLFWHandle->window(), str.c_str());
         }
 
 		ImGui::Text("Controls type");
@@ -1498,12 +2685,12 @@ int ViewerApplication::run()
 			if (controlsType == 0)
 			{
 				cameraController = std::make_unique<TrackballCameraController>(
-					m_GLFWHandle.window());
+					m_GLFWHandle->window());
 			}
 			else
 			{
 				cameraController = std::make_unique<FirstPersonCameraController>(
-					m_GLFWHandle.window());
+					m_GLFWHandle->window());
 			}
 
 			cameraController->setCamera(oldCamera);
@@ -1523,6 +2710,18 @@ int ViewerApplication::run()
 			ImGui::ColorEdit3("Color#lightColor", (float*) &lightRadiance, 0);
 
 			ImGui::Checkbox("Bind to Camera", &lightFromCamera);
+
+			ImGui::Text("Punctual lights: %zu", scene.lights.size());
+			if (featurePunctualLights && !scene.lights.empty())
+			{
+				ImGui::Text("Cluster light indices: %zu (%.1f per cluster, at most %zu)",
+					lightClusters.lightIndexCount(),
+					double(lightClusters.lightIndexCount())
+						/ (LIGHT_CLUSTER_COUNT_X * LIGHT_CLUSTER_COUNT_Y
+							* LIGHT_CLUSTER_COUNT_Z),
+					lightClusters.maxClusterLightCount());
+				ImGui::Text("Clustering: %.1f us", lightClusteringTime);
+			}
 		}
 
 		if (ImGui::CollapsingHeader("features"))
@@ -1533,6 +2732,98 @@ int ViewerApplication::run()
 			ImGui::Checkbox("Emission Map", &featureEmission);
 			ImGui::Checkbox("Normal Map", &featureNormal);
 			ImGui::Checkbox("Environment Map", &featureEnvironment);
+			ImGui::Checkbox("BRDF LUT (analytic fit if disabled)", &featureBRDFLUT);
+			ImGui::Checkbox("Punctual lights (KHR_lights_punctual)", &featurePunctualLights);
+		}
+
+		if (ImGui::CollapsingHeader("Rendering"))
+		{
+			const auto issuedCount = glState.issuedCount();
+			const auto skippedCount = glState.skippedCount();
+			const auto totalCount = issuedCount + skippedCount;
+
+			ImGui::Checkbox("Multi-draw indirect", &indirectDraw);
+			if (m_customVertexShader)
+			{
+				ImGui::Text("Instancing: off (--vs %s has no instanced variant)",
+					m_vertexShader.c_str());
+			}
+			else
+			{
+				ImGui::Checkbox("Instancing", &instancing);
+			}
+			ImGui::Text("Instanced draws: %zu (%zu instances, %zu EXT_mesh_gpu_instancing)",
+				instancedDraws.size(),
+				instanceTransforms.size(),
+				scene.instanceNodes.size());
+			ImGui::Checkbox("Frustum culling", &frustumCulling);
+			ImGui::Checkbox("Depth prepass (GL_EQUAL shading)", &depthPrepass);
+			ImGui::Checkbox("Overdraw heatmap", &overdrawHeatmap);
+			ImGui::Text("Shaded fragments: %.2f M (%.2f per pixel)",
+				shadedFragmentCount / 1e6,
+				double(shadedFragmentCount)
+					/ (double(m_nWindowWidth) * m_nWindowHeight));
+			ImGui::Text("Visible primitives: %zu, culled: %zu",
+				visibleCount,
+				culledCount);
+			ImGui::Text("Draw calls: %zu (%zu primitives)",
+				drawCallCount,
+				scene.drawList.size());
+			ImGui::Text("GL state calls issued: %zu", issuedCount);
+			ImGui::Text("GL state calls saved: %zu (%.1f%%)",
+				skippedCount,
+				totalCount ? 100.0 * skippedCount / totalCount : 0.0);
+			ImGui::Checkbox("BVH culling", &bvhCulling);
+			ImGui::Text("Culling: %.1f us (%zu BVH nodes)",
+				cullingTime,
+				scene.bvh.nodes().size());
+		}
+
+		if (ImGui::CollapsingHeader("Textures"))
+		{
+			const auto &textures = scene.textures;
+
+			if (textures.streaming())
+			{
+				ImGui::SliderInt("Budget (MiB)", &textureBudgetMiB, 16, 4096);
+				ImGui::Text("Streamed levels: %zu, evicted: %zu",
+					textures.streamedLevelCount(),
+					textures.evictedLevelCount());
+			}
+			else
+			{
+				ImGui::Text("Streaming disabled, every level is resident");
+			}
+
+			ImGui::Text("Resident: %.1f / %.1f MiB (%zu textures)",
+				textures.residentBytes() / double(1 << 20),
+				textures.totalBytes() / double(1 << 20),
+				textures.size());
+		}
+
+		if (ImGui::CollapsingHeader("Picking"))
+		{
+			if (pickedItem >= 0)
+			{
+				const auto &item = scene.drawList[pickedItem];
+				const auto nodeIdx = scene.sceneGraph.nodeIndices()[item.node];
+				const auto meshIdx = scene.sceneGraph.meshes()[item.node];
+
+				ImGui::Text("Node: %d \"%s\"",
+					nodeIdx,
+					scene.model.nodes[nodeIdx].name.c_str());
+				ImGui::Text("Mesh: %d \"%s\", primitive %d",
+					meshIdx,
+					scene.model.meshes[meshIdx].name.c_str(),
+					item.primitive);
+				ImGui::Text("Distance: %.3f", pickedDistance);
+			}
+			else
+			{
+				ImGui::Text("Nothing under the cursor");
+			}
+
+			ImGui::Text("Picking: %.1f us", pickingTime);
 		}
       }
 
@@ -1550,7 +2841,7 @@ int ViewerApplication::run()
       cameraController->update(float(ellapsedTime));
     }
 
-    m_GLFWHandle.swapBuffers(); // Swap front and back buffers
+    m_GLFWHandle->swapBuffers(); // Swap front and back buffers
   }
 
   // TODO clean up allocated GL data
@@ -1561,16 +2852,21 @@ int ViewerApplication::run()
 ViewerApplication::ViewerApplication(const fs::path &appPath, uint32_t width,
     uint32_t height, const fs::path &gltfFile, const fs::path &cubeMapFile,
     const std::vector<float> &lookatArgs, const std::string &vertexShader,
-    const std::string &fragmentShader, const fs::path &output) :
+    const std::string &fragmentShader, const fs::path &output,
+    const fs::path &batchFile, bool indirectDraw, uint32_t textureBudgetMiB,
+    bool optimizeMeshes) :
     m_nWindowWidth(width),
     m_nWindowHeight(height),
     m_AppPath{appPath},
     m_AppName{m_AppPath.stem().string()},
     m_ImGuiIniFilename{m_AppName + ".imgui.ini"},
     m_ShadersRootPath{m_AppPath.parent_path() / "shaders"},
+    m_CacheRootPath{m_AppPath.parent_path() / "cache"},
+    m_AssetsRootPath{m_AppPath.parent_path() / "assets"},
     m_gltfFilePath{gltfFile},
     m_cubeMapFilePath{cubeMapFile},
-    m_OutputPath{output}
+    m_OutputPath{output},
+    m_BatchFilePath{batchFile}
 {
   if (!lookatArgs.empty()) {
     m_hasUserCamera = true;
@@ -1582,17 +2878,26 @@ ViewerApplication::ViewerApplication(const fs::path &appPath, uint32_t width,
 
   if (!vertexShader.empty()) {
     m_vertexShader = vertexShader;
+    m_customVertexShader = true;
   }
 
   if (!fragmentShader.empty()) {
     m_fragmentShader = fragmentShader;
   }
 
-  ImGui::GetIO().IniFilename =
-      m_ImGuiIniFilename.c_str(); // At exit, ImGUI will store its windows
-                                  // positions in this file
+  m_useIndirectDraw = indirectDraw;
+  m_textureBudgetMiB = textureBudgetMiB;
+  m_optimizeMeshes = optimizeMeshes;
+
+  if (m_GLFWHandle) {
+    ImGui::GetIO().IniFilename =
+        m_ImGuiIniFilename.c_str(); // At exit, ImGUI will store its windows
+                                    // positions in this file
+
+    glfwSetKeyCallback(m_GLFWHandle->window(), keyCallback);
+  }
 
-  glfwSetKeyCallback(m_GLFWHandle.window(), keyCallback);
+  m_programCache.setBinaryDirectory(m_CacheRootPath / "programs");
 
   printGLVersion();
 }
@@ -1,9 +1,21 @@
 #pragma once
 
+#include "utils/EGLHandle.hpp"
 #include "utils/GLFWHandle.hpp"
+#include "utils/ThreadPool.hpp"
+#include "utils/bvh.hpp"
 #include "utils/cameras.hpp"
+#include "utils/files.hpp"
 #include "utils/filesystem.hpp"
+#include "utils/gltf.hpp"
+#include "utils/indirect.hpp"
+#include "utils/lights.hpp"
+#include "utils/program_cache.hpp"
+#include "utils/scene_graph.hpp"
 #include "utils/shaders.hpp"
+#include "utils/texture_streaming.hpp"
+#include "utils/uniform_blocks.hpp"
+#include <memory>
 #include <tiny_gltf.h>
 
 class ViewerApplication
@@ -18,7 +30,11 @@ public:
 	  const std::vector<float> &lookatArgs,
       const std::string &vertexShader,
 	  const std::string &fragmentShader,
-      const fs::path &output);
+      const fs::path &output,
+      const fs::path &batchFile = {},
+      bool indirectDraw = false,
+      uint32_t textureBudgetMiB = 0,
+      bool optimizeMeshes = true);
 
   int run();
 
@@ -30,30 +46,117 @@ private:
     GLsizei count; // Number of elements in range
   };
 
+  // A single draw call of a primitive of a mesh node
+  struct DrawItem
+  {
+    uint32_t node; // Flat index in LoadedModel::sceneGraph
+    uint32_t transform; // Index in LoadedModel::transformMatrices
+    GLsizei primitive; // Index in the primitives of the node's mesh
+    int material;
+    GLuint vertexArray;
+    GLenum mode;
+    GLsizei count;
+    GLenum indexType; // 0 for glDrawArrays
+    size_t indexByteOffset;
+    GLint indirectCommand; // In the multi-draw indirect path, -1 if not merged
+    bool hasBounds; // False if the positions could not be read
+    glm::vec3 localMin; // Bounding box of the primitive in node space
+    glm::vec3 localMax;
+  };
+
+  // Consecutive indirect commands sharing a material, drawn with a single
+  // glMultiDrawElementsIndirect
+  struct IndirectBucket
+  {
+    int material;
+    GLsizei firstCommand;
+    GLsizei commandCount;
+  };
+
+  // A glTF file and everything uploaded on the GPU to draw it
+  struct LoadedModel
+  {
+    tinygltf::Model model;
+    glm::vec3 bboxMin;
+    glm::vec3 bboxMax;
+    TextureStreamer textures;
+    std::vector<GLuint> bufferObjects;
+    std::vector<GLuint> vertexArrayObjects;
+    std::vector<VaoRange> meshIndexToVaoRange;
+    SceneGraph sceneGraph; // Flattened default scene
+    std::vector<DrawItem> drawList; // Sorted by material, then vertex array
+    // KHR_lights_punctual lights of the scene graph, in world space
+    std::vector<PunctualLight> lights;
+    // EXT_mesh_gpu_instancing: the flat node of each instance (in increasing
+    // order) and its matrix relative to the node. Nodes with instances are
+    // only drawn by them.
+    std::vector<uint32_t> instanceNodes;
+    std::vector<glm::mat4> instanceMatrices;
+    // World matrix of every transform a draw can use: each node (by flat
+    // index), then each instance
+    std::vector<glm::mat4> transformMatrices;
+    // Per-frame transform index of each instance of the instanced draws, read
+    // by every vertex array as VERTEX_ATTRIB_NODE_IDX (divisor 1)
+    GLuint instanceTransformBuffer = 0;
+    // Arrays of NodeUniforms (indexed by transform) and MaterialUniforms
+    // (indexed by material, the last one is used by primitives without
+    // material), one element every stride bytes
+    GLuint nodeUniformBuffer = 0;
+    GLsizeiptr nodeUniformStride = 0;
+    GLuint materialUniformBuffer = 0;
+    GLsizeiptr materialUniformStride = 0;
+    // SHADER_FEATURE_* bits of each material (same indices as the blocks)
+    std::vector<uint32_t> materialShaderFeatures;
+    // Multi-draw indirect path: the geometry of every primitive that could be
+    // merged in shared buffers, one command per DrawItem::indirectCommand
+    // and the NodeUniforms packed in a shader storage buffer
+    GLuint nodeStorageBuffer = 0;
+    GLuint indirectVertexArray = 0;
+    GLuint indirectVertexBuffer = 0;
+    GLuint indirectIndexBuffer = 0;
+    GLuint indirectNodeIndexBuffer = 0; // Per-instance flat node index
+    GLuint indirectCommandBuffer = 0;
+    std::vector<IndirectBucket> indirectBuckets;
+    std::vector<DrawElementsIndirectCommand> indirectCommands;
+    // World space bounding volumes of each DrawItem, for culling
+    std::vector<glm::vec4> drawSpheres; // center, radius
+    std::vector<glm::vec3> drawBoundsMin;
+    std::vector<glm::vec3> drawBoundsMax;
+    Bvh bvh; // Over drawBoundsMin/Max, primitive i is drawList[i]
+  };
+
   GLsizei m_nWindowWidth = 1280;
   GLsizei m_nWindowHeight = 720;
   GLuint m_unitCubeVAO = 0;
   GLuint m_unitCubeVBO = 0;
-  GLuint m_quadVAO = 0;
-  GLuint m_quadVBO = 0;
 
   const fs::path m_AppPath;
   const std::string m_AppName;
   const fs::path m_ShadersRootPath;
+  const fs::path m_CacheRootPath;
+  const fs::path m_AssetsRootPath;
 
   fs::path m_gltfFilePath;
   std::string m_vertexShader = "forward.vs.glsl";
   std::string m_fragmentShader = "pbr_directional_light.fs.glsl";
+  std::string m_indirectVertexShader = "forward_indirect.vs.glsl";
+  // Set by --vs: the instanced path, which needs m_indirectVertexShader, is
+  // turned off so that m_vertexShader draws everything by default
+  bool m_customVertexShader = false;
+  std::string m_depthFragmentShader = "depth_only.fs.glsl";
+  std::string m_overdrawFragmentShader = "overdraw.fs.glsl";
+  bool m_useIndirectDraw = false;
+  // GPU memory for streamed textures, 0 uploads every level at load time
+  uint32_t m_textureBudgetMiB = 0;
+  // Reorder triangles and vertices of the models at load time
+  bool m_optimizeMeshes = true;
 
   fs::path m_cubeMapFilePath;
   std::string m_cubemapVertexShader = "cubemap.vs.glsl";
   std::string m_cubemapFragmentShader = "cubemap.fs.glsl";
-  std::string m_irradianceFragmentShader = "irradiance.fs.glsl";
-  std::string m_prefilterFragmentShader = "prefilter.fs.glsl";
+  std::string m_prefilterComputeShader = "prefilter.cs.glsl";
   std::string m_skyboxVertexShader = "skybox.vs.glsl";
   std::string m_skyboxFragmentShader = "skybox.fs.glsl";
-  std::string m_integrateVertexShader = "integrate.vs.glsl";
-  std::string m_integrateFragmentShader = "integrate.fs.glsl";
 
   bool m_hasUserCamera = false;
   Camera m_userCamera;
@@ -99,35 +202,108 @@ private:
   };
 
   fs::path m_OutputPath;
+  fs::path m_BatchFilePath;
 
   // Order is important here, see comment below
   const std::string m_ImGuiIniFilename;
-  // Last to be initialized, first to be destroyed:
-  GLFWHandle m_GLFWHandle{int(m_nWindowWidth), int(m_nWindowHeight),
-      "glTF Viewer",
-      m_OutputPath.empty()}; // show the window only if m_OutputPath is empty
+  // Last to be initialized, first to be destroyed: a headless context when
+  // rendering to files (if one can be created, see createHeadlessContext),
+  // else a window that is shown only if neither m_OutputPath nor
+  // m_BatchFilePath is set. Only the window has ImGui.
+  std::unique_ptr<EGLHandle> m_EGLHandle{createHeadlessContext()};
+  std::unique_ptr<GLFWHandle> m_GLFWHandle{
+      m_EGLHandle ? nullptr
+                  : std::make_unique<GLFWHandle>(int(m_nWindowWidth),
+                        int(m_nWindowHeight), "glTF Viewer",
+                        m_OutputPath.empty() && m_BatchFilePath.empty())};
   /*
     ! THE ORDER OF DECLARATION OF MEMBER VARIABLES IS IMPORTANT !
     - m_ImGuiIniFilename.c_str() will be used by ImGUI in ImGui::Shutdown, which
     will be called in destructor of m_GLFWHandle. So we must declare
     m_ImGuiIniFilename before m_GLFWHandle so that m_ImGuiIniFilename
     destructor is called after.
-    - m_GLFWHandle must be declared before the creation of any object managing
-    OpenGL resources (e.g. GLProgram, GLShader) because it is responsible for
-    the creation of a GLFW windows and thus a GL context which must exists
+    - m_EGLHandle and m_GLFWHandle must be declared before the creation of any
+    object managing OpenGL resources (e.g. GLProgram, GLShader) because they
+    are responsible for the creation of the GL context which must exists
     before most of OpenGL function calls.
   */
 
-  tinygltf::TinyGLTF m_gltfLoader;
+  // Every GLSL program, watched for changes to the shader files
+  ProgramCache m_programCache;
+
+  ThreadPool m_threadPool;
+
+  // EGL context for --output and batch rendering, so that no display server
+  // is needed. Returns nullptr in interactive mode or if EGL is unavailable.
+  std::unique_ptr<EGLHandle> createHeadlessContext() const;
+
+  bool loadGltfFile(const fs::path& path, tinygltf::Model& model);
 
-  bool loadGltfFile(tinygltf::Model& model);
+  // Load a glTF file and upload its textures, buffers and vertex arrays
+  bool loadModel(const fs::path& path, LoadedModel& scene);
+
+  // Collect the EXT_mesh_gpu_instancing instances of the scene graph and
+  // add the instance transform attribute to every vertex array
+  void createInstancing(LoadedModel& scene) const;
+
+  // Fill scene.drawList from its scene graph and vertex arrays
+  void buildDrawList(LoadedModel& scene) const;
+
+  // Upload the factors of every material of the model once and record the
+  // textures each one samples
+  void createMaterialUniforms(LoadedModel& scene) const;
+
+  // Merge the geometry of the draw list and record its indirect commands
+  void createIndirectDraws(LoadedModel& scene) const;
+
+  // Compute the transform matrices from the cached matrices of the scene
+  // graph and upload them, to be called again after each update() that
+  // changed something
+  void uploadNodeUniforms(LoadedModel& scene) const;
+
+  // Transform the local bounds of the draw list by the cached world matrices
+  // and rebuild the BVH over them, to be called with uploadNodeUniforms
+  void updateDrawBounds(LoadedModel& scene);
+
+  glm::mat4 computeProjectionMatrix(const LoadedModel& scene) const;
+  Camera computeDefaultCamera(const LoadedModel& scene) const;
+
+  // Render every job of m_BatchFilePath with the same context, programs and
+  // IBL maps, loading each model only once. renderToFile queues an image,
+  // flushImages waits for all of them and returns how many failed.
+  int runBatch(
+	  const std::function<void(
+		  const LoadedModel&,
+		  const Camera&,
+		  const fs::path&)>& renderToFile,
+	  const std::function<size_t()>& flushImages);
 
   GLuint loadEnvTexture();
   GLuint loadCorrectedEnvTexture();
-  GLuint computeIrradianceMap(GLuint envCubemap);
+  // Project envCubemap on SH, or load the coefficients from cachePath if it
+  // has been written for key (an empty cachePath disables the cache)
+  void computeIrradianceSH(
+	  GLuint envCubemap,
+	  const fs::path& cachePath,
+	  uint64_t key,
+	  EnvironmentUniforms& uniforms);
   GLuint prefilterEnvironmentMap(GLuint envCubemap);
   GLuint integrateBRDF();
 
+  // Hash the sources of shaders (relative to the app shader directory)
+  uint64_t hashShaders(
+	  const std::vector<std::string>& shaders,
+	  uint64_t seed) const;
+
+  // Load a baked texture from the cache directory, or call bake() and store
+  // its first levelCount levels there under key
+  GLuint loadCachedTexture(
+	  const std::string& name,
+	  uint64_t key,
+	  GLenum target,
+	  GLsizei levelCount,
+	  const std::function<GLuint()>& bake);
+
   std::vector<GLuint> createBufferObjects(
 	  const tinygltf::Model& model);
 
@@ -136,11 +312,6 @@ private:
 	  const std::vector<GLuint>& bufferObjects,
 	  std::vector<VaoRange>& meshIndexToVaoRange);
 
-  std::vector<GLuint> createTextureObjects(
-	  const tinygltf::Model &model) const;
-
   void initCube();
   void renderCube();
-  void initQuad();
-  void renderQuad();
 };
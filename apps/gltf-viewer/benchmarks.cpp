@@ -0,0 +1,347 @@
+#include "benchmarks.hpp"
+#include "utils/ThreadPool.hpp"
+#include "utils/bvh.hpp"
+#include "utils/frustum.hpp"
+#include "utils/gltf.hpp"
+#include "utils/scene_graph.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+
+using Clock = std::chrono::steady_clock;
+
+static double secondsSince(const Clock::time_point &start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Parse a glTF file, images are only collected and never decoded
+static bool loadBenchmarkModel(const fs::path &path, tinygltf::Model &model)
+{
+  std::vector<DeferredImage> images;
+  return loadGltfModel(path, model, images);
+}
+
+// A primitive of a mesh node of the scene graph
+struct BenchmarkPrimitive
+{
+  uint32_t node; // Flat index in the scene graph
+  const tinygltf::Primitive *pPrimitive;
+};
+
+int benchmarkBvh(const std::vector<fs::path> &files, size_t queryCount)
+{
+  ThreadPool pool;
+  std::mt19937 generator(0);
+  auto returnCode = 0;
+
+  std::cout << std::fixed << std::setprecision(3);
+
+  for (const auto &path : files) {
+    tinygltf::Model model;
+    if (!loadBenchmarkModel(path, model)) {
+      std::cerr << "Unable to load " << path << std::endl;
+      returnCode = -1;
+      continue;
+    }
+
+    SceneGraph sceneGraph;
+    sceneGraph.build(model, model.defaultScene >= 0 ? model.defaultScene : 0);
+    sceneGraph.update();
+
+    std::vector<BenchmarkPrimitive> primitives;
+    std::vector<glm::vec3> boundsMin, boundsMax;
+    glm::vec3 sceneMin(std::numeric_limits<float>::max());
+    glm::vec3 sceneMax(std::numeric_limits<float>::lowest());
+
+    for (const auto node : sceneGraph.meshNodes()) {
+      const auto &mesh = model.meshes[sceneGraph.meshes()[node]];
+      for (const auto &primitive : mesh.primitives) {
+        glm::vec3 localMin, localMax, worldMin, worldMax;
+        if (!computePrimitiveBounds(model, primitive, localMin, localMax)) {
+          continue;
+        }
+        transformBounds(sceneGraph.worldMatrices()[node], localMin, localMax,
+            worldMin, worldMax);
+
+        primitives.push_back({node, &primitive});
+        boundsMin.push_back(worldMin);
+        boundsMax.push_back(worldMax);
+        sceneMin = glm::min(sceneMin, worldMin);
+        sceneMax = glm::max(sceneMax, worldMax);
+      }
+    }
+
+    if (primitives.empty()) {
+      std::cout << path.filename().string() << ": no primitive" << std::endl;
+      continue;
+    }
+
+    // Best of a few builds, the first one also warms up the allocator
+    const auto timeBuild = [&](ThreadPool *pBuildPool) {
+      auto best = std::numeric_limits<double>::max();
+      for (auto i = 0; i < 5; ++i) {
+        Bvh bvh;
+        const auto start = Clock::now();
+        bvh.build(boundsMin, boundsMax, pBuildPool);
+        best = std::min(best, secondsSince(start));
+      }
+      return best;
+    };
+
+    const auto serialBuildTime = timeBuild(nullptr);
+    const auto parallelBuildTime = timeBuild(&pool);
+
+    Bvh bvh;
+    bvh.build(boundsMin, boundsMax, &pool);
+
+    // Random cameras around the scene, looking at a point inside it
+    const auto sceneDiag = glm::length(sceneMax - sceneMin);
+    const auto sceneCenter = 0.5f * (sceneMin + sceneMax);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    const auto randomPoint = [&](float scale) {
+      const auto halfExtent = 0.5f * scale * (sceneMax - sceneMin);
+      return sceneCenter + (2.f * glm::vec3(unit(generator), unit(generator),
+                                      unit(generator)) -
+                               1.f) * halfExtent;
+    };
+
+    const auto projMatrix = glm::perspective(glm::radians(70.f), 16.f / 9.f,
+        0.001f * sceneDiag, 1.5f * sceneDiag);
+    std::vector<Frustum> frustums(queryCount);
+    for (auto &frustum : frustums) {
+      const auto viewMatrix = glm::lookAt(
+          randomPoint(1.5f), randomPoint(0.5f), glm::vec3(0, 1, 0));
+      frustum = extractFrustum(projMatrix * viewMatrix);
+    }
+
+    std::vector<uint8_t> visibility;
+    size_t bvhVisibleCount = 0;
+    auto start = Clock::now();
+    for (const auto &frustum : frustums) {
+      bvhVisibleCount += bvh.cullFrustum(frustum, visibility);
+    }
+    const auto bvhCullTime = secondsSince(start);
+
+    size_t linearVisibleCount = 0;
+    start = Clock::now();
+    for (const auto &frustum : frustums) {
+      for (size_t i = 0; i < primitives.size(); ++i) {
+        linearVisibleCount +=
+            intersectsFrustum(frustum, boundsMin[i], boundsMax[i]);
+      }
+    }
+    const auto linearCullTime = secondsSince(start);
+
+    // Random rays through the scene, tested against the triangles
+    std::vector<glm::mat4> worldToLocal(sceneGraph.size());
+    for (const auto node : sceneGraph.meshNodes()) {
+      worldToLocal[node] = glm::inverse(sceneGraph.worldMatrices()[node]);
+    }
+
+    size_t hitCount = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < queryCount; ++i) {
+      const auto origin = randomPoint(1.5f);
+      const auto direction = randomPoint(0.5f) - origin;
+      const auto intersect = [&](uint32_t primitiveIdx, float &t) {
+        const auto &primitive = primitives[primitiveIdx];
+        const auto &matrix = worldToLocal[primitive.node];
+        return intersectPrimitive(model, *primitive.pPrimitive,
+            glm::vec3(matrix * glm::vec4(origin, 1)),
+            glm::vec3(matrix * glm::vec4(direction, 0)), t);
+      };
+
+      uint32_t primitiveIdx;
+      float t;
+      hitCount += bvh.intersectRay(origin, direction,
+          std::numeric_limits<float>::max(), intersect, primitiveIdx, t);
+    }
+    const auto rayTime = secondsSince(start);
+
+    std::cout << path.filename().string() << ": " << primitives.size()
+              << " primitives, " << bvh.nodes().size() << " nodes"
+              << std::endl;
+    std::cout << "  build: " << 1000 * serialBuildTime << " ms serial, "
+              << 1000 * parallelBuildTime << " ms on " << pool.size()
+              << " threads" << std::endl;
+    std::cout << "  frustum: " << queryCount / bvhCullTime
+              << " queries/s with BVH, " << queryCount / linearCullTime
+              << " queries/s linear, "
+              << double(bvhVisibleCount) / queryCount
+              << " visible primitives per query" << std::endl;
+    std::cout << "  rays: " << queryCount / rayTime << " queries/s, "
+              << hitCount << " hits" << std::endl;
+
+    if (bvhVisibleCount != linearVisibleCount) {
+      std::cerr << "  BVH and linear culling disagree: " << bvhVisibleCount
+                << " vs " << linearVisibleCount << std::endl;
+      returnCode = -1;
+    }
+  }
+
+  return returnCode;
+}
+
+// Former computeSceneBounds, kept as a reference: every index of every
+// primitive of every node is dereferenced and transformed
+static void computeSceneBoundsReference(
+    const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax)
+{
+  bboxMin = glm::vec3(std::numeric_limits<float>::max());
+  bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+  if (model.defaultScene < 0) {
+    return;
+  }
+
+  const std::function<void(int, const glm::mat4 &)> updateBounds =
+      [&](int nodeIdx, const glm::mat4 &parentMatrix) {
+        const auto &node = model.nodes[nodeIdx];
+        const glm::mat4 modelMatrix = getLocalToWorldMatrix(node, parentMatrix);
+        if (node.mesh >= 0) {
+          for (const auto &primitive : model.meshes[node.mesh].primitives) {
+            const auto positionAttrIdxIt =
+                primitive.attributes.find("POSITION");
+            if (positionAttrIdxIt == end(primitive.attributes)) {
+              continue;
+            }
+            const auto &positionAccessor =
+                model.accessors[(*positionAttrIdxIt).second];
+            if (positionAccessor.type != TINYGLTF_TYPE_VEC3) {
+              continue;
+            }
+            const auto &positionBufferView =
+                model.bufferViews[positionAccessor.bufferView];
+            const auto byteOffset =
+                positionAccessor.byteOffset + positionBufferView.byteOffset;
+            const auto &positionBuffer =
+                model.buffers[positionBufferView.buffer];
+            const auto positionByteStride =
+                positionBufferView.byteStride ? positionBufferView.byteStride
+                                              : 3 * sizeof(float);
+
+            const auto addVertex = [&](uint32_t index) {
+              const auto &localPosition =
+                  *((const glm::vec3 *)&positionBuffer
+                          .data[byteOffset + positionByteStride * index]);
+              const auto worldPosition =
+                  glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f));
+              bboxMin = glm::min(bboxMin, worldPosition);
+              bboxMax = glm::max(bboxMax, worldPosition);
+            };
+
+            if (primitive.indices >= 0) {
+              const auto &indexAccessor = model.accessors[primitive.indices];
+              const auto &indexBufferView =
+                  model.bufferViews[indexAccessor.bufferView];
+              const auto *pIndices =
+                  &model.buffers[indexBufferView.buffer]
+                       .data[indexAccessor.byteOffset +
+                             indexBufferView.byteOffset];
+
+              for (size_t i = 0; i < indexAccessor.count; ++i) {
+                switch (indexAccessor.componentType) {
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+                  addVertex(((const uint8_t *)pIndices)[i]);
+                  break;
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+                  addVertex(((const uint16_t *)pIndices)[i]);
+                  break;
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+                  addVertex(((const uint32_t *)pIndices)[i]);
+                  break;
+                }
+              }
+            } else {
+              for (size_t i = 0; i < positionAccessor.count; ++i) {
+                addVertex(uint32_t(i));
+              }
+            }
+          }
+        }
+        for (const auto childNodeIdx : node.children) {
+          updateBounds(childNodeIdx, modelMatrix);
+        }
+      };
+
+  for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
+    updateBounds(nodeIdx, glm::mat4(1));
+  }
+}
+
+int benchmarkSceneBounds(
+    const std::vector<fs::path> &files, size_t repetitionCount)
+{
+  ThreadPool pool;
+  auto returnCode = 0;
+
+  std::cout << std::fixed << std::setprecision(3);
+
+  for (const auto &path : files) {
+    tinygltf::Model model;
+    if (!loadBenchmarkModel(path, model)) {
+      std::cerr << "Unable to load " << path << std::endl;
+      returnCode = -1;
+      continue;
+    }
+
+    // Same model without the optional POSITION min/max, so that every
+    // vertex has to be read
+    auto scannedModel = model;
+    for (auto &accessor : scannedModel.accessors) {
+      accessor.minValues.clear();
+      accessor.maxValues.clear();
+    }
+
+    glm::vec3 referenceMin, referenceMax;
+    glm::vec3 bboxMin, bboxMax;
+
+    const auto timeBest = [&](const std::function<void()> &fn) {
+      auto best = std::numeric_limits<double>::max();
+      for (size_t i = 0; i < std::max(repetitionCount, size_t(1)); ++i) {
+        const auto start = Clock::now();
+        fn();
+        best = std::min(best, secondsSince(start));
+      }
+      return 1000 * best;
+    };
+
+    const auto referenceTime = timeBest([&]() {
+      computeSceneBoundsReference(model, referenceMin, referenceMax);
+    });
+    const auto serialTime = timeBest(
+        [&]() { computeSceneBounds(model, bboxMin, bboxMax, nullptr); });
+    const auto parallelTime =
+        timeBest([&]() { computeSceneBounds(model, bboxMin, bboxMax, &pool); });
+    const auto scanSerialTime = timeBest([&]() {
+      computeSceneBounds(scannedModel, bboxMin, bboxMax, nullptr);
+    });
+    const auto scanParallelTime = timeBest(
+        [&]() { computeSceneBounds(scannedModel, bboxMin, bboxMax, &pool); });
+
+    std::cout << path.filename().string() << ": reference " << referenceTime
+              << " ms, accessor bounds " << serialTime << " ms ("
+              << parallelTime << " ms on " << pool.size()
+              << " threads), vertex scan " << scanSerialTime << " ms ("
+              << scanParallelTime << " ms)" << std::endl;
+
+    // Transformed boxes are conservative, they must contain the exact one
+    const auto epsilon =
+        1e-4f * std::max(1.f, glm::length(referenceMax - referenceMin));
+    if (glm::any(glm::greaterThan(bboxMin, referenceMin + epsilon)) ||
+        glm::any(glm::lessThan(bboxMax, referenceMax - epsilon))) {
+      std::cerr << "  bounds do not contain the reference bounds"
+                << std::endl;
+      returnCode = -1;
+    }
+  }
+
+  return returnCode;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "utils/filesystem.hpp"
+
+#include <string>
+#include <vector>
+
+// CPU benchmarks of the viewer, run on glTF files without any GL context
+// (see scripts/clone_gltf_samples.sh for the Khronos sample models). Results
+// are printed on std::cout, one line per model. Return 0, or -1 if a model
+// cannot be loaded.
+
+// Build time of the BVH of each model (serial and on the thread pool) and
+// throughput of queryCount random frustum and ray queries against it
+int benchmarkBvh(const std::vector<fs::path> &files, size_t queryCount);
+
+// Time of computeSceneBounds on each model (serial, on the thread pool, and
+// with the accessor min/max ignored to time the vertex scan) against the
+// reference per-vertex transform, best of repetitionCount runs
+int benchmarkSceneBounds(
+    const std::vector<fs::path> &files, size_t repetitionCount);
@@ -1,6 +1,10 @@
 #include "ViewerApplication.hpp"
+#include "benchmarks.hpp"
+#include "meshopt.hpp"
+#include "texcompress.hpp"
 #include "utils/GLFWHandle.hpp"
 #include "utils/filesystem.hpp"
+#include "utils/ibl.hpp"
 
 #include <args.hxx>
 
@@ -45,6 +49,17 @@ int main(int argc, char **argv)
             "Output path to render the image. If specified no window is shown. "
             "Only png is supported.",
             {"o", "output"}};
+        args::Flag indirect{parser, "indirect",
+            "Start with multi-draw indirect rendering enabled",
+            {"indirect"}};
+        args::ValueFlag<uint32_t> textureBudget{parser, "MiB",
+            "GPU memory for textures, streamed in by level of detail "
+            "(default 1024, 0 loads every level upfront)",
+            {"texture-budget"}};
+        args::Flag noMeshOptimization{parser, "no-mesh-optimization",
+            "Draw vertices and indices in the order of the file, without "
+            "optimizing them at load time",
+            {"no-mesh-optimization"}};
         parser.Parse();
 
         std::vector<float> lookatParams;
@@ -66,9 +81,129 @@ int main(int argc, char **argv)
 
         ViewerApplication app{fs::path{argv[0]}, width, height, args::get(file), args::get(cube),
             lookatParams, args::get(vertexShader), args::get(fragmentShader),
-            args::get(output)};
+            args::get(output), {}, args::get(indirect),
+            textureBudget ? args::get(textureBudget) : 1024u,
+            !args::get(noMeshOptimization)};
         returnCode = app.run();
       }};
+  args::Command batch{commands, "batch",
+      "Render many images with a single context", [&](args::Subparser &parser) {
+        args::Positional<std::string> jobs{parser, "jobs",
+            "Path to job file, one job per line with format "
+            "model eye_x,...,up_z|- width height output.png",
+            args::Options::Required};
+        args::Positional<std::string> cube{
+            parser, "cube", "Path to cubemap file"};
+        args::ValueFlag<std::string> vertexShader{
+            parser, "vs", "Vertex shader to use", {"vs"}};
+        args::ValueFlag<std::string> fragmentShader{
+            parser, "fs", "Fragment shader to use", {"fs"}};
+        args::Flag indirect{parser, "indirect",
+            "Render with multi-draw indirect", {"indirect"}};
+        parser.Parse();
+
+        ViewerApplication app{fs::path{argv[0]}, 1, 1, {}, args::get(cube),
+            {}, args::get(vertexShader), args::get(fragmentShader), {},
+            args::get(jobs), args::get(indirect)};
+        returnCode = app.run();
+      }};
+  args::Command benchBvh{commands, "bench-bvh",
+      "Benchmark BVH build and queries (see scripts/clone_gltf_samples.sh "
+      "for test models)",
+      [&](args::Subparser &parser) {
+        args::PositionalList<std::string> files{
+            parser, "files", "Paths to glTF files", args::Options::Required};
+        args::ValueFlag<size_t> queries{parser, "queries",
+            "Number of frustum and ray queries per model (default 10000)",
+            {"queries"}};
+        parser.Parse();
+
+        std::vector<fs::path> paths;
+        for (const auto &file : args::get(files)) {
+          paths.emplace_back(file);
+        }
+
+        returnCode =
+            benchmarkBvh(paths, queries ? args::get(queries) : size_t(10000));
+      }};
+  args::Command benchBounds{commands, "bench-bounds",
+      "Benchmark scene bounding box computation",
+      [&](args::Subparser &parser) {
+        args::PositionalList<std::string> files{
+            parser, "files", "Paths to glTF files", args::Options::Required};
+        args::ValueFlag<size_t> repetitions{parser, "repetitions",
+            "Number of runs per model, the best one is reported (default 10)",
+            {"repetitions"}};
+        parser.Parse();
+
+        std::vector<fs::path> paths;
+        for (const auto &file : args::get(files)) {
+          paths.emplace_back(file);
+        }
+
+        returnCode = benchmarkSceneBounds(
+            paths, repetitions ? args::get(repetitions) : size_t(10));
+      }};
+  args::Command bakeBrdfLut{commands, "bake-brdf-lut",
+      "Compute the BRDF LUT shipped as assets/gltf-viewer/brdf_lut.bin (see "
+      "the gltf-viewer-brdf-lut build target)",
+      [&](args::Subparser &parser) {
+        args::Positional<std::string> output{
+            parser, "output", "Path to the LUT file", args::Options::Required};
+        parser.Parse();
+
+        ThreadPool pool;
+        if (saveBRDFLUT(args::get(output), &pool)) {
+          std::clog << "BRDF LUT written to " << args::get(output)
+                    << std::endl;
+        } else {
+          returnCode = 1;
+        }
+      }};
+  args::Command texcompress{commands, "texcompress",
+      "Convert the textures of a glTF model to block compressed KTX2 images "
+      "(private GLMLV_texture_ktx2_bcn extension, the original images are "
+      "kept as fallback for other viewers)",
+      [&](args::Subparser &parser) {
+        args::Positional<std::string> input{
+            parser, "input", "Path to the glTF file", args::Options::Required};
+        args::Positional<std::string> output{parser, "output",
+            "Path to the converted glTF file, images are written next to it",
+            args::Options::Required};
+        args::ValueFlag<std::string> metallicRoughnessFormat{parser, "format",
+            "Format of metallic roughness textures: bc7 (default) or bc1",
+            {"metallic-roughness-format"}};
+        parser.Parse();
+
+        auto format = BlockFormat::BC7;
+        if (metallicRoughnessFormat) {
+          const auto &name = args::get(metallicRoughnessFormat);
+          if (name == "bc1") {
+            format = BlockFormat::BC1;
+          } else if (name != "bc7") {
+            throw args::ValidationError(
+                "Unknown metallic roughness format " + name +
+                " (expected bc7 or bc1)");
+          }
+        }
+
+        returnCode =
+            compressGltfTextures(args::get(input), args::get(output), format);
+      }};
+
+  args::Command meshopt{commands, "meshopt",
+      "Reorder the triangles and vertices of a glTF model for the vertex "
+      "cache, overdraw and vertex fetches, and narrow its indices",
+      [&](args::Subparser &parser) {
+        args::Positional<std::string> input{
+            parser, "input", "Path to the glTF file", args::Options::Required};
+        args::Positional<std::string> output{parser, "output",
+            "Path to the optimized glTF file, images are written next to it",
+            args::Options::Required};
+        parser.Parse();
+
+        returnCode = optimizeGltfMeshes(args::get(input), args::get(output));
+      }};
 
   try {
     parser.ParseCLI(argc, argv);
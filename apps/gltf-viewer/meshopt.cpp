@@ -0,0 +1,74 @@
+#include "meshopt.hpp"
+#include "utils/ThreadPool.hpp"
+#include "utils/gltf.hpp"
+#include "utils/mesh_optimization.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+using Clock = std::chrono::steady_clock;
+
+int optimizeGltfMeshes(const fs::path &inputPath, const fs::path &outputPath)
+{
+  // Images are written back as they are, there is no need to decode them
+  tinygltf::Model model;
+  std::vector<DeferredImage> deferredImages;
+  if (!loadGltfModel(inputPath, model, deferredImages)) {
+    return -1;
+  }
+
+  const auto start = Clock::now();
+
+  ThreadPool pool;
+  const auto results = optimizeMeshes(model, pool);
+
+  const auto milliseconds =
+      std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  std::cout << std::fixed << std::setprecision(3);
+
+  for (const auto &result : results) {
+    const auto &mesh = model.meshes[result.meshIdx];
+    const auto &indexAccessor =
+        model.accessors[mesh.primitives[result.primitiveIdx].indices];
+    const auto indexBits = 8 * tinygltf::GetComponentSizeInBytes(
+                                   indexAccessor.componentType);
+
+    std::cout << "mesh " << result.meshIdx << " \"" << mesh.name
+              << "\" primitive " << result.primitiveIdx
+              << " triangles=" << result.before.triangleCount
+              << " vertices=" << result.before.vertexCount
+              << " acmr=" << result.before.acmr() << "->"
+              << result.after.acmr() << " atvr=" << result.before.atvr()
+              << "->" << result.after.atvr()
+              << " vertex_fetch=" << (result.vertexFetch ? "yes" : "no")
+              << " index_bits=" << indexBits
+              << (result.narrowed ? " (narrowed)" : "") << std::endl;
+  }
+
+  for (const auto &deferred : deferredImages) {
+    model.images[deferred.imageIdx].image = deferred.bytes;
+  }
+
+  if (!saveGltfModel(outputPath, model)) {
+    return -1;
+  }
+
+  size_t primitiveCount = 0;
+  for (const auto &mesh : model.meshes) {
+    primitiveCount += mesh.primitives.size();
+  }
+
+  VertexCacheStatistics before;
+  VertexCacheStatistics after;
+  sumMeshOptimizations(results, before, after);
+
+  std::cout << "total primitives=" << results.size() << "/" << primitiveCount
+            << " triangles=" << before.triangleCount
+            << " acmr=" << before.acmr() << "->" << after.acmr()
+            << " atvr=" << before.atvr() << "->" << after.atvr()
+            << " ms=" << milliseconds << std::endl;
+
+  return 0;
+}
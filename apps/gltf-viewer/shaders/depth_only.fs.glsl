@@ -0,0 +1,6 @@
+#version 330
+
+// Depth prepass: only the depth buffer is written, color writes are masked
+void main()
+{
+}
@@ -4,19 +4,47 @@ layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoords;
 
+// POSITION_ONLY is defined for the depth prepass and the overdraw view, which
+// only need gl_Position
+#ifndef POSITION_ONLY
 out vec2 vTexCoords;
 out vec3 vWorldSpaceNormal;
 out vec3 vWorldSpacePosition;
+#endif
 
-uniform mat4 uNormalMatrix;
-uniform mat4 uModelViewProjMatrix;
-uniform mat4 uModelViewMatrix;
-uniform mat4 uModelMatrix;
+// The depth prepass and the shading pass compile this shader with different
+// defines, they must still compute the exact same depth for GL_EQUAL
+invariant gl_Position;
+
+// See utils/uniform_blocks.hpp
+layout(std140) uniform FrameUniforms
+{
+	mat4 uViewMatrix;
+	mat4 uProjMatrix;
+	mat4 uViewProjMatrix;
+	vec4 uCamDir;
+	vec4 uLightDirection;
+	vec4 uLightIntensity;
+	int uMetallicRoughnessEnabled;
+	int uEmissionEnabled;
+	int uOcclusionEnabled;
+	int uNormalMapEnabled;
+};
+
+layout(std140) uniform NodeUniforms
+{
+	mat4 uModelMatrix;
+	mat4 uNormalMatrix;
+};
 
 void main()
 {
+	vec3 worldSpacePosition = vec3(uModelMatrix * vec4(aPosition, 1));
+	gl_Position = uViewProjMatrix * vec4(worldSpacePosition, 1);
+
+#ifndef POSITION_ONLY
 	vTexCoords = aTexCoords;
-    vWorldSpacePosition = vec3(uModelMatrix * vec4(aPosition, 1));
+	vWorldSpacePosition = worldSpacePosition;
 	vWorldSpaceNormal = normalize(vec3(uModelMatrix * vec4(aNormal, 1)));
-    gl_Position =  uModelViewProjMatrix * vec4(aPosition, 1);
+#endif
 }
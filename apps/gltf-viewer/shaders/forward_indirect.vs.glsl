@@ -0,0 +1,63 @@
+#version 430
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+// One value per instance: the attribute has a divisor of 1. Every indirect
+// command sets baseInstance to its own index, which makes it an equivalent
+// of gl_DrawID (not core before OpenGL 4.6), instanced draws read the
+// transform index of each instance. Indices past the nodes of the scene graph
+// are EXT_mesh_gpu_instancing instances.
+layout(location = 3) in uint aNodeIndex;
+
+// POSITION_ONLY is defined for the depth prepass and the overdraw view, which
+// only need gl_Position
+#ifndef POSITION_ONLY
+out vec2 vTexCoords;
+out vec3 vWorldSpaceNormal;
+out vec3 vWorldSpacePosition;
+#endif
+
+// The depth prepass and the shading pass compile this shader with different
+// defines, they must still compute the exact same depth for GL_EQUAL
+invariant gl_Position;
+
+// See utils/uniform_blocks.hpp
+layout(std140) uniform FrameUniforms
+{
+	mat4 uViewMatrix;
+	mat4 uProjMatrix;
+	mat4 uViewProjMatrix;
+	vec4 uCamDir;
+	vec4 uLightDirection;
+	vec4 uLightIntensity;
+	int uMetallicRoughnessEnabled;
+	int uEmissionEnabled;
+	int uOcclusionEnabled;
+	int uNormalMapEnabled;
+};
+
+struct NodeTransform
+{
+	mat4 modelMatrix;
+	mat4 normalMatrix;
+};
+
+layout(std430, binding = 0) readonly buffer NodeTransforms
+{
+	NodeTransform uNodes[];
+};
+
+void main()
+{
+	mat4 modelMatrix = uNodes[aNodeIndex].modelMatrix;
+
+	vec3 worldSpacePosition = vec3(modelMatrix * vec4(aPosition, 1));
+	gl_Position = uViewProjMatrix * vec4(worldSpacePosition, 1);
+
+#ifndef POSITION_ONLY
+	vTexCoords = aTexCoords;
+	vWorldSpacePosition = worldSpacePosition;
+	vWorldSpaceNormal = normalize(vec3(modelMatrix * vec4(aNormal, 1)));
+#endif
+}
@@ -0,0 +1,10 @@
+#version 330
+
+out vec3 fColor;
+
+// One layer of the overdraw heatmap, drawn with additive blending: shaded
+// once is dark red, about 8 times orange, 16 times yellow and 32 times white
+void main()
+{
+  fColor = vec3(1.0 / 8.0, 1.0 / 16.0, 1.0 / 32.0);
+}
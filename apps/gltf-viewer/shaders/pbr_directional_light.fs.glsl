@@ -4,29 +4,81 @@ in vec2 vTexCoords;
 in vec3 vWorldSpacePosition;
 in vec3 vWorldSpaceNormal;
 
-uniform vec3 uLightDirection;
-uniform vec3 uLightIntensity;
-
-uniform vec4 uBaseColorFactor;
+// See utils/uniform_blocks.hpp
+layout(std140) uniform FrameUniforms
+{
+  mat4 uViewMatrix;
+  mat4 uProjMatrix;
+  mat4 uViewProjMatrix;
+  vec4 uCamDir;
+  vec4 uLightDirection;
+  vec4 uLightIntensity;
+  int uMetallicRoughnessEnabled;
+  int uEmissionEnabled;
+  int uOcclusionEnabled;
+  int uNormalMapEnabled;
+};
+
+layout(std140) uniform MaterialUniforms
+{
+  vec4 uBaseColorFactor;
+  vec4 uEmissiveFactor;
+  float uMetallicFactor;
+  float uRoughnessFactor;
+  float uOcclusionStrength;
+  float uNormalScale;
+};
+
+// Each material gets its own variant: the viewer defines HAS_*_TEXTURE for
+// the textures it samples, USE_IBL for the environment lighting and
+// HAS_BRDF_LUT to read its split sum terms from the LUT instead of an analytic
+// fit, HAS_PUNCTUAL_LIGHTS for the KHR_lights_punctual lights of the scene,
+// see SHADER_FEATURE_DEFINES. Missing textures count as white.
+#ifdef HAS_BASE_COLOR_TEXTURE
 uniform sampler2D uBaseColorTexture;
-
-uniform float uMetallicFactor;
-uniform float uRoughnessFactor;
+#endif
+#ifdef HAS_METALLIC_ROUGHNESS_TEXTURE
 uniform sampler2D uMetallicRoughnessTexture;
-
-uniform vec3 uEmissiveFactor;
+#endif
+#ifdef HAS_EMISSIVE_TEXTURE
 uniform sampler2D uEmissiveTexture;
-
-uniform float uOcclusionStrength;
+#endif
+#ifdef HAS_OCCLUSION_TEXTURE
 uniform sampler2D uOcclusionTexture;
-
-uniform float uNormalScale;
+#endif
+#ifdef HAS_NORMAL_TEXTURE
 uniform sampler2D uNormalTexture;
+#endif
+
+#ifdef USE_IBL
+// Diffuse environment lighting, see projectIrradianceSH in utils/ibl.hpp
+layout(std140) uniform EnvironmentUniforms
+{
+  vec4 uIrradianceSH[9];
+};
 
-uniform samplerCube uIrradianceMap;
 uniform samplerCube uPrefilterMap;
+#ifdef HAS_BRDF_LUT
 uniform sampler2D uBrdfLUT;
-uniform vec3 uCamDir;
+#endif
+#endif
+
+#ifdef HAS_PUNCTUAL_LIGHTS
+// Light lists of the clusters of the view frustum, see LightClusters in
+// utils/lights.hpp
+layout(std140) uniform ClusterUniforms
+{
+  uvec4 uClusterGridSize;
+  float uClusterDepthScale;
+  float uClusterDepthBias;
+  vec2 uClusterTileSize;
+};
+
+uniform usamplerBuffer uClusterTexture; // first index, light count
+uniform usamplerBuffer uClusterLightIndices;
+uniform samplerBuffer uLights; // (position, range), (radiance, cone scale),
+                               // (direction, cone offset)
+#endif
 
 out vec3 fColor;
 
@@ -54,14 +106,185 @@ vec4 SRGBtoLINEAR(vec4 srgbIn)
   return vec4(pow(srgbIn.xyz, vec3(GAMMA)), srgbIn.w);
 }
 
+#ifdef USE_IBL
+// Irradiance over PI for a unit normal n, same basis order as
+// projectIrradianceSH
+vec3 evaluateIrradianceSH(vec3 n)
+{
+  vec3 irradiance =
+    uIrradianceSH[0].rgb * 0.282095
+    + uIrradianceSH[1].rgb * (0.488603 * n.y)
+    + uIrradianceSH[2].rgb * (0.488603 * n.z)
+    + uIrradianceSH[3].rgb * (0.488603 * n.x)
+    + uIrradianceSH[4].rgb * (1.092548 * n.x * n.y)
+    + uIrradianceSH[5].rgb * (1.092548 * n.y * n.z)
+    + uIrradianceSH[6].rgb * (0.315392 * (3.0 * n.z * n.z - 1.0))
+    + uIrradianceSH[7].rgb * (1.092548 * n.x * n.z)
+    + uIrradianceSH[8].rgb * (0.546274 * (n.x * n.x - n.y * n.y));
+
+  // Ringing can go below zero with very bright, small light sources
+  return max(irradiance, vec3(0.0));
+}
+
+#ifndef HAS_BRDF_LUT
+// Analytic fit of the split sum scale and bias stored in the BRDF LUT
+// (Karis, "Physically Based Shading on Mobile")
+vec2 approximateEnvBRDF(float NdotV, float roughness)
+{
+  const vec4 c0 = vec4(-1.0, -0.0275, -0.572, 0.022);
+  const vec4 c1 = vec4(1.0, 0.0425, 1.04, -0.04);
+  vec4 r = roughness * c0 + c1;
+  float a004 = min(r.x * r.x, exp2(-9.28 * NdotV)) * r.x + r.y;
+
+  return vec2(-1.04, 1.04) * a004 + r.zw;
+}
+#endif
+#endif
+
+// Reflected radiance for a light of unit radiance coming from direction L
+vec3 evaluateBRDF(
+  vec3 N,
+  vec3 V,
+  vec3 L,
+  vec3 F0,
+  vec3 diffuse,
+  float a_sq)
+{
+  vec3 H = normalize(L+V);
+
+  // dot products
+  float NdotL = clamp(dot(N, L), 0, 1);
+  float VdotH = clamp(dot(V, H), 0, 1);
+  float NdotV = clamp(dot(N, V), 0, 1);
+  float NdotH = clamp(dot(N, H), 0, 1);
+
+  // compute Vis
+  float Vis_sqrt_a =
+    sqrt(NdotV * NdotV * (1 - a_sq) + a_sq);
+  float Vis_sqrt_b =
+    sqrt(NdotL * NdotL * (1 - a_sq) + a_sq);
+  float Vis_denom =
+    (NdotL * Vis_sqrt_a) + (NdotV * Vis_sqrt_b);
+
+  float Vis;
+
+  if (Vis_denom <= 0)
+  {
+  	Vis = 0;
+  }
+  else
+  {
+  	Vis = 0.5 / Vis_denom;
+  }
+
+  // regular point-light fresnel
+  float VdotH_p5 = (1 - VdotH);
+  VdotH_p5 *= VdotH_p5 * VdotH_p5 * VdotH_p5 * VdotH_p5;
+  float D = a_sq * M_1_PI * pow((NdotH * NdotH) * (a_sq - 1) + 1, -2);
+  vec3 F = F0 + (1 - F0) * VdotH_p5;
+  vec3 f_diffuse = (1 - F) * diffuse * M_1_PI;
+  vec3 f_specular = (F * Vis * D);
+
+  return (f_diffuse + f_specular) * NdotL;
+}
+
+#ifdef HAS_PUNCTUAL_LIGHTS
+// Sum of the lights of the cluster of the fragment
+vec3 evaluatePunctualLights(
+  vec3 N,
+  vec3 V,
+  vec3 F0,
+  vec3 diffuse,
+  float a_sq)
+{
+  float viewDepth =
+    max(-(uViewMatrix * vec4(vWorldSpacePosition, 1.0)).z, 1e-6);
+  int slice =
+    clamp(
+      int(floor(log(viewDepth) * uClusterDepthScale + uClusterDepthBias)),
+      0,
+      int(uClusterGridSize.z) - 1);
+  ivec2 tile =
+    min(
+      ivec2(gl_FragCoord.xy / uClusterTileSize),
+      ivec2(uClusterGridSize.xy) - 1);
+  int cluster =
+    (slice * int(uClusterGridSize.y) + tile.y) * int(uClusterGridSize.x)
+    + tile.x;
+  uvec2 lightRange = texelFetch(uClusterTexture, cluster).rg;
+
+  vec3 color = vec3(0.0);
+
+  for (uint i = 0u; i < lightRange.y; ++i)
+  {
+    int light =
+      int(texelFetch(uClusterLightIndices, int(lightRange.x + i)).r);
+    vec4 positionRange = texelFetch(uLights, 3 * light);
+    vec4 radianceConeScale = texelFetch(uLights, 3 * light + 1);
+    vec4 directionConeOffset = texelFetch(uLights, 3 * light + 2);
+
+    vec3 L = -directionConeOffset.xyz;
+    float attenuation = 1.0;
+
+    // Directional lights have no range
+    if (positionRange.w > 0.0)
+    {
+      vec3 toLight = positionRange.xyz - vWorldSpacePosition;
+      float distanceSq = max(dot(toLight, toLight), 1e-4);
+      L = toLight * inversesqrt(distanceSq);
+
+      // inverse square falloff, windowed to reach 0 at the range
+      float rangeRatio = distanceSq / (positionRange.w * positionRange.w);
+      float window = clamp(1.0 - rangeRatio * rangeRatio, 0.0, 1.0);
+      attenuation = window * window / distanceSq;
+
+      // spot cone, always 1 for point lights
+      float cone =
+        clamp(
+          dot(directionConeOffset.xyz, -L) * radianceConeScale.w
+          + directionConeOffset.w,
+          0.0,
+          1.0);
+      attenuation *= cone * cone;
+    }
+
+    color +=
+      evaluateBRDF(N, V, L, F0, diffuse, a_sq)
+      * radianceConeScale.rgb
+      * attenuation;
+  }
+
+  return color;
+}
+#endif
+
 void main()
 {
+  // material factors, disabled features fall back to neutral values
+  vec4 baseColorFactor =
+	uMetallicRoughnessEnabled != 0 ? uBaseColorFactor : vec4(1.0);
+  float metallicFactor =
+	uMetallicRoughnessEnabled != 0 ? uMetallicFactor : 0.0;
+  float roughnessFactor =
+	uMetallicRoughnessEnabled != 0 ? uRoughnessFactor : 0.0;
+  vec3 emissiveFactor =
+	uEmissionEnabled != 0 ? uEmissiveFactor.rgb : vec3(0.0);
+  float occlusionStrength =
+	uOcclusionEnabled != 0 ? uOcclusionStrength : 1.0;
+  float normalScale =
+	uNormalMapEnabled != 0 ? uNormalScale : 1.0;
+
+#ifdef HAS_NORMAL_TEXTURE
   // normal map
+  // z is rebuilt from x and y, block compressed normal maps (BC5) only store
+  // those two
   vec4 normalSample =
 	  texture2D(uNormalTexture, vTexCoords);
+  vec2 normalXY = normalSample.xy * 2.0 - 1.0;
   vec3 scaledNormal =
-	  (normalSample.xyz * 2.0 - 1.0)
-	  * vec3(uNormalScale, uNormalScale, 1.0);
+	  vec3(
+		normalXY * normalScale,
+		sqrt(max(1.0 - dot(normalXY, normalXY), 0.0)));
 
   // tbn matrix
   vec3 fragTgX = dFdx(vWorldSpacePosition);
@@ -78,40 +301,46 @@ void main()
   b = normalize(cross(n, cross(b, n)));
   mat3 tbn = mat3(t, b, n);
 
+  vec3 N = normalize(tbn * scaledNormal + vWorldSpaceNormal);
+#else
+  vec3 N = normalize(vWorldSpaceNormal);
+#endif
+
   // constants
   vec3 dielectricSpecular = vec3(0.04, 0.04, 0.04);
   vec3 black = vec3(0, 0, 0);
-  vec3 L = uLightDirection;
-  vec3 N = normalize(tbn * scaledNormal + vWorldSpaceNormal);
-  vec3 V = normalize(uCamDir - vWorldSpacePosition);
-  vec3 H = normalize(L+V);
-
-  // dot products
-  float NdotL = clamp(dot(N, L), 0, 1);
-  float VdotH = clamp(dot(V, H), 0, 1);
+  vec3 V = normalize(uCamDir.xyz - vWorldSpacePosition);
   float NdotV = clamp(dot(N, V), 0, 1);
-  float NdotH = clamp(dot(N, H), 0, 1);
 
+#ifdef HAS_METALLIC_ROUGHNESS_TEXTURE
   // metallic/roughness texture
   vec4 mrSample = texture2D(uMetallicRoughnessTexture, vTexCoords);
-  float roughness = mrSample.g * uRoughnessFactor;
-  float metallic = mrSample.b * uMetallicFactor;
-
+  float roughness = mrSample.g * roughnessFactor;
+  float metallic = mrSample.b * metallicFactor;
+#else
+  float roughness = roughnessFactor;
+  float metallic = metallicFactor;
+#endif
+
+#ifdef HAS_EMISSIVE_TEXTURE
   // emissive texture
   vec4 emSample =
 	SRGBtoLINEAR(texture2D(uEmissiveTexture, vTexCoords));
   vec3 emissive =
-	emSample.rgb * uEmissiveFactor;
-
-  // occlusion texture
-  vec4 ocSample =
-	SRGBtoLINEAR(texture2D(uOcclusionTexture, vTexCoords));
+	emSample.rgb * emissiveFactor;
+#else
+  vec3 emissive = emissiveFactor;
+#endif
 
+#ifdef HAS_BASE_COLOR_TEXTURE
   // color texture
   vec4 baseColorFromTexture =
 	SRGBtoLINEAR(texture(uBaseColorTexture, vTexCoords));
   vec4 baseColor =
-	baseColorFromTexture * uBaseColorFactor;
+	baseColorFromTexture * baseColorFactor;
+#else
+  vec4 baseColor = baseColorFactor;
+#endif
 
   // alpha squared == roughness to the 4
   float a_sq =
@@ -120,25 +349,6 @@ void main()
 	* roughness
 	* roughness;
 
-  // compute Vis
-  float Vis_sqrt_a =
-    sqrt(NdotV * NdotV * (1 - a_sq) + a_sq);
-  float Vis_sqrt_b =
-    sqrt(NdotL * NdotL * (1 - a_sq) + a_sq);
-  float Vis_denom =
-    (NdotL * Vis_sqrt_a) + (NdotV * Vis_sqrt_b);
-
-  float Vis;
-
-  if (Vis_denom <= 0)
-  {
-  	Vis = 0;
-  }
-  else
-  {
-  	Vis = 0.5 / Vis_denom;
-  }
-
   // fresnel
   vec3 F0 = mix(dielectricSpecular, baseColor.rgb, metallic);
   vec3 diffuse =
@@ -147,43 +357,54 @@ void main()
       black,
       metallic);
 
-  // regular point-light fresnel
-  float VdotH_p5 = (1 - VdotH);
-  VdotH_p5 *= VdotH_p5 * VdotH_p5 * VdotH_p5 * VdotH_p5;
-  float D = a_sq * M_1_PI * pow((NdotH * NdotH) * (a_sq - 1) + 1, -2);
-  vec3 F = F0 + (1 - F0) * VdotH_p5;
-  vec3 f_diffuse = (1 - F) * diffuse * M_1_PI;
-  vec3 f_specular = (F * Vis * D);
   vec3 unoc_color =
-	(f_diffuse + f_specular)
-	* uLightIntensity
-	* NdotL;
+	evaluateBRDF(N, V, uLightDirection.xyz, F0, diffuse, a_sq)
+	* uLightIntensity.rgb;
 
+#ifdef HAS_PUNCTUAL_LIGHTS
+  unoc_color += evaluatePunctualLights(N, V, F0, diffuse, a_sq);
+#endif
+
+#ifdef USE_IBL
   // modified fresnel for irradiance accounting
   float NdotV_p5 = 1 - NdotV;
   NdotV_p5 *= NdotV_p5 * NdotV_p5 * NdotV_p5 * NdotV_p5;
-  F = F0 + (max(vec3(1.0 - roughness), F0) - F0) * NdotV_p5;
-  vec3 irradiance = texture(uIrradianceMap, N).rgb;
+  vec3 F = F0 + (max(vec3(1.0 - roughness), F0) - F0) * NdotV_p5;
+  vec3 irradiance = evaluateIrradianceSH(N);
   vec3 R = reflect(-V, N);
   vec3 prefilteredColor =
     textureLod(
 	  uPrefilterMap,
 	  R,
 	  roughness * 4.0f).rgb;
+#ifdef HAS_BRDF_LUT
   vec2 envBRDF =
     texture(
       uBrdfLUT,
 	  vec2(NdotV, roughness)).rg;
+#else
+  vec2 envBRDF = approximateEnvBRDF(NdotV, roughness);
+#endif
   vec3 specular =
     prefilteredColor
 	* (F * envBRDF.x + envBRDF.y);
-  f_diffuse = (1 - F) * diffuse * irradiance;
-  f_specular = specular;
+  vec3 f_diffuse = (1 - F) * diffuse * irradiance;
+  vec3 f_specular = specular;
   unoc_color += (f_diffuse + f_specular);
+#endif
 
-  fColor =
-    LINEARtoSRGB(mix(
+#ifdef HAS_OCCLUSION_TEXTURE
+  // occlusion texture
+  vec4 ocSample =
+	SRGBtoLINEAR(texture2D(uOcclusionTexture, vTexCoords));
+  vec3 color =
+    mix(
 	  unoc_color,
 	  unoc_color * ocSample.r,
-	  uOcclusionStrength) + emissive);
+	  occlusionStrength);
+#else
+  vec3 color = unoc_color;
+#endif
+
+  fColor = LINEARtoSRGB(color + emissive);
 }
@@ -0,0 +1,72 @@
+#version 430
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform samplerCube uEnvironmentMap;
+
+// One mip level, every face at once: gl_GlobalInvocationID.z is the face
+layout(rgba16f, binding = 0) writeonly uniform imageCube uPrefilterMap;
+
+// See computePrefilterSamples in utils/ibl.cpp: tangent space light direction
+// and source mip level. The samples of every roughness are packed together,
+// uSampleOffset and uSampleCount select the ones of this mip level.
+layout(std430, binding = 0) readonly buffer Samples
+{
+	vec4 uSamples[];
+};
+
+uniform int uSampleOffset;
+uniform int uSampleCount;
+
+// Direction of the center of a cube map texel, following the face
+// orientations of the OpenGL specification
+vec3 cubeMapDirection(ivec3 texel, vec2 size)
+{
+	vec2 uv = 2.0 * (vec2(texel.xy) + 0.5) / size - 1.0;
+
+	switch (texel.z)
+	{
+		case 0: return normalize(vec3(1.0, -uv.y, -uv.x));
+		case 1: return normalize(vec3(-1.0, -uv.y, uv.x));
+		case 2: return normalize(vec3(uv.x, 1.0, uv.y));
+		case 3: return normalize(vec3(uv.x, -1.0, -uv.y));
+		case 4: return normalize(vec3(uv.x, -uv.y, 1.0));
+		default: return normalize(vec3(-uv.x, -uv.y, -1.0));
+	}
+}
+
+void main()
+{
+	ivec3 texel = ivec3(gl_GlobalInvocationID);
+	ivec2 size = imageSize(uPrefilterMap);
+
+	if (any(greaterThanEqual(texel.xy, size)))
+	{
+		return;
+	}
+
+	vec3 N = cubeMapDirection(texel, vec2(size));
+	vec3 up = abs(N.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+	vec3 tangent = normalize(cross(up, N));
+	vec3 bitangent = cross(N, tangent);
+
+	float totalWeight = 0.0;
+	vec3 prefilteredColor = vec3(0.0);
+
+	for (int i = uSampleOffset; i < uSampleOffset + uSampleCount; ++i)
+	{
+		vec4 lightSample = uSamples[i];
+
+		vec3 L =
+			tangent * lightSample.x
+			+ bitangent * lightSample.y
+			+ N * lightSample.z;
+
+		// NdotL is the tangent space z, always positive
+		prefilteredColor +=
+			textureLod(uEnvironmentMap, L, lightSample.w).rgb * lightSample.z;
+		totalWeight += lightSample.z;
+	}
+
+	imageStore(uPrefilterMap, texel, vec4(prefilteredColor / totalWeight, 1.0));
+}
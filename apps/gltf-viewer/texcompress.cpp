@@ -0,0 +1,199 @@
+#include "texcompress.hpp"
+#include "utils/ThreadPool.hpp"
+#include "utils/gltf.hpp"
+#include "utils/images.hpp"
+#include "utils/ktx2.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+using Clock = std::chrono::steady_clock;
+
+// How the materials sample an image
+static const uint32_t IMAGE_USE_BASE_COLOR = 1u << 0;
+static const uint32_t IMAGE_USE_METALLIC_ROUGHNESS = 1u << 1;
+static const uint32_t IMAGE_USE_NORMAL = 1u << 2;
+static const uint32_t IMAGE_USE_OCCLUSION = 1u << 3;
+static const uint32_t IMAGE_USE_EMISSIVE = 1u << 4;
+
+static const char *getBlockFormatName(BlockFormat format)
+{
+  switch (format) {
+  case BlockFormat::BC1:
+    return "BC1";
+  case BlockFormat::BC5:
+    return "BC5";
+  case BlockFormat::BC7:
+    return "BC7";
+  }
+  return "";
+}
+
+int compressGltfTextures(const fs::path &inputPath, const fs::path &outputPath,
+    BlockFormat metallicRoughnessFormat)
+{
+  tinygltf::Model model;
+  std::vector<DeferredImage> deferredImages;
+  if (!loadGltfModel(inputPath, model, deferredImages)) {
+    return -1;
+  }
+
+  // The original files are written back as fallback
+  std::vector<std::vector<unsigned char>> encodedImages(model.images.size());
+  for (const auto &deferred : deferredImages) {
+    encodedImages[deferred.imageIdx] = deferred.bytes;
+  }
+
+  ThreadPool pool;
+  if (!decodeDeferredImages(model, deferredImages, pool)) {
+    return -1;
+  }
+
+  // Textures that already have a KTX2 image are left as they are
+  std::vector<uint32_t> imageUses(model.images.size(), 0);
+  const auto addUse = [&](int textureIndex, uint32_t use) {
+    if (textureIndex < 0) {
+      return;
+    }
+    const auto &texture = model.textures[textureIndex];
+    if (texture.source >= 0 &&
+        getTextureImageIndex(model, texture) == texture.source) {
+      imageUses[texture.source] |= use;
+    }
+  };
+
+  for (const auto &material : model.materials) {
+    const auto &pbr = material.pbrMetallicRoughness;
+    addUse(pbr.baseColorTexture.index, IMAGE_USE_BASE_COLOR);
+    addUse(pbr.metallicRoughnessTexture.index, IMAGE_USE_METALLIC_ROUGHNESS);
+    addUse(material.normalTexture.index, IMAGE_USE_NORMAL);
+    addUse(material.occlusionTexture.index, IMAGE_USE_OCCLUSION);
+    addUse(material.emissiveTexture.index, IMAGE_USE_EMISSIVE);
+  }
+
+  const auto originalImageCount = model.images.size();
+  std::vector<int> compressedImages(originalImageCount, -1);
+  size_t uncompressedBytes = 0;
+  size_t compressedBytes = 0;
+
+  std::cout << std::fixed << std::setprecision(2);
+
+  for (size_t i = 0; i < originalImageCount; ++i) {
+    const auto uses = imageUses[i];
+    if (!uses) {
+      continue;
+    }
+
+    const auto &image = model.images[i];
+    if (image.image.empty() || image.component != 4 || image.bits != 8) {
+      std::cerr << "Warning: image " << i << " \"" << image.name
+                << "\" is not 8-bit RGBA, left uncompressed" << std::endl;
+      continue;
+    }
+
+    // Normal maps only keep x and y, shared images keep every channel
+    auto format = BlockFormat::BC1;
+    if (uses == IMAGE_USE_NORMAL) {
+      format = BlockFormat::BC5;
+    } else if (uses & IMAGE_USE_BASE_COLOR) {
+      format = BlockFormat::BC7;
+    } else if (uses & IMAGE_USE_METALLIC_ROUGHNESS) {
+      format = metallicRoughnessFormat;
+    }
+    const auto srgb = (uses & (IMAGE_USE_BASE_COLOR | IMAGE_USE_EMISSIVE)) != 0;
+
+    const auto start = Clock::now();
+
+    size_t width = image.width;
+    size_t height = image.height;
+    std::vector<unsigned char> pixels = image.image;
+    std::vector<std::vector<uint8_t>> levels;
+    size_t rgbaBytes = 0;
+
+    while (true) {
+      levels.push_back(
+          compressImage(format, pixels.data(), width, height, &pool));
+      rgbaBytes += pixels.size();
+
+      if (width == 1 && height == 1) {
+        break;
+      }
+
+      const auto levelWidth = std::max(width / 2, size_t(1));
+      const auto levelHeight = std::max(height / 2, size_t(1));
+      std::vector<unsigned char> levelPixels(levelWidth * levelHeight * 4);
+      downsampleImage(pixels.data(), width, height, levelPixels.data(),
+          levelWidth, levelHeight);
+
+      pixels = std::move(levelPixels);
+      width = levelWidth;
+      height = levelHeight;
+    }
+
+    tinygltf::Image ktx2;
+    ktx2.name = image.name;
+    ktx2.mimeType = "image/ktx2";
+    ktx2.width = image.width;
+    ktx2.height = image.height;
+    ktx2.image = writeKtx2(
+        format, srgb, uint32_t(image.width), uint32_t(image.height), levels);
+
+    size_t blockBytes = 0;
+    for (const auto &level : levels) {
+      blockBytes += level.size();
+    }
+    uncompressedBytes += rgbaBytes;
+    compressedBytes += blockBytes;
+
+    std::cout << "image " << i << " \"" << image.name << "\" " << image.width
+              << "x" << image.height << " " << getBlockFormatName(format)
+              << " levels=" << levels.size()
+              << " rgba_MiB=" << rgbaBytes / double(1 << 20)
+              << " compressed_MiB=" << blockBytes / double(1 << 20) << " ms="
+              << std::chrono::duration<double, std::milli>(
+                     Clock::now() - start)
+                     .count()
+              << std::endl;
+
+    compressedImages[i] = int(model.images.size());
+    model.images.push_back(std::move(ktx2));
+  }
+
+  for (auto &texture : model.textures) {
+    if (texture.source >= 0 && compressedImages[texture.source] >= 0) {
+      tinygltf::Value::Object extension;
+      extension["source"] = tinygltf::Value(compressedImages[texture.source]);
+      texture.extensions[KTX2_TEXTURE_EXTENSION] =
+          tinygltf::Value(std::move(extension));
+    }
+  }
+
+  // Not required: the fallback images are still there
+  if (std::find(model.extensionsUsed.begin(), model.extensionsUsed.end(),
+          KTX2_TEXTURE_EXTENSION) == model.extensionsUsed.end()) {
+    model.extensionsUsed.push_back(KTX2_TEXTURE_EXTENSION);
+  }
+
+  // The KTX2 images are named after their fallback
+  for (size_t i = 0; i < originalImageCount; ++i) {
+    if (compressedImages[i] >= 0) {
+      model.images[compressedImages[i]].uri =
+          fs::path(getImageFileName(model.images[i], i)).stem().string() +
+          ".ktx2";
+    }
+    model.images[i].image = std::move(encodedImages[i]);
+  }
+
+  if (!saveGltfModel(outputPath, model)) {
+    return -1;
+  }
+
+  std::cout << "total images=" << model.images.size() - originalImageCount
+            << " rgba_MiB=" << uncompressedBytes / double(1 << 20)
+            << " compressed_MiB=" << compressedBytes / double(1 << 20)
+            << std::endl;
+
+  return 0;
+}
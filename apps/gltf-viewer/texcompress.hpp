@@ -0,0 +1,16 @@
+#pragma once
+
+#include "utils/bcn.hpp"
+#include "utils/filesystem.hpp"
+
+// Offline conversion of the textures of a glTF model to block compressed
+// KTX2 images, with their whole mip chain: BC5 for normal maps, BC7 for base
+// color, metallicRoughnessFormat for metallic roughness (and the occlusion
+// packed with it), BC1 for emissive and separate occlusion maps. The model is
+// written at outputPath with its images (the KTX2 ones and the original ones,
+// kept as fallback) next to it, and its textures reference the KTX2 images
+// through the private KTX2_TEXTURE_EXTENSION, which other loaders ignore. A
+// summary is printed on std::cout. Returns 0, or -1 if the model cannot be
+// loaded or written.
+int compressGltfTextures(const fs::path &inputPath, const fs::path &outputPath,
+    BlockFormat metallicRoughnessFormat);
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "gl_debug_output.hpp"
+
+#include <glad/glad.h>
+
+#ifdef GLMLV_USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <iostream>
+#include <stdexcept>
+
+// Headless counterpart of GLFWHandle for offline rendering: an OpenGL 4.4
+// core context without any window, surface or display server, on the first
+// EGL device (GPU driver or Mesa llvmpipe) or else on the Mesa surfaceless
+// platform. There is no default framebuffer, everything must be rendered in
+// framebuffer objects, and ImGui is not initialized.
+//
+// Requires the GLMLV_USE_EGL build option, the constructor throws
+// std::runtime_error if it is off or if no context can be created.
+class EGLHandle
+{
+public:
+  EGLHandle()
+  {
+#ifdef GLMLV_USE_EGL
+    m_display = getHeadlessDisplay();
+    if (m_display == EGL_NO_DISPLAY ||
+        !eglInitialize(m_display, nullptr, nullptr)) {
+      throw std::runtime_error("Unable to init EGL.");
+    }
+
+    // The default surface type is EGL_WINDOW_BIT, which headless displays
+    // do not have
+    const EGLint configAttributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglBindAPI(EGL_OPENGL_API) ||
+        !eglChooseConfig(
+            m_display, configAttributes, &config, 1, &configCount) ||
+        configCount == 0) {
+      eglTerminate(m_display);
+      throw std::runtime_error("No EGL config supports OpenGL.");
+    }
+
+    const EGLint contextAttributes[] = {EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 4, EGL_CONTEXT_OPENGL_PROFILE_MASK,
+        EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_CONTEXT_OPENGL_DEBUG,
+        EGL_TRUE, EGL_NONE};
+    m_context =
+        eglCreateContext(m_display, config, EGL_NO_CONTEXT, contextAttributes);
+
+    // Surfaceless: EGL_KHR_surfaceless_context
+    if (m_context == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(
+            m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context)) {
+      eglTerminate(m_display);
+      throw std::runtime_error("Unable to create an OpenGL 4.4 EGL context.");
+    }
+
+    if (!gladLoadGLLoader(GLADloadproc(eglGetProcAddress))) {
+      eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+      eglDestroyContext(m_display, m_context);
+      eglTerminate(m_display);
+      throw std::runtime_error("Unable to init OpenGL.");
+    }
+
+    initGLDebugOutput();
+#else
+    throw std::runtime_error("Built without EGL (GLMLV_USE_EGL option).");
+#endif
+  }
+
+  ~EGLHandle()
+  {
+#ifdef GLMLV_USE_EGL
+    eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(m_display, m_context);
+    eglTerminate(m_display);
+#endif
+  }
+
+  // Non-copyable class:
+  EGLHandle(const EGLHandle &) = delete;
+  EGLHandle &operator=(const EGLHandle &) = delete;
+
+private:
+#ifdef GLMLV_USE_EGL
+  static EGLDisplay getHeadlessDisplay()
+  {
+    const auto getPlatformDisplay = PFNEGLGETPLATFORMDISPLAYEXTPROC(
+        eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    const auto queryDevices = PFNEGLQUERYDEVICESEXTPROC(
+        eglGetProcAddress("eglQueryDevicesEXT"));
+
+    if (!getPlatformDisplay) {
+      return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    // EGL_EXT_platform_device
+    EGLDeviceEXT device;
+    EGLint deviceCount = 0;
+    if (queryDevices && queryDevices(1, &device, &deviceCount) &&
+        deviceCount > 0) {
+      const auto display =
+          getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+      if (display != EGL_NO_DISPLAY) {
+        return display;
+      }
+    }
+
+    // EGL_MESA_platform_surfaceless
+    return getPlatformDisplay(
+        EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+  }
+
+  EGLDisplay m_display = EGL_NO_DISPLAY;
+  EGLContext m_context = EGL_NO_CONTEXT;
+#endif
+};
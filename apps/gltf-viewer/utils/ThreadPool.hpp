@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads consuming a FIFO queue of tasks
+class ThreadPool
+{
+public:
+  explicit ThreadPool(size_t threadCount = defaultThreadCount())
+  {
+    for (size_t i = 0; i < threadCount; ++i) {
+      m_workers.emplace_back([this]() { workerLoop(); });
+    }
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_condition.notify_all();
+
+    for (auto &worker : m_workers) {
+      worker.join();
+    }
+  }
+
+  // Non-copyable class:
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t size() const { return m_workers.size(); }
+
+  // Queue f() for execution, the returned future holds its result (or the
+  // exception it has thrown)
+  template <typename F> auto enqueue(F &&f) -> std::future<decltype(f())>
+  {
+    using ReturnType = decltype(f());
+
+    const auto task = std::make_shared<std::packaged_task<ReturnType()>>(
+        std::forward<F>(f));
+    auto future = task->get_future();
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_tasks.emplace([task]() { (*task)(); });
+    }
+    m_condition.notify_one();
+
+    return future;
+  }
+
+  // Call fn(i) for each i in [0, count) on the pool and wait for all of them.
+  // The first exception thrown by a task is rethrown once every task is done.
+  // Must not be called from a task running on the same pool.
+  template <typename F> void parallelFor(size_t count, F &&fn)
+  {
+    std::vector<std::future<void>> futures;
+    futures.reserve(count);
+
+    for (size_t i = 0; i < count; ++i) {
+      futures.emplace_back(enqueue([&fn, i]() { fn(i); }));
+    }
+
+    // fn lives on our stack: wait for everyone before anything can throw
+    for (auto &future : futures) {
+      future.wait();
+    }
+    for (auto &future : futures) {
+      future.get();
+    }
+  }
+
+  static size_t defaultThreadCount()
+  {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+private:
+  void workerLoop()
+  {
+    for (;;) {
+      std::function<void()> task;
+
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(
+            lock, [this]() { return m_stopping || !m_tasks.empty(); });
+
+        if (m_tasks.empty()) {
+          return; // stopping and nothing left to do
+        }
+
+        task = std::move(m_tasks.front());
+        m_tasks.pop();
+      }
+
+      task();
+    }
+  }
+
+  std::vector<std::thread> m_workers;
+  std::queue<std::function<void()>> m_tasks;
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  bool m_stopping = false;
+};
@@ -0,0 +1,498 @@
+#include "bcn.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <limits>
+
+// Interpolation weights (out of 64) of the 4-bit indices of BC7
+static const int BC7_WEIGHTS[16] = {
+    0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// Append the count low bits of value to a little endian bit stream
+static void putBits(uint8_t *block, size_t &offset, size_t count, uint32_t value)
+{
+  for (size_t i = 0; i < count; ++i, ++offset) {
+    if (value & (1u << i)) {
+      block[offset / 8] |= uint8_t(1u << (offset % 8));
+    }
+  }
+}
+
+static float squaredDistance(const glm::vec4 &a, const glm::vec4 &b)
+{
+  const auto d = a - b;
+  return glm::dot(d, d);
+}
+
+// End points of the segment of the principal axis of the points that spans
+// their projections on it
+static void fitPrincipalAxis(
+    const glm::vec4 *points, size_t count, glm::vec4 &lo, glm::vec4 &hi)
+{
+  auto mean = glm::vec4(0.f);
+  for (size_t i = 0; i < count; ++i) {
+    mean += points[i];
+  }
+  mean /= float(count);
+
+  auto covariance = glm::mat4(0.f);
+  for (size_t i = 0; i < count; ++i) {
+    const auto d = points[i] - mean;
+    covariance += glm::outerProduct(d, d);
+  }
+
+  // Power iteration, from the diagonal of the bounding box
+  auto boxMin = points[0];
+  auto boxMax = points[0];
+  for (size_t i = 1; i < count; ++i) {
+    boxMin = glm::min(boxMin, points[i]);
+    boxMax = glm::max(boxMax, points[i]);
+  }
+
+  auto axis = boxMax - boxMin;
+  for (size_t iteration = 0; iteration < 8; ++iteration) {
+    const auto next = covariance * axis;
+    const auto length = glm::length(next);
+    if (length < 1e-6f) {
+      break;
+    }
+    axis = next / length;
+  }
+
+  const auto axisLength = glm::length(axis);
+  if (axisLength < 1e-6f) {
+    lo = hi = mean;
+    return;
+  }
+  axis /= axisLength;
+
+  auto tMin = std::numeric_limits<float>::max();
+  auto tMax = std::numeric_limits<float>::lowest();
+  for (size_t i = 0; i < count; ++i) {
+    const auto t = glm::dot(points[i] - mean, axis);
+    tMin = std::min(tMin, t);
+    tMax = std::max(tMax, t);
+  }
+
+  lo = mean + tMin * axis;
+  hi = mean + tMax * axis;
+}
+
+// Least squares end points a and b for points approximated by
+// mix(a, b, weights[i]). Returns false if the system is degenerate.
+static bool refineEndpoints(const glm::vec4 *points, const float *weights,
+    size_t count, glm::vec4 &a, glm::vec4 &b)
+{
+  float aa = 0.f, ab = 0.f, bb = 0.f;
+  auto pa = glm::vec4(0.f);
+  auto pb = glm::vec4(0.f);
+
+  for (size_t i = 0; i < count; ++i) {
+    const auto w = weights[i];
+    aa += (1.f - w) * (1.f - w);
+    ab += (1.f - w) * w;
+    bb += w * w;
+    pa += (1.f - w) * points[i];
+    pb += w * points[i];
+  }
+
+  const auto determinant = aa * bb - ab * ab;
+  if (std::abs(determinant) < 1e-6f) {
+    return false;
+  }
+
+  a = glm::clamp((bb * pa - ab * pb) / determinant, 0.f, 255.f);
+  b = glm::clamp((aa * pb - ab * pa) / determinant, 0.f, 255.f);
+
+  return true;
+}
+
+static void loadTexels(const uint8_t texels[64], glm::vec4 points[16])
+{
+  for (size_t i = 0; i < 16; ++i) {
+    points[i] = glm::vec4(texels[4 * i], texels[4 * i + 1], texels[4 * i + 2],
+        texels[4 * i + 3]);
+  }
+}
+
+// BC1
+
+static uint16_t packRGB565(const glm::vec4 &color)
+{
+  const auto r = uint16_t(std::lround(glm::clamp(color.r, 0.f, 255.f) * 31.f / 255.f));
+  const auto g = uint16_t(std::lround(glm::clamp(color.g, 0.f, 255.f) * 63.f / 255.f));
+  const auto b = uint16_t(std::lround(glm::clamp(color.b, 0.f, 255.f) * 31.f / 255.f));
+  return uint16_t((r << 11) | (g << 5) | b);
+}
+
+static glm::vec4 unpackRGB565(uint16_t color)
+{
+  const auto r = (color >> 11) & 31;
+  const auto g = (color >> 5) & 63;
+  const auto b = color & 31;
+  return glm::vec4((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2), 0.f);
+}
+
+// Four color block with the end points a and b, returns its squared error
+static float encodeBC1Endpoints(const glm::vec4 points[16], const glm::vec4 &a,
+    const glm::vec4 &b, uint8_t block[8], float weights[16])
+{
+  auto color0 = packRGB565(a);
+  auto color1 = packRGB565(b);
+  // color0 > color1 selects the four color mode
+  if (color0 < color1) {
+    std::swap(color0, color1);
+  }
+
+  std::memset(block, 0, 8);
+  std::memcpy(block, &color0, 2);
+  std::memcpy(block + 2, &color1, 2);
+
+  const auto c0 = unpackRGB565(color0);
+  const auto c1 = unpackRGB565(color1);
+
+  float error = 0.f;
+
+  if (color0 == color1) {
+    for (size_t i = 0; i < 16; ++i) {
+      weights[i] = 0.f;
+      error += squaredDistance(points[i], c0);
+    }
+    return error;
+  }
+
+  // Palette order of the indices, with their weight towards color1
+  const glm::vec4 palette[4] = {
+      c0, c1, (2.f * c0 + c1) / 3.f, (c0 + 2.f * c1) / 3.f};
+  static const float PALETTE_WEIGHTS[4] = {0.f, 1.f, 1.f / 3.f, 2.f / 3.f};
+
+  size_t offset = 32;
+  for (size_t i = 0; i < 16; ++i) {
+    uint32_t best = 0;
+    auto bestError = squaredDistance(points[i], palette[0]);
+    for (uint32_t index = 1; index < 4; ++index) {
+      const auto indexError = squaredDistance(points[i], palette[index]);
+      if (indexError < bestError) {
+        best = index;
+        bestError = indexError;
+      }
+    }
+
+    putBits(block, offset, 2, best);
+    weights[i] = PALETTE_WEIGHTS[best];
+    error += bestError;
+  }
+
+  return error;
+}
+
+void encodeBC1Block(const uint8_t texels[64], uint8_t block[8])
+{
+  glm::vec4 points[16];
+  loadTexels(texels, points);
+  for (auto &point : points) {
+    point.a = 0.f; // Opaque
+  }
+
+  glm::vec4 lo, hi;
+  fitPrincipalAxis(points, 16, lo, hi);
+
+  float weights[16];
+  const auto error = encodeBC1Endpoints(points, hi, lo, block, weights);
+
+  // The refined end points are relative to the ordered colors of the block
+  uint16_t color0, color1;
+  std::memcpy(&color0, block, 2);
+  std::memcpy(&color1, block + 2, 2);
+  auto a = unpackRGB565(color0);
+  auto b = unpackRGB565(color1);
+
+  uint8_t refined[8];
+  if (error > 0.f && refineEndpoints(points, weights, 16, a, b) &&
+      encodeBC1Endpoints(points, a, b, refined, weights) < error) {
+    std::memcpy(block, refined, 8);
+  }
+}
+
+// BC5, two BC4 blocks
+
+// Eight value block of one channel, returns its squared error
+static float encodeBC4Endpoints(const float values[16], float a, float b,
+    uint8_t block[8], float weights[16])
+{
+  auto value0 = uint8_t(std::lround(glm::clamp(a, 0.f, 255.f)));
+  auto value1 = uint8_t(std::lround(glm::clamp(b, 0.f, 255.f)));
+  // value0 > value1 selects the eight value mode
+  if (value0 < value1) {
+    std::swap(value0, value1);
+  }
+
+  std::memset(block, 0, 8);
+  block[0] = value0;
+  block[1] = value1;
+
+  float error = 0.f;
+
+  if (value0 == value1) {
+    for (size_t i = 0; i < 16; ++i) {
+      weights[i] = 0.f;
+      error += (values[i] - value0) * (values[i] - value0);
+    }
+    return error;
+  }
+
+  float palette[8];
+  float paletteWeights[8];
+  palette[0] = value0;
+  paletteWeights[0] = 0.f;
+  palette[1] = value1;
+  paletteWeights[1] = 1.f;
+  for (size_t index = 2; index < 8; ++index) {
+    paletteWeights[index] = float(index - 1) / 7.f;
+    palette[index] = ((8 - index) * value0 + (index - 1) * value1) / 7.f;
+  }
+
+  size_t offset = 16;
+  for (size_t i = 0; i < 16; ++i) {
+    uint32_t best = 0;
+    auto bestError = std::abs(values[i] - palette[0]);
+    for (uint32_t index = 1; index < 8; ++index) {
+      const auto indexError = std::abs(values[i] - palette[index]);
+      if (indexError < bestError) {
+        best = index;
+        bestError = indexError;
+      }
+    }
+
+    putBits(block, offset, 3, best);
+    weights[i] = paletteWeights[best];
+    error += bestError * bestError;
+  }
+
+  return error;
+}
+
+static void encodeBC4Block(const float values[16], uint8_t block[8])
+{
+  const auto minmax = std::minmax_element(values, values + 16);
+
+  float weights[16];
+  const auto error =
+      encodeBC4Endpoints(values, *minmax.second, *minmax.first, block, weights);
+
+  glm::vec4 points[16];
+  for (size_t i = 0; i < 16; ++i) {
+    points[i] = glm::vec4(values[i], 0.f, 0.f, 0.f);
+  }
+
+  auto a = glm::vec4(block[0], 0.f, 0.f, 0.f);
+  auto b = glm::vec4(block[1], 0.f, 0.f, 0.f);
+
+  uint8_t refined[8];
+  if (error > 0.f && refineEndpoints(points, weights, 16, a, b) &&
+      encodeBC4Endpoints(values, a.r, b.r, refined, weights) < error) {
+    std::memcpy(block, refined, 8);
+  }
+}
+
+void encodeBC5Block(const uint8_t texels[64], uint8_t block[16])
+{
+  float values[16];
+
+  for (size_t channel = 0; channel < 2; ++channel) {
+    for (size_t i = 0; i < 16; ++i) {
+      values[i] = texels[4 * i + channel];
+    }
+    encodeBC4Block(values, block + 8 * channel);
+  }
+}
+
+// BC7 mode 6: RGBA end points with 7 bits per channel and a shared lowest
+// bit per end point, 4-bit indices
+
+struct BC7Endpoint
+{
+  uint8_t channels[4]; // 7 bits
+  uint8_t pBit;
+
+  glm::ivec4 value() const
+  {
+    return glm::ivec4((channels[0] << 1) | pBit, (channels[1] << 1) | pBit,
+        (channels[2] << 1) | pBit, (channels[3] << 1) | pBit);
+  }
+};
+
+static BC7Endpoint quantizeBC7Endpoint(const glm::vec4 &color)
+{
+  BC7Endpoint best{};
+  auto bestError = std::numeric_limits<float>::max();
+
+  for (uint8_t pBit = 0; pBit < 2; ++pBit) {
+    BC7Endpoint endpoint{};
+    endpoint.pBit = pBit;
+    for (size_t c = 0; c < 4; ++c) {
+      const auto channel = std::lround((color[c] - pBit) * 0.5f);
+      endpoint.channels[c] = uint8_t(std::min(std::max(channel, 0l), 127l));
+    }
+
+    const auto error = squaredDistance(glm::vec4(endpoint.value()), color);
+    if (error < bestError) {
+      best = endpoint;
+      bestError = error;
+    }
+  }
+
+  return best;
+}
+
+// Returns the squared error of the block
+static float encodeBC7Endpoints(const glm::vec4 points[16], const glm::vec4 &a,
+    const glm::vec4 &b, uint8_t block[16], float weights[16])
+{
+  BC7Endpoint endpoints[2] = {quantizeBC7Endpoint(a), quantizeBC7Endpoint(b)};
+
+  glm::vec4 palette[16];
+  const auto e0 = endpoints[0].value();
+  const auto e1 = endpoints[1].value();
+  for (size_t index = 0; index < 16; ++index) {
+    const auto w = BC7_WEIGHTS[index];
+    palette[index] = glm::vec4(((64 - w) * e0 + w * e1 + 32) >> 6);
+  }
+
+  uint32_t indices[16];
+  float error = 0.f;
+  for (size_t i = 0; i < 16; ++i) {
+    uint32_t best = 0;
+    auto bestError = squaredDistance(points[i], palette[0]);
+    for (uint32_t index = 1; index < 16; ++index) {
+      const auto indexError = squaredDistance(points[i], palette[index]);
+      if (indexError < bestError) {
+        best = index;
+        bestError = indexError;
+      }
+    }
+
+    indices[i] = best;
+    error += bestError;
+  }
+
+  // The highest bit of the first index is implicitly 0
+  if (indices[0] & 8) {
+    std::swap(endpoints[0], endpoints[1]);
+    for (auto &index : indices) {
+      index = 15 - index;
+    }
+  }
+
+  std::memset(block, 0, 16);
+  size_t offset = 0;
+  putBits(block, offset, 7, 1u << 6);
+  for (size_t c = 0; c < 4; ++c) {
+    putBits(block, offset, 7, endpoints[0].channels[c]);
+    putBits(block, offset, 7, endpoints[1].channels[c]);
+  }
+  putBits(block, offset, 1, endpoints[0].pBit);
+  putBits(block, offset, 1, endpoints[1].pBit);
+  for (size_t i = 0; i < 16; ++i) {
+    putBits(block, offset, i == 0 ? 3 : 4, indices[i]);
+    weights[i] = BC7_WEIGHTS[indices[i]] / 64.f;
+  }
+
+  return error;
+}
+
+void encodeBC7Block(const uint8_t texels[64], uint8_t block[16])
+{
+  glm::vec4 points[16];
+  loadTexels(texels, points);
+
+  glm::vec4 lo, hi;
+  fitPrincipalAxis(points, 16, lo, hi);
+
+  float weights[16];
+  const auto error = encodeBC7Endpoints(points, lo, hi, block, weights);
+
+  // Weights are relative to the end points as stored, which may have been
+  // swapped: refine from the stored ones
+  BC7Endpoint stored[2];
+  for (size_t e = 0; e < 2; ++e) {
+    for (size_t c = 0; c < 4; ++c) {
+      uint32_t value = 0;
+      for (size_t bit = 0; bit < 7; ++bit) {
+        const auto offset = 7 + 14 * c + 7 * e + bit;
+        value |= uint32_t((block[offset / 8] >> (offset % 8)) & 1) << bit;
+      }
+      stored[e].channels[c] = uint8_t(value);
+    }
+    stored[e].pBit = (block[(63 + e) / 8] >> ((63 + e) % 8)) & 1;
+  }
+
+  auto a = glm::vec4(stored[0].value());
+  auto b = glm::vec4(stored[1].value());
+
+  uint8_t refined[16];
+  if (error > 0.f && refineEndpoints(points, weights, 16, a, b) &&
+      encodeBC7Endpoints(points, a, b, refined, weights) < error) {
+    std::memcpy(block, refined, 16);
+  }
+}
+
+size_t getBlockByteSize(BlockFormat format)
+{
+  return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+size_t getCompressedByteSize(BlockFormat format, size_t width, size_t height)
+{
+  return ((width + 3) / 4) * ((height + 3) / 4) * getBlockByteSize(format);
+}
+
+std::vector<uint8_t> compressImage(BlockFormat format, const uint8_t *rgba,
+    size_t width, size_t height, ThreadPool *pool)
+{
+  const auto blockByteSize = getBlockByteSize(format);
+  const auto blockCountX = (width + 3) / 4;
+  const auto blockCountY = (height + 3) / 4;
+
+  std::vector<uint8_t> blocks(blockCountX * blockCountY * blockByteSize);
+
+  const auto compressRow = [&](size_t blockY) {
+    uint8_t texels[64];
+
+    for (size_t blockX = 0; blockX < blockCountX; ++blockX) {
+      for (size_t y = 0; y < 4; ++y) {
+        const auto imageY = std::min(blockY * 4 + y, height - 1);
+        for (size_t x = 0; x < 4; ++x) {
+          const auto imageX = std::min(blockX * 4 + x, width - 1);
+          std::memcpy(texels + 4 * (4 * y + x),
+              rgba + 4 * (imageY * width + imageX), 4);
+        }
+      }
+
+      auto *block = blocks.data() + (blockY * blockCountX + blockX) * blockByteSize;
+      switch (format) {
+      case BlockFormat::BC1:
+        encodeBC1Block(texels, block);
+        break;
+      case BlockFormat::BC5:
+        encodeBC5Block(texels, block);
+        break;
+      case BlockFormat::BC7:
+        encodeBC7Block(texels, block);
+        break;
+      }
+    }
+  };
+
+  if (pool) {
+    pool->parallelFor(blockCountY, compressRow);
+  } else {
+    for (size_t blockY = 0; blockY < blockCountY; ++blockY) {
+      compressRow(blockY);
+    }
+  }
+
+  return blocks;
+}
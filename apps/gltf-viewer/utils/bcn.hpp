@@ -0,0 +1,32 @@
+#pragma once
+
+#include "ThreadPool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Block compression of RGBA8 images in the formats desktop GPUs sample
+// natively. Every format stores 4x4 texel blocks, partial blocks at the right
+// and bottom edges repeat their last column and row.
+enum class BlockFormat
+{
+  BC1, // RGB, 8 bytes per block
+  BC5, // RG as two independent channels, 16 bytes per block (normal maps)
+  BC7 // RGBA, 16 bytes per block (single subset mode 6 only)
+};
+
+size_t getBlockByteSize(BlockFormat format);
+
+size_t getCompressedByteSize(BlockFormat format, size_t width, size_t height);
+
+// Encode one block of 16 RGBA8 texels (row major) into getBlockByteSize
+// bytes. The endpoints are fitted along the principal axis of the texels and
+// refined once by least squares.
+void encodeBC1Block(const uint8_t texels[64], uint8_t block[8]);
+void encodeBC5Block(const uint8_t texels[64], uint8_t block[16]);
+void encodeBC7Block(const uint8_t texels[64], uint8_t block[16]);
+
+// Compress a width * height RGBA8 image, on pool if there is one
+std::vector<uint8_t> compressImage(BlockFormat format, const uint8_t *rgba,
+    size_t width, size_t height, ThreadPool *pool = nullptr);
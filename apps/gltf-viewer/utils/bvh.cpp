@@ -0,0 +1,457 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+
+static const size_t BIN_COUNT = 16;
+// Above this size a node is always split, even if SAH says otherwise
+static const uint32_t MAX_LEAF_SIZE = 8;
+// Cost of traversing a node relative to testing a primitive
+static const float TRAVERSAL_COST = 1.f;
+// Subtrees smaller than this are not worth a task of their own
+static const uint32_t PARALLEL_MIN_PRIMITIVES = 1024;
+
+static float halfArea(const glm::vec3 &bboxMin, const glm::vec3 &bboxMax)
+{
+  const auto d = glm::max(bboxMax - bboxMin, glm::vec3(0));
+  return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+struct Bvh::Builder
+{
+  const std::vector<glm::vec3> &boundsMin;
+  const std::vector<glm::vec3> &boundsMax;
+  const std::vector<glm::vec3> &centroids;
+  std::vector<uint32_t> &indices;
+
+  // Compute the bounds of node, then either leave it as a leaf (returns false)
+  // or partition its primitives in [begin, middle) and [middle, end)
+  bool split(Node &node, uint32_t &middle) const;
+
+  // Build the whole subtree of nodes[rootIdx] in nodes
+  void buildSubtree(std::vector<Node> &nodes, uint32_t rootIdx) const;
+};
+
+bool Bvh::Builder::split(Node &node, uint32_t &middle) const
+{
+  const auto begin = node.primitiveBegin;
+  const auto end = begin + node.primitiveCount;
+
+  glm::vec3 centroidMin(std::numeric_limits<float>::max());
+  glm::vec3 centroidMax(std::numeric_limits<float>::lowest());
+  node.bboxMin = glm::vec3(std::numeric_limits<float>::max());
+  node.bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+
+  for (auto i = begin; i < end; ++i) {
+    const auto primitive = indices[i];
+    node.bboxMin = glm::min(node.bboxMin, boundsMin[primitive]);
+    node.bboxMax = glm::max(node.bboxMax, boundsMax[primitive]);
+    centroidMin = glm::min(centroidMin, centroids[primitive]);
+    centroidMax = glm::max(centroidMax, centroids[primitive]);
+  }
+
+  node.leftChild = 0;
+
+  if (node.primitiveCount <= 1) {
+    return false;
+  }
+
+  // Evaluate SAH at every bin boundary of every axis
+  struct Bin
+  {
+    glm::vec3 bboxMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+    uint32_t count = 0;
+  };
+
+  const auto centroidExtent = centroidMax - centroidMin;
+  auto bestCost = std::numeric_limits<float>::max();
+  int bestAxis = -1;
+  size_t bestBin = 0;
+
+  for (int axis = 0; axis < 3; ++axis) {
+    if (centroidExtent[axis] <= 0.f) {
+      continue;
+    }
+
+    const auto scale = BIN_COUNT / centroidExtent[axis];
+    Bin bins[BIN_COUNT];
+
+    for (auto i = begin; i < end; ++i) {
+      const auto primitive = indices[i];
+      const auto binIdx = std::min(BIN_COUNT - 1,
+          size_t((centroids[primitive][axis] - centroidMin[axis]) * scale));
+      auto &bin = bins[binIdx];
+      bin.bboxMin = glm::min(bin.bboxMin, boundsMin[primitive]);
+      bin.bboxMax = glm::max(bin.bboxMax, boundsMax[primitive]);
+      ++bin.count;
+    }
+
+    // Sweep from the right to get the cost of each right side, then from the
+    // left to combine
+    float rightCosts[BIN_COUNT];
+    Bin right;
+    for (size_t i = BIN_COUNT - 1; i > 0; --i) {
+      right.bboxMin = glm::min(right.bboxMin, bins[i].bboxMin);
+      right.bboxMax = glm::max(right.bboxMax, bins[i].bboxMax);
+      right.count += bins[i].count;
+      rightCosts[i] =
+          right.count ? right.count * halfArea(right.bboxMin, right.bboxMax)
+                      : 0.f;
+    }
+
+    Bin left;
+    for (size_t i = 0; i < BIN_COUNT - 1; ++i) {
+      left.bboxMin = glm::min(left.bboxMin, bins[i].bboxMin);
+      left.bboxMax = glm::max(left.bboxMax, bins[i].bboxMax);
+      left.count += bins[i].count;
+
+      if (left.count == 0 || left.count == node.primitiveCount) {
+        continue;
+      }
+
+      const auto cost =
+          left.count * halfArea(left.bboxMin, left.bboxMax) + rightCosts[i + 1];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestBin = i;
+      }
+    }
+  }
+
+  const auto nodeArea = halfArea(node.bboxMin, node.bboxMax);
+  const auto leafCost = float(node.primitiveCount);
+  const auto splitCost =
+      nodeArea > 0.f ? TRAVERSAL_COST + bestCost / nodeArea : leafCost;
+
+  if (node.primitiveCount <= MAX_LEAF_SIZE &&
+      (bestAxis < 0 || splitCost >= leafCost)) {
+    return false;
+  }
+
+  auto *pBegin = indices.data() + begin;
+  auto *pEnd = indices.data() + end;
+
+  if (bestAxis >= 0) {
+    const auto scale = BIN_COUNT / centroidExtent[bestAxis];
+    const auto *pMiddle = std::partition(pBegin, pEnd, [&](uint32_t primitive) {
+      const auto binIdx = std::min(BIN_COUNT - 1,
+          size_t((centroids[primitive][bestAxis] - centroidMin[bestAxis]) *
+                 scale));
+      return binIdx <= bestBin;
+    });
+    middle = uint32_t(pMiddle - indices.data());
+  } else {
+    // Every centroid is at the same place, split in two halves
+    middle = begin + node.primitiveCount / 2;
+  }
+
+  if (middle == begin || middle == end) {
+    middle = begin + node.primitiveCount / 2;
+  }
+
+  return true;
+}
+
+void Bvh::Builder::buildSubtree(
+    std::vector<Node> &nodes, uint32_t rootIdx) const
+{
+  std::vector<uint32_t> stack = {rootIdx};
+
+  while (!stack.empty()) {
+    const auto nodeIdx = stack.back();
+    stack.pop_back();
+
+    // Copied: nodes may be reallocated by the children
+    auto node = nodes[nodeIdx];
+    uint32_t middle;
+
+    if (split(node, middle)) {
+      node.leftChild = uint32_t(nodes.size());
+
+      const auto end = node.primitiveBegin + node.primitiveCount;
+      Node left = {};
+      left.primitiveBegin = node.primitiveBegin;
+      left.primitiveCount = middle - node.primitiveBegin;
+      Node right = {};
+      right.primitiveBegin = middle;
+      right.primitiveCount = end - middle;
+
+      nodes.push_back(left);
+      nodes.push_back(right);
+      stack.push_back(node.leftChild);
+      stack.push_back(node.leftChild + 1);
+    }
+
+    nodes[nodeIdx] = node;
+  }
+}
+
+void Bvh::build(const std::vector<glm::vec3> &boundsMin,
+    const std::vector<glm::vec3> &boundsMax, ThreadPool *pool)
+{
+  clear();
+
+  m_primitiveCount = boundsMin.size();
+  m_boundsMin = boundsMin;
+  m_boundsMax = boundsMax;
+
+  std::vector<glm::vec3> centroids(m_primitiveCount);
+
+  for (size_t i = 0; i < m_primitiveCount; ++i) {
+    const auto &bboxMin = boundsMin[i];
+    const auto &bboxMax = boundsMax[i];
+    const auto isFinite = [](const glm::vec3 &v) {
+      return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z);
+    };
+
+    if (!isFinite(bboxMin) || !isFinite(bboxMax) ||
+        glm::any(glm::greaterThan(bboxMin, bboxMax))) {
+      m_unboundedPrimitives.push_back(uint32_t(i));
+      continue;
+    }
+
+    centroids[i] = 0.5f * (bboxMin + bboxMax);
+    m_primitiveIndices.push_back(uint32_t(i));
+  }
+
+  if (m_primitiveIndices.empty()) {
+    return;
+  }
+
+  const Builder builder = {
+      m_boundsMin, m_boundsMax, centroids, m_primitiveIndices};
+
+  Node root = {};
+  root.primitiveCount = uint32_t(m_primitiveIndices.size());
+  m_nodes.reserve(2 * m_primitiveIndices.size());
+  m_nodes.push_back(root);
+
+  if (!pool || pool->size() < 2 ||
+      root.primitiveCount < 2 * PARALLEL_MIN_PRIMITIVES) {
+    builder.buildSubtree(m_nodes, 0);
+    return;
+  }
+
+  // Breadth first on this thread until there are enough subtrees to share
+  const size_t targetSubtreeCount = 4 * pool->size();
+  std::deque<uint32_t> openNodes = {0};
+  std::vector<uint32_t> subtreeRoots;
+
+  while (!openNodes.empty()) {
+    const auto nodeIdx = openNodes.front();
+    openNodes.pop_front();
+
+    auto node = m_nodes[nodeIdx];
+
+    if (node.primitiveCount < PARALLEL_MIN_PRIMITIVES ||
+        openNodes.size() + subtreeRoots.size() >= targetSubtreeCount) {
+      subtreeRoots.push_back(nodeIdx);
+      continue;
+    }
+
+    uint32_t middle;
+    if (builder.split(node, middle)) {
+      node.leftChild = uint32_t(m_nodes.size());
+
+      const auto end = node.primitiveBegin + node.primitiveCount;
+      Node left = {};
+      left.primitiveBegin = node.primitiveBegin;
+      left.primitiveCount = middle - node.primitiveBegin;
+      Node right = {};
+      right.primitiveBegin = middle;
+      right.primitiveCount = end - middle;
+
+      m_nodes.push_back(left);
+      m_nodes.push_back(right);
+      openNodes.push_back(node.leftChild);
+      openNodes.push_back(node.leftChild + 1);
+    }
+
+    m_nodes[nodeIdx] = node;
+  }
+
+  // Subtrees cover disjoint ranges of m_primitiveIndices, each one is built
+  // in its own node array
+  std::vector<std::vector<Node>> subtrees(subtreeRoots.size());
+
+  pool->parallelFor(subtreeRoots.size(), [&](size_t i) {
+    auto &nodes = subtrees[i];
+    nodes.reserve(2 * m_nodes[subtreeRoots[i]].primitiveCount);
+    nodes.push_back(m_nodes[subtreeRoots[i]]);
+    builder.buildSubtree(nodes, 0);
+  });
+
+  // Then appended: local index 0 is the subtree root, which replaces its
+  // placeholder, local index j > 0 goes to base + j - 1
+  for (size_t i = 0; i < subtrees.size(); ++i) {
+    const auto &nodes = subtrees[i];
+    const auto base = uint32_t(m_nodes.size());
+    const auto relocate = [&](Node node) {
+      if (node.leftChild) {
+        node.leftChild = base + node.leftChild - 1;
+      }
+      return node;
+    };
+
+    m_nodes[subtreeRoots[i]] = relocate(nodes[0]);
+    for (size_t j = 1; j < nodes.size(); ++j) {
+      m_nodes.push_back(relocate(nodes[j]));
+    }
+  }
+}
+
+size_t Bvh::cullFrustum(
+    const Frustum &frustum, std::vector<uint8_t> &visibility) const
+{
+  visibility.assign(m_primitiveCount, 0);
+  size_t visibleCount = 0;
+
+  for (const auto primitive : m_unboundedPrimitives) {
+    visibility[primitive] = 1;
+    ++visibleCount;
+  }
+
+  if (m_nodes.empty()) {
+    return visibleCount;
+  }
+
+  std::vector<uint32_t> stack = {0};
+
+  while (!stack.empty()) {
+    const auto &node = m_nodes[stack.back()];
+    stack.pop_back();
+
+    const auto intersection =
+        classifyFrustum(frustum, node.bboxMin, node.bboxMax);
+
+    if (intersection == FrustumIntersection::Outside) {
+      continue;
+    }
+
+    const auto begin = node.primitiveBegin;
+    const auto end = begin + node.primitiveCount;
+
+    if (intersection == FrustumIntersection::Inside) {
+      for (auto i = begin; i < end; ++i) {
+        visibility[m_primitiveIndices[i]] = 1;
+      }
+      visibleCount += node.primitiveCount;
+      continue;
+    }
+
+    if (node.leftChild) {
+      stack.push_back(node.leftChild);
+      stack.push_back(node.leftChild + 1);
+      continue;
+    }
+
+    for (auto i = begin; i < end; ++i) {
+      const auto primitive = m_primitiveIndices[i];
+      if (intersectsFrustum(
+              frustum, m_boundsMin[primitive], m_boundsMax[primitive])) {
+        visibility[primitive] = 1;
+        ++visibleCount;
+      }
+    }
+  }
+
+  return visibleCount;
+}
+
+// Slab test, tEntry is the distance at which the ray enters the box
+static bool intersectBox(const glm::vec3 &origin, const glm::vec3 &invDirection,
+    const glm::vec3 &bboxMin, const glm::vec3 &bboxMax, float tMax,
+    float &tEntry)
+{
+  const auto t0 = (bboxMin - origin) * invDirection;
+  const auto t1 = (bboxMax - origin) * invDirection;
+  const auto tNear = glm::min(t0, t1);
+  const auto tFar = glm::max(t0, t1);
+
+  tEntry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+  const auto tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+
+  return tEntry <= tExit;
+}
+
+bool Bvh::intersectRay(const glm::vec3 &origin, const glm::vec3 &direction,
+    float tMax,
+    const std::function<bool(uint32_t primitive, float &t)> &intersectPrimitive,
+    uint32_t &primitive, float &t) const
+{
+  bool hit = false;
+  t = tMax;
+
+  for (const auto unbounded : m_unboundedPrimitives) {
+    if (intersectPrimitive(unbounded, t)) {
+      primitive = unbounded;
+      hit = true;
+    }
+  }
+
+  if (m_nodes.empty()) {
+    return hit;
+  }
+
+  const auto invDirection = 1.f / direction;
+  float tEntry;
+
+  if (!intersectBox(origin, invDirection, m_nodes[0].bboxMin,
+          m_nodes[0].bboxMax, t, tEntry)) {
+    return hit;
+  }
+
+  // Pairs of (node, entry distance), the nearest child is visited first
+  std::vector<std::pair<uint32_t, float>> stack = {{0, tEntry}};
+
+  while (!stack.empty()) {
+    const auto entry = stack.back();
+    stack.pop_back();
+
+    // A closer hit may have been found since the node was pushed
+    if (entry.second > t) {
+      continue;
+    }
+
+    const auto &node = m_nodes[entry.first];
+
+    if (!node.leftChild) {
+      const auto end = node.primitiveBegin + node.primitiveCount;
+      for (auto i = node.primitiveBegin; i < end; ++i) {
+        if (intersectPrimitive(m_primitiveIndices[i], t)) {
+          primitive = m_primitiveIndices[i];
+          hit = true;
+        }
+      }
+      continue;
+    }
+
+    float tLeft, tRight;
+    const auto &left = m_nodes[node.leftChild];
+    const auto &right = m_nodes[node.leftChild + 1];
+    const auto hitLeft =
+        intersectBox(origin, invDirection, left.bboxMin, left.bboxMax, t, tLeft);
+    const auto hitRight = intersectBox(
+        origin, invDirection, right.bboxMin, right.bboxMax, t, tRight);
+
+    if (hitLeft && hitRight) {
+      if (tLeft <= tRight) {
+        stack.emplace_back(node.leftChild + 1, tRight);
+        stack.emplace_back(node.leftChild, tLeft);
+      } else {
+        stack.emplace_back(node.leftChild, tLeft);
+        stack.emplace_back(node.leftChild + 1, tRight);
+      }
+    } else if (hitLeft) {
+      stack.emplace_back(node.leftChild, tLeft);
+    } else if (hitRight) {
+      stack.emplace_back(node.leftChild + 1, tRight);
+    }
+  }
+
+  return hit;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "ThreadPool.hpp"
+#include "frustum.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Bounding volume hierarchy over a set of axis aligned boxes (typically the
+// world space bounds of the primitives of a scene). Built top-down with the
+// surface area heuristic evaluated on a fixed number of bins per axis. The top
+// of the tree is built on the calling thread until there are enough
+// independent subtrees to keep a ThreadPool busy, the subtrees are then built
+// in parallel.
+//
+// Every node covers a contiguous range of primitiveIndices(), so that a node
+// found fully inside a query volume can accept its primitives without testing
+// them one by one.
+class Bvh
+{
+public:
+  struct Node
+  {
+    glm::vec3 bboxMin;
+    uint32_t primitiveBegin; // In primitiveIndices()
+    glm::vec3 bboxMax;
+    uint32_t primitiveCount;
+    uint32_t leftChild; // Right child is leftChild + 1, 0 for leaves
+  };
+
+  // Build over the boxes (boundsMin[i], boundsMax[i]), i being the primitive
+  // index reported by queries. Boxes that are empty or not finite are kept
+  // out of the tree, as unbounded primitives. Without pool everything is
+  // built on the calling thread.
+  void build(const std::vector<glm::vec3> &boundsMin,
+      const std::vector<glm::vec3> &boundsMax, ThreadPool *pool = nullptr);
+
+  void clear() { *this = Bvh(); }
+
+  bool empty() const { return m_nodes.empty(); }
+
+  const std::vector<Node> &nodes() const { return m_nodes; }
+
+  const std::vector<uint32_t> &primitiveIndices() const
+  {
+    return m_primitiveIndices;
+  }
+
+  // Primitives left out of the tree by build()
+  const std::vector<uint32_t> &unboundedPrimitives() const
+  {
+    return m_unboundedPrimitives;
+  }
+
+  // Set visibility[i] to 1 for each primitive whose box may intersect the
+  // frustum and to 0 for the others (unbounded primitives are visible).
+  // Returns the number of visible primitives.
+  size_t cullFrustum(
+      const Frustum &frustum, std::vector<uint8_t> &visibility) const;
+
+  // Closest hit along origin + t * direction for t in (0, tMax]. The
+  // traversal only tests boxes: intersectPrimitive(i, t) must test the
+  // primitive itself and return true after lowering t if it is hit closer
+  // than t. Returns false if nothing has been hit, or else the primitive and
+  // its t.
+  bool intersectRay(const glm::vec3 &origin, const glm::vec3 &direction,
+      float tMax,
+      const std::function<bool(uint32_t primitive, float &t)>
+          &intersectPrimitive,
+      uint32_t &primitive, float &t) const;
+
+private:
+  struct Builder;
+
+  std::vector<Node> m_nodes;
+  std::vector<uint32_t> m_primitiveIndices;
+  std::vector<uint32_t> m_unboundedPrimitives;
+  std::vector<glm::vec3> m_boundsMin; // Indexed by primitive
+  std::vector<glm::vec3> m_boundsMax;
+  size_t m_primitiveCount = 0;
+};
@@ -0,0 +1,185 @@
+#include "files.hpp"
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const fs::path &path)
+{
+  reset();
+
+  const HANDLE hFile = CreateFileW(path.wstring().c_str(), GENERIC_READ,
+      FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+      nullptr);
+  if (hFile == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0) {
+    CloseHandle(hFile);
+    return false;
+  }
+
+  const HANDLE hMapping =
+      CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!hMapping) {
+    CloseHandle(hFile);
+    return false;
+  }
+
+  const auto pView = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+  if (!pView) {
+    CloseHandle(hMapping);
+    CloseHandle(hFile);
+    return false;
+  }
+
+  m_hFile = hFile;
+  m_hMapping = hMapping;
+  m_pData = static_cast<const unsigned char *>(pView);
+  m_size = size_t(fileSize.QuadPart);
+
+  return true;
+}
+
+void MappedFile::reset()
+{
+  if (m_pData) {
+    UnmapViewOfFile(m_pData);
+  }
+  if (m_hMapping) {
+    CloseHandle(m_hMapping);
+  }
+  if (m_hFile) {
+    CloseHandle(m_hFile);
+  }
+
+  m_pData = nullptr;
+  m_size = 0;
+  m_hFile = nullptr;
+  m_hMapping = nullptr;
+}
+
+void MappedFile::swap(MappedFile &other)
+{
+  std::swap(m_pData, other.m_pData);
+  std::swap(m_size, other.m_size);
+  std::swap(m_hFile, other.m_hFile);
+  std::swap(m_hMapping, other.m_hMapping);
+}
+
+#else
+
+bool MappedFile::open(const fs::path &path)
+{
+  reset();
+
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+
+  void *pView =
+      mmap(nullptr, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  if (pView == MAP_FAILED) {
+    ::close(fd);
+    return false;
+  }
+
+  // The whole file is parsed front to back, then the BIN chunk is uploaded
+  // in one go: let the kernel read ahead aggressively.
+  madvise(pView, size_t(fileStat.st_size), MADV_SEQUENTIAL);
+
+  m_fd = fd;
+  m_pData = static_cast<const unsigned char *>(pView);
+  m_size = size_t(fileStat.st_size);
+
+  return true;
+}
+
+void MappedFile::reset()
+{
+  if (m_pData) {
+    munmap(const_cast<unsigned char *>(m_pData), m_size);
+  }
+  if (m_fd >= 0) {
+    ::close(m_fd);
+  }
+
+  m_pData = nullptr;
+  m_size = 0;
+  m_fd = -1;
+}
+
+void MappedFile::swap(MappedFile &other)
+{
+  std::swap(m_pData, other.m_pData);
+  std::swap(m_size, other.m_size);
+  std::swap(m_fd, other.m_fd);
+}
+
+#endif
+
+uint64_t hashBytes(const void *bytes, size_t size, uint64_t seed)
+{
+  // FNV-1a over 64-bit words instead of bytes (with an extra xorshift so that
+  // high bits propagate), hashing a large HDR file stays well under its
+  // reading time
+  static const uint64_t prime = 0x100000001b3ull;
+
+  const auto *pBytes = static_cast<const unsigned char *>(bytes);
+  uint64_t hash = seed ^ (size * prime);
+
+  for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, pBytes, sizeof(word));
+    hash = (hash ^ word) * prime;
+    hash ^= hash >> 29;
+    pBytes += sizeof(word);
+  }
+
+  for (; size > 0; --size) {
+    hash = (hash ^ *pBytes++) * prime;
+  }
+
+  return hash ^ (hash >> 32);
+}
+
+bool hashFile(const fs::path &path, uint64_t &hash, uint64_t seed)
+{
+  MappedFile file;
+  if (!file.open(path)) {
+    return false;
+  }
+
+  hash = hashBytes(file.data(), file.size(), seed);
+  return true;
+}
+
+std::string hashToString(uint64_t hash)
+{
+  std::stringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return ss.str();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file. The mapping stays valid until the
+// object is destroyed or reset, so pointers into data() can be handed to
+// loaders without copying the file into a heap buffer first.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+
+  ~MappedFile() { reset(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  MappedFile(MappedFile &&rvalue) { swap(rvalue); }
+
+  MappedFile &operator=(MappedFile &&rvalue)
+  {
+    reset();
+    swap(rvalue);
+    return *this;
+  }
+
+  // Map the file at path, unmapping any previous file. Returns false (and
+  // leaves the object empty) if the file cannot be opened or mapped.
+  bool open(const fs::path &path);
+
+  void reset();
+
+  bool empty() const { return m_pData == nullptr; }
+
+  const unsigned char *data() const { return m_pData; }
+
+  size_t size() const { return m_size; }
+
+private:
+  void swap(MappedFile &other);
+
+  const unsigned char *m_pData = nullptr;
+  size_t m_size = 0;
+#ifdef _WIN32
+  void *m_hFile = nullptr;
+  void *m_hMapping = nullptr;
+#else
+  int m_fd = -1;
+#endif
+};
+
+static const uint64_t HASH_SEED = 0xcbf29ce484222325ull;
+
+// Fast non-cryptographic 64-bit hash of a byte range, used to build cache
+// keys. Hashes can be chained by passing a previous hash as seed.
+uint64_t hashBytes(const void *bytes, size_t size, uint64_t seed = HASH_SEED);
+
+// Hash of the content of a file, returns false if it cannot be read
+bool hashFile(const fs::path &path, uint64_t &hash, uint64_t seed = HASH_SEED);
+
+// Fixed width hexadecimal representation of a hash, for file names
+std::string hashToString(uint64_t hash);
@@ -0,0 +1,104 @@
+#include "frustum.hpp"
+
+Frustum extractFrustum(const glm::mat4 &viewProjMatrix)
+{
+  // Gribb & Hartmann, "Fast Extraction of Viewing Frustum Planes from the
+  // World-View-Projection Matrix". glm is column major, rows are extracted by
+  // hand.
+  const auto row = [&](int i) {
+    return glm::vec4(viewProjMatrix[0][i], viewProjMatrix[1][i],
+        viewProjMatrix[2][i], viewProjMatrix[3][i]);
+  };
+
+  const auto x = row(0);
+  const auto y = row(1);
+  const auto z = row(2);
+  const auto w = row(3);
+
+  Frustum frustum;
+  frustum.planes[0] = w + x;
+  frustum.planes[1] = w - x;
+  frustum.planes[2] = w + y;
+  frustum.planes[3] = w - y;
+  frustum.planes[4] = w + z;
+  frustum.planes[5] = w - z;
+
+  for (auto &plane : frustum.planes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+
+  return frustum;
+}
+
+bool intersectsFrustum(
+    const Frustum &frustum, const glm::vec3 &center, float radius)
+{
+  for (const auto &plane : frustum.planes) {
+    if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool intersectsFrustum(const Frustum &frustum, const glm::vec3 &bboxMin,
+    const glm::vec3 &bboxMax)
+{
+  for (const auto &plane : frustum.planes) {
+    // Corner of the box the furthest along the plane normal
+    const glm::vec3 positiveVertex(plane.x >= 0 ? bboxMax.x : bboxMin.x,
+        plane.y >= 0 ? bboxMax.y : bboxMin.y,
+        plane.z >= 0 ? bboxMax.z : bboxMin.z);
+
+    if (glm::dot(glm::vec3(plane), positiveVertex) + plane.w < 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+FrustumIntersection classifyFrustum(const Frustum &frustum,
+    const glm::vec3 &bboxMin, const glm::vec3 &bboxMax)
+{
+  auto result = FrustumIntersection::Inside;
+
+  for (const auto &plane : frustum.planes) {
+    const glm::vec3 normal(plane);
+    const glm::vec3 positiveVertex(plane.x >= 0 ? bboxMax.x : bboxMin.x,
+        plane.y >= 0 ? bboxMax.y : bboxMin.y,
+        plane.z >= 0 ? bboxMax.z : bboxMin.z);
+
+    if (glm::dot(normal, positiveVertex) + plane.w < 0) {
+      return FrustumIntersection::Outside;
+    }
+
+    // The opposite corner tells if the box straddles the plane
+    const glm::vec3 negativeVertex(plane.x >= 0 ? bboxMin.x : bboxMax.x,
+        plane.y >= 0 ? bboxMin.y : bboxMax.y,
+        plane.z >= 0 ? bboxMin.z : bboxMax.z);
+
+    if (glm::dot(normal, negativeVertex) + plane.w < 0) {
+      result = FrustumIntersection::Intersecting;
+    }
+  }
+
+  return result;
+}
+
+void transformBounds(const glm::mat4 &matrix, const glm::vec3 &bboxMin,
+    const glm::vec3 &bboxMax, glm::vec3 &outMin, glm::vec3 &outMax)
+{
+  // Arvo, "Transforming Axis-Aligned Bounding Boxes" (Graphics Gems): each
+  // output coordinate is the translation plus the min/max contributions of
+  // each input axis
+  outMin = outMax = glm::vec3(matrix[3]);
+
+  for (int i = 0; i < 3; ++i) {
+    const auto a = glm::vec3(matrix[i]) * bboxMin[i];
+    const auto b = glm::vec3(matrix[i]) * bboxMax[i];
+    outMin += glm::min(a, b);
+    outMax += glm::max(a, b);
+  }
+}
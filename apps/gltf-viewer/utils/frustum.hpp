@@ -0,0 +1,39 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// View frustum as 6 planes (left, right, bottom, top, near, far). Each plane
+// is (normal, distance) with a unit normal pointing inside, so that
+// dot(normal, p) + distance >= 0 for every point p in the frustum.
+struct Frustum
+{
+  glm::vec4 planes[6];
+};
+
+// Planes of the clip volume of viewProjMatrix, in the space viewProjMatrix
+// transforms from (world space for projMatrix * viewMatrix)
+Frustum extractFrustum(const glm::mat4 &viewProjMatrix);
+
+// Conservative tests: false means the volume is fully outside, true means it
+// may be visible
+bool intersectsFrustum(
+    const Frustum &frustum, const glm::vec3 &center, float radius);
+bool intersectsFrustum(const Frustum &frustum, const glm::vec3 &bboxMin,
+    const glm::vec3 &bboxMax);
+
+enum class FrustumIntersection
+{
+  Outside,
+  Intersecting, // Or maybe outside, close to a corner of the frustum
+  Inside
+};
+
+// Same as the box version of intersectsFrustum, but also tells whether the
+// box is fully inside, so that its content does not need to be tested
+FrustumIntersection classifyFrustum(const Frustum &frustum,
+    const glm::vec3 &bboxMin, const glm::vec3 &bboxMax);
+
+// Axis aligned box containing the box (bboxMin, bboxMax) transformed by
+// matrix (affine)
+void transformBounds(const glm::mat4 &matrix, const glm::vec3 &bboxMin,
+    const glm::vec3 &bboxMax, glm::vec3 &outMin, glm::vec3 &outMax);
@@ -0,0 +1,186 @@
+#include "gl_state.hpp"
+
+#include <cstring>
+
+void GLStateTracker::useProgram(GLuint program)
+{
+  if (program == m_program) {
+    ++m_skippedCount;
+    return;
+  }
+
+  glUseProgram(program);
+  ++m_issuedCount;
+
+  m_program = program;
+  m_pProgramUniforms = &m_uniforms[program];
+}
+
+void GLStateTracker::bindVertexArray(GLuint vao)
+{
+  if (vao == m_vertexArray) {
+    ++m_skippedCount;
+    return;
+  }
+
+  glBindVertexArray(vao);
+  ++m_issuedCount;
+
+  m_vertexArray = vao;
+}
+
+bool GLStateTracker::activeTexture(GLuint unit)
+{
+  if (unit == m_activeTextureUnit) {
+    ++m_skippedCount;
+    return false;
+  }
+
+  glActiveTexture(GL_TEXTURE0 + unit);
+  ++m_issuedCount;
+
+  m_activeTextureUnit = unit;
+  return true;
+}
+
+void GLStateTracker::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+  if (unit >= TEXTURE_UNIT_COUNT) {
+    activeTexture(unit);
+    glBindTexture(target, texture);
+    ++m_issuedCount;
+    return;
+  }
+
+  auto &binding = m_textures[unit];
+  if (binding.target == target && binding.texture == texture) {
+    // glActiveTexture + glBindTexture
+    m_skippedCount += 2;
+    return;
+  }
+
+  // Only the last target bound on each unit is tracked: switching targets on
+  // a unit always issues the bind, even if the texture is already there
+  activeTexture(unit);
+  glBindTexture(target, texture);
+  ++m_issuedCount;
+
+  binding.target = target;
+  binding.texture = texture;
+}
+
+void GLStateTracker::bindUniformBufferRange(
+    GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+  if (index >= UNIFORM_BUFFER_BINDING_COUNT) {
+    glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+    ++m_issuedCount;
+    return;
+  }
+
+  auto &range = m_uniformBuffers[index];
+  if (range.buffer == buffer && range.offset == offset && range.size == size) {
+    ++m_skippedCount;
+    return;
+  }
+
+  glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+  ++m_issuedCount;
+
+  range.buffer = buffer;
+  range.offset = offset;
+  range.size = size;
+}
+
+bool GLStateTracker::setUniform(
+    GLint location, const GLfloat *values, size_t count)
+{
+  if (location < 0) {
+    return false;
+  }
+
+  if (!m_pProgramUniforms) {
+    // No program has been bound through the tracker, nothing to compare to
+    ++m_issuedCount;
+    return true;
+  }
+
+  auto &uniforms = *m_pProgramUniforms;
+  if (size_t(location) >= uniforms.size()) {
+    uniforms.resize(location + 1);
+  }
+
+  auto &uniform = uniforms[location];
+  if (uniform.valid &&
+      std::memcmp(uniform.values.data(), values, count * sizeof(GLfloat)) ==
+          0) {
+    ++m_skippedCount;
+    return false;
+  }
+
+  std::memcpy(uniform.values.data(), values, count * sizeof(GLfloat));
+  uniform.valid = true;
+  ++m_issuedCount;
+
+  return true;
+}
+
+void GLStateTracker::uniform1i(GLint location, GLint x)
+{
+  // Stored bit for bit, the comparison does not care about the type
+  GLfloat value;
+  std::memcpy(&value, &x, sizeof(value));
+
+  if (setUniform(location, &value, 1)) {
+    glUniform1i(location, x);
+  }
+}
+
+void GLStateTracker::uniform1f(GLint location, GLfloat x)
+{
+  if (setUniform(location, &x, 1)) {
+    glUniform1f(location, x);
+  }
+}
+
+void GLStateTracker::uniform3f(GLint location, GLfloat x, GLfloat y, GLfloat z)
+{
+  const GLfloat values[] = {x, y, z};
+
+  if (setUniform(location, values, 3)) {
+    glUniform3f(location, x, y, z);
+  }
+}
+
+void GLStateTracker::uniform4f(
+    GLint location, GLfloat x, GLfloat y, GLfloat z, GLfloat w)
+{
+  const GLfloat values[] = {x, y, z, w};
+
+  if (setUniform(location, values, 4)) {
+    glUniform4f(location, x, y, z, w);
+  }
+}
+
+void GLStateTracker::uniformMatrix4fv(GLint location, const GLfloat *value)
+{
+  if (setUniform(location, value, 16)) {
+    glUniformMatrix4fv(location, 1, GL_FALSE, value);
+  }
+}
+
+void GLStateTracker::invalidateBindings()
+{
+  m_program = UNKNOWN;
+  m_vertexArray = UNKNOWN;
+  m_activeTextureUnit = UNKNOWN;
+  m_textures.fill(TextureBinding());
+  m_uniformBuffers.fill(BufferRange());
+  m_pProgramUniforms = nullptr;
+}
+
+void GLStateTracker::invalidate()
+{
+  invalidateBindings();
+  m_uniforms.clear();
+}
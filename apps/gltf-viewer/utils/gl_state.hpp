@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <glad/glad.h>
+#include <unordered_map>
+#include <vector>
+
+// Shadow copy of the GL state touched by the draw loop. Every call compares
+// the requested value with the last one that has been sent to GL and is
+// dropped if it would not change anything. Counters keep track of the calls
+// that have been issued and skipped since the last resetCounters().
+//
+// Uniform values are stored per program (uniforms are program state, they
+// survive glUseProgram switches), bindings are global. The tracker is only
+// right as long as nobody else changes the state behind its back: call
+// invalidateBindings() after code that binds programs, vertex arrays or
+// textures directly, and invalidate() when programs are relinked.
+class GLStateTracker
+{
+public:
+  void useProgram(GLuint program);
+  void bindVertexArray(GLuint vao);
+
+  // glActiveTexture(GL_TEXTURE0 + unit) is only issued if the binding of the
+  // unit has to change
+  void bindTexture(GLuint unit, GLenum target, GLuint texture);
+
+  // glBindBufferRange(GL_UNIFORM_BUFFER, index, ...)
+  void bindUniformBufferRange(
+      GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+  // Uniforms of the program of the last useProgram(), locations < 0 are
+  // ignored like GL does
+  void uniform1i(GLint location, GLint x);
+  void uniform1f(GLint location, GLfloat x);
+  void uniform3f(GLint location, GLfloat x, GLfloat y, GLfloat z);
+  void uniform4f(GLint location, GLfloat x, GLfloat y, GLfloat z, GLfloat w);
+  void uniformMatrix4fv(GLint location, const GLfloat *value);
+
+  // Forget the current program, vertex array, texture and uniform buffer
+  // bindings
+  void invalidateBindings();
+
+  // Forget everything, including uniform values
+  void invalidate();
+
+  void resetCounters()
+  {
+    m_issuedCount = 0;
+    m_skippedCount = 0;
+  }
+
+  size_t issuedCount() const { return m_issuedCount; }
+  size_t skippedCount() const { return m_skippedCount; }
+
+private:
+  static const GLuint UNKNOWN = GLuint(-1);
+  static const size_t TEXTURE_UNIT_COUNT = 16;
+  static const size_t UNIFORM_BUFFER_BINDING_COUNT = 16;
+
+  struct TextureBinding
+  {
+    GLenum target = 0;
+    GLuint texture = UNKNOWN;
+  };
+
+  struct BufferRange
+  {
+    GLuint buffer = UNKNOWN;
+    GLintptr offset = 0;
+    GLsizeiptr size = 0;
+  };
+
+  struct UniformValue
+  {
+    bool valid = false;
+    std::array<GLfloat, 16> values;
+  };
+
+  // Returns true (and records the value) if the uniform has to be uploaded
+  bool setUniform(GLint location, const GLfloat *values, size_t count);
+
+  bool activeTexture(GLuint unit);
+
+  GLuint m_program = UNKNOWN;
+  GLuint m_vertexArray = UNKNOWN;
+  GLuint m_activeTextureUnit = UNKNOWN;
+  std::array<TextureBinding, TEXTURE_UNIT_COUNT> m_textures;
+  std::array<BufferRange, UNIFORM_BUFFER_BINDING_COUNT> m_uniformBuffers;
+  std::unordered_map<GLuint, std::vector<UniformValue>> m_uniforms;
+  std::vector<UniformValue> *m_pProgramUniforms = nullptr;
+
+  size_t m_issuedCount = 0;
+  size_t m_skippedCount = 0;
+};
@@ -1,9 +1,45 @@
 #include "gltf.hpp"
+#include "files.hpp"
+#include "frustum.hpp"
+#include "ktx2.hpp"
+#include "scene_graph.hpp"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <set>
+
+// SSE is always there on x86-64, AVX only if the compiler has been told so
+// (GLMLV_USE_AVX option)
+#if defined(__AVX__)
+#include <immintrin.h>
+#define GLTF_SIMD_SSE
+#define GLTF_SIMD_AVX
+static const size_t SIMD_BLOCK_FLOAT_COUNT = 24;
+#elif defined(__SSE__) || defined(_M_X64) ||                                   \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define GLTF_SIMD_SSE
+static const size_t SIMD_BLOCK_FLOAT_COUNT = 12;
+#endif
+
+static const uint32_t GLB_MAGIC = 0x46546C67; // "glTF"
+static const size_t GLB_HEADER_SIZE = 12;
+
+static uint32_t readUint32(const unsigned char *bytes)
+{
+  uint32_t value;
+  std::memcpy(&value, bytes, sizeof(value));
+  return value;
+}
 
 glm::mat4 getLocalToWorldMatrix(
     const tinygltf::Node &node, const glm::mat4 &parentMatrix)
@@ -35,119 +71,786 @@ glm::mat4 getLocalToWorldMatrix(
                                                  node.scale[1], node.scale[2]));
 };
 
-void computeSceneBounds(
-    const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax)
+void computeSceneBounds(const tinygltf::Model &model, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax, ThreadPool *pool)
+{
+  SceneGraph sceneGraph;
+  sceneGraph.build(model, model.defaultScene);
+  sceneGraph.update();
+
+  computeSceneBounds(model, sceneGraph, bboxMin, bboxMax, pool);
+}
+
+void computeSceneBounds(const tinygltf::Model &model,
+    const SceneGraph &sceneGraph, glm::vec3 &bboxMin, glm::vec3 &bboxMax,
+    ThreadPool *pool)
+{
+  bboxMin = glm::vec3(std::numeric_limits<float>::max());
+  bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+
+  // Local bounds of the primitives of each mesh that is drawn, computed once
+  // however many nodes share the mesh
+  const auto noPrimitive = std::numeric_limits<size_t>::max();
+  std::vector<size_t> meshFirstPrimitive(model.meshes.size(), noPrimitive);
+  std::vector<const tinygltf::Primitive *> primitives;
+
+  for (const auto node : sceneGraph.meshNodes()) {
+    const auto meshIdx = sceneGraph.meshes()[node];
+    if (meshFirstPrimitive[meshIdx] != noPrimitive) {
+      continue;
+    }
+
+    meshFirstPrimitive[meshIdx] = primitives.size();
+    for (const auto &primitive : model.meshes[meshIdx].primitives) {
+      primitives.push_back(&primitive);
+    }
+  }
+
+  std::vector<glm::vec3> localMin(primitives.size());
+  std::vector<glm::vec3> localMax(primitives.size());
+  std::vector<uint8_t> hasBounds(primitives.size());
+
+  const auto computeBounds = [&](size_t i) {
+    hasBounds[i] =
+        computePrimitiveBounds(model, *primitives[i], localMin[i], localMax[i]);
+  };
+
+  if (pool) {
+    pool->parallelFor(primitives.size(), computeBounds);
+  } else {
+    for (size_t i = 0; i < primitives.size(); ++i) {
+      computeBounds(i);
+    }
+  }
+
+  // Then only the corners of each local box are transformed
+  for (const auto node : sceneGraph.meshNodes()) {
+    const auto meshIdx = sceneGraph.meshes()[node];
+    const auto firstPrimitive = meshFirstPrimitive[meshIdx];
+    const auto primitiveCount = model.meshes[meshIdx].primitives.size();
+
+    for (auto i = firstPrimitive; i < firstPrimitive + primitiveCount; ++i) {
+      if (!hasBounds[i]) {
+        continue;
+      }
+
+      glm::vec3 worldMin, worldMax;
+      transformBounds(sceneGraph.worldMatrices()[node], localMin[i],
+          localMax[i], worldMin, worldMax);
+      bboxMin = glm::min(bboxMin, worldMin);
+      bboxMax = glm::max(bboxMax, worldMax);
+    }
+  }
+}
+
+void computePositionBounds(const unsigned char *data, size_t count,
+    size_t byteStride, glm::vec3 &bboxMin, glm::vec3 &bboxMax)
 {
-  // Compute scene bounding box
-  // todo refactor with scene drawing
-  // todo need a visitScene generic function that takes a accept() functor
   bboxMin = glm::vec3(std::numeric_limits<float>::max());
   bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
-  if (model.defaultScene >= 0) {
-    const std::function<void(int, const glm::mat4 &)> updateBounds =
-        [&](int nodeIdx, const glm::mat4 &parentMatrix) {
-          const auto &node = model.nodes[nodeIdx];
-          const glm::mat4 modelMatrix =
-              getLocalToWorldMatrix(node, parentMatrix);
-          if (node.mesh >= 0) {
-            const auto &mesh = model.meshes[node.mesh];
-            for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
-              const auto &primitive = mesh.primitives[pIdx];
-              const auto positionAttrIdxIt =
-                  primitive.attributes.find("POSITION");
-              if (positionAttrIdxIt == end(primitive.attributes)) {
-                continue;
-              }
-              const auto &positionAccessor =
-                  model.accessors[(*positionAttrIdxIt).second];
-              if (positionAccessor.type != 3) {
-                std::cerr << "Position accessor with type != VEC3, skipping"
-                          << std::endl;
-                continue;
-              }
-              const auto &positionBufferView =
-                  model.bufferViews[positionAccessor.bufferView];
-              const auto byteOffset =
-                  positionAccessor.byteOffset + positionBufferView.byteOffset;
-              const auto &positionBuffer =
-                  model.buffers[positionBufferView.buffer];
-              const auto positionByteStride =
-                  positionBufferView.byteStride ? positionBufferView.byteStride
-                                                : 3 * sizeof(float);
-
-              if (primitive.indices >= 0) {
-                const auto &indexAccessor = model.accessors[primitive.indices];
-                const auto &indexBufferView =
-                    model.bufferViews[indexAccessor.bufferView];
-                const auto indexByteOffset =
-                    indexAccessor.byteOffset + indexBufferView.byteOffset;
-                const auto &indexBuffer = model.buffers[indexBufferView.buffer];
-                auto indexByteStride = indexBufferView.byteStride;
-
-                switch (indexAccessor.componentType) {
-                default:
-                  std::cerr
-                      << "Primitive index accessor with bad componentType "
-                      << indexAccessor.componentType << ", skipping it."
-                      << std::endl;
-                  continue;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-                  indexByteStride =
-                      indexByteStride ? indexByteStride : sizeof(uint8_t);
-                  break;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-                  indexByteStride =
-                      indexByteStride ? indexByteStride : sizeof(uint16_t);
-                  break;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-                  indexByteStride =
-                      indexByteStride ? indexByteStride : sizeof(uint32_t);
-                  break;
-                }
-
-                for (size_t i = 0; i < indexAccessor.count; ++i) {
-                  uint32_t index = 0;
-                  switch (indexAccessor.componentType) {
-                  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-                    index = *((const uint8_t *)&indexBuffer
-                                  .data[indexByteOffset + indexByteStride * i]);
-                    break;
-                  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-                    index = *((const uint16_t *)&indexBuffer
-                                  .data[indexByteOffset + indexByteStride * i]);
-                    break;
-                  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-                    index = *((const uint32_t *)&indexBuffer
-                                  .data[indexByteOffset + indexByteStride * i]);
-                    break;
-                  }
-                  const auto &localPosition =
-                      *((const glm::vec3 *)&positionBuffer
-                              .data[byteOffset + positionByteStride * index]);
-                  const auto worldPosition =
-                      glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f));
-                  bboxMin = glm::min(bboxMin, worldPosition);
-                  bboxMax = glm::max(bboxMax, worldPosition);
-                }
-              } else {
-                for (size_t i = 0; i < positionAccessor.count; ++i) {
-                  const auto &localPosition =
-                      *((const glm::vec3 *)&positionBuffer
-                              .data[byteOffset + positionByteStride * i]);
-                  const auto worldPosition =
-                      glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f));
-                  bboxMin = glm::min(bboxMin, worldPosition);
-                  bboxMax = glm::max(bboxMax, worldPosition);
-                }
-              }
-            }
-          }
-          for (const auto childNodeIdx : node.children) {
-            updateBounds(childNodeIdx, modelMatrix);
-          }
-        };
-    for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
-      updateBounds(nodeIdx, glm::mat4(1));
-    }
-  }
-}
\ No newline at end of file
+
+  size_t i = 0;
+
+#if defined(GLTF_SIMD_SSE)
+  if (byteStride == 3 * sizeof(float)) {
+    // Packed positions: the components repeat every 3 floats, so min/max
+    // registers are accumulated over blocks of 3 registers (lane k of the
+    // block always holds component k % 3) and only reduced at the end. The
+    // accumulator is the second operand: minps/maxps return it when the
+    // position is NaN.
+    const auto *pFloats = reinterpret_cast<const float *>(data);
+    const size_t floatCount = 3 * count;
+    alignas(32) float blockMin[SIMD_BLOCK_FLOAT_COUNT];
+    alignas(32) float blockMax[SIMD_BLOCK_FLOAT_COUNT];
+    size_t f = 0;
+
+#if defined(GLTF_SIMD_AVX)
+    auto min0 = _mm256_set1_ps(std::numeric_limits<float>::max());
+    auto min1 = min0, min2 = min0;
+    auto max0 = _mm256_set1_ps(std::numeric_limits<float>::lowest());
+    auto max1 = max0, max2 = max0;
+
+    for (; f + SIMD_BLOCK_FLOAT_COUNT <= floatCount;
+         f += SIMD_BLOCK_FLOAT_COUNT) {
+      const auto v0 = _mm256_loadu_ps(pFloats + f);
+      const auto v1 = _mm256_loadu_ps(pFloats + f + 8);
+      const auto v2 = _mm256_loadu_ps(pFloats + f + 16);
+      min0 = _mm256_min_ps(v0, min0);
+      min1 = _mm256_min_ps(v1, min1);
+      min2 = _mm256_min_ps(v2, min2);
+      max0 = _mm256_max_ps(v0, max0);
+      max1 = _mm256_max_ps(v1, max1);
+      max2 = _mm256_max_ps(v2, max2);
+    }
+
+    _mm256_store_ps(blockMin, min0);
+    _mm256_store_ps(blockMin + 8, min1);
+    _mm256_store_ps(blockMin + 16, min2);
+    _mm256_store_ps(blockMax, max0);
+    _mm256_store_ps(blockMax + 8, max1);
+    _mm256_store_ps(blockMax + 16, max2);
+#else
+    auto min0 = _mm_set1_ps(std::numeric_limits<float>::max());
+    auto min1 = min0, min2 = min0;
+    auto max0 = _mm_set1_ps(std::numeric_limits<float>::lowest());
+    auto max1 = max0, max2 = max0;
+
+    for (; f + SIMD_BLOCK_FLOAT_COUNT <= floatCount;
+         f += SIMD_BLOCK_FLOAT_COUNT) {
+      const auto v0 = _mm_loadu_ps(pFloats + f);
+      const auto v1 = _mm_loadu_ps(pFloats + f + 4);
+      const auto v2 = _mm_loadu_ps(pFloats + f + 8);
+      min0 = _mm_min_ps(v0, min0);
+      min1 = _mm_min_ps(v1, min1);
+      min2 = _mm_min_ps(v2, min2);
+      max0 = _mm_max_ps(v0, max0);
+      max1 = _mm_max_ps(v1, max1);
+      max2 = _mm_max_ps(v2, max2);
+    }
+
+    _mm_store_ps(blockMin, min0);
+    _mm_store_ps(blockMin + 4, min1);
+    _mm_store_ps(blockMin + 8, min2);
+    _mm_store_ps(blockMax, max0);
+    _mm_store_ps(blockMax + 4, max1);
+    _mm_store_ps(blockMax + 8, max2);
+#endif
+
+    for (size_t k = 0; k < SIMD_BLOCK_FLOAT_COUNT; ++k) {
+      bboxMin[k % 3] = std::min(bboxMin[k % 3], blockMin[k]);
+      bboxMax[k % 3] = std::max(bboxMax[k % 3], blockMax[k]);
+    }
+
+    // Blocks hold a whole number of positions, the scalar loop does the rest
+    i = f / 3;
+  } else if (byteStride >= 4 * sizeof(float)) {
+    // Interleaved positions: one position per register, the 4th lane reads
+    // the next attribute and is ignored. The last position may end the
+    // buffer, it is left to the scalar loop.
+    auto min = _mm_set1_ps(std::numeric_limits<float>::max());
+    auto max = _mm_set1_ps(std::numeric_limits<float>::lowest());
+
+    for (; i + 1 < count; ++i) {
+      const auto v =
+          _mm_loadu_ps(reinterpret_cast<const float *>(data + byteStride * i));
+      min = _mm_min_ps(v, min);
+      max = _mm_max_ps(v, max);
+    }
+
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, min);
+    bboxMin = glm::vec3(lanes[0], lanes[1], lanes[2]);
+    _mm_store_ps(lanes, max);
+    bboxMax = glm::vec3(lanes[0], lanes[1], lanes[2]);
+  }
+#endif
+
+  for (; i < count; ++i) {
+    glm::vec3 position;
+    std::memcpy(&position, data + byteStride * i, sizeof(position));
+    bboxMin = glm::min(bboxMin, position);
+    bboxMax = glm::max(bboxMax, position);
+  }
+}
+
+bool computePrimitiveBounds(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax)
+{
+  const auto positionAttrIdxIt = primitive.attributes.find("POSITION");
+  if (positionAttrIdxIt == end(primitive.attributes)) {
+    return false;
+  }
+
+  const auto &positionAccessor = model.accessors[(*positionAttrIdxIt).second];
+  if (positionAccessor.type != TINYGLTF_TYPE_VEC3 ||
+      positionAccessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT) {
+    return false;
+  }
+
+  // Required by the specification for POSITION, but not checked by tinygltf
+  if (positionAccessor.minValues.size() == 3 &&
+      positionAccessor.maxValues.size() == 3) {
+    bboxMin = glm::vec3(positionAccessor.minValues[0],
+        positionAccessor.minValues[1], positionAccessor.minValues[2]);
+    bboxMax = glm::vec3(positionAccessor.maxValues[0],
+        positionAccessor.maxValues[1], positionAccessor.maxValues[2]);
+    return true;
+  }
+
+  if (positionAccessor.bufferView < 0) {
+    return false;
+  }
+
+  const auto &positionBufferView =
+      model.bufferViews[positionAccessor.bufferView];
+  const auto &positionBuffer = model.buffers[positionBufferView.buffer];
+  const auto byteOffset =
+      positionAccessor.byteOffset + positionBufferView.byteOffset;
+  const auto positionByteStride = positionBufferView.byteStride
+                                      ? positionBufferView.byteStride
+                                      : 3 * sizeof(float);
+
+  computePositionBounds(&positionBuffer.data[byteOffset],
+      positionAccessor.count, positionByteStride, bboxMin, bboxMax);
+
+  return positionAccessor.count > 0;
+}
+
+// Moller-Trumbore, two-sided
+static bool intersectTriangle(const glm::vec3 &origin,
+    const glm::vec3 &direction, const glm::vec3 &v0, const glm::vec3 &v1,
+    const glm::vec3 &v2, float &t)
+{
+  const auto edge1 = v1 - v0;
+  const auto edge2 = v2 - v0;
+  const auto p = glm::cross(direction, edge2);
+  const auto det = glm::dot(edge1, p);
+
+  if (std::abs(det) < std::numeric_limits<float>::epsilon()) {
+    return false;
+  }
+
+  const auto invDet = 1.f / det;
+  const auto s = origin - v0;
+  const auto u = glm::dot(s, p) * invDet;
+  if (u < 0.f || u > 1.f) {
+    return false;
+  }
+
+  const auto q = glm::cross(s, edge1);
+  const auto v = glm::dot(direction, q) * invDet;
+  if (v < 0.f || u + v > 1.f) {
+    return false;
+  }
+
+  const auto hitT = glm::dot(edge2, q) * invDet;
+  if (hitT <= 0.f || hitT >= t) {
+    return false;
+  }
+
+  t = hitT;
+  return true;
+}
+
+bool intersectPrimitive(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, const glm::vec3 &origin,
+    const glm::vec3 &direction, float &t)
+{
+  if (primitive.mode != -1 && primitive.mode != TINYGLTF_MODE_TRIANGLES) {
+    return false;
+  }
+
+  const auto positionAttrIdxIt = primitive.attributes.find("POSITION");
+  if (positionAttrIdxIt == end(primitive.attributes)) {
+    return false;
+  }
+
+  const auto &positionAccessor = model.accessors[(*positionAttrIdxIt).second];
+  if (positionAccessor.type != TINYGLTF_TYPE_VEC3 ||
+      positionAccessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT ||
+      positionAccessor.bufferView < 0) {
+    return false;
+  }
+
+  const auto &positionBufferView =
+      model.bufferViews[positionAccessor.bufferView];
+  const auto &positionBuffer = model.buffers[positionBufferView.buffer];
+  const auto positionByteOffset =
+      positionAccessor.byteOffset + positionBufferView.byteOffset;
+  const auto positionByteStride = positionBufferView.byteStride
+                                      ? positionBufferView.byteStride
+                                      : 3 * sizeof(float);
+
+  const auto getPosition = [&](uint32_t vertex) {
+    glm::vec3 position;
+    std::memcpy(&position,
+        &positionBuffer.data[positionByteOffset + positionByteStride * vertex],
+        sizeof(position));
+    return position;
+  };
+
+  const unsigned char *pIndices = nullptr;
+  size_t indexByteSize = 0;
+  size_t vertexCount = positionAccessor.count;
+
+  if (primitive.indices >= 0) {
+    const auto &indexAccessor = model.accessors[primitive.indices];
+    if (indexAccessor.bufferView < 0) {
+      return false;
+    }
+    const auto &indexBufferView = model.bufferViews[indexAccessor.bufferView];
+
+    switch (indexAccessor.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+      indexByteSize = sizeof(uint8_t);
+      break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+      indexByteSize = sizeof(uint16_t);
+      break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+      indexByteSize = sizeof(uint32_t);
+      break;
+    default:
+      return false;
+    }
+
+    pIndices = &model.buffers[indexBufferView.buffer]
+                    .data[indexAccessor.byteOffset + indexBufferView.byteOffset];
+    vertexCount = indexAccessor.count;
+  }
+
+  const auto getIndex = [&](size_t i) -> uint32_t {
+    if (!pIndices) {
+      return uint32_t(i);
+    }
+    switch (indexByteSize) {
+    case sizeof(uint8_t):
+      return pIndices[i];
+    case sizeof(uint16_t): {
+      uint16_t index;
+      std::memcpy(&index, pIndices + i * indexByteSize, sizeof(index));
+      return index;
+    }
+    default: {
+      uint32_t index;
+      std::memcpy(&index, pIndices + i * indexByteSize, sizeof(index));
+      return index;
+    }
+    }
+  };
+
+  bool hit = false;
+  for (size_t i = 0; i + 2 < vertexCount; i += 3) {
+    const auto i0 = getIndex(i);
+    const auto i1 = getIndex(i + 1);
+    const auto i2 = getIndex(i + 2);
+    if (i0 >= positionAccessor.count || i1 >= positionAccessor.count ||
+        i2 >= positionAccessor.count) {
+      continue;
+    }
+
+    hit |= intersectTriangle(origin, direction, getPosition(i0),
+        getPosition(i1), getPosition(i2), t);
+  }
+
+  return hit;
+}
+
+bool isBinaryGltf(const unsigned char *bytes, size_t size)
+{
+  return size >= GLB_HEADER_SIZE && readUint32(bytes) == GLB_MAGIC;
+}
+
+bool loadGltfModel(const fs::path &path, tinygltf::Model &model,
+    std::vector<DeferredImage> &deferredImages)
+{
+  MappedFile file;
+  if (!file.open(path)) {
+    std::cerr << "Error: unable to map " << path << std::endl;
+    return false;
+  }
+
+  // tinygltf takes the length of the file as an unsigned int
+  if (file.size() > std::numeric_limits<unsigned int>::max()) {
+    std::cerr << "Error: " << path << " is too large (" << file.size()
+              << " bytes, tinygltf parses at most "
+              << std::numeric_limits<unsigned int>::max() << ")" << std::endl;
+    return false;
+  }
+
+  tinygltf::TinyGLTF loader;
+  loader.SetImageLoader(deferImageData, &deferredImages);
+
+  std::string err;
+  std::string warn;
+  const auto baseDir = path.parent_path().string();
+  const auto loaded =
+      isBinaryGltf(file.data(), file.size())
+          ? loader.LoadBinaryFromMemory(&model, &err, &warn, file.data(),
+                (unsigned int)file.size(), baseDir)
+          : loader.LoadASCIIFromString(&model, &err, &warn,
+                (const char *)file.data(), (unsigned int)file.size(),
+                baseDir);
+
+  if (!err.empty()) {
+    std::cerr << "Error: " << err << std::endl;
+  }
+  if (!warn.empty()) {
+    std::cerr << "Warning: " << warn << std::endl;
+  }
+
+  return loaded;
+}
+
+bool deferImageData(tinygltf::Image * /*image*/, const int imageIdx,
+    std::string * /*err*/, std::string * /*warn*/, int reqWidth, int reqHeight,
+    const unsigned char *bytes, int size, void *userData)
+{
+  auto &images = *static_cast<std::vector<DeferredImage> *>(userData);
+  images.push_back(DeferredImage{
+      imageIdx, reqWidth, reqHeight, {bytes, bytes + size}});
+
+  return true;
+}
+
+bool decodeDeferredImages(tinygltf::Model &model,
+    std::vector<DeferredImage> &images, ThreadPool &pool)
+{
+  using clock = std::chrono::steady_clock;
+
+  struct DecodeResult
+  {
+    bool success = false;
+    std::string err;
+    std::string warn;
+    double milliseconds = 0;
+  };
+
+  std::vector<DecodeResult> results(images.size());
+
+  // Block compressed images only need a valid header, they are uploaded as
+  // they are
+  std::vector<uint8_t> isKtx2Image(images.size(), 0);
+
+  for (size_t i = 0; i < images.size(); ++i) {
+    auto &deferred = images[i];
+    auto &image = model.images[deferred.imageIdx];
+
+    if (!isKtx2(deferred.bytes.data(), deferred.bytes.size())) {
+      continue;
+    }
+    isKtx2Image[i] = 1;
+
+    Ktx2Image ktx2;
+    std::string err;
+    if (!parseKtx2(
+            deferred.bytes.data(), deferred.bytes.size(), ktx2, err)) {
+      // Textures use their fallback source if they have one
+      std::cerr << "Warning: image " << deferred.imageIdx << " \""
+                << image.name << "\": " << err << std::endl;
+      continue;
+    }
+
+    image.width = int(ktx2.levels[0].width);
+    image.height = int(ktx2.levels[0].height);
+    image.component = 4;
+    image.bits = 8;
+    image.mimeType = "image/ktx2";
+    image.image = std::move(deferred.bytes);
+
+    std::clog << "Loaded KTX2 image " << deferred.imageIdx << " \""
+              << image.name << "\" (" << image.width << "x" << image.height
+              << ", " << ktx2.levels.size() << " levels)" << std::endl;
+  }
+
+  // Fallback images of textures that have a KTX2 version are never sampled
+  std::vector<uint8_t> isSampled(model.images.size(), 0);
+  std::vector<uint8_t> isSource(model.images.size(), 0);
+  for (const auto &texture : model.textures) {
+    const auto imageIndex = getTextureImageIndex(model, texture);
+    if (imageIndex >= 0) {
+      isSampled[imageIndex] = 1;
+    }
+    if (texture.source >= 0) {
+      isSource[texture.source] = 1;
+    }
+  }
+
+  std::vector<size_t> decoded;
+  for (size_t i = 0; i < images.size(); ++i) {
+    const auto imageIdx = images[i].imageIdx;
+    if (!isKtx2Image[i] && (isSampled[imageIdx] || !isSource[imageIdx])) {
+      decoded.push_back(i);
+    }
+  }
+
+  const auto start = clock::now();
+
+  pool.parallelFor(decoded.size(), [&](size_t j) {
+    const auto i = decoded[j];
+    const auto &deferred = images[i];
+    auto &result = results[i];
+    const auto imageStart = clock::now();
+
+    // tinygltf default stb_image loader, now running on a worker thread
+    result.success = tinygltf::LoadImageData(&model.images[deferred.imageIdx],
+        deferred.imageIdx, &result.err, &result.warn, deferred.reqWidth,
+        deferred.reqHeight, deferred.bytes.data(), int(deferred.bytes.size()),
+        nullptr);
+
+    result.milliseconds =
+        std::chrono::duration<double, std::milli>(clock::now() - imageStart)
+            .count();
+  });
+
+  const auto wallMilliseconds =
+      std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+  bool success = true;
+  double serialMilliseconds = 0;
+
+  for (const auto i : decoded) {
+    const auto &image = model.images[images[i].imageIdx];
+    const auto &result = results[i];
+
+    if (!result.warn.empty()) {
+      std::cerr << "Warning: " << result.warn << std::endl;
+    }
+    if (!result.success) {
+      std::cerr << "Error: " << result.err << std::endl;
+      success = false;
+      continue;
+    }
+
+    serialMilliseconds += result.milliseconds;
+    std::clog << "Decoded image " << images[i].imageIdx << " \"" << image.name
+              << "\" (" << image.width << "x" << image.height << ", "
+              << image.bits << " bits) in " << std::fixed
+              << std::setprecision(2) << result.milliseconds << " ms"
+              << std::defaultfloat << std::endl;
+  }
+
+  if (decoded.size() < images.size()) {
+    std::clog << "Skipped decoding " << images.size() - decoded.size()
+              << " KTX2 and fallback images" << std::endl;
+  }
+
+  if (!decoded.empty()) {
+    std::clog << "Decoded " << decoded.size() << " images in " << std::fixed
+              << std::setprecision(2) << wallMilliseconds << " ms on "
+              << pool.size() << " threads (" << serialMilliseconds
+              << " ms of decoding, x" << serialMilliseconds / wallMilliseconds
+              << ")" << std::defaultfloat << std::endl;
+  }
+
+  images.clear();
+
+  return success;
+}
+
+bool writeEncodedImage(const std::string *basePath,
+    const std::string *fileName, tinygltf::Image *image, bool /*embedImages*/,
+    void * /*userData*/)
+{
+  if (image->image.empty()) {
+    return true;
+  }
+
+  std::ofstream output(
+      (fs::path(*basePath) / *fileName).string(), std::ios::binary);
+  output.write(reinterpret_cast<const char *>(image->image.data()),
+      std::streamsize(image->image.size()));
+
+  return bool(output);
+}
+
+std::string getImageFileName(const tinygltf::Image &image, size_t index)
+{
+  if (!image.uri.empty() && image.uri.compare(0, 5, "data:") != 0) {
+    return fs::path(image.uri).filename().string();
+  }
+
+  const auto stem =
+      image.name.empty() ? "image" + std::to_string(index) : image.name;
+  if (image.mimeType == "image/jpeg") {
+    return stem + ".jpg";
+  }
+  if (image.mimeType == "image/png") {
+    return stem + ".png";
+  }
+  if (image.mimeType == "image/ktx2") {
+    return stem + ".ktx2";
+  }
+  return stem + ".bin";
+}
+
+bool saveGltfModel(const fs::path &path, tinygltf::Model &model)
+{
+  // Every image is written next to the model, under a unique name
+  std::set<std::string> fileNames;
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    auto &image = model.images[i];
+    if (image.image.empty()) {
+      continue;
+    }
+
+    const auto fileName = getImageFileName(image, i);
+    const auto stem = fs::path(fileName).stem().string();
+    const auto extension = fs::path(fileName).extension().string();
+    auto uri = fileName;
+    for (size_t n = 1; !fileNames.insert(uri).second; ++n) {
+      uri = stem + "_" + std::to_string(n) + extension;
+    }
+
+    image.uri = uri;
+    image.bufferView = -1;
+  }
+
+  tinygltf::TinyGLTF writer;
+  writer.SetImageWriter(writeEncodedImage, nullptr);
+  if (!writer.WriteGltfSceneToFile(&model, path.string(), false, false, true,
+          path.extension() == ".glb")) {
+    std::cerr << "Error: unable to write " << path << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+int getTextureImageIndex(
+    const tinygltf::Model &model, const tinygltf::Texture &texture)
+{
+  const auto extension = texture.extensions.find(KTX2_TEXTURE_EXTENSION);
+  if (extension != texture.extensions.end() &&
+      extension->second.Has("source") &&
+      extension->second.Get("source").IsNumber()) {
+    const auto imageIndex =
+        int(extension->second.Get("source").GetNumberAsInt());
+
+    if (imageIndex >= 0 && size_t(imageIndex) < model.images.size() &&
+        model.images[imageIndex].mimeType == "image/ktx2" &&
+        !model.images[imageIndex].image.empty()) {
+      return imageIndex;
+    }
+  }
+
+  return texture.source;
+}
+
+// Elements of a float or normalized integer accessor with componentCount
+// components, the other components of values are left to 0
+static bool readAccessorVectors(const tinygltf::Model &model, int accessorIdx,
+    int componentCount, std::vector<glm::vec4> &values)
+{
+  if (accessorIdx < 0 || size_t(accessorIdx) >= model.accessors.size()) {
+    return false;
+  }
+
+  const auto &accessor = model.accessors[accessorIdx];
+  if (tinygltf::GetNumComponentsInType(uint32_t(accessor.type)) !=
+          componentCount ||
+      accessor.bufferView < 0) {
+    return false;
+  }
+
+  const auto &bufferView = model.bufferViews[accessor.bufferView];
+  const auto &buffer = model.buffers[bufferView.buffer];
+  const auto componentSize =
+      tinygltf::GetComponentSizeInBytes(uint32_t(accessor.componentType));
+  const auto byteStride = accessor.ByteStride(bufferView);
+  const auto byteOffset = bufferView.byteOffset + accessor.byteOffset;
+
+  if (componentSize <= 0 || byteStride <= 0 ||
+      (accessor.count > 0 &&
+          byteOffset + (accessor.count - 1) * byteStride +
+                  componentCount * componentSize >
+              buffer.data.size())) {
+    return false;
+  }
+
+  values.assign(accessor.count, glm::vec4(0));
+
+  for (size_t i = 0; i < accessor.count; ++i) {
+    for (int c = 0; c < componentCount; ++c) {
+      const auto component =
+          &buffer.data[byteOffset + i * byteStride + c * componentSize];
+
+      // https://github.com/KhronosGroup/glTF/tree/master/specification/2.0#animations
+      // (same normalized integer conversions)
+      switch (accessor.componentType) {
+      case TINYGLTF_COMPONENT_TYPE_FLOAT:
+        std::memcpy(&values[i][c], component, sizeof(float));
+        break;
+      case TINYGLTF_COMPONENT_TYPE_BYTE:
+        values[i][c] =
+            std::max(float(*reinterpret_cast<const int8_t *>(component)) /
+                         127.f,
+                -1.f);
+        break;
+      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+        values[i][c] = float(*component) / 255.f;
+        break;
+      case TINYGLTF_COMPONENT_TYPE_SHORT: {
+        int16_t value;
+        std::memcpy(&value, component, sizeof(value));
+        values[i][c] = std::max(float(value) / 32767.f, -1.f);
+        break;
+      }
+      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+        uint16_t value;
+        std::memcpy(&value, component, sizeof(value));
+        values[i][c] = float(value) / 65535.f;
+        break;
+      }
+      default:
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+std::vector<glm::mat4> getMeshGpuInstances(
+    const tinygltf::Model &model, const tinygltf::Node &node)
+{
+  // https://github.com/KhronosGroup/glTF/tree/master/extensions/2.0/Vendor/EXT_mesh_gpu_instancing
+  const auto extension = node.extensions.find("EXT_mesh_gpu_instancing");
+  if (extension == node.extensions.end() ||
+      !extension->second.Has("attributes")) {
+    return {};
+  }
+
+  const auto &attributes = extension->second.Get("attributes");
+  const auto readAttribute = [&](const char *name, int componentCount,
+                                 std::vector<glm::vec4> &values) {
+    if (!attributes.Has(name)) {
+      return true;
+    }
+
+    const auto &accessorIdx = attributes.Get(name);
+    return accessorIdx.IsNumber() &&
+           readAccessorVectors(model, accessorIdx.GetNumberAsInt(),
+               componentCount, values);
+  };
+
+  std::vector<glm::vec4> translations;
+  std::vector<glm::vec4> rotations;
+  std::vector<glm::vec4> scales;
+  if (!readAttribute("TRANSLATION", 3, translations) ||
+      !readAttribute("ROTATION", 4, rotations) ||
+      !readAttribute("SCALE", 3, scales)) {
+    std::cerr << "Warning: invalid EXT_mesh_gpu_instancing attributes on node \""
+              << node.name << "\"" << std::endl;
+    return {};
+  }
+
+  // Every attribute has the same count
+  const auto count =
+      std::max({translations.size(), rotations.size(), scales.size()});
+  if ((!translations.empty() && translations.size() != count) ||
+      (!rotations.empty() && rotations.size() != count) ||
+      (!scales.empty() && scales.size() != count)) {
+    std::cerr << "Warning: EXT_mesh_gpu_instancing attributes of node \""
+              << node.name << "\" have different counts" << std::endl;
+    return {};
+  }
+
+  std::vector<glm::mat4> matrices(count, glm::mat4(1));
+
+  for (size_t i = 0; i < count; ++i) {
+    if (!translations.empty()) {
+      matrices[i] = glm::translate(matrices[i], glm::vec3(translations[i]));
+    }
+    if (!rotations.empty()) {
+      const auto &q = rotations[i]; // x, y, z, w
+      matrices[i] *= glm::mat4_cast(glm::quat(q.w, q.x, q.y, q.z));
+    }
+    if (!scales.empty()) {
+      matrices[i] = glm::scale(matrices[i], glm::vec3(scales[i]));
+    }
+  }
+
+  return matrices;
+}
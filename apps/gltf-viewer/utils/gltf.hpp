@@ -1,10 +1,117 @@
 #pragma once
 
+#include "ThreadPool.hpp"
+#include "filesystem.hpp"
+
 #include <glm/glm.hpp>
 #include <tiny_gltf.h>
 
 glm::mat4 getLocalToWorldMatrix(
     const tinygltf::Node &node, const glm::mat4 &parentMatrix);
 
-void computeSceneBounds(
-    const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax);
\ No newline at end of file
+class SceneGraph;
+
+// World space bounding box of the default scene: the local box of each
+// primitive (see computePrimitiveBounds) is computed once per mesh, on pool
+// if there is one, then only its corners are transformed by the nodes.
+void computeSceneBounds(const tinygltf::Model &model, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax, ThreadPool *pool = nullptr);
+
+// Same with the cached world matrices of an updated scene graph
+void computeSceneBounds(const tinygltf::Model &model,
+    const SceneGraph &sceneGraph, glm::vec3 &bboxMin, glm::vec3 &bboxMax,
+    ThreadPool *pool = nullptr);
+
+// Bounding box of count float VEC3 positions starting at data, byteStride
+// bytes apart (SSE or AVX min/max when available)
+void computePositionBounds(const unsigned char *data, size_t count,
+    size_t byteStride, glm::vec3 &bboxMin, glm::vec3 &bboxMax);
+
+// Local space bounding box of a primitive, from the min/max of its POSITION
+// accessor when they are present or else from its vertices. Returns false if
+// the primitive has no float VEC3 positions.
+bool computePrimitiveBounds(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax);
+
+// Closest intersection of the ray origin + t * direction (in the local space
+// of the primitive) with the triangles of a TRIANGLES primitive with float VEC3
+// positions, for t in (0, tMax]. Both faces are hit. Returns false if nothing
+// closer than t is hit, or else lowers t to the hit distance.
+bool intersectPrimitive(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, const glm::vec3 &origin,
+    const glm::vec3 &direction, float &t);
+
+// Whether bytes start with the header of a binary glTF (.glb) file
+// https://github.com/KhronosGroup/glTF/tree/master/specification/2.0#glb-file-format-specification
+bool isBinaryGltf(const unsigned char *bytes, size_t size);
+
+// Encoded image kept by deferImageData while tinygltf parses a file
+struct DeferredImage
+{
+  int imageIdx;
+  int reqWidth;
+  int reqHeight;
+  std::vector<unsigned char> bytes;
+};
+
+// Parse the glTF file at path into model, from a memory mapping released
+// before returning. It is parsed as binary glTF if it starts with the .glb
+// header (see isBinaryGltf), whatever its extension. Images are not decoded,
+// only appended to deferredImages (see deferImageData). Errors and warnings
+// are printed on std::cerr. Returns false if the file cannot be parsed.
+bool loadGltfModel(const fs::path &path, tinygltf::Model &model,
+    std::vector<DeferredImage> &deferredImages);
+
+// tinygltf LoadImageDataFunction that does not decode anything: it only
+// appends the encoded bytes to the std::vector<DeferredImage> passed as
+// userData, so that decodeDeferredImages can decode them all in parallel.
+// Use with TinyGLTF::SetImageLoader.
+bool deferImageData(tinygltf::Image *image, const int imageIdx,
+    std::string *err, std::string *warn, int reqWidth, int reqHeight,
+    const unsigned char *bytes, int size, void *userData);
+
+// Decode the images collected by deferImageData into model.images on the
+// pool, print a per-image timing breakdown on std::clog and clear images.
+// KTX2 files are not decoded: their bytes are kept in image.image, with
+// mimeType set to "image/ktx2", and the fallback images of the textures that
+// use them are skipped. Returns false if one of them cannot be decoded.
+bool decodeDeferredImages(tinygltf::Model &model,
+    std::vector<DeferredImage> &images, ThreadPool &pool);
+
+// tinygltf WriteImageDataFunction writing image.image as it is (an encoded
+// file, as kept by deferImageData, or a KTX2 file) at fileName next to the
+// model. Images without data keep their uri. Use with TinyGLTF::SetImageWriter.
+bool writeEncodedImage(const std::string *basePath,
+    const std::string *fileName, tinygltf::Image *image, bool embedImages,
+    void *userData);
+
+// File name of an image written next to a model: the one of its uri, or its
+// name (else "image" and its index) with the extension of its mime type
+std::string getImageFileName(const tinygltf::Image &image, size_t index);
+
+// Write model at path, as binary glTF if its extension is .glb. Every image
+// with data is written next to it (see writeEncodedImage) under its
+// getImageFileName, numbered if another image already took that name, and
+// its uri is updated. Prints an error on std::cerr and returns false if the
+// model cannot be written.
+bool saveGltfModel(const fs::path &path, tinygltf::Model &model);
+
+// Private texture extension written by the texcompress command, {"source":
+// <image index>} of a KTX2 image with BC1, BC5 or BC7 blocks and no
+// supercompression. KHR_texture_basisu cannot be used: it requires Basis
+// Universal (ETC1S or UASTC) payloads.
+static const char *const KTX2_TEXTURE_EXTENSION = "GLMLV_texture_ktx2_bcn";
+
+// Image sampled for a texture: the KTX2 image of its KTX2_TEXTURE_EXTENSION
+// if it has been loaded (see decodeDeferredImages), else its source. Returns
+// -1 if there is none.
+int getTextureImageIndex(
+    const tinygltf::Model &model, const tinygltf::Texture &texture);
+
+// Matrices of the instances of a node with the EXT_mesh_gpu_instancing
+// extension, relative to the node: TRANSLATION, ROTATION and SCALE (each
+// optional) of every instance. Empty if the node has no such extension, or
+// if its accessors cannot be read.
+std::vector<glm::mat4> getMeshGpuInstances(
+    const tinygltf::Model &model, const tinygltf::Node &node);
@@ -0,0 +1,341 @@
+#include "ibl.hpp"
+#include "files.hpp"
+#include "texture_cache.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+#include <glm/gtc/packing.hpp>
+
+static const float PI = 3.14159265359f;
+
+// Bump when computeBRDFLUT changes, to invalidate the files written before
+static const uint32_t BRDF_LUT_REVISION = 1;
+
+// Bump when projectIrradianceSH changes, older cache files are ignored
+static const char IRRADIANCE_SH_MAGIC[4] = {'I', 'S', 'H', '9'};
+static const uint32_t IRRADIANCE_SH_VERSION = 1;
+
+struct IrradianceSHFile
+{
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  float coefficients[9][3];
+};
+
+static float radicalInverseVdC(uint32_t bits)
+{
+  bits = (bits << 16u) | (bits >> 16u);
+  bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+  bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+  bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+  bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+
+  return float(bits) * 2.3283064365386963e-10f;
+}
+
+// Direction of the center of texel (x, y) of a cube map face, following the
+// face orientations of the OpenGL specification, and its solid angle
+static glm::vec3 cubeMapDirection(
+    size_t face, size_t x, size_t y, size_t size, float &solidAngle)
+{
+  const float u = 2.f * (x + 0.5f) / size - 1.f;
+  const float v = 2.f * (y + 0.5f) / size - 1.f;
+  const float lengthSq = 1.f + u * u + v * v;
+  const float texelSize = 2.f / size;
+
+  solidAngle = texelSize * texelSize / (lengthSq * std::sqrt(lengthSq));
+
+  glm::vec3 direction;
+  switch (face) {
+  case 0:
+    direction = glm::vec3(1.f, -v, -u);
+    break;
+  case 1:
+    direction = glm::vec3(-1.f, -v, u);
+    break;
+  case 2:
+    direction = glm::vec3(u, 1.f, v);
+    break;
+  case 3:
+    direction = glm::vec3(u, -1.f, -v);
+    break;
+  case 4:
+    direction = glm::vec3(u, -v, 1.f);
+    break;
+  default:
+    direction = glm::vec3(-u, -v, -1.f);
+    break;
+  }
+
+  return direction / std::sqrt(lengthSq);
+}
+
+void projectIrradianceSH(const float *faces, size_t size,
+    glm::vec3 coefficients[9], ThreadPool *pool)
+{
+  // One partial sum per face, the last element holds the total solid angle
+  // (4 PI up to discretization errors)
+  glm::vec3 faceSums[6][10];
+
+  const auto projectFace = [&](size_t face) {
+    auto &sums = faceSums[face];
+    std::fill(std::begin(sums), std::end(sums), glm::vec3(0.f));
+
+    const float *pTexel = faces + face * size * size * 3;
+    for (size_t y = 0; y < size; ++y) {
+      for (size_t x = 0; x < size; ++x, pTexel += 3) {
+        float solidAngle;
+        const auto d = cubeMapDirection(face, x, y, size, solidAngle);
+        const auto radiance =
+            glm::vec3(pTexel[0], pTexel[1], pTexel[2]) * solidAngle;
+
+        sums[0] += radiance * 0.282095f;
+        sums[1] += radiance * (0.488603f * d.y);
+        sums[2] += radiance * (0.488603f * d.z);
+        sums[3] += radiance * (0.488603f * d.x);
+        sums[4] += radiance * (1.092548f * d.x * d.y);
+        sums[5] += radiance * (1.092548f * d.y * d.z);
+        sums[6] += radiance * (0.315392f * (3.f * d.z * d.z - 1.f));
+        sums[7] += radiance * (1.092548f * d.x * d.z);
+        sums[8] += radiance * (0.546274f * (d.x * d.x - d.y * d.y));
+        sums[9].x += solidAngle;
+      }
+    }
+  };
+
+  if (pool) {
+    pool->parallelFor(6, projectFace);
+  } else {
+    for (size_t face = 0; face < 6; ++face) {
+      projectFace(face);
+    }
+  }
+
+  float totalSolidAngle = 0.f;
+  for (size_t i = 0; i < 9; ++i) {
+    coefficients[i] = glm::vec3(0.f);
+  }
+  for (const auto &sums : faceSums) {
+    for (size_t i = 0; i < 9; ++i) {
+      coefficients[i] += sums[i];
+    }
+    totalSolidAngle += sums[9].x;
+  }
+
+  // Clamped cosine convolution (PI, 2 PI / 3 and PI / 4 per band) over PI
+  static const float bandFactors[9] = {
+      1.f, 2.f / 3.f, 2.f / 3.f, 2.f / 3.f, .25f, .25f, .25f, .25f, .25f};
+
+  const float normalization = 4.f * PI / totalSolidAngle;
+  for (size_t i = 0; i < 9; ++i) {
+    coefficients[i] *= bandFactors[i] * normalization;
+  }
+}
+
+std::vector<glm::vec4> computePrefilterSamples(
+    float roughness, size_t sampleCount, float sourceResolution)
+{
+  // Every sample is the normal itself for a perfect mirror
+  if (roughness == 0.f) {
+    return {glm::vec4(0.f, 0.f, 1.f, 0.f)};
+  }
+
+  const float a = roughness * roughness;
+  const float a2 = a * a;
+  const float saTexel =
+      4.f * PI / (6.f * sourceResolution * sourceResolution);
+
+  std::vector<glm::vec4> samples;
+  samples.reserve(sampleCount);
+
+  for (size_t i = 0; i < sampleCount; ++i) {
+    // Hammersley point
+    const float u = float(i) / sampleCount;
+    const float v = radicalInverseVdC(uint32_t(i));
+
+    // Half vector from the GGX distribution
+    const float phi = 2.f * PI * u;
+    const float cosTheta = std::sqrt((1.f - v) / (1.f + (a2 - 1.f) * v));
+    const float sinTheta = std::sqrt(1.f - cosTheta * cosTheta);
+    const glm::vec3 h(
+        std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+
+    // Reflect V = N = +Z about H
+    const glm::vec3 l =
+        glm::normalize(2.f * h.z * h - glm::vec3(0.f, 0.f, 1.f));
+    if (l.z <= 0.f) {
+      continue;
+    }
+
+    // With N = V, NdotH == HdotV and the PDF reduces to D / 4
+    const float NdotH = h.z;
+    float denom = NdotH * NdotH * (a2 - 1.f) + 1.f;
+    denom *= denom * PI;
+    const float D = a2 / denom;
+    const float pdf = D / 4.f + 0.0001f;
+
+    const float saSample = 1.f / (float(sampleCount) * pdf + 0.0001f);
+    const float mipLevel = std::max(0.f, 0.5f * std::log2(saSample / saTexel));
+
+    samples.emplace_back(l, mipLevel);
+  }
+
+  return samples;
+}
+
+// Smith visibility with Schlick-GGX, k = roughness^2 / 2 for IBL
+static float geometrySchlickGGX(float NdotV, float roughness)
+{
+  const float k = roughness * roughness * 0.5f;
+  return NdotV / (NdotV * (1.f - k) + k);
+}
+
+static glm::vec2 integrateBRDF(
+    float NdotV, float roughness, size_t sampleCount)
+{
+  const glm::vec3 V(std::sqrt(1.f - NdotV * NdotV), 0.f, NdotV);
+  const float a = roughness * roughness;
+  const float a2 = a * a;
+
+  glm::vec2 result(0.f);
+  for (size_t i = 0; i < sampleCount; ++i) {
+    const float u = float(i) / sampleCount;
+    const float v = radicalInverseVdC(uint32_t(i));
+
+    const float phi = 2.f * PI * u;
+    const float cosTheta = std::sqrt((1.f - v) / (1.f + (a2 - 1.f) * v));
+    const float sinTheta = std::sqrt(1.f - cosTheta * cosTheta);
+    const glm::vec3 H(
+        std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+
+    const float VdotH = glm::dot(V, H);
+    const glm::vec3 L = glm::normalize(2.f * VdotH * H - V);
+
+    const float NdotL = L.z;
+    const float NdotH = H.z;
+    if (NdotL > 0.f && VdotH > 0.f) {
+      const float G = geometrySchlickGGX(NdotV, roughness) *
+                      geometrySchlickGGX(NdotL, roughness);
+      const float GVis = G * VdotH / (NdotH * NdotV);
+      const float Fc = std::pow(1.f - VdotH, 5.f);
+
+      result += glm::vec2((1.f - Fc) * GVis, Fc * GVis);
+    }
+  }
+
+  return result / float(sampleCount);
+}
+
+std::vector<glm::vec2> computeBRDFLUT(
+    size_t size, size_t sampleCount, ThreadPool *pool)
+{
+  std::vector<glm::vec2> lut(size * size);
+
+  const auto computeRow = [&](size_t y) {
+    const float roughness = (y + 0.5f) / size;
+    for (size_t x = 0; x < size; ++x) {
+      const float NdotV = (x + 0.5f) / size;
+      lut[y * size + x] = integrateBRDF(NdotV, roughness, sampleCount);
+    }
+  };
+
+  if (pool) {
+    pool->parallelFor(size, computeRow);
+  } else {
+    for (size_t y = 0; y < size; ++y) {
+      computeRow(y);
+    }
+  }
+
+  return lut;
+}
+
+bool saveIrradianceSH(
+    const fs::path &path, uint64_t key, const glm::vec3 coefficients[9])
+{
+  IrradianceSHFile file;
+  std::memcpy(file.magic, IRRADIANCE_SH_MAGIC, sizeof(file.magic));
+  file.version = IRRADIANCE_SH_VERSION;
+  file.key = key;
+  for (size_t i = 0; i < 9; ++i) {
+    for (int c = 0; c < 3; ++c) {
+      file.coefficients[i][c] = coefficients[i][c];
+    }
+  }
+
+  // Same temporary file dance as the texture cache
+  auto tmpPath = path;
+  tmpPath += ".tmp";
+
+  try {
+    if (path.has_parent_path()) {
+      fs::create_directories(path.parent_path());
+    }
+
+    {
+      std::ofstream output(tmpPath.string(), std::ios::binary);
+      output.write(reinterpret_cast<const char *>(&file), sizeof(file));
+
+      if (!output) {
+        throw std::runtime_error("write failed");
+      }
+    }
+
+    fs::rename(tmpPath, path);
+  } catch (const std::exception &e) {
+    std::cerr << "Irradiance SH cache: unable to write " << path << ": "
+              << e.what() << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool loadIrradianceSH(
+    const fs::path &path, uint64_t key, glm::vec3 coefficients[9])
+{
+  std::ifstream input(path.string(), std::ios::binary);
+  IrradianceSHFile file;
+  if (!input.read(reinterpret_cast<char *>(&file), sizeof(file)) ||
+      std::memcmp(file.magic, IRRADIANCE_SH_MAGIC, sizeof(file.magic)) ||
+      file.version != IRRADIANCE_SH_VERSION || file.key != key) {
+    return false;
+  }
+
+  for (size_t i = 0; i < 9; ++i) {
+    coefficients[i] = glm::vec3(file.coefficients[i][0],
+        file.coefficients[i][1], file.coefficients[i][2]);
+  }
+
+  return true;
+}
+
+uint64_t getBRDFLUTKey()
+{
+  const uint32_t parameters[] = {
+      BRDF_LUT_SIZE, BRDF_LUT_SAMPLE_COUNT, BRDF_LUT_REVISION};
+  return hashBytes(parameters, sizeof(parameters));
+}
+
+bool saveBRDFLUT(const fs::path &path, ThreadPool *pool)
+{
+  const auto lut = computeBRDFLUT(BRDF_LUT_SIZE, BRDF_LUT_SAMPLE_COUNT, pool);
+
+  std::vector<uint16_t> halves;
+  halves.reserve(2 * lut.size());
+  for (const auto &texel : lut) {
+    halves.emplace_back(glm::packHalf1x16(texel.x));
+    halves.emplace_back(glm::packHalf1x16(texel.y));
+  }
+
+  return writeTextureCache(path, getBRDFLUTKey(), GL_TEXTURE_2D, GL_RG16F,
+      BRDF_LUT_SIZE, BRDF_LUT_SIZE, 1, halves.data(),
+      halves.size() * sizeof(halves[0]));
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "ThreadPool.hpp"
+#include "filesystem.hpp"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// Resolution and sample count of the BRDF LUT, shipped precomputed as
+// assets/gltf-viewer/brdf_lut.bin (see the bake-brdf-lut command)
+#define BRDF_LUT_SIZE 128
+#define BRDF_LUT_SAMPLE_COUNT 1024
+
+// Diffuse environment lighting as 9 spherical harmonics coefficients (bands 0
+// to 2, Ramamoorthi & Hanrahan, "An Efficient Representation for Irradiance
+// Environment Maps"), projected from the 6 faces of a cube map stored one
+// after the other as size x size RGB floats, in the GL face order.
+// The coefficients are already convolved with the clamped cosine and divided
+// by PI: evaluating them for a normal gives the radiance a Lambertian surface
+// of albedo 1 reflects (see evaluateIrradianceSH in
+// pbr_directional_light.fs.glsl).
+void projectIrradianceSH(const float *faces, size_t size,
+    glm::vec3 coefficients[9], ThreadPool *pool = nullptr);
+
+// Small cache files for the coefficients, next to the cube maps they are
+// projected from and tagged with the same key: the projection needs every
+// texel of the cube map read back from the GPU. Loading returns false if the
+// file is missing, invalid or has been written for another key.
+bool saveIrradianceSH(
+    const fs::path &path, uint64_t key, const glm::vec3 coefficients[9]);
+bool loadIrradianceSH(
+    const fs::path &path, uint64_t key, glm::vec3 coefficients[9]);
+
+// Sample set of the prefilter.cs.glsl compute shader, generated once on the
+// CPU instead of per texel. Sample directions are in a tangent space where
+// the surface normal is +Z.
+
+// GGX importance sampling of sampleCount Hammersley points for roughness,
+// assuming N = V = R: (light direction, source mip level). The mip level
+// follows from the sample PDF and the resolution of the source cube map.
+// Samples under the horizon have no weight and are not returned.
+std::vector<glm::vec4> computePrefilterSamples(
+    float roughness, size_t sampleCount, float sourceResolution);
+
+// Split sum scale and bias of the GGX specular BRDF (Karis, "Real Shading in
+// Unreal Engine 4"): F0 * x + y. A size x size table with NdotV along x and
+// roughness along y, sampled at texel centers.
+std::vector<glm::vec2> computeBRDFLUT(
+    size_t size, size_t sampleCount, ThreadPool *pool = nullptr);
+
+// Key of BRDF LUT files (see texture_cache.hpp), depends on the LUT size,
+// sample count and on the revision of computeBRDFLUT
+uint64_t getBRDFLUTKey();
+
+// Compute the BRDF LUT and write it at path as a RG16F texture, to be read by
+// loadTextureCache(path, getBRDFLUTKey()). Does not need an OpenGL context.
+bool saveBRDFLUT(const fs::path &path, ThreadPool *pool = nullptr);
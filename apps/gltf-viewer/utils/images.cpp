@@ -1,5 +1,6 @@
 #include "images.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <glad/glad.h>
 #include <iostream>
@@ -75,4 +76,236 @@ void renderToImage(size_t width, size_t height, size_t numComponents,
 
   glBindTexture(GL_TEXTURE_2D, previousTextureObject);
   glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousFramebufferObject);
-}
\ No newline at end of file
+}
+
+AsyncImageRenderer::AsyncImageRenderer(ThreadPool &pool, size_t bufferCount) :
+    m_pool(pool), m_slots(std::max(size_t(1), bufferCount))
+{
+  glGenFramebuffers(1, &m_framebuffer);
+}
+
+AsyncImageRenderer::~AsyncImageRenderer()
+{
+  try {
+    flush();
+  } catch (const std::exception &e) {
+    std::cerr << "AsyncImageRenderer: " << e.what() << std::endl;
+  }
+
+  for (auto &slot : m_slots) {
+    if (slot.pixelPackBuffer) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixelPackBuffer);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      glDeleteBuffers(1, &slot.pixelPackBuffer);
+    }
+  }
+
+  glDeleteTextures(1, &m_colorTexture);
+  glDeleteTextures(1, &m_depthTexture);
+  glDeleteFramebuffers(1, &m_framebuffer);
+}
+
+void AsyncImageRenderer::render(size_t width, size_t height,
+    const std::function<void()> &drawScene,
+    std::function<void(std::vector<unsigned char> &)> onPixels)
+{
+  auto &slot = m_slots[m_nextSlot];
+  m_nextSlot = (m_nextSlot + 1) % m_slots.size();
+
+  // Only blocks when every slot is still in flight
+  waitIdle(slot);
+
+  resizeFramebuffer(width, height);
+  reserve(slot, width * height * 4);
+
+  GLint previousDrawFramebuffer = 0;
+  GLint previousReadFramebuffer = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousDrawFramebuffer);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousReadFramebuffer);
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer);
+
+  drawScene();
+
+  GLint currentlyBoundFBO = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &currentlyBoundFBO);
+  if (GLuint(currentlyBoundFBO) != m_framebuffer) {
+    std::clog
+        << "Warning: AsyncImageRenderer - GL_DRAW_FRAMEBUFFER_BINDING has "
+           "changed during drawScene. It might lead to unexpected behavior."
+        << std::endl;
+  }
+
+  // RGBA8 to GL_RGBA / GL_UNSIGNED_BYTE is the fast path of every driver, and
+  // rows are always 4-byte aligned. Alpha is dropped on the CPU.
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixelPackBuffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(0, 0, GLsizei(width), GLsizei(height), GL_RGBA,
+      GL_UNSIGNED_BYTE, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot.width = width;
+  slot.height = height;
+  slot.onPixels = std::move(onPixels);
+
+  // Make sure the fence reaches the GPU, it is polled without flushing
+  glFlush();
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousDrawFramebuffer);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, previousReadFramebuffer);
+
+  processCompleted();
+}
+
+void AsyncImageRenderer::flush()
+{
+  // Start from the oldest frame
+  for (size_t i = 0; i < m_slots.size(); ++i) {
+    auto &slot = m_slots[(m_nextSlot + i) % m_slots.size()];
+    if (slot.fence) {
+      process(slot);
+    }
+  }
+
+  for (auto &slot : m_slots) {
+    if (slot.processing.valid()) {
+      slot.processing.wait();
+    }
+  }
+  for (auto &slot : m_slots) {
+    if (slot.processing.valid()) {
+      slot.processing.get();
+    }
+  }
+}
+
+void AsyncImageRenderer::resizeFramebuffer(size_t width, size_t height)
+{
+  if (width == m_width && height == m_height) {
+    return;
+  }
+
+  // Immutable storage: recreate the attachments. Pending frames are not
+  // affected, they have already been copied into their pixel pack buffer.
+  glDeleteTextures(1, &m_colorTexture);
+  glDeleteTextures(1, &m_depthTexture);
+
+  GLint previousTextureObject = 0;
+  GLint previousFramebufferObject = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTextureObject);
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebufferObject);
+
+  glGenTextures(1, &m_colorTexture);
+  glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, GLsizei(width), GLsizei(height));
+
+  glGenTextures(1, &m_depthTexture);
+  glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, GLsizei(width),
+      GLsizei(height));
+
+  glBindTexture(GL_TEXTURE_2D, previousTextureObject);
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer);
+  glFramebufferTexture(
+      GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_colorTexture, 0);
+  glFramebufferTexture(
+      GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_depthTexture, 0);
+
+  GLenum drawBuffers[1] = {GL_COLOR_ATTACHMENT0};
+  glDrawBuffers(1, drawBuffers);
+
+  const auto framebufferStatus = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+  assert(framebufferStatus == GL_FRAMEBUFFER_COMPLETE);
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousFramebufferObject);
+
+  m_width = width;
+  m_height = height;
+}
+
+void AsyncImageRenderer::reserve(Slot &slot, size_t byteSize)
+{
+  if (slot.capacity >= byteSize) {
+    return;
+  }
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixelPackBuffer);
+  if (slot.pixelPackBuffer) {
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glDeleteBuffers(1, &slot.pixelPackBuffer);
+  }
+
+  // Persistent coherent mapping: pool tasks read the pixels right from the
+  // buffer once the fence has been signaled, no glMapBuffer round trip
+  const GLbitfield flags =
+      GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+  glGenBuffers(1, &slot.pixelPackBuffer);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixelPackBuffer);
+  glBufferStorage(GL_PIXEL_PACK_BUFFER, byteSize, nullptr, flags);
+  slot.pMapped = static_cast<const unsigned char *>(
+      glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, byteSize, flags));
+  slot.capacity = byteSize;
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void AsyncImageRenderer::waitIdle(Slot &slot)
+{
+  if (slot.fence) {
+    process(slot);
+  }
+
+  // The mapped buffer is read by the task, it cannot be reused before the end
+  if (slot.processing.valid()) {
+    slot.processing.get();
+  }
+}
+
+void AsyncImageRenderer::process(Slot &slot)
+{
+  // Block until the GPU is done writing to the buffer
+  while (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+             1000000000) == GL_TIMEOUT_EXPIRED) {
+  }
+  glDeleteSync(slot.fence);
+  slot.fence = nullptr;
+
+  const auto *pMapped = slot.pMapped;
+  const auto width = slot.width;
+  const auto height = slot.height;
+  auto onPixels = std::move(slot.onPixels);
+
+  slot.processing = m_pool.enqueue([=]() {
+    // Flip and drop alpha in a single pass out of the mapped buffer
+    std::vector<unsigned char> pixels(width * height * 3);
+
+    for (size_t y = 0; y < height; ++y) {
+      const auto *pSrc = pMapped + (height - 1 - y) * width * 4;
+      auto *pDst = pixels.data() + y * width * 3;
+
+      for (size_t x = 0; x < width; ++x) {
+        pDst[3 * x + 0] = pSrc[4 * x + 0];
+        pDst[3 * x + 1] = pSrc[4 * x + 1];
+        pDst[3 * x + 2] = pSrc[4 * x + 2];
+      }
+    }
+
+    onPixels(pixels);
+  });
+}
+
+void AsyncImageRenderer::processCompleted()
+{
+  for (auto &slot : m_slots) {
+    if (slot.fence &&
+        glClientWaitSync(slot.fence, 0, 0) != GL_TIMEOUT_EXPIRED) {
+      process(slot);
+    }
+  }
+}
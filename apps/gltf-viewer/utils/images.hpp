@@ -1,6 +1,13 @@
 #pragma once
 
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cstdint>
 #include <functional>
+#include <future>
+#include <glad/glad.h>
+#include <vector>
 
 template <typename ComponentType>
 void flipImageYAxis(
@@ -17,6 +24,31 @@ void flipImageYAxis(
   }
 }
 
+// 2x2 box filter of RGBA pixels into the next mip level (width and height
+// halved, at least 1), odd sizes repeat their last row or column
+template <typename ComponentType>
+void downsampleImage(const ComponentType *src, size_t srcWidth,
+    size_t srcHeight, ComponentType *dst, size_t width, size_t height)
+{
+  for (size_t y = 0; y < height; ++y) {
+    const auto y0 = std::min(2 * y, srcHeight - 1);
+    const auto y1 = std::min(2 * y + 1, srcHeight - 1);
+
+    for (size_t x = 0; x < width; ++x) {
+      const auto x0 = std::min(2 * x, srcWidth - 1);
+      const auto x1 = std::min(2 * x + 1, srcWidth - 1);
+
+      for (size_t c = 0; c < 4; ++c) {
+        const uint32_t sum = uint32_t(src[(y0 * srcWidth + x0) * 4 + c]) +
+                             src[(y0 * srcWidth + x1) * 4 + c] +
+                             src[(y1 * srcWidth + x0) * 4 + c] +
+                             src[(y1 * srcWidth + x1) * 4 + c];
+        dst[(y * width + x) * 4 + c] = ComponentType((sum + 2) / 4);
+      }
+    }
+  }
+}
+
 void renderToImage(size_t width, size_t height, size_t numComponents,
     unsigned char *outPixels, std::function<void()> drawScene);
 // Setup GL state in order to render in texture, call drawScene() then get the
@@ -27,4 +59,66 @@ void renderToImage(size_t width, size_t height, size_t numComponents,
 // GL_DRAW_FRAMEBUFFER.
 // It means that if drawScene change GL_DRAW_FRAMEBUFFER, in must restore it
 // before doing final rendering (for example for deferred rendering,
-// GL_DRAW_FRAMEBUFFER must be restored before the shading pass).
\ No newline at end of file
+// GL_DRAW_FRAMEBUFFER must be restored before the shading pass).
+
+// Pipelined version of renderToImage for rendering many images in a row.
+// Frames are rendered in an offscreen framebuffer and read back with
+// glReadPixels into a ring of persistently mapped pixel pack buffers guarded by
+// fences, so that the GPU renders the next frames while previous ones are
+// transferred. Once a frame's fence is signaled, a task on the thread pool
+// flips it and hands it to its callback (typically a PNG encoder), so that the
+// CPU work overlaps with rendering too.
+//
+// Must be created and destroyed while the GL context is current, render()
+// and flush() must be called from the GL thread.
+class AsyncImageRenderer
+{
+public:
+  // Up to bufferCount frames are in flight between rendering and the end of
+  // their callback
+  AsyncImageRenderer(ThreadPool &pool, size_t bufferCount = 3);
+
+  ~AsyncImageRenderer();
+
+  AsyncImageRenderer(const AsyncImageRenderer &) = delete;
+  AsyncImageRenderer &operator=(const AsyncImageRenderer &) = delete;
+
+  // Same contract as renderToImage for drawScene. onPixels is called later
+  // on a pool thread with width * height tightly packed RGB8 pixels, first
+  // row at the top of the image (already flipped).
+  void render(size_t width, size_t height, const std::function<void()> &drawScene,
+      std::function<void(std::vector<unsigned char> &)> onPixels);
+
+  // Wait until every rendered frame has gone through its callback. Rethrows
+  // the first exception thrown by a callback.
+  void flush();
+
+private:
+  struct Slot
+  {
+    GLuint pixelPackBuffer = 0;
+    size_t capacity = 0;
+    const unsigned char *pMapped = nullptr;
+    GLsync fence = nullptr;
+    size_t width = 0;
+    size_t height = 0;
+    std::function<void(std::vector<unsigned char> &)> onPixels;
+    std::future<void> processing;
+  };
+
+  void resizeFramebuffer(size_t width, size_t height);
+  void reserve(Slot &slot, size_t byteSize);
+  void waitIdle(Slot &slot);
+  void process(Slot &slot);
+  void processCompleted();
+
+  ThreadPool &m_pool;
+  std::vector<Slot> m_slots;
+  size_t m_nextSlot = 0;
+
+  GLuint m_framebuffer = 0;
+  GLuint m_colorTexture = 0;
+  GLuint m_depthTexture = 0;
+  size_t m_width = 0;
+  size_t m_height = 0;
+};
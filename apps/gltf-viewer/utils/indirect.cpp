@@ -0,0 +1,193 @@
+#include "indirect.hpp"
+
+#include <cstring>
+
+// First element of a non sparse accessor and the distance between its
+// elements, nullptr if they do not all fit in its buffer view and buffer.
+// Sparse accessors are not resolved, their primitives are left to the
+// regular draw path.
+static const unsigned char *getAccessorData(const tinygltf::Model &model,
+    const tinygltf::Accessor &accessor, size_t elementSize, size_t &byteStride)
+{
+  if (accessor.bufferView < 0 ||
+      size_t(accessor.bufferView) >= model.bufferViews.size() ||
+      accessor.sparse.isSparse) {
+    return nullptr;
+  }
+
+  const auto &bufferView = model.bufferViews[accessor.bufferView];
+  if (bufferView.buffer < 0 ||
+      size_t(bufferView.buffer) >= model.buffers.size()) {
+    return nullptr;
+  }
+  const auto &buffer = model.buffers[bufferView.buffer];
+
+  byteStride = bufferView.byteStride ? bufferView.byteStride : elementSize;
+
+  const auto byteLength = accessor.count
+                              ? byteStride * (accessor.count - 1) + elementSize
+                              : 0;
+  if (bufferView.byteOffset + bufferView.byteLength > buffer.data.size() ||
+      accessor.byteOffset + byteLength > bufferView.byteLength) {
+    return nullptr;
+  }
+
+  return buffer.data.data() + bufferView.byteOffset + accessor.byteOffset;
+}
+
+// Location and stride of the elements of a float accessor with
+// componentCount components, nullptr if the attribute cannot be read as such
+static const unsigned char *getFloatAttribute(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, const char *name, int componentCount,
+    size_t &count, size_t &byteStride)
+{
+  const auto it = primitive.attributes.find(name);
+  if (it == end(primitive.attributes) || it->second < 0 ||
+      size_t(it->second) >= model.accessors.size()) {
+    return nullptr;
+  }
+
+  const auto &accessor = model.accessors[it->second];
+  if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT ||
+      accessor.type != componentCount) {
+    return nullptr;
+  }
+
+  count = accessor.count;
+  return getAccessorData(
+      model, accessor, componentCount * sizeof(float), byteStride);
+}
+
+bool appendMergedPrimitive(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, std::vector<MergedVertex> &vertices,
+    std::vector<uint32_t> &indices, MergedPrimitive &range)
+{
+  if (primitive.mode != TINYGLTF_MODE_TRIANGLES) {
+    return false;
+  }
+
+  size_t vertexCount = 0;
+  size_t positionStride = 0;
+  const auto *pPositions = getFloatAttribute(
+      model, primitive, "POSITION", 3, vertexCount, positionStride);
+  if (!pPositions) {
+    return false;
+  }
+
+  // Optional attributes must be floats too, the merged format has no
+  // normalized integers
+  size_t normalCount = 0;
+  size_t normalStride = 0;
+  const auto *pNormals = getFloatAttribute(
+      model, primitive, "NORMAL", 3, normalCount, normalStride);
+  if ((!pNormals && primitive.attributes.count("NORMAL")) ||
+      (pNormals && normalCount < vertexCount)) {
+    return false;
+  }
+
+  size_t texCoordCount = 0;
+  size_t texCoordStride = 0;
+  const auto *pTexCoords = getFloatAttribute(
+      model, primitive, "TEXCOORD_0", 2, texCoordCount, texCoordStride);
+  if ((!pTexCoords && primitive.attributes.count("TEXCOORD_0")) ||
+      (pTexCoords && texCoordCount < vertexCount)) {
+    return false;
+  }
+
+  // Check the indices before appending anything
+  const unsigned char *pIndices = nullptr;
+  size_t indexCount = vertexCount;
+  size_t indexSize = 0;
+
+  if (primitive.indices >= 0) {
+    if (size_t(primitive.indices) >= model.accessors.size()) {
+      return false;
+    }
+    const auto &accessor = model.accessors[primitive.indices];
+
+    switch (accessor.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+      indexSize = sizeof(uint8_t);
+      break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+      indexSize = sizeof(uint16_t);
+      break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+      indexSize = sizeof(uint32_t);
+      break;
+    default:
+      return false;
+    }
+
+    // Index buffer views have no stride
+    size_t indexStride = 0;
+    pIndices = getAccessorData(model, accessor, indexSize, indexStride);
+    if (!pIndices || indexStride != indexSize) {
+      return false;
+    }
+    indexCount = accessor.count;
+  }
+
+  const auto getIndex = [&](size_t i) -> uint32_t {
+    switch (indexSize) {
+    case 0:
+      return uint32_t(i);
+    case sizeof(uint8_t):
+      return pIndices[i];
+    case sizeof(uint16_t): {
+      uint16_t index;
+      std::memcpy(&index, pIndices + i * sizeof(index), sizeof(index));
+      return index;
+    }
+    default: {
+      uint32_t index;
+      std::memcpy(&index, pIndices + i * sizeof(index), sizeof(index));
+      return index;
+    }
+    }
+  };
+
+  for (size_t i = 0; i < indexCount; ++i) {
+    if (getIndex(i) >= vertexCount) {
+      return false;
+    }
+  }
+
+  range.firstIndex = GLuint(indices.size());
+  range.indexCount = GLuint(indexCount);
+  range.baseVertex = GLint(vertices.size());
+
+  const auto firstVertex = vertices.size();
+  vertices.resize(firstVertex + vertexCount);
+
+  for (size_t i = 0; i < vertexCount; ++i) {
+    auto &vertex = vertices[firstVertex + i];
+
+    std::memcpy(vertex.position, pPositions + i * positionStride,
+        sizeof(vertex.position));
+
+    if (pNormals) {
+      std::memcpy(
+          vertex.normal, pNormals + i * normalStride, sizeof(vertex.normal));
+    } else {
+      std::memset(vertex.normal, 0, sizeof(vertex.normal));
+    }
+
+    if (pTexCoords) {
+      std::memcpy(vertex.texCoords, pTexCoords + i * texCoordStride,
+          sizeof(vertex.texCoords));
+    } else {
+      std::memset(vertex.texCoords, 0, sizeof(vertex.texCoords));
+    }
+  }
+
+  // Indices are relative to baseVertex
+  const auto firstIndex = indices.size();
+  indices.resize(firstIndex + indexCount);
+
+  for (size_t i = 0; i < indexCount; ++i) {
+    indices[firstIndex + i] = getIndex(i);
+  }
+
+  return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <glad/glad.h>
+#include <tiny_gltf.h>
+#include <vector>
+
+// Command layout read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+  GLuint count;
+  GLuint instanceCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+  GLuint baseInstance;
+};
+
+// Common vertex format of the merged vertex buffer, attributes missing from
+// a primitive are left to zero
+struct MergedVertex
+{
+  float position[3];
+  float normal[3];
+  float texCoords[2];
+};
+
+// Where a primitive has been appended in the merged buffers
+struct MergedPrimitive
+{
+  GLuint firstIndex;
+  GLuint indexCount;
+  GLint baseVertex;
+};
+
+// Convert the vertices and indices of a primitive to MergedVertex and 32-bit
+// indices appended to vertices and indices. Only triangle lists with float
+// positions, normals and texture coordinates, whose accessors are not sparse
+// and fit in their buffers, and whose indices are in range, can be merged:
+// for anything else false is returned and nothing is appended.
+bool appendMergedPrimitive(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, std::vector<MergedVertex> &vertices,
+    std::vector<uint32_t> &indices, MergedPrimitive &range);
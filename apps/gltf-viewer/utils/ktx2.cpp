@@ -0,0 +1,256 @@
+#include "ktx2.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+// Not in the core profile, but supported by every desktop implementation
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#endif
+
+static const unsigned char KTX2_IDENTIFIER[12] = {
+    0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+// VkFormat values
+static const uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+static const uint32_t VK_FORMAT_BC1_RGB_SRGB_BLOCK = 132;
+static const uint32_t VK_FORMAT_BC1_RGBA_UNORM_BLOCK = 133;
+static const uint32_t VK_FORMAT_BC1_RGBA_SRGB_BLOCK = 134;
+static const uint32_t VK_FORMAT_BC5_UNORM_BLOCK = 141;
+static const uint32_t VK_FORMAT_BC7_UNORM_BLOCK = 145;
+static const uint32_t VK_FORMAT_BC7_SRGB_BLOCK = 146;
+
+// Data Format Descriptor values (Khronos Data Format Specification)
+static const uint32_t KHR_DF_MODEL_BC1A = 128;
+static const uint32_t KHR_DF_MODEL_BC5 = 131;
+static const uint32_t KHR_DF_MODEL_BC7 = 133;
+static const uint32_t KHR_DF_PRIMARIES_BT709 = 1;
+static const uint32_t KHR_DF_TRANSFER_LINEAR = 1;
+static const uint32_t KHR_DF_TRANSFER_SRGB = 2;
+
+struct Ktx2Header
+{
+  unsigned char identifier[12];
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t layerCount;
+  uint32_t faceCount;
+  uint32_t levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset;
+  uint32_t dfdByteLength;
+  uint32_t kvdByteOffset;
+  uint32_t kvdByteLength;
+  uint64_t sgdByteOffset;
+  uint64_t sgdByteLength;
+};
+
+static_assert(sizeof(Ktx2Header) == 80, "KTX2 header must not be padded");
+
+struct Ktx2LevelIndex
+{
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+static bool getBlockFormat(uint32_t vkFormat, BlockFormat &format,
+    GLenum &internalFormat)
+{
+  switch (vkFormat) {
+  case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+  case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    format = BlockFormat::BC1;
+    internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    return true;
+  case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+  case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    format = BlockFormat::BC1;
+    internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+    return true;
+  case VK_FORMAT_BC5_UNORM_BLOCK:
+    format = BlockFormat::BC5;
+    internalFormat = GL_COMPRESSED_RG_RGTC2;
+    return true;
+  case VK_FORMAT_BC7_UNORM_BLOCK:
+  case VK_FORMAT_BC7_SRGB_BLOCK:
+    format = BlockFormat::BC7;
+    internalFormat = GL_COMPRESSED_RGBA_BPTC_UNORM;
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool isKtx2(const unsigned char *bytes, size_t size)
+{
+  return size >= sizeof(KTX2_IDENTIFIER) &&
+         std::memcmp(bytes, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0;
+}
+
+bool parseKtx2(const unsigned char *bytes, size_t size, Ktx2Image &image,
+    std::string &err)
+{
+  Ktx2Header header;
+  if (!isKtx2(bytes, size) || size < sizeof(header)) {
+    err = "not a KTX2 file";
+    return false;
+  }
+  std::memcpy(&header, bytes, sizeof(header));
+
+  if (header.supercompressionScheme != 0) {
+    err = "supercompressed KTX2 (Basis Universal, zstd) is not supported";
+    return false;
+  }
+
+  BlockFormat format;
+  if (!getBlockFormat(header.vkFormat, format, image.internalFormat)) {
+    err = "unsupported KTX2 format " + std::to_string(header.vkFormat) +
+          " (expected BC1, BC5 or BC7)";
+    return false;
+  }
+
+  if (header.pixelWidth == 0 || header.pixelHeight == 0 ||
+      header.pixelDepth != 0 || header.layerCount > 1 ||
+      header.faceCount != 1) {
+    err = "only 2D KTX2 textures are supported";
+    return false;
+  }
+
+  // 0 asks the loader to generate the levels, which is not possible here
+  // A 32-bit size has at most 32 levels, the shift below needs fewer than 33
+  const auto levelCount = std::max(header.levelCount, 1u);
+  if (levelCount > 32 ||
+      sizeof(header) + uint64_t(levelCount) * sizeof(Ktx2LevelIndex) > size ||
+      (std::max(header.pixelWidth, header.pixelHeight) >> (levelCount - 1)) ==
+          0) {
+    err = "invalid KTX2 level count";
+    return false;
+  }
+
+  image.vkFormat = header.vkFormat;
+  image.levels.clear();
+
+  for (uint32_t level = 0; level < levelCount; ++level) {
+    Ktx2LevelIndex index;
+    std::memcpy(&index,
+        bytes + sizeof(header) + level * sizeof(Ktx2LevelIndex),
+        sizeof(index));
+
+    const auto width = std::max(header.pixelWidth >> level, 1u);
+    const auto height = std::max(header.pixelHeight >> level, 1u);
+    const auto byteSize = getCompressedByteSize(format, width, height);
+
+    if (index.byteLength < byteSize || index.byteOffset > size ||
+        index.byteLength > size - index.byteOffset) {
+      err = "KTX2 level " + std::to_string(level) + " is out of the file";
+      return false;
+    }
+
+    image.levels.push_back(
+        Ktx2Level{width, height, bytes + index.byteOffset, byteSize});
+  }
+
+  return true;
+}
+
+// Basic data format descriptor of a block compressed format
+static std::vector<uint32_t> getDataFormatDescriptor(
+    BlockFormat format, bool srgb)
+{
+  uint32_t colorModel = KHR_DF_MODEL_BC7;
+  uint32_t sampleCount = 1;
+  if (format == BlockFormat::BC1) {
+    colorModel = KHR_DF_MODEL_BC1A;
+  } else if (format == BlockFormat::BC5) {
+    colorModel = KHR_DF_MODEL_BC5;
+    sampleCount = 2; // Red and green, one BC4 block each
+  }
+
+  const uint32_t blockSize = 24 + 16 * sampleCount;
+  const auto bytesPlane0 = uint32_t(getBlockByteSize(format));
+  const auto transfer = srgb ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR;
+
+  std::vector<uint32_t> words = {
+      4 + blockSize, // dfdTotalSize
+      0, // vendorId, descriptorType
+      2 | (blockSize << 16), // versionNumber, descriptorBlockSize
+      colorModel | (KHR_DF_PRIMARIES_BT709 << 8) | (transfer << 16),
+      3 | (3 << 8), // 4x4 texel blocks
+      bytesPlane0,
+      0,
+  };
+
+  const auto bitLength = uint32_t(bytesPlane0 * 8 / sampleCount);
+  for (uint32_t sample = 0; sample < sampleCount; ++sample) {
+    // bitOffset, bitLength - 1, channel (color for BC1 and BC7, red then
+    // green for BC5)
+    words.push_back((sample * bitLength) | ((bitLength - 1) << 16) |
+                    (sample << 24));
+    words.push_back(0); // samplePosition
+    words.push_back(0); // sampleLower
+    words.push_back(0xFFFFFFFF); // sampleUpper
+  }
+
+  return words;
+}
+
+std::vector<unsigned char> writeKtx2(BlockFormat format, bool srgb,
+    uint32_t width, uint32_t height,
+    const std::vector<std::vector<uint8_t>> &levels)
+{
+  const auto dfd = getDataFormatDescriptor(format, srgb);
+  const auto dfdByteSize = dfd.size() * sizeof(uint32_t);
+
+  Ktx2Header header{};
+  std::memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+  switch (format) {
+  case BlockFormat::BC1:
+    header.vkFormat =
+        srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    break;
+  case BlockFormat::BC5:
+    header.vkFormat = VK_FORMAT_BC5_UNORM_BLOCK;
+    break;
+  case BlockFormat::BC7:
+    header.vkFormat =
+        srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+    break;
+  }
+  header.typeSize = 1;
+  header.pixelWidth = width;
+  header.pixelHeight = height;
+  header.faceCount = 1;
+  header.levelCount = uint32_t(levels.size());
+  header.dfdByteOffset =
+      uint32_t(sizeof(header) + levels.size() * sizeof(Ktx2LevelIndex));
+  header.dfdByteLength = uint32_t(dfdByteSize);
+
+  std::vector<unsigned char> bytes(header.dfdByteOffset + dfdByteSize);
+  std::memcpy(bytes.data(), &header, sizeof(header));
+  std::memcpy(bytes.data() + header.dfdByteOffset, dfd.data(), dfdByteSize);
+
+  // Level data is stored coarsest first, each level aligned on a block
+  const auto alignment = getBlockByteSize(format);
+  std::vector<Ktx2LevelIndex> index(levels.size());
+
+  for (size_t level = levels.size(); level-- > 0;) {
+    const auto offset = (bytes.size() + alignment - 1) / alignment * alignment;
+    bytes.resize(offset);
+    bytes.insert(bytes.end(), levels[level].begin(), levels[level].end());
+
+    index[level] = Ktx2LevelIndex{
+        offset, levels[level].size(), levels[level].size()};
+  }
+
+  std::memcpy(bytes.data() + sizeof(header), index.data(),
+      index.size() * sizeof(Ktx2LevelIndex));
+
+  return bytes;
+}
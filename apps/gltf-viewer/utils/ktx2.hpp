@@ -0,0 +1,46 @@
+#pragma once
+
+#include "bcn.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+
+// KTX 2.0 container for block compressed 2D textures
+// https://github.khronos.org/KTX-Specification/
+//
+// Only what the texcompress command writes is read back: BC1, BC5 or BC7
+// data without supercompression. Basis Universal supercompressed files
+// (ETC1S, UASTC) would need a transcoder and are rejected.
+
+struct Ktx2Level
+{
+  uint32_t width;
+  uint32_t height;
+  const unsigned char *data;
+  size_t byteSize;
+};
+
+struct Ktx2Image
+{
+  uint32_t vkFormat = 0;
+  GLenum internalFormat = 0;
+  std::vector<Ktx2Level> levels; // Finest first
+};
+
+bool isKtx2(const unsigned char *bytes, size_t size);
+
+// Read the header and level index of a KTX2 file. The levels point in bytes,
+// which must outlive image. Returns false and describes the problem in err if
+// the file is invalid or its format is not supported.
+bool parseKtx2(const unsigned char *bytes, size_t size, Ktx2Image &image,
+    std::string &err);
+
+// KTX2 file holding the levels (finest first) of a width * height texture
+// compressed in format. srgb only tags the data with the sRGB transfer
+// function: the shaders decode it, so both read back as UNORM formats.
+std::vector<unsigned char> writeKtx2(BlockFormat format, bool srgb,
+    uint32_t width, uint32_t height,
+    const std::vector<std::vector<uint8_t>> &levels);
@@ -0,0 +1,270 @@
+#include "lights.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// Radiance under which a light without range no longer lights anything
+static const float LIGHT_CUTOFF_RADIANCE = 0.01f;
+
+static const int LIGHT_CLUSTER_TILE_COUNT =
+    LIGHT_CLUSTER_COUNT_X * LIGHT_CLUSTER_COUNT_Y;
+
+std::vector<PunctualLight> collectPunctualLights(
+    const tinygltf::Model &model, const SceneGraph &sceneGraph)
+{
+  std::vector<PunctualLight> lights;
+  const auto &nodeIndices = sceneGraph.nodeIndices();
+
+  for (size_t i = 0; i < nodeIndices.size(); ++i) {
+    // https://github.com/KhronosGroup/glTF/tree/master/extensions/2.0/Khronos/KHR_lights_punctual
+    const auto &node = model.nodes[nodeIndices[i]];
+    const auto extension = node.extensions.find("KHR_lights_punctual");
+    if (extension == node.extensions.end() ||
+        !extension->second.Has("light") ||
+        !extension->second.Get("light").IsNumber()) {
+      continue;
+    }
+
+    const auto lightIndex = extension->second.Get("light").GetNumberAsInt();
+    if (lightIndex < 0 || size_t(lightIndex) >= model.lights.size()) {
+      std::cerr << "Warning: node " << nodeIndices[i]
+                << " references missing light " << lightIndex << std::endl;
+      continue;
+    }
+
+    const auto &light = model.lights[lightIndex];
+    const auto &worldMatrix = sceneGraph.worldMatrices()[i];
+
+    glm::vec3 color(1);
+    if (light.color.size() >= 3) {
+      color = glm::vec3(light.color[0], light.color[1], light.color[2]);
+    }
+
+    PunctualLight punctualLight;
+    punctualLight.position = glm::vec3(worldMatrix[3]);
+    punctualLight.direction =
+        glm::normalize(glm::vec3(worldMatrix * glm::vec4(0, 0, -1, 0)));
+    punctualLight.radiance = color * float(light.intensity);
+    punctualLight.range = 0;
+    punctualLight.coneScale = 0;
+    punctualLight.coneOffset = 1;
+
+    const auto maxRadiance =
+        std::max(punctualLight.radiance.r,
+            std::max(punctualLight.radiance.g, punctualLight.radiance.b));
+    if (maxRadiance <= 0) {
+      continue;
+    }
+
+    if (light.type != "directional") {
+      // Inverse square falloff, windowed to 0 at the range
+      punctualLight.range =
+          light.range > 0 ? float(light.range)
+                          : std::sqrt(maxRadiance / LIGHT_CUTOFF_RADIANCE);
+    }
+
+    if (light.type == "spot") {
+      const auto cosOuter = std::cos(float(light.spot.outerConeAngle));
+      const auto cosInner = std::cos(float(light.spot.innerConeAngle));
+      punctualLight.coneScale = 1.f / std::max(cosInner - cosOuter, 0.001f);
+      punctualLight.coneOffset = -cosOuter * punctualLight.coneScale;
+    }
+
+    lights.push_back(punctualLight);
+  }
+
+  return lights;
+}
+
+LightClusters::LightClusters()
+{
+  static const GLenum formats[3] = {GL_RG32UI, GL_R32UI, GL_RGBA32F};
+
+  glGenBuffers(3, m_buffers);
+  glGenTextures(3, m_textures);
+
+  for (size_t i = 0; i < 3; ++i) {
+    glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+    glBufferData(GL_TEXTURE_BUFFER, 0, nullptr, GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+    glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_buffers[i]);
+  }
+
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  m_sliceLists.resize(LIGHT_CLUSTER_COUNT_Z,
+      std::vector<std::vector<uint32_t>>(LIGHT_CLUSTER_TILE_COUNT));
+}
+
+LightClusters::~LightClusters()
+{
+  glDeleteTextures(3, m_textures);
+  glDeleteBuffers(3, m_buffers);
+}
+
+void LightClusters::update(const std::vector<PunctualLight> &lights,
+    const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix, GLsizei width,
+    GLsizei height, ThreadPool &pool)
+{
+  // Planes of glm::perspective: projMatrix[2][2] = -(far + near) / (far -
+  // near) and projMatrix[3][2] = -2 * far * near / (far - near)
+  const auto zNear = projMatrix[3][2] / (projMatrix[2][2] - 1.f);
+  const auto zFar = projMatrix[3][2] / (projMatrix[2][2] + 1.f);
+  const auto logDepthRatio = std::log(zFar / zNear);
+
+  m_depthScale = LIGHT_CLUSTER_COUNT_Z / logDepthRatio;
+  m_depthBias = -LIGHT_CLUSTER_COUNT_Z * std::log(zNear) / logDepthRatio;
+  m_tileSize = glm::vec2(float(width) / LIGHT_CLUSTER_COUNT_X,
+      float(height) / LIGHT_CLUSTER_COUNT_Y);
+
+  const auto getSliceDepth = [&](int slice) {
+    return zNear * std::exp(slice / m_depthScale);
+  };
+  const auto getDepthSlice = [&](float depth) {
+    return std::min(std::max(int(std::floor(std::log(depth) * m_depthScale +
+                                             m_depthBias)),
+                        0),
+        LIGHT_CLUSTER_COUNT_Z - 1);
+  };
+
+  m_viewLights.clear();
+  m_lightData.clear();
+
+  for (const auto &light : lights) {
+    m_lightData.emplace_back(light.position, light.range);
+    m_lightData.emplace_back(light.radiance, light.coneScale);
+    m_lightData.emplace_back(light.direction, light.coneOffset);
+
+    // Spot lights are bounded by their sphere too, conservatively
+    ViewLight viewLight;
+    viewLight.center = glm::vec3(viewMatrix * glm::vec4(light.position, 1));
+    viewLight.radius = light.range;
+    viewLight.firstSlice = 0;
+    viewLight.lastSlice = LIGHT_CLUSTER_COUNT_Z - 1;
+
+    if (light.range > 0) {
+      const auto minDepth = -viewLight.center.z - light.range;
+      const auto maxDepth = -viewLight.center.z + light.range;
+
+      if (maxDepth < zNear || minDepth > zFar) {
+        viewLight.firstSlice = 1;
+        viewLight.lastSlice = 0;
+      } else {
+        viewLight.firstSlice = getDepthSlice(std::max(minDepth, zNear));
+        viewLight.lastSlice = getDepthSlice(std::min(maxDepth, zFar));
+      }
+    }
+
+    m_viewLights.push_back(viewLight);
+  }
+
+  // x and y in view space are ndc * depth / projMatrix[0][0] (resp. [1][1])
+  const glm::vec2 projScale(projMatrix[0][0], projMatrix[1][1]);
+  const glm::ivec2 tileCount(LIGHT_CLUSTER_COUNT_X, LIGHT_CLUSTER_COUNT_Y);
+
+  pool.parallelFor(LIGHT_CLUSTER_COUNT_Z, [&](size_t sliceIdx) {
+    const auto slice = int(sliceIdx);
+    auto &lists = m_sliceLists[slice];
+    for (auto &list : lists) {
+      list.clear();
+    }
+
+    const auto sliceNear = getSliceDepth(slice);
+    const auto sliceFar = getSliceDepth(slice + 1);
+
+    for (uint32_t l = 0; l < uint32_t(m_viewLights.size()); ++l) {
+      const auto &light = m_viewLights[l];
+      if (slice < light.firstSlice || slice > light.lastSlice) {
+        continue;
+      }
+
+      // Directional lights are in every cluster
+      if (light.radius <= 0) {
+        for (auto &list : lists) {
+          list.push_back(l);
+        }
+        continue;
+      }
+
+      // Screen bounds of the part of the sphere in the slice: x / depth is
+      // extreme at the nearest or farthest depth
+      const auto depthNear = std::max(sliceNear, -light.center.z - light.radius);
+      const auto depthFar = std::min(sliceFar, -light.center.z + light.radius);
+      const glm::vec2 center(light.center);
+      const auto boundsMin =
+          glm::min((center - light.radius) / depthNear,
+              (center - light.radius) / depthFar) *
+          projScale;
+      const auto boundsMax =
+          glm::max((center + light.radius) / depthNear,
+              (center + light.radius) / depthFar) *
+          projScale;
+
+      if (glm::any(glm::lessThan(boundsMax, glm::vec2(-1))) ||
+          glm::any(glm::greaterThan(boundsMin, glm::vec2(1)))) {
+        continue;
+      }
+
+      const auto firstTile = glm::clamp(
+          glm::ivec2(glm::floor((boundsMin * 0.5f + 0.5f) * glm::vec2(tileCount))),
+          glm::ivec2(0), tileCount - 1);
+      const auto lastTile = glm::clamp(
+          glm::ivec2(glm::floor((boundsMax * 0.5f + 0.5f) * glm::vec2(tileCount))),
+          glm::ivec2(0), tileCount - 1);
+
+      for (int y = firstTile.y; y <= lastTile.y; ++y) {
+        for (int x = firstTile.x; x <= lastTile.x; ++x) {
+          // View space bounding box of the froxel
+          const auto ndcMin =
+              glm::vec2(x, y) / glm::vec2(tileCount) * 2.f - 1.f;
+          const auto ndcMax =
+              glm::vec2(x + 1, y + 1) / glm::vec2(tileCount) * 2.f - 1.f;
+          const auto xyMin =
+              glm::min(ndcMin * sliceNear, ndcMin * sliceFar) / projScale;
+          const auto xyMax =
+              glm::max(ndcMax * sliceNear, ndcMax * sliceFar) / projScale;
+          const glm::vec3 froxelMin(xyMin, -sliceFar);
+          const glm::vec3 froxelMax(xyMax, -sliceNear);
+
+          const auto closest =
+              glm::clamp(light.center, froxelMin, froxelMax) - light.center;
+          if (glm::dot(closest, closest) <= light.radius * light.radius) {
+            lists[y * LIGHT_CLUSTER_COUNT_X + x].push_back(l);
+          }
+        }
+      }
+    }
+  });
+
+  m_clusters.resize(LIGHT_CLUSTER_COUNT_Z * LIGHT_CLUSTER_TILE_COUNT);
+  m_lightIndices.clear();
+  m_maxClusterLightCount = 0;
+
+  for (int slice = 0; slice < LIGHT_CLUSTER_COUNT_Z; ++slice) {
+    for (int tile = 0; tile < LIGHT_CLUSTER_TILE_COUNT; ++tile) {
+      const auto &list = m_sliceLists[slice][tile];
+      m_clusters[slice * LIGHT_CLUSTER_TILE_COUNT + tile] =
+          glm::uvec2(m_lightIndices.size(), list.size());
+      m_lightIndices.insert(m_lightIndices.end(), list.begin(), list.end());
+      m_maxClusterLightCount = std::max(m_maxClusterLightCount, list.size());
+    }
+  }
+
+  m_lightCount = lights.size();
+
+  // Orphaned every frame, the previous content may still be in use
+  const GLsizeiptr sizes[3] = {
+      GLsizeiptr(m_clusters.size() * sizeof(glm::uvec2)),
+      GLsizeiptr(m_lightIndices.size() * sizeof(uint32_t)),
+      GLsizeiptr(m_lightData.size() * sizeof(glm::vec4))};
+  const void *data[3] = {
+      m_clusters.data(), m_lightIndices.data(), m_lightData.data()};
+
+  for (size_t i = 0; i < 3; ++i) {
+    glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+    glBufferData(GL_TEXTURE_BUFFER, sizes[i], data[i], GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
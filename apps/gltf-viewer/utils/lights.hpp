@@ -0,0 +1,108 @@
+#pragma once
+
+#include "ThreadPool.hpp"
+#include "scene_graph.hpp"
+
+#include <cstdint>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+#include <vector>
+
+// Size of the cluster grid of LightClusters: screen tiles along x and y, and
+// depth slices (spaced exponentially between the near and far planes)
+#define LIGHT_CLUSTER_COUNT_X 16
+#define LIGHT_CLUSTER_COUNT_Y 9
+#define LIGHT_CLUSTER_COUNT_Z 24
+
+// A KHR_lights_punctual light placed by a node of the scene graph
+struct PunctualLight
+{
+  glm::vec3 position; // World space
+  glm::vec3 direction; // World space, where the light points (-z of its node)
+  glm::vec3 radiance; // color * intensity
+  // Radius of influence: the range of the light, or for lights without range
+  // the distance at which their radiance falls under a small threshold. 0 for
+  // directional lights, which reach everything.
+  float range;
+  // Spot cone attenuation clamp(cos(angle) * scale + offset, 0, 1), squared.
+  // 0 and 1 for point lights.
+  float coneScale;
+  float coneOffset;
+};
+
+// Lights of the nodes of sceneGraph referencing one of model.lights, with the
+// cached world matrices of the graph
+std::vector<PunctualLight> collectPunctualLights(
+    const tinygltf::Model &model, const SceneGraph &sceneGraph);
+
+// Clustered forward shading: the view frustum is split in a grid of froxels
+// (a screen tile times a depth slice), and each one gets the list of the
+// lights whose sphere of influence intersects it. The fragment shader only
+// loops over the lights of its cluster, so hundreds of lights cost a few per
+// fragment.
+//
+// The grid is rebuilt on the CPU every frame, one depth slice per task of the
+// pool, then uploaded to three texture buffers read with texelFetch:
+// - clusterTexture(): GL_RG32UI, (first index, light count) of each cluster,
+//   cluster (x, y, z) at (z * LIGHT_CLUSTER_COUNT_Y + y) *
+//   LIGHT_CLUSTER_COUNT_X + x
+// - lightIndexTexture(): GL_R32UI, the concatenated light lists
+// - lightTexture(): GL_RGBA32F, 3 texels per light: (position, range),
+//   (radiance, coneScale), (direction, coneOffset)
+class LightClusters
+{
+public:
+  LightClusters();
+  ~LightClusters();
+
+  LightClusters(const LightClusters &) = delete;
+  LightClusters &operator=(const LightClusters &) = delete;
+
+  // Bin lights for a perspective projMatrix (as built by glm::perspective)
+  // and a viewport of width x height pixels, then upload the result
+  void update(const std::vector<PunctualLight> &lights,
+      const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix, GLsizei width,
+      GLsizei height, ThreadPool &pool);
+
+  GLuint clusterTexture() const { return m_textures[0]; }
+  GLuint lightIndexTexture() const { return m_textures[1]; }
+  GLuint lightTexture() const { return m_textures[2]; }
+
+  // Mapping of a fragment to its cluster: slice = log(view depth) *
+  // depthScale + depthBias, tile = gl_FragCoord.xy / tileSize
+  float depthScale() const { return m_depthScale; }
+  float depthBias() const { return m_depthBias; }
+  glm::vec2 tileSize() const { return m_tileSize; }
+
+  // Statistics of the last update
+  size_t lightCount() const { return m_lightCount; }
+  size_t lightIndexCount() const { return m_lightIndices.size(); }
+  size_t maxClusterLightCount() const { return m_maxClusterLightCount; }
+
+private:
+  // Light sphere in view space, and the range of depth slices it overlaps
+  struct ViewLight
+  {
+    glm::vec3 center;
+    float radius;
+    int firstSlice;
+    int lastSlice;
+  };
+
+  std::vector<ViewLight> m_viewLights;
+  // Light lists of each cluster of a slice, filled by its task
+  std::vector<std::vector<std::vector<uint32_t>>> m_sliceLists;
+  std::vector<glm::uvec2> m_clusters;
+  std::vector<uint32_t> m_lightIndices;
+  std::vector<glm::vec4> m_lightData;
+
+  GLuint m_buffers[3] = {0, 0, 0};
+  GLuint m_textures[3] = {0, 0, 0};
+
+  float m_depthScale = 0;
+  float m_depthBias = 0;
+  glm::vec2 m_tileSize = glm::vec2(1);
+  size_t m_lightCount = 0;
+  size_t m_maxClusterLightCount = 0;
+};
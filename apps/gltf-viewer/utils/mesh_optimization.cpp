@@ -0,0 +1,825 @@
+#include "mesh_optimization.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <tuple>
+
+// Forsyth's scoring: an LRU cache a bit larger than the hardware one, the
+// vertices of the last triangle get a fixed score, the others decay with
+// their position, and vertices with few triangles left get a boost so that
+// no isolated triangle is left behind
+static const size_t FORSYTH_CACHE_SIZE = 32;
+static const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+static const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+static const float FORSYTH_VALENCE_BOOST_SCALE = 2.f;
+static const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+static const size_t FORSYTH_VALENCE_TABLE_SIZE = 64;
+
+static const uint32_t NO_TRIANGLE = std::numeric_limits<uint32_t>::max();
+static const uint32_t NO_VERTEX = std::numeric_limits<uint32_t>::max();
+
+namespace {
+
+// FIFO cache simulation: a vertex is in the cache if fewer than cacheSize
+// misses happened since it has been transformed
+class VertexCacheSimulation
+{
+public:
+  VertexCacheSimulation(size_t vertexCount, size_t cacheSize) :
+      m_timestamps(vertexCount, 0),
+      m_cacheSize(uint32_t(cacheSize)),
+      m_timestamp(uint32_t(cacheSize) + 1)
+  {
+  }
+
+  // Returns 1 if the vertex has to be transformed
+  uint32_t transform(uint32_t vertex)
+  {
+    if (m_timestamp - m_timestamps[vertex] > m_cacheSize) {
+      m_timestamps[vertex] = m_timestamp++;
+      return 1;
+    }
+    return 0;
+  }
+
+  uint32_t transformTriangle(const uint32_t *triangle)
+  {
+    return transform(triangle[0]) + transform(triangle[1]) +
+           transform(triangle[2]);
+  }
+
+  void flush() { m_timestamp += m_cacheSize + 1; }
+
+private:
+  std::vector<uint32_t> m_timestamps;
+  uint32_t m_cacheSize;
+  uint32_t m_timestamp;
+};
+
+struct ForsythScoreTables
+{
+  float cache[FORSYTH_CACHE_SIZE];
+  float valence[FORSYTH_VALENCE_TABLE_SIZE];
+
+  ForsythScoreTables()
+  {
+    for (size_t i = 0; i < FORSYTH_CACHE_SIZE; ++i) {
+      cache[i] = i < 3 ? FORSYTH_LAST_TRIANGLE_SCORE
+                       : std::pow(1.f - float(i - 3) / (FORSYTH_CACHE_SIZE - 3),
+                             FORSYTH_CACHE_DECAY_POWER);
+    }
+    valence[0] = 0;
+    for (size_t i = 1; i < FORSYTH_VALENCE_TABLE_SIZE; ++i) {
+      valence[i] = FORSYTH_VALENCE_BOOST_SCALE *
+                   std::pow(float(i), -FORSYTH_VALENCE_BOOST_POWER);
+    }
+  }
+};
+
+} // namespace
+
+static float getForsythScore(int cachePosition, uint32_t remainingTriangles)
+{
+  static const ForsythScoreTables tables;
+
+  if (remainingTriangles == 0) {
+    return -1.f;
+  }
+
+  const auto valence =
+      remainingTriangles < FORSYTH_VALENCE_TABLE_SIZE
+          ? tables.valence[remainingTriangles]
+          : FORSYTH_VALENCE_BOOST_SCALE *
+                std::pow(float(remainingTriangles),
+                    -FORSYTH_VALENCE_BOOST_POWER);
+
+  return (cachePosition >= 0 ? tables.cache[cachePosition] : 0.f) + valence;
+}
+
+VertexCacheStatistics analyzeVertexCache(const uint32_t *indices,
+    size_t indexCount, size_t vertexCount, size_t cacheSize)
+{
+  VertexCacheStatistics statistics;
+  statistics.triangleCount = indexCount / 3;
+
+  VertexCacheSimulation cache(vertexCount, cacheSize);
+  std::vector<uint8_t> referenced(vertexCount, 0);
+
+  for (size_t i = 0; i < statistics.triangleCount * 3; ++i) {
+    statistics.transformCount += cache.transform(indices[i]);
+    if (!referenced[indices[i]]) {
+      referenced[indices[i]] = 1;
+      ++statistics.vertexCount;
+    }
+  }
+
+  return statistics;
+}
+
+void optimizeVertexCache(
+    uint32_t *indices, size_t indexCount, size_t vertexCount)
+{
+  const auto triangleCount = indexCount / 3;
+  if (triangleCount == 0) {
+    return;
+  }
+
+  // Triangles of each vertex, those not emitted yet first
+  std::vector<uint32_t> remainingTriangles(vertexCount, 0);
+  for (size_t i = 0; i < triangleCount * 3; ++i) {
+    ++remainingTriangles[indices[i]];
+  }
+
+  std::vector<uint32_t> triangleOffsets(vertexCount + 1, 0);
+  std::partial_sum(remainingTriangles.begin(), remainingTriangles.end(),
+      triangleOffsets.begin() + 1);
+
+  std::vector<uint32_t> vertexTriangles(triangleCount * 3);
+  {
+    std::vector<uint32_t> cursors(
+        triangleOffsets.begin(), triangleOffsets.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+      vertexTriangles[cursors[indices[i]]++] = uint32_t(i / 3);
+    }
+  }
+
+  std::vector<float> vertexScores(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    vertexScores[v] = getForsythScore(-1, remainingTriangles[v]);
+  }
+
+  // Sums of the scores of their vertices, kept up to date
+  std::vector<float> triangleScores(triangleCount);
+  for (size_t t = 0; t < triangleCount; ++t) {
+    triangleScores[t] = vertexScores[indices[3 * t + 0]] +
+                        vertexScores[indices[3 * t + 1]] +
+                        vertexScores[indices[3 * t + 2]];
+  }
+
+  const auto setVertexScore = [&](uint32_t vertex, float score) {
+    const auto delta = score - vertexScores[vertex];
+    vertexScores[vertex] = score;
+    const auto *begin = &vertexTriangles[triangleOffsets[vertex]];
+    const auto *end = begin + remainingTriangles[vertex];
+    for (const auto *t = begin; t != end; ++t) {
+      triangleScores[*t] += delta;
+    }
+  };
+
+  // Start with the triangle of the least connected vertices
+  auto bestTriangle = uint32_t(
+      std::max_element(triangleScores.begin(), triangleScores.end()) -
+      triangleScores.begin());
+
+  std::vector<uint32_t> output;
+  output.reserve(triangleCount * 3);
+  std::vector<uint8_t> emitted(triangleCount, 0);
+
+  uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+  uint32_t newCache[FORSYTH_CACHE_SIZE + 3];
+  size_t cacheCount = 0;
+  size_t deadEndCursor = 0;
+
+  for (size_t n = 0; n < triangleCount; ++n) {
+    // Nothing left around the cache: continue with the next triangle in
+    // input order, which is usually close anyway
+    if (bestTriangle == NO_TRIANGLE) {
+      while (emitted[deadEndCursor]) {
+        ++deadEndCursor;
+      }
+      bestTriangle = uint32_t(deadEndCursor);
+    }
+
+    const auto *triangle = indices + 3 * bestTriangle;
+    output.insert(output.end(), triangle, triangle + 3);
+    emitted[bestTriangle] = 1;
+
+    // Once per corner, degenerate triangles are listed twice by a vertex
+    for (size_t k = 0; k < 3; ++k) {
+      const auto vertex = triangle[k];
+      auto *begin = &vertexTriangles[triangleOffsets[vertex]];
+      auto *end = begin + remainingTriangles[vertex];
+      std::iter_swap(std::find(begin, end, bestTriangle), end - 1);
+      --remainingTriangles[vertex];
+    }
+
+    // The vertices of the triangle move to the front of the cache
+    size_t newCacheCount = 0;
+    for (size_t k = 0; k < 3; ++k) {
+      if (std::find(newCache, newCache + newCacheCount, triangle[k]) ==
+          newCache + newCacheCount) {
+        newCache[newCacheCount++] = triangle[k];
+      }
+    }
+    for (size_t c = 0; c < cacheCount; ++c) {
+      if (cache[c] != triangle[0] && cache[c] != triangle[1] &&
+          cache[c] != triangle[2]) {
+        newCache[newCacheCount++] = cache[c];
+      }
+    }
+
+    for (size_t c = FORSYTH_CACHE_SIZE; c < newCacheCount; ++c) {
+      const auto vertex = newCache[c];
+      setVertexScore(vertex, getForsythScore(-1, remainingTriangles[vertex]));
+    }
+
+    cacheCount = std::min(newCacheCount, FORSYTH_CACHE_SIZE);
+    std::copy(newCache, newCache + cacheCount, cache);
+
+    for (size_t c = 0; c < cacheCount; ++c) {
+      const auto vertex = cache[c];
+      setVertexScore(
+          vertex, getForsythScore(int(c), remainingTriangles[vertex]));
+    }
+
+    // Only the triangles of cached vertices have a new score
+    bestTriangle = NO_TRIANGLE;
+    auto bestScore = -std::numeric_limits<float>::max();
+    for (size_t c = 0; c < cacheCount; ++c) {
+      const auto vertex = cache[c];
+      const auto *begin = &vertexTriangles[triangleOffsets[vertex]];
+      const auto *end = begin + remainingTriangles[vertex];
+      for (const auto *t = begin; t != end; ++t) {
+        const auto score = triangleScores[*t];
+        if (score > bestScore) {
+          bestScore = score;
+          bestTriangle = *t;
+        }
+      }
+    }
+  }
+
+  std::copy(output.begin(), output.end(), indices);
+}
+
+void optimizeOverdraw(uint32_t *indices, size_t indexCount,
+    const glm::vec3 *positions, size_t vertexCount, float threshold)
+{
+  const auto triangleCount = indexCount / 3;
+  if (triangleCount == 0) {
+    return;
+  }
+
+  VertexCacheSimulation cache(vertexCount, VERTEX_CACHE_SIZE);
+
+  // A triangle missing its three vertices starts a new patch of the mesh
+  std::vector<size_t> patches;
+  for (size_t t = 0; t < triangleCount; ++t) {
+    if (cache.transformTriangle(indices + 3 * t) == 3 || t == 0) {
+      patches.push_back(t);
+    }
+  }
+  patches.push_back(triangleCount);
+
+  // Patches are split further as soon as a run of triangles is about as
+  // cache efficient as the whole patch
+  std::vector<size_t> clusters;
+  for (size_t p = 0; p + 1 < patches.size(); ++p) {
+    const auto begin = patches[p];
+    const auto end = patches[p + 1];
+
+    cache.flush();
+    size_t patchTransforms = 0;
+    for (auto t = begin; t < end; ++t) {
+      patchTransforms += cache.transformTriangle(indices + 3 * t);
+    }
+    const auto clusterThreshold =
+        threshold * float(patchTransforms) / float(end - begin);
+
+    cache.flush();
+    clusters.push_back(begin);
+    size_t runTransforms = 0;
+    size_t runTriangles = 0;
+    for (auto t = begin; t < end; ++t) {
+      runTransforms += cache.transformTriangle(indices + 3 * t);
+      ++runTriangles;
+      if (t + 1 < end &&
+          float(runTransforms) <= clusterThreshold * float(runTriangles)) {
+        clusters.push_back(t + 1);
+        cache.flush();
+        runTransforms = 0;
+        runTriangles = 0;
+      }
+    }
+  }
+  clusters.push_back(triangleCount);
+
+  const auto clusterCount = clusters.size() - 1;
+
+  // Area weighted centroid and normal of each cluster
+  std::vector<glm::vec3> centroids(clusterCount, glm::vec3(0));
+  std::vector<glm::vec3> normals(clusterCount, glm::vec3(0));
+  glm::vec3 meshCentroid(0);
+  float meshArea = 0;
+
+  for (size_t c = 0; c < clusterCount; ++c) {
+    float area = 0;
+    glm::vec3 centroidSum(0);
+    glm::vec3 averageCentroid(0);
+
+    for (auto t = clusters[c]; t < clusters[c + 1]; ++t) {
+      const auto &p0 = positions[indices[3 * t + 0]];
+      const auto &p1 = positions[indices[3 * t + 1]];
+      const auto &p2 = positions[indices[3 * t + 2]];
+      const auto cross = glm::cross(p1 - p0, p2 - p0);
+      const auto triangleArea = 0.5f * glm::length(cross);
+      const auto triangleCentroid = (p0 + p1 + p2) / 3.f;
+
+      area += triangleArea;
+      centroidSum += triangleCentroid * triangleArea;
+      averageCentroid += triangleCentroid;
+      normals[c] += cross;
+    }
+
+    centroids[c] = area > 0 ? centroidSum / area
+                            : averageCentroid /
+                                  float(clusters[c + 1] - clusters[c]);
+    meshCentroid += centroidSum;
+    meshArea += area;
+  }
+
+  if (meshArea > 0) {
+    meshCentroid /= meshArea;
+  }
+
+  // Clusters facing away from the center of the mesh are more likely to
+  // occlude the others
+  std::vector<float> sortKeys(clusterCount, 0.f);
+  for (size_t c = 0; c < clusterCount; ++c) {
+    const auto normalLength = glm::length(normals[c]);
+    if (normalLength > 0) {
+      sortKeys[c] =
+          glm::dot(centroids[c] - meshCentroid, normals[c] / normalLength);
+    }
+  }
+
+  std::vector<size_t> order(clusterCount);
+  std::iota(order.begin(), order.end(), size_t(0));
+  std::stable_sort(order.begin(), order.end(),
+      [&](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+  std::vector<uint32_t> output;
+  output.reserve(triangleCount * 3);
+  for (const auto c : order) {
+    output.insert(output.end(), indices + 3 * clusters[c],
+        indices + 3 * clusters[c + 1]);
+  }
+
+  std::copy(output.begin(), output.end(), indices);
+}
+
+std::vector<uint32_t> optimizeVertexFetch(
+    uint32_t *indices, size_t indexCount, size_t vertexCount)
+{
+  std::vector<uint32_t> remap(vertexCount, NO_VERTEX);
+  uint32_t nextVertex = 0;
+
+  for (size_t i = 0; i < indexCount; ++i) {
+    auto &newIndex = remap[indices[i]];
+    if (newIndex == NO_VERTEX) {
+      newIndex = nextVertex++;
+    }
+    indices[i] = newIndex;
+  }
+
+  for (auto &newIndex : remap) {
+    if (newIndex == NO_VERTEX) {
+      newIndex = nextVertex++;
+    }
+  }
+
+  return remap;
+}
+
+// First element of a non sparse accessor, and the distance between its
+// elements. Returns nullptr if it has no data or does not fit in its buffer.
+static unsigned char *getAccessorData(tinygltf::Model &model,
+    const tinygltf::Accessor &accessor, size_t &elementSize,
+    size_t &byteStride)
+{
+  if (accessor.bufferView < 0 ||
+      size_t(accessor.bufferView) >= model.bufferViews.size() ||
+      accessor.sparse.isSparse || accessor.count == 0) {
+    return nullptr;
+  }
+
+  const auto componentSize =
+      tinygltf::GetComponentSizeInBytes(accessor.componentType);
+  const auto componentCount = tinygltf::GetNumComponentsInType(accessor.type);
+  if (componentSize <= 0 || componentCount <= 0) {
+    return nullptr;
+  }
+
+  const auto &bufferView = model.bufferViews[accessor.bufferView];
+  if (bufferView.buffer < 0 ||
+      size_t(bufferView.buffer) >= model.buffers.size()) {
+    return nullptr;
+  }
+  auto &buffer = model.buffers[bufferView.buffer];
+
+  elementSize = size_t(componentSize) * size_t(componentCount);
+  byteStride = bufferView.byteStride ? bufferView.byteStride : elementSize;
+
+  const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+  if (byteOffset + byteStride * (accessor.count - 1) + elementSize >
+      buffer.data.size()) {
+    return nullptr;
+  }
+
+  return &buffer.data[byteOffset];
+}
+
+// Move each element v of an accessor to remap[v]
+static void remapAccessor(tinygltf::Model &model,
+    const tinygltf::Accessor &accessor, const std::vector<uint32_t> &remap)
+{
+  size_t elementSize;
+  size_t byteStride;
+  auto *data = getAccessorData(model, accessor, elementSize, byteStride);
+
+  std::vector<unsigned char> elements(elementSize * accessor.count);
+  for (size_t v = 0; v < accessor.count; ++v) {
+    std::memcpy(&elements[elementSize * remap[v]], data + byteStride * v,
+        elementSize);
+  }
+  for (size_t v = 0; v < accessor.count; ++v) {
+    std::memcpy(data + byteStride * v, &elements[elementSize * v], elementSize);
+  }
+}
+
+namespace {
+
+struct PrimitiveTask
+{
+  int meshIdx;
+  int primitiveIdx;
+  size_t vertexCount;
+  bool reorderVertices;
+  bool shrinkIndexView;
+};
+
+} // namespace
+
+static bool optimizePrimitive(tinygltf::Model &model, const PrimitiveTask &task,
+    PrimitiveOptimization &result)
+{
+  const auto &primitive =
+      model.meshes[task.meshIdx].primitives[task.primitiveIdx];
+  auto &indexAccessor = model.accessors[primitive.indices];
+
+  size_t indexSize;
+  size_t indexStride;
+  auto *indexData =
+      getAccessorData(model, indexAccessor, indexSize, indexStride);
+  if (!indexData) {
+    return false;
+  }
+
+  std::vector<uint32_t> indices(indexAccessor.count);
+  for (size_t i = 0; i < indices.size(); ++i) {
+    const auto *index = indexData + indexStride * i;
+    switch (indexAccessor.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+      indices[i] = *index;
+      break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+      uint16_t value;
+      std::memcpy(&value, index, sizeof(value));
+      indices[i] = value;
+      break;
+    }
+    default:
+      std::memcpy(&indices[i], index, sizeof(uint32_t));
+      break;
+    }
+
+    if (indices[i] >= task.vertexCount) {
+      return false;
+    }
+  }
+
+  result.meshIdx = task.meshIdx;
+  result.primitiveIdx = task.primitiveIdx;
+  result.before =
+      analyzeVertexCache(indices.data(), indices.size(), task.vertexCount);
+
+  optimizeVertexCache(indices.data(), indices.size(), task.vertexCount);
+
+  const auto position = primitive.attributes.find("POSITION");
+  if (position != primitive.attributes.end()) {
+    const auto &positionAccessor = model.accessors[position->second];
+    size_t positionSize;
+    size_t positionStride;
+    const auto *positionData = getAccessorData(
+        model, positionAccessor, positionSize, positionStride);
+
+    if (positionData &&
+        positionAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT &&
+        positionAccessor.type == TINYGLTF_TYPE_VEC3) {
+      std::vector<glm::vec3> positions(task.vertexCount);
+      for (size_t v = 0; v < positions.size(); ++v) {
+        std::memcpy(&positions[v], positionData + positionStride * v,
+            sizeof(glm::vec3));
+      }
+      optimizeOverdraw(indices.data(), indices.size(), positions.data(),
+          positions.size());
+    }
+  }
+
+  // Every attribute must be in its buffer before anything is moved
+  auto reorderVertices = task.reorderVertices;
+  const auto hasData = [&](int accessorIdx) {
+    size_t elementSize;
+    size_t byteStride;
+    return getAccessorData(model, model.accessors[accessorIdx], elementSize,
+               byteStride) != nullptr;
+  };
+  for (const auto &attribute : primitive.attributes) {
+    reorderVertices = reorderVertices && hasData(attribute.second);
+  }
+  for (const auto &target : primitive.targets) {
+    for (const auto &attribute : target) {
+      reorderVertices = reorderVertices && hasData(attribute.second);
+    }
+  }
+
+  if (reorderVertices) {
+    const auto remap =
+        optimizeVertexFetch(indices.data(), indices.size(), task.vertexCount);
+
+    for (const auto &attribute : primitive.attributes) {
+      remapAccessor(model, model.accessors[attribute.second], remap);
+    }
+    for (const auto &target : primitive.targets) {
+      for (const auto &attribute : target) {
+        remapAccessor(model, model.accessors[attribute.second], remap);
+      }
+    }
+    result.vertexFetch = true;
+  }
+
+  result.after =
+      analyzeVertexCache(indices.data(), indices.size(), task.vertexCount);
+
+  const auto minMax = std::minmax_element(indices.begin(), indices.end());
+
+  // 0xffff is a primitive restart index, glTF does not allow it
+  auto &indexBufferView = model.bufferViews[indexAccessor.bufferView];
+  if (indexAccessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT &&
+      indexBufferView.byteStride == 0 && *minMax.second < 0xffff) {
+    indexAccessor.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+    indexStride = sizeof(uint16_t);
+    if (task.shrinkIndexView) {
+      indexBufferView.byteLength =
+          indexAccessor.byteOffset + indices.size() * sizeof(uint16_t);
+    }
+    result.narrowed = true;
+  }
+
+  for (size_t i = 0; i < indices.size(); ++i) {
+    auto *index = indexData + indexStride * i;
+    switch (indexAccessor.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+      *index = uint8_t(indices[i]);
+      break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+      const auto value = uint16_t(indices[i]);
+      std::memcpy(index, &value, sizeof(value));
+      break;
+    }
+    default:
+      std::memcpy(index, &indices[i], sizeof(uint32_t));
+      break;
+    }
+  }
+
+  if (!indexAccessor.minValues.empty() && !indexAccessor.maxValues.empty()) {
+    indexAccessor.minValues = {double(*minMax.first)};
+    indexAccessor.maxValues = {double(*minMax.second)};
+  }
+
+  return true;
+}
+
+std::vector<PrimitiveOptimization> optimizeMeshes(
+    tinygltf::Model &model, ThreadPool &pool)
+{
+  // A shared accessor or buffer view cannot be rewritten for one primitive
+  std::vector<int> accessorUses(model.accessors.size(), 0);
+  std::vector<int> bufferViewUses(model.bufferViews.size(), 0);
+
+  const auto isValidAccessor = [&](int accessorIdx) {
+    return accessorIdx >= 0 && size_t(accessorIdx) < model.accessors.size();
+  };
+  const auto addAccessorUse = [&](int accessorIdx) {
+    if (isValidAccessor(accessorIdx)) {
+      ++accessorUses[accessorIdx];
+    }
+  };
+
+  for (const auto &mesh : model.meshes) {
+    for (const auto &primitive : mesh.primitives) {
+      addAccessorUse(primitive.indices);
+      for (const auto &attribute : primitive.attributes) {
+        addAccessorUse(attribute.second);
+      }
+      for (const auto &target : primitive.targets) {
+        for (const auto &attribute : target) {
+          addAccessorUse(attribute.second);
+        }
+      }
+    }
+  }
+  const auto addBufferViewUse = [&](int bufferViewIdx) {
+    if (bufferViewIdx >= 0 && size_t(bufferViewIdx) < bufferViewUses.size()) {
+      ++bufferViewUses[bufferViewIdx];
+    }
+  };
+  for (const auto &accessor : model.accessors) {
+    addBufferViewUse(accessor.bufferView);
+  }
+  for (const auto &image : model.images) {
+    addBufferViewUse(image.bufferView);
+  }
+
+  // Accessors can also alias the same bytes through different buffer views:
+  // overlapping ones are shared as well, unless they are interleaved
+  // attributes of the same primitive, whose elements are moved together
+  struct AccessorRange
+  {
+    int buffer;
+    size_t begin;
+    size_t end;
+    size_t elementSize;
+    size_t byteStride;
+    int accessorIdx;
+  };
+  std::vector<AccessorRange> ranges;
+  for (size_t i = 0; i < model.accessors.size(); ++i) {
+    size_t elementSize;
+    size_t byteStride;
+    const auto &accessor = model.accessors[i];
+    const auto *data =
+        getAccessorData(model, accessor, elementSize, byteStride);
+    if (data) {
+      const auto buffer = model.bufferViews[accessor.bufferView].buffer;
+      const auto begin = size_t(data - model.buffers[buffer].data.data());
+      ranges.push_back({buffer, begin,
+          begin + byteStride * (accessor.count - 1) + elementSize, elementSize,
+          byteStride, int(i)});
+    }
+  }
+  std::sort(ranges.begin(), ranges.end(),
+      [](const AccessorRange &a, const AccessorRange &b) {
+        return std::tie(a.buffer, a.begin) < std::tie(b.buffer, b.begin);
+      });
+
+  // Primitive of each vertex accessor, those of several primitives are
+  // already shared
+  std::vector<int> vertexAccessorPrimitive(model.accessors.size(), -1);
+  int primitiveCount = 0;
+  for (const auto &mesh : model.meshes) {
+    for (const auto &primitive : mesh.primitives) {
+      for (const auto &attribute : primitive.attributes) {
+        if (isValidAccessor(attribute.second)) {
+          vertexAccessorPrimitive[attribute.second] = primitiveCount;
+        }
+      }
+      for (const auto &target : primitive.targets) {
+        for (const auto &attribute : target) {
+          if (isValidAccessor(attribute.second)) {
+            vertexAccessorPrimitive[attribute.second] = primitiveCount;
+          }
+        }
+      }
+      ++primitiveCount;
+    }
+  }
+
+  // Elements of b sit between those of a, with the same stride
+  const auto isInterleaved = [&](const AccessorRange &a,
+                                 const AccessorRange &b) {
+    if (vertexAccessorPrimitive[a.accessorIdx] < 0 ||
+        vertexAccessorPrimitive[a.accessorIdx] !=
+            vertexAccessorPrimitive[b.accessorIdx] ||
+        a.byteStride != b.byteStride) {
+      return false;
+    }
+    const auto offset = (b.begin - a.begin) % a.byteStride;
+    return offset >= a.elementSize && offset + b.elementSize <= a.byteStride;
+  };
+
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    for (auto j = i + 1; j < ranges.size() &&
+                         ranges[j].buffer == ranges[i].buffer &&
+                         ranges[j].begin < ranges[i].end;
+         ++j) {
+      if (!isInterleaved(ranges[i], ranges[j])) {
+        const auto a = ranges[i].accessorIdx;
+        const auto b = ranges[j].accessorIdx;
+        accessorUses[a] = std::max(accessorUses[a], 2);
+        accessorUses[b] = std::max(accessorUses[b], 2);
+      }
+    }
+  }
+
+  const auto isOwnAccessor = [&](int accessorIdx) {
+    return isValidAccessor(accessorIdx) && accessorUses[accessorIdx] == 1 &&
+           model.accessors[accessorIdx].bufferView >= 0 &&
+           size_t(model.accessors[accessorIdx].bufferView) <
+               model.bufferViews.size() &&
+           !model.accessors[accessorIdx].sparse.isSparse;
+  };
+
+  std::vector<PrimitiveTask> tasks;
+  for (size_t m = 0; m < model.meshes.size(); ++m) {
+    const auto &primitives = model.meshes[m].primitives;
+    for (size_t p = 0; p < primitives.size(); ++p) {
+      const auto &primitive = primitives[p];
+      if (primitive.mode != TINYGLTF_MODE_TRIANGLES ||
+          !isOwnAccessor(primitive.indices) ||
+          primitive.attributes.empty()) {
+        continue;
+      }
+
+      const auto &indexAccessor = model.accessors[primitive.indices];
+      if (indexAccessor.type != TINYGLTF_TYPE_SCALAR ||
+          indexAccessor.count == 0 || indexAccessor.count % 3 != 0) {
+        continue;
+      }
+
+      PrimitiveTask task;
+      task.meshIdx = int(m);
+      task.primitiveIdx = int(p);
+      task.vertexCount = std::numeric_limits<size_t>::max();
+      task.reorderVertices = true;
+      task.shrinkIndexView = bufferViewUses[indexAccessor.bufferView] == 1;
+
+      // Vertices are only renumbered if every attribute has all of them
+      size_t maxVertexCount = 0;
+      const auto addVertexAccessor = [&](int accessorIdx) {
+        if (!isValidAccessor(accessorIdx)) {
+          task.vertexCount = 0;
+          return;
+        }
+        const auto count = model.accessors[accessorIdx].count;
+        task.vertexCount = std::min(task.vertexCount, count);
+        maxVertexCount = std::max(maxVertexCount, count);
+        task.reorderVertices =
+            task.reorderVertices && isOwnAccessor(accessorIdx);
+      };
+
+      for (const auto &attribute : primitive.attributes) {
+        addVertexAccessor(attribute.second);
+      }
+      for (const auto &target : primitive.targets) {
+        for (const auto &attribute : target) {
+          addVertexAccessor(attribute.second);
+        }
+      }
+      task.reorderVertices =
+          task.reorderVertices && task.vertexCount == maxVertexCount;
+
+      if (task.vertexCount > 0) {
+        tasks.push_back(task);
+      }
+    }
+  }
+
+  std::vector<PrimitiveOptimization> results(tasks.size());
+  std::vector<uint8_t> optimized(tasks.size(), 0);
+
+  pool.parallelFor(tasks.size(), [&](size_t i) {
+    optimized[i] = optimizePrimitive(model, tasks[i], results[i]);
+  });
+
+  // Primitives with out of range indices are left as they are
+  size_t resultCount = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (optimized[i]) {
+      results[resultCount++] = results[i];
+    }
+  }
+  results.resize(resultCount);
+
+  return results;
+}
+
+void sumMeshOptimizations(const std::vector<PrimitiveOptimization> &results,
+    VertexCacheStatistics &before, VertexCacheStatistics &after)
+{
+  before = VertexCacheStatistics();
+  after = VertexCacheStatistics();
+
+  for (const auto &result : results) {
+    before.triangleCount += result.before.triangleCount;
+    before.vertexCount += result.before.vertexCount;
+    before.transformCount += result.before.transformCount;
+    after.triangleCount += result.after.triangleCount;
+    after.vertexCount += result.after.vertexCount;
+    after.transformCount += result.after.transformCount;
+  }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "ThreadPool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+#include <vector>
+
+// Size of the FIFO post-transform cache simulated to measure and order
+// triangles. Recent GPUs batch vertices instead of keeping a FIFO, but their
+// reuse follows the same locality.
+#define VERTEX_CACHE_SIZE 16
+
+// Vertex shader invocations of an index buffer through a FIFO cache
+struct VertexCacheStatistics
+{
+  size_t triangleCount = 0;
+  size_t vertexCount = 0; // Distinct vertices referenced by the indices
+  size_t transformCount = 0; // Cache misses
+
+  // Average cache miss ratio: transforms per triangle, from 3 down to about
+  // 0.5 for large regular meshes
+  double acmr() const
+  {
+    return triangleCount ? double(transformCount) / triangleCount : 0;
+  }
+
+  // Average transform to vertex ratio: transforms per vertex, 1 at best
+  double atvr() const
+  {
+    return vertexCount ? double(transformCount) / vertexCount : 0;
+  }
+};
+
+VertexCacheStatistics analyzeVertexCache(const uint32_t *indices,
+    size_t indexCount, size_t vertexCount,
+    size_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Reorder the triangles of a triangle list for post-transform cache reuse,
+// with Tom Forsyth's linear-speed vertex cache optimization: the next
+// triangle is the best scoring neighbour of the vertices in a simulated LRU
+// cache, favoring recently used vertices and those with few triangles left.
+void optimizeVertexCache(
+    uint32_t *indices, size_t indexCount, size_t vertexCount);
+
+// Reorder clusters of a cache optimized triangle list so that the ones
+// facing outwards are drawn first and occlude the others (Sander, Nehab and
+// Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw", 2007). Clusters are split where the cache simulation restarts
+// and wherever their running ACMR gets under threshold times the ACMR of the
+// whole run, so that the reordering costs at most that much cache
+// efficiency.
+void optimizeOverdraw(uint32_t *indices, size_t indexCount,
+    const glm::vec3 *positions, size_t vertexCount, float threshold = 1.05f);
+
+// Renumber vertices in the order the indices first reference them, so that
+// vertex fetches walk the attribute buffers forward. Rewrites indices and
+// returns the new index of each vertex, unreferenced vertices being moved
+// last.
+std::vector<uint32_t> optimizeVertexFetch(
+    uint32_t *indices, size_t indexCount, size_t vertexCount);
+
+// Result of optimizeMeshes for one primitive
+struct PrimitiveOptimization
+{
+  int meshIdx;
+  int primitiveIdx;
+  VertexCacheStatistics before;
+  VertexCacheStatistics after;
+  bool vertexFetch = false; // Attributes have been reordered
+  bool narrowed = false; // 32-bit indices are now 16-bit
+};
+
+// Optimize the indexed TRIANGLES primitives of model in place, one per task
+// of the pool: vertex cache and overdraw ordering of their indices (overdraw
+// only with float VEC3 positions), vertex fetch ordering of their attributes
+// and morph targets, and 32-bit indices narrowed to 16 bits when every index
+// fits. Primitives whose index accessor is shared or sparse are left as they
+// are, and only keep their attribute order if one of their attribute
+// accessors is shared, sparse or overlaps bytes of another primitive. Buffers
+// are modified, not reallocated: the end of a narrowed index buffer view is
+// left unused.
+std::vector<PrimitiveOptimization> optimizeMeshes(
+    tinygltf::Model &model, ThreadPool &pool);
+
+// Totals of optimizeMeshes results, transforms and vertices summed over
+// primitives
+void sumMeshOptimizations(const std::vector<PrimitiveOptimization> &results,
+    VertexCacheStatistics &before, VertexCacheStatistics &after);
@@ -0,0 +1,396 @@
+#include "program_cache.hpp"
+#include "files.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_set>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+
+// Directories are watched rather than files: most editors save by writing a
+// new file and renaming it over the old one
+struct ProgramCache::Watcher
+{
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  std::unordered_map<int, fs::path> directories; // By watch descriptor
+  std::unordered_set<std::string> watchedDirectories;
+
+  ~Watcher()
+  {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  void watch(const fs::path &file)
+  {
+    const auto directory = file.parent_path();
+    if (fd < 0 || !watchedDirectories.insert(directory.string()).second) {
+      return;
+    }
+
+    const auto wd = inotify_add_watch(fd,
+        directory.empty() ? "." : directory.c_str(),
+        IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0) {
+      std::cerr << "Unable to watch " << directory << " for shader changes"
+                << std::endl;
+      return;
+    }
+
+    directories[wd] = directory;
+  }
+
+  std::unordered_set<std::string> pollChangedFiles()
+  {
+    std::unordered_set<std::string> changedFiles;
+    if (fd < 0) {
+      return changedFiles;
+    }
+
+    alignas(inotify_event) char buffer[4096];
+    for (;;) {
+      const auto length = read(fd, buffer, sizeof(buffer));
+      if (length <= 0) {
+        break; // EAGAIN: no more events
+      }
+
+      for (ssize_t offset = 0; offset < length;) {
+        const auto *pEvent =
+            reinterpret_cast<const inotify_event *>(buffer + offset);
+        const auto it = directories.find(pEvent->wd);
+        if (it != end(directories) && pEvent->len > 0) {
+          changedFiles.insert(((*it).second / pEvent->name).string());
+        }
+        offset += sizeof(inotify_event) + pEvent->len;
+      }
+    }
+
+    return changedFiles;
+  }
+};
+
+#else
+
+// Modification times of the watched files, checked twice per second
+struct ProgramCache::Watcher
+{
+  using WriteTime = decltype(fs::last_write_time(fs::path()));
+  using Clock = std::chrono::steady_clock;
+
+  std::unordered_map<std::string, WriteTime> writeTimes;
+  Clock::time_point lastPoll = Clock::now();
+
+  static bool getWriteTime(const fs::path &file, WriteTime &writeTime)
+  {
+    try {
+      writeTime = fs::last_write_time(file);
+    } catch (const std::exception &) {
+      return false;
+    }
+    return true;
+  }
+
+  void watch(const fs::path &file)
+  {
+    WriteTime writeTime;
+    if (getWriteTime(file, writeTime)) {
+      writeTimes.emplace(file.string(), writeTime);
+    }
+  }
+
+  std::unordered_set<std::string> pollChangedFiles()
+  {
+    std::unordered_set<std::string> changedFiles;
+
+    const auto now = Clock::now();
+    if (now - lastPoll < std::chrono::milliseconds(500)) {
+      return changedFiles;
+    }
+    lastPoll = now;
+
+    for (auto &file : writeTimes) {
+      WriteTime writeTime;
+      if (getWriteTime(file.first, writeTime) && writeTime != file.second) {
+        file.second = writeTime;
+        changedFiles.insert(file.first);
+      }
+    }
+
+    return changedFiles;
+  }
+};
+
+#endif
+
+static const char PROGRAM_BINARY_MAGIC[4] = {'P', 'R', 'G', 'B'};
+static const uint32_t PROGRAM_BINARY_VERSION = 1;
+
+struct ProgramBinaryHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint32_t format;
+  uint32_t length;
+};
+
+static bool loadProgramBinary(
+    const fs::path &path, uint64_t key, const GLProgram &program)
+{
+  MappedFile file;
+  if (!file.open(path) || file.size() < sizeof(ProgramBinaryHeader)) {
+    return false;
+  }
+
+  ProgramBinaryHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+
+  if (std::memcmp(header.magic, PROGRAM_BINARY_MAGIC, sizeof(header.magic)) ||
+      header.version != PROGRAM_BINARY_VERSION || header.key != key ||
+      file.size() != sizeof(header) + header.length) {
+    return false;
+  }
+
+  glProgramBinary(program.glId(), header.format, file.data() + sizeof(header),
+      header.length);
+
+  // A driver update may invalidate binaries of the same GL version
+  if (!program.getLinkStatus()) {
+    std::clog << "Program binary " << path
+              << " rejected by the driver, compiling from sources"
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+static bool saveProgramBinary(
+    const fs::path &path, uint64_t key, const GLProgram &program)
+{
+  GLint length = 0;
+  glGetProgramiv(program.glId(), GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return false;
+  }
+
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(program.glId(), length, &length, &format, binary.data());
+
+  ProgramBinaryHeader header;
+  std::memcpy(header.magic, PROGRAM_BINARY_MAGIC, sizeof(header.magic));
+  header.version = PROGRAM_BINARY_VERSION;
+  header.key = key;
+  header.format = format;
+  header.length = uint32_t(length);
+
+  // Same as the texture cache: never let another run read a partial file
+  auto tmpPath = path;
+  tmpPath += ".tmp";
+
+  try {
+    fs::create_directories(path.parent_path());
+
+    {
+      std::ofstream output(tmpPath.string(), std::ios::binary);
+      output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      output.write(binary.data(), length);
+
+      if (!output) {
+        throw std::runtime_error("write failed");
+      }
+    }
+
+    fs::rename(tmpPath, path);
+  } catch (const std::exception &e) {
+    std::cerr << "Program cache: unable to write " << path << ": " << e.what()
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+ProgramCache::ProgramCache() : m_watcher(new Watcher) {}
+
+ProgramCache::~ProgramCache() = default;
+
+const GLProgram &ProgramCache::get(const std::vector<fs::path> &shaderPaths,
+    const std::vector<std::string> &defines)
+{
+  std::string key;
+  for (const auto &path : shaderPaths) {
+    key += path.string() + '\n';
+  }
+  for (const auto &define : defines) {
+    key += "#define " + define + '\n';
+  }
+
+  auto &pEntry = m_entries[key];
+  if (!pEntry) {
+    try {
+      pEntry.reset(
+          new Entry{shaderPaths, defines, buildProgram(shaderPaths, defines)});
+    } catch (...) {
+      m_entries.erase(key);
+      throw;
+    }
+
+    for (const auto &path : shaderPaths) {
+      m_watcher->watch(path);
+    }
+  }
+
+  return pEntry->program;
+}
+
+size_t ProgramCache::update()
+{
+  const auto changedFiles = m_watcher->pollChangedFiles();
+  if (changedFiles.empty()) {
+    return 0;
+  }
+
+  size_t reloadCount = 0;
+
+  for (auto &keyAndEntry : m_entries) {
+    auto &entry = *keyAndEntry.second;
+
+    const auto changed = std::any_of(begin(entry.shaderPaths),
+        end(entry.shaderPaths), [&](const fs::path &path) {
+          return changedFiles.count(path.string()) > 0;
+        });
+    if (!changed) {
+      continue;
+    }
+
+    try {
+      entry.program = buildProgram(entry.shaderPaths, entry.defines);
+      ++reloadCount;
+    } catch (const std::exception &) {
+      // The compilation log has already been printed
+      std::cerr << "Keeping the previous version of the program" << std::endl;
+    }
+  }
+
+  if (reloadCount) {
+    std::clog << "Reloaded " << reloadCount << " program(s)" << std::endl;
+  }
+
+  return reloadCount;
+}
+
+bool ProgramCache::binaryCacheEnabled()
+{
+  if (m_binaryDirectory.empty()) {
+    return false;
+  }
+
+  if (m_binaryFormatCount < 0) {
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &m_binaryFormatCount);
+
+    // Binaries are only valid for the exact same driver
+    m_contextHash = HASH_SEED;
+    for (const auto name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+      const auto *pString = glGetString(name);
+      if (pString) {
+        m_contextHash = hashBytes(pString,
+            std::strlen(reinterpret_cast<const char *>(pString)),
+            m_contextHash);
+      }
+    }
+  }
+
+  return m_binaryFormatCount > 0;
+}
+
+GLProgram ProgramCache::buildProgram(const std::vector<fs::path> &shaderPaths,
+    const std::vector<std::string> &defines)
+{
+  const auto start = std::chrono::steady_clock::now();
+  const auto elapsed = [&]() {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start)
+        .count();
+  };
+
+  std::string name;
+  std::vector<std::string> sources;
+  for (const auto &path : shaderPaths) {
+    name += (name.empty() ? "" : "+") + path.filename().string();
+    sources.push_back(addShaderDefines(loadShaderSource(path), defines));
+  }
+
+  const auto useBinaryCache = binaryCacheEnabled();
+  uint64_t key = m_contextHash;
+  fs::path binaryPath;
+
+  if (useBinaryCache) {
+    // File names give the shader stages
+    for (size_t i = 0; i < sources.size(); ++i) {
+      const auto fileName = shaderPaths[i].filename().string();
+      key = hashBytes(fileName.data(), fileName.size(), key);
+      key = hashBytes(sources[i].data(), sources[i].size(), key);
+    }
+
+    binaryPath =
+        m_binaryDirectory / ("program_" + hashToString(key) + ".bin");
+
+    GLProgram program;
+    if (loadProgramBinary(binaryPath, key, program)) {
+      const auto time = elapsed();
+      std::clog << "Loaded program " << name << " from binary in " << time
+                << " ms" << std::endl;
+
+      ++m_binaryLoadCount;
+      m_buildTime += time;
+
+      return program;
+    }
+  }
+
+  GLProgram program;
+  if (useBinaryCache) {
+    glProgramParameteri(
+        program.glId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+
+  for (size_t i = 0; i < sources.size(); ++i) {
+    program.attachShader(compileShaderFile(shaderPaths[i], sources[i]));
+  }
+
+  if (!program.link()) {
+    std::cerr << "Program link error:" << program.getInfoLog() << std::endl;
+    throw std::runtime_error("Program link error:" + program.getInfoLog());
+  }
+
+  if (useBinaryCache) {
+    saveProgramBinary(binaryPath, key, program);
+  }
+
+  const auto time = elapsed();
+  std::clog << "Compiled program " << name << " in " << time << " ms"
+            << std::endl;
+
+  ++m_compileCount;
+  m_buildTime += time;
+
+  return program;
+}
+
+void ProgramCache::logStatistics() const
+{
+  std::clog << "Programs: " << m_binaryLoadCount << " loaded from binaries, "
+            << m_compileCount << " compiled from sources, " << m_buildTime
+            << " ms" << std::endl;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "shaders.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Compiled GLSL programs keyed by their shader files and #define list, so
+// that each permutation is only compiled once. The directories of the shader
+// files are watched (inotify on Linux, modification times elsewhere): update()
+// recompiles in place every program using a file that changed, which makes
+// it possible to edit shaders while the viewer is running.
+//
+// References returned by get() stay valid as long as the cache, but the GL
+// name of a program changes when it is reloaded: uniform locations and block
+// bindings have to be set up again when update() returns non zero.
+//
+// Linked programs can also be stored on disk as driver binaries
+// (glGetProgramBinary), keyed by their sources and the GL vendor, renderer
+// and version: later runs skip compilation entirely, and fall back to it
+// whenever the driver rejects a binary.
+class ProgramCache
+{
+public:
+  ProgramCache();
+  ~ProgramCache();
+
+  ProgramCache(const ProgramCache &) = delete;
+  ProgramCache &operator=(const ProgramCache &) = delete;
+
+  // The program linked from shaderPaths with defines (see addShaderDefines),
+  // compiled on the first request. Throws like compileProgram.
+  const GLProgram &get(const std::vector<fs::path> &shaderPaths,
+      const std::vector<std::string> &defines = {});
+
+  // Recompile the programs whose shader files changed since the last call. A
+  // program that no longer compiles keeps its previous version. Returns the
+  // number of programs that have been replaced.
+  size_t update();
+
+  size_t size() const { return m_entries.size(); }
+
+  // Enable the on-disk cache of program binaries in directory (disabled if
+  // empty, the default)
+  void setBinaryDirectory(const fs::path &directory)
+  {
+    m_binaryDirectory = directory;
+  }
+
+  // Print on std::clog how many programs have been loaded from binaries and
+  // compiled from sources so far, and the time spent doing so
+  void logStatistics() const;
+
+private:
+  struct Entry
+  {
+    std::vector<fs::path> shaderPaths;
+    std::vector<std::string> defines;
+    GLProgram program;
+  };
+
+  // Load from the binary cache or compile, throws like compileProgram
+  GLProgram buildProgram(const std::vector<fs::path> &shaderPaths,
+      const std::vector<std::string> &defines);
+
+  bool binaryCacheEnabled();
+
+  // Platform specific file watching
+  struct Watcher;
+
+  std::unordered_map<std::string, std::unique_ptr<Entry>> m_entries;
+  std::unique_ptr<Watcher> m_watcher;
+
+  fs::path m_binaryDirectory;
+  int m_binaryFormatCount = -1; // Queried on first use
+  uint64_t m_contextHash = 0; // GL vendor, renderer and version
+
+  size_t m_binaryLoadCount = 0;
+  size_t m_compileCount = 0;
+  double m_buildTime = 0; // In milliseconds
+};
@@ -0,0 +1,127 @@
+#include "scene_graph.hpp"
+#include "gltf.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+void SceneGraph::build(const tinygltf::Model &model, int sceneIdx)
+{
+  *this = SceneGraph();
+
+  if (sceneIdx < 0 || size_t(sceneIdx) >= model.scenes.size()) {
+    return;
+  }
+
+  // Iterative pre-order traversal, large scenes can be deep enough to
+  // overflow the stack with recursion. Pairs are (node, flat parent).
+  std::vector<std::pair<int, int>> stack;
+  std::vector<uint8_t> visited(model.nodes.size(), 0);
+
+  const auto &roots = model.scenes[sceneIdx].nodes;
+  for (auto it = roots.rbegin(); it != roots.rend(); ++it) {
+    stack.emplace_back(*it, -1);
+  }
+
+  while (!stack.empty()) {
+    const auto nodeIdx = stack.back().first;
+    const auto parent = stack.back().second;
+    stack.pop_back();
+
+    if (nodeIdx < 0 || size_t(nodeIdx) >= model.nodes.size()) {
+      std::cerr << "Scene graph: invalid node index " << nodeIdx << ", skipping"
+                << std::endl;
+      continue;
+    }
+    if (visited[nodeIdx]) {
+      std::cerr << "Scene graph: node " << nodeIdx
+                << " has several parents, skipping" << std::endl;
+      continue;
+    }
+    visited[nodeIdx] = 1;
+
+    const auto &node = model.nodes[nodeIdx];
+    const auto flatIdx = int(m_nodeIndices.size());
+
+    m_nodeIndices.push_back(nodeIdx);
+    m_parents.push_back(parent);
+    m_meshes.push_back(
+        size_t(node.mesh) < model.meshes.size() ? node.mesh : -1);
+    m_localMatrices.push_back(getLocalToWorldMatrix(node, glm::mat4(1)));
+
+    // Reversed so that children keep their glTF order once popped
+    for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
+      stack.emplace_back(*it, flatIdx);
+    }
+  }
+
+  const auto nodeCount = m_nodeIndices.size();
+
+  // Children come after their parent, so walking backward every subtree end
+  // is known before it is propagated to the parent
+  m_subtreeEnds.resize(nodeCount);
+  for (size_t i = 0; i < nodeCount; ++i) {
+    m_subtreeEnds[i] = uint32_t(i + 1);
+  }
+  for (size_t i = nodeCount; i-- > 0;) {
+    if (m_parents[i] >= 0) {
+      auto &parentEnd = m_subtreeEnds[m_parents[i]];
+      parentEnd = std::max(parentEnd, m_subtreeEnds[i]);
+    }
+  }
+
+  for (size_t i = 0; i < nodeCount; ++i) {
+    if (m_meshes[i] >= 0) {
+      m_meshNodes.push_back(uint32_t(i));
+    }
+  }
+
+  m_worldMatrices.resize(nodeCount);
+  m_normalMatrices.resize(nodeCount);
+  m_dirty.assign(nodeCount, 1);
+  m_hasDirtyNodes = nodeCount > 0;
+}
+
+void SceneGraph::setLocalMatrix(size_t i, const glm::mat4 &localMatrix)
+{
+  m_localMatrices[i] = localMatrix;
+  m_dirty[i] = 1;
+  m_hasDirtyNodes = true;
+}
+
+size_t SceneGraph::update()
+{
+  if (!m_hasDirtyNodes) {
+    return 0;
+  }
+
+  size_t updatedCount = 0;
+
+  for (size_t i = 0; i < size();) {
+    if (!m_dirty[i]) {
+      ++i;
+      continue;
+    }
+
+    // The whole subtree depends on this node, parents are always updated
+    // before their children
+    const size_t end = m_subtreeEnds[i];
+    for (size_t j = i; j < end; ++j) {
+      const auto parent = m_parents[j];
+      m_worldMatrices[j] = parent < 0
+                               ? m_localMatrices[j]
+                               : m_worldMatrices[parent] * m_localMatrices[j];
+      if (m_meshes[j] >= 0) {
+        m_normalMatrices[j] = glm::transpose(glm::inverse(m_worldMatrices[j]));
+      }
+      m_dirty[j] = 0;
+    }
+
+    updatedCount += end - i;
+    i = end;
+  }
+
+  m_hasDirtyNodes = false;
+
+  return updatedCount;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+#include <vector>
+
+// Flattened node hierarchy of a glTF scene. Nodes are stored depth first, so
+// parents always come before their children and every subtree is a contiguous
+// range of flat indices [i, subtreeEnd(i)). Each attribute is a separate array
+// (structure of arrays), so the transform update and the draw loop walk
+// through memory linearly instead of chasing tinygltf::Node children.
+//
+// World and normal matrices are cached: they are only recomputed by update()
+// for the subtrees whose local matrix changed since the last call.
+class SceneGraph
+{
+public:
+  // Flatten the nodes reachable from model.scenes[sceneIdx]. The graph is
+  // empty if sceneIdx is not a valid scene. Every node is flagged dirty.
+  void build(const tinygltf::Model &model, int sceneIdx);
+
+  size_t size() const { return m_nodeIndices.size(); }
+
+  // Replace the local matrix of the node at flat index i and flag its subtree
+  void setLocalMatrix(size_t i, const glm::mat4 &localMatrix);
+
+  // Recompute world and normal matrices of dirty subtrees. Returns the number
+  // of nodes that have been updated (0 if nothing changed).
+  size_t update();
+
+  // Index of the node in tinygltf::Model::nodes
+  const std::vector<int> &nodeIndices() const { return m_nodeIndices; }
+
+  // Flat index of the parent node, -1 for root nodes
+  const std::vector<int> &parents() const { return m_parents; }
+
+  // One past the flat index of the last node of each subtree
+  const std::vector<uint32_t> &subtreeEnds() const { return m_subtreeEnds; }
+
+  // Index in tinygltf::Model::meshes, -1 for nodes without mesh
+  const std::vector<int> &meshes() const { return m_meshes; }
+
+  const std::vector<glm::mat4> &localMatrices() const
+  {
+    return m_localMatrices;
+  }
+
+  const std::vector<glm::mat4> &worldMatrices() const
+  {
+    return m_worldMatrices;
+  }
+
+  // transpose(inverse(worldMatrix)), only computed for nodes with a mesh
+  const std::vector<glm::mat4> &normalMatrices() const
+  {
+    return m_normalMatrices;
+  }
+
+  // Flat indices of the nodes with a mesh, in increasing order
+  const std::vector<uint32_t> &meshNodes() const { return m_meshNodes; }
+
+private:
+  std::vector<int> m_nodeIndices;
+  std::vector<int> m_parents;
+  std::vector<uint32_t> m_subtreeEnds;
+  std::vector<int> m_meshes;
+  std::vector<glm::mat4> m_localMatrices;
+  std::vector<glm::mat4> m_worldMatrices;
+  std::vector<glm::mat4> m_normalMatrices;
+  std::vector<uint8_t> m_dirty;
+  std::vector<uint32_t> m_meshNodes;
+  bool m_hasDirtyNodes = false;
+};
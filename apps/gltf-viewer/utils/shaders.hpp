@@ -9,6 +9,7 @@
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 
 class GLShader
@@ -93,12 +94,41 @@ GLShader compileShader(GLenum type, StringType &&src)
   return shader;
 }
 
-// Load and compile a shader according to the following naming convention:
+// Insert "#define <define>" lines for each define ("NAME" or "NAME VALUE")
+// after the #version directive of src, which must stay first
+inline std::string addShaderDefines(
+    const std::string &src, const std::vector<std::string> &defines)
+{
+  if (defines.empty()) {
+    return src;
+  }
+
+  std::string defineLines;
+  for (const auto &define : defines) {
+    defineLines += "#define " + define + "\n";
+  }
+
+  const auto versionPos = src.find("#version");
+  if (versionPos == std::string::npos) {
+    return defineLines + src;
+  }
+
+  const auto lineEnd = src.find('\n', versionPos);
+  if (lineEnd == std::string::npos) {
+    return src + "\n" + defineLines;
+  }
+
+  return src.substr(0, lineEnd + 1) + defineLines + src.substr(lineEnd + 1);
+}
+
+// Compile src as the shader type given by the name of shaderPath, following
+// this naming convention:
 // *.vs.glsl -> vertex shader
 // *.fs.glsl -> fragment shader
 // *.gs.glsl -> geometry shader
 // *.cs.glsl -> compute shader
-inline GLShader loadShader(const fs::path &shaderPath)
+inline GLShader compileShaderFile(
+    const fs::path &shaderPath, const std::string &src)
 {
   static auto extToShaderType =
       std::unordered_map<std::string, std::pair<GLenum, std::string>>(
@@ -118,7 +148,7 @@ inline GLShader loadShader(const fs::path &shaderPath)
             << "\n";
 
   GLShader shader{(*it).second.first};
-  shader.setSource(loadShaderSource(shaderPath));
+  shader.setSource(src);
   shader.compile();
   if (!shader.getCompileStatus()) {
     std::cerr << "Shader compilation error:" << shader.getInfoLog()
@@ -128,6 +158,14 @@ inline GLShader loadShader(const fs::path &shaderPath)
   return shader;
 }
 
+// Load and compile a shader, see compileShaderFile for the naming convention
+inline GLShader loadShader(
+    const fs::path &shaderPath, const std::vector<std::string> &defines = {})
+{
+  return compileShaderFile(
+      shaderPath, addShaderDefines(loadShaderSource(shaderPath), defines));
+}
+
 class GLProgram
 {
   GLuint m_GLId;
@@ -244,11 +282,12 @@ template <typename CSrc> GLProgram buildComputeProgram(CSrc &&src)
   ;
 }
 
-inline GLProgram compileProgram(std::vector<fs::path> shaderPaths)
+inline GLProgram compileProgram(std::vector<fs::path> shaderPaths,
+    const std::vector<std::string> &defines = {})
 {
   GLProgram program;
   for (const auto &path : shaderPaths) {
-    auto shader = loadShader(path);
+    auto shader = loadShader(path, defines);
     program.attachShader(shader);
   }
   program.link();
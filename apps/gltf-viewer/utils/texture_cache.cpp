@@ -0,0 +1,237 @@
+#include "texture_cache.hpp"
+#include "files.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+static const char TEXTURE_CACHE_MAGIC[4] = {'T', 'X', 'C', 'H'};
+static const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+struct TextureCacheHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint32_t target;
+  uint32_t internalFormat;
+  uint32_t width;
+  uint32_t height;
+  uint32_t levelCount;
+  uint32_t padding;
+};
+
+// Pixel transfer format and component count of the supported formats
+static bool getTransferFormat(
+    GLenum internalFormat, GLenum &format, size_t &componentCount)
+{
+  switch (internalFormat) {
+  case GL_R16F:
+    format = GL_RED;
+    componentCount = 1;
+    return true;
+  case GL_RG16F:
+    format = GL_RG;
+    componentCount = 2;
+    return true;
+  case GL_RGB16F:
+    format = GL_RGB;
+    componentCount = 3;
+    return true;
+  case GL_RGBA16F:
+    format = GL_RGBA;
+    componentCount = 4;
+    return true;
+  default:
+    return false;
+  }
+}
+
+static size_t levelByteSize(
+    uint32_t width, uint32_t height, uint32_t level, size_t componentCount)
+{
+  const size_t levelWidth = std::max(1u, width >> level);
+  const size_t levelHeight = std::max(1u, height >> level);
+  return levelWidth * levelHeight * componentCount * sizeof(uint16_t);
+}
+
+bool saveTextureCache(const fs::path &path, uint64_t key, GLenum target,
+    GLuint texture, GLsizei levelCount)
+{
+  const GLuint faceCount = (target == GL_TEXTURE_CUBE_MAP) ? 6 : 1;
+  const GLenum faceTarget =
+      (target == GL_TEXTURE_CUBE_MAP) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+
+  GLint previousTexture = 0;
+  GLint previousPackAlignment = 0;
+  glGetIntegerv(target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_BINDING_CUBE_MAP
+                                              : GL_TEXTURE_BINDING_2D,
+      &previousTexture);
+  glGetIntegerv(GL_PACK_ALIGNMENT, &previousPackAlignment);
+
+  glBindTexture(target, texture);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+  GLint width = 0;
+  GLint height = 0;
+  GLint internalFormat = 0;
+  glGetTexLevelParameteriv(faceTarget, 0, GL_TEXTURE_WIDTH, &width);
+  glGetTexLevelParameteriv(faceTarget, 0, GL_TEXTURE_HEIGHT, &height);
+  glGetTexLevelParameteriv(
+      faceTarget, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+
+  GLenum format;
+  size_t componentCount;
+  bool success = getTransferFormat(internalFormat, format, componentCount);
+
+  std::vector<char> data;
+  if (success) {
+    for (GLsizei level = 0; level < levelCount; ++level) {
+      const auto byteSize =
+          levelByteSize(width, height, level, componentCount);
+
+      for (GLuint face = 0; face < faceCount; ++face) {
+        const auto offset = data.size();
+        data.resize(offset + byteSize);
+        glGetTexImage(
+            faceTarget + face, level, format, GL_HALF_FLOAT, &data[offset]);
+      }
+    }
+  }
+
+  glPixelStorei(GL_PACK_ALIGNMENT, previousPackAlignment);
+  glBindTexture(target, previousTexture);
+
+  if (!success) {
+    std::cerr << "Texture cache: unsupported internal format "
+              << internalFormat << std::endl;
+    return false;
+  }
+
+  return writeTextureCache(path, key, target, internalFormat, width, height,
+      levelCount, data.data(), data.size());
+}
+
+bool writeTextureCache(const fs::path &path, uint64_t key, GLenum target,
+    GLenum internalFormat, uint32_t width, uint32_t height,
+    uint32_t levelCount, const void *data, size_t byteSize)
+{
+  TextureCacheHeader header;
+  std::memcpy(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic));
+  header.version = TEXTURE_CACHE_VERSION;
+  header.key = key;
+  header.target = target;
+  header.internalFormat = internalFormat;
+  header.width = width;
+  header.height = height;
+  header.levelCount = levelCount;
+  header.padding = 0;
+
+  // Write a temporary file first so that a concurrent reader never sees a
+  // partially written cache entry
+  auto tmpPath = path;
+  tmpPath += ".tmp";
+
+  try {
+    if (path.has_parent_path()) {
+      fs::create_directories(path.parent_path());
+    }
+
+    {
+      std::ofstream output(tmpPath.string(), std::ios::binary);
+      output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      output.write(static_cast<const char *>(data), byteSize);
+
+      if (!output) {
+        throw std::runtime_error("write failed");
+      }
+    }
+
+    fs::rename(tmpPath, path);
+  } catch (const std::exception &e) {
+    std::cerr << "Texture cache: unable to write " << path << ": " << e.what()
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+GLuint loadTextureCache(const fs::path &path, uint64_t key)
+{
+  MappedFile file;
+  if (!file.open(path) || file.size() < sizeof(TextureCacheHeader)) {
+    return 0;
+  }
+
+  TextureCacheHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+
+  GLenum format;
+  size_t componentCount;
+  if (std::memcmp(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic)) ||
+      header.version != TEXTURE_CACHE_VERSION || header.key != key ||
+      (header.target != GL_TEXTURE_2D &&
+          header.target != GL_TEXTURE_CUBE_MAP) ||
+      header.levelCount < 1 ||
+      !getTransferFormat(header.internalFormat, format, componentCount)) {
+    return 0;
+  }
+
+  const GLenum target = header.target;
+  const GLuint faceCount = (target == GL_TEXTURE_CUBE_MAP) ? 6 : 1;
+  const GLenum faceTarget =
+      (target == GL_TEXTURE_CUBE_MAP) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+
+  size_t expectedSize = sizeof(header);
+  for (uint32_t level = 0; level < header.levelCount; ++level) {
+    expectedSize += faceCount * levelByteSize(header.width, header.height,
+                                    level, componentCount);
+  }
+  if (file.size() != expectedSize) {
+    return 0;
+  }
+
+  GLint previousTexture = 0;
+  GLint previousUnpackAlignment = 0;
+  glGetIntegerv(target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_BINDING_CUBE_MAP
+                                              : GL_TEXTURE_BINDING_2D,
+      &previousTexture);
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousUnpackAlignment);
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(target, texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  // Upload straight from the mapped file
+  const unsigned char *pData = file.data() + sizeof(header);
+  for (uint32_t level = 0; level < header.levelCount; ++level) {
+    const GLsizei width = std::max(1u, header.width >> level);
+    const GLsizei height = std::max(1u, header.height >> level);
+
+    for (GLuint face = 0; face < faceCount; ++face) {
+      glTexImage2D(faceTarget + face, level, header.internalFormat, width,
+          height, 0, format, GL_HALF_FLOAT, pData);
+      pData +=
+          levelByteSize(header.width, header.height, level, componentCount);
+    }
+  }
+
+  glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(target, GL_TEXTURE_MIN_FILTER,
+      header.levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+  glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, header.levelCount - 1);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, previousUnpackAlignment);
+  glBindTexture(target, previousTexture);
+
+  return texture;
+}
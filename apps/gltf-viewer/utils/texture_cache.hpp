@@ -0,0 +1,28 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <cstdint>
+#include <glad/glad.h>
+
+// Raw on-disk container for floating point textures baked at startup (IBL
+// cube maps, BRDF LUT). Every face of every stored mip level is written as
+// half floats, in the texture's own format, after a small header holding the
+// cache key: no conversion is needed in either direction.
+
+// Read back the first levelCount mip levels of texture (a GL_TEXTURE_2D or
+// GL_TEXTURE_CUBE_MAP with a R16F, RG16F, RGB16F or RGBA16F internal format)
+// and write them at path, tagged with key. Returns false on failure.
+bool saveTextureCache(const fs::path &path, uint64_t key, GLenum target,
+    GLuint texture, GLsizei levelCount);
+
+// Same, with the data of every level (faces interleaved per level, as
+// half floats) already in memory: does not need an OpenGL context, which lets
+// offline tools write files for loadTextureCache
+bool writeTextureCache(const fs::path &path, uint64_t key, GLenum target,
+    GLenum internalFormat, uint32_t width, uint32_t height,
+    uint32_t levelCount, const void *data, size_t byteSize);
+
+// Create a texture from a file written by saveTextureCache. Returns 0 if the
+// file is missing, invalid or has been written for another key.
+GLuint loadTextureCache(const fs::path &path, uint64_t key);
@@ -0,0 +1,318 @@
+#include "texture_streaming.hpp"
+#include "gltf.hpp"
+#include "images.hpp"
+#include "ktx2.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// Levels up to this size are always resident
+static const GLsizei STREAMING_MIN_SIZE = 64;
+
+// Used for images that could not be decoded, and textures without any
+static const unsigned char WHITE_TEXEL[4] = {255, 255, 255, 255};
+
+TextureStreamer::~TextureStreamer()
+{
+  for (const auto &texture : m_textures) {
+    glDeleteTextures(1, &texture.glId);
+  }
+}
+
+void TextureStreamer::init(
+    const tinygltf::Model &model, ThreadPool &pool, bool streaming)
+{
+  assert(m_textures.empty());
+
+  m_streaming = streaming;
+  // The last chain stands for missing images
+  m_mipChains.resize(model.images.size() + 1);
+  m_mipChains.back().levels.push_back(
+      Level{1, 1, WHITE_TEXEL, sizeof(WHITE_TEXEL)});
+
+  pool.parallelFor(model.images.size(), [&](size_t i) {
+    const auto &image = model.images[i];
+    auto &chain = m_mipChains[i];
+
+    // Block compressed levels are used as they are, image holds the KTX2 file
+    // (see decodeDeferredImages)
+    Ktx2Image ktx2;
+    std::string err;
+    if (image.mimeType == "image/ktx2" &&
+        parseKtx2(image.image.data(), image.image.size(), ktx2, err)) {
+      chain.internalFormat = ktx2.internalFormat;
+      chain.compressed = true;
+      for (const auto &level : ktx2.levels) {
+        chain.levels.push_back(Level{GLsizei(level.width),
+            GLsizei(level.height), level.data, level.byteSize});
+      }
+      return;
+    }
+
+    // tinygltf always decodes to RGBA
+    if (image.image.empty() || image.width <= 0 || image.height <= 0 ||
+        image.component != 4) {
+      chain.levels.push_back(Level{1, 1, WHITE_TEXEL, sizeof(WHITE_TEXEL)});
+      return;
+    }
+
+    const size_t texelSize = image.bits == 16 ? 8 : 4;
+    chain.internalFormat = image.bits == 16 ? GL_RGBA16 : GL_RGBA8;
+    chain.type = image.bits == 16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+
+    // Sizes and offsets of every level first, the storage never moves after
+    GLsizei width = image.width;
+    GLsizei height = image.height;
+    size_t storageSize = 0;
+
+    chain.levels.push_back(Level{width, height, image.image.data(),
+        size_t(width) * height * texelSize});
+
+    while (width > 1 || height > 1) {
+      width = std::max(width / 2, 1);
+      height = std::max(height / 2, 1);
+
+      const auto byteSize = size_t(width) * height * texelSize;
+      chain.levels.push_back(
+          Level{width, height, nullptr, storageSize}); // Offset for now
+      storageSize += byteSize;
+    }
+
+    chain.storage.resize(storageSize);
+
+    for (size_t level = 1; level < chain.levels.size(); ++level) {
+      const auto &src = chain.levels[level - 1];
+      auto &dst = chain.levels[level];
+
+      const auto offset = dst.byteSize;
+      dst.data = chain.storage.data() + offset;
+      dst.byteSize = size_t(dst.width) * dst.height * texelSize;
+
+      if (image.bits == 16) {
+        downsampleImage(reinterpret_cast<const uint16_t *>(src.data),
+            src.width, src.height,
+            reinterpret_cast<uint16_t *>(chain.storage.data() + offset),
+            dst.width, dst.height);
+      } else {
+        downsampleImage(src.data, src.width, src.height,
+            chain.storage.data() + offset, dst.width, dst.height);
+      }
+    }
+  });
+
+  m_textures.resize(model.textures.size());
+
+  for (size_t i = 0; i < model.textures.size(); ++i) {
+    const auto &gltfTexture = model.textures[i];
+    auto &texture = m_textures[i];
+
+    const auto imageIndex = getTextureImageIndex(model, gltfTexture);
+    texture.image = imageIndex >= 0 ? size_t(imageIndex) : model.images.size();
+
+    if (gltfTexture.sampler >= 0) {
+      const auto &sampler = model.samplers[gltfTexture.sampler];
+      texture.minFilter =
+          (sampler.minFilter != -1) ? sampler.minFilter : GL_LINEAR;
+      texture.magFilter =
+          (sampler.magFilter != -1) ? sampler.magFilter : GL_LINEAR;
+      texture.wrapS = sampler.wrapS;
+      texture.wrapT = sampler.wrapT;
+    }
+
+    const auto &levels = m_mipChains[texture.image].levels;
+    while (texture.baseLevel + 1 < levels.size() &&
+           std::max(levels[texture.baseLevel].width,
+               levels[texture.baseLevel].height) > STREAMING_MIN_SIZE) {
+      ++texture.baseLevel;
+    }
+    texture.requestedLevel = texture.baseLevel;
+
+    setResidentLevel(texture, streaming ? texture.baseLevel : 0);
+    m_totalBytes += levelRangeBytes(texture, 0, uint32_t(levels.size()));
+  }
+}
+
+void TextureStreamer::request(size_t textureIndex, float pixelSize)
+{
+  auto &texture = m_textures[textureIndex];
+  const auto &finest = m_mipChains[texture.image].levels[0];
+  const auto size = float(std::max(finest.width, finest.height));
+
+  // Level whose size is the first one at least as large as pixelSize
+  uint32_t level = texture.baseLevel;
+  if (pixelSize >= size) {
+    level = 0;
+  } else if (pixelSize > 0.f) {
+    level = std::min(
+        uint32_t(std::log2(size / pixelSize)), texture.baseLevel);
+  }
+
+  texture.requestedLevel = std::min(texture.requestedLevel, level);
+  texture.lastUsedFrame = m_frame;
+}
+
+size_t TextureStreamer::update(size_t budgetBytes, size_t uploadBytes)
+{
+  if (!m_streaming) {
+    return 0;
+  }
+
+  size_t changedCount = 0;
+
+  // What a texture can be reduced to: its base level if it has not been used
+  // this frame, else the level it requested
+  const auto keptLevel = [&](const Texture &texture) {
+    return texture.lastUsedFrame == m_frame ? texture.requestedLevel
+                                            : texture.baseLevel;
+  };
+
+  // Eviction order, least recently used first
+  std::vector<size_t> victims;
+  for (size_t i = 0; i < m_textures.size(); ++i) {
+    if (m_textures[i].residentLevel < keptLevel(m_textures[i])) {
+      victims.push_back(i);
+    }
+  }
+  std::stable_sort(victims.begin(), victims.end(), [&](size_t a, size_t b) {
+    return m_textures[a].lastUsedFrame < m_textures[b].lastUsedFrame;
+  });
+
+  size_t nextVictim = 0;
+  const auto evict = [&]() {
+    if (nextVictim == victims.size()) {
+      return false;
+    }
+
+    auto &texture = m_textures[victims[nextVictim++]];
+    const auto level = keptLevel(texture);
+
+    m_evictedLevelCount += level - texture.residentLevel;
+    setResidentLevel(texture, level);
+    ++changedCount;
+
+    return true;
+  };
+
+  // The budget may have been lowered
+  while (m_residentBytes > budgetBytes && evict()) {
+  }
+
+  // Textures used this frame that miss detail, the largest gaps first. No
+  // texture is both a candidate and a victim.
+  std::vector<size_t> candidates;
+  for (size_t i = 0; i < m_textures.size(); ++i) {
+    const auto &texture = m_textures[i];
+    if (texture.lastUsedFrame == m_frame &&
+        texture.requestedLevel < texture.residentLevel) {
+      candidates.push_back(i);
+    }
+  }
+  std::stable_sort(
+      candidates.begin(), candidates.end(), [&](size_t a, size_t b) {
+        const auto &ta = m_textures[a];
+        const auto &tb = m_textures[b];
+        return ta.residentLevel - ta.requestedLevel >
+               tb.residentLevel - tb.requestedLevel;
+      });
+
+  size_t uploadedBytes = 0;
+
+  for (const auto i : candidates) {
+    auto &texture = m_textures[i];
+
+    // As many levels as the upload limit allows, but always at least one
+    // per frame so that large levels are streamed in eventually
+    auto level = texture.requestedLevel;
+    while (level + 1 < texture.residentLevel &&
+           uploadedBytes +
+                   levelRangeBytes(texture, level, texture.residentLevel) >
+               uploadBytes) {
+      ++level;
+    }
+
+    const auto byteSize =
+        levelRangeBytes(texture, level, texture.residentLevel);
+    if (uploadedBytes > 0 && uploadedBytes + byteSize > uploadBytes) {
+      continue;
+    }
+
+    while (m_residentBytes + byteSize > budgetBytes && evict()) {
+    }
+    if (m_residentBytes + byteSize > budgetBytes) {
+      continue;
+    }
+
+    uploadedBytes += byteSize;
+    m_streamedLevelCount += texture.residentLevel - level;
+    setResidentLevel(texture, level);
+    ++changedCount;
+  }
+
+  for (auto &texture : m_textures) {
+    texture.requestedLevel = texture.baseLevel;
+  }
+  ++m_frame;
+
+  return changedCount;
+}
+
+size_t TextureStreamer::levelRangeBytes(
+    const Texture &texture, uint32_t begin, uint32_t end) const
+{
+  const auto &levels = m_mipChains[texture.image].levels;
+
+  size_t byteSize = 0;
+  for (auto level = begin; level < end; ++level) {
+    byteSize += levels[level].byteSize;
+  }
+
+  return byteSize;
+}
+
+void TextureStreamer::setResidentLevel(Texture &texture, uint32_t level)
+{
+  const auto &chain = m_mipChains[texture.image];
+  const auto levelCount = uint32_t(chain.levels.size());
+
+  GLuint glId;
+  glGenTextures(1, &glId);
+  glBindTexture(GL_TEXTURE_2D, glId);
+  glTexStorage2D(GL_TEXTURE_2D, GLsizei(levelCount - level),
+      chain.internalFormat, chain.levels[level].width,
+      chain.levels[level].height);
+
+  for (auto i = level; i < levelCount; ++i) {
+    const auto &src = chain.levels[i];
+
+    if (texture.glId && i >= texture.residentLevel) {
+      // Already on the GPU
+      glCopyImageSubData(texture.glId, GL_TEXTURE_2D,
+          GLint(i - texture.residentLevel), 0, 0, 0, glId, GL_TEXTURE_2D,
+          GLint(i - level), 0, 0, 0, src.width, src.height, 1);
+    } else if (chain.compressed) {
+      glCompressedTexSubImage2D(GL_TEXTURE_2D, GLint(i - level), 0, 0,
+          src.width, src.height, chain.internalFormat, GLsizei(src.byteSize),
+          src.data);
+    } else {
+      glTexSubImage2D(GL_TEXTURE_2D, GLint(i - level), 0, 0, src.width,
+          src.height, GL_RGBA, chain.type, src.data);
+    }
+  }
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture.minFilter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, texture.magFilter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, texture.wrapS);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, texture.wrapT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  if (texture.glId) {
+    m_residentBytes -=
+        levelRangeBytes(texture, texture.residentLevel, levelCount);
+    glDeleteTextures(1, &texture.glId);
+  }
+
+  texture.glId = glId;
+  texture.residentLevel = level;
+  m_residentBytes += levelRangeBytes(texture, level, levelCount);
+}
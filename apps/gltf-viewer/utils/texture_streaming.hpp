@@ -0,0 +1,115 @@
+#pragma once
+
+#include "ThreadPool.hpp"
+
+#include <cstdint>
+#include <glad/glad.h>
+#include <tiny_gltf.h>
+#include <vector>
+
+// Level of detail residency of the textures of a glTF model. A mip chain of
+// every image is built on the CPU at load time (or read from its KTX2 file for
+// block compressed images, see getTextureImageIndex), and each texture starts
+// on the GPU with only its small levels (at most STREAMING_MIN_SIZE texels
+// wide). The renderer reports how many pixels each texture covers on screen
+// with request(), and update() streams in the finer levels it needs, under a
+// memory budget: the levels of the least recently used textures are evicted
+// to make room.
+//
+// A texture is an immutable storage texture holding its resident levels only,
+// so that evicted levels really give their memory back. Changing its levels
+// creates a new texture: the GL name returned by texture() is only valid until
+// the next update() that returns non zero.
+class TextureStreamer
+{
+public:
+  TextureStreamer() = default;
+  ~TextureStreamer();
+
+  TextureStreamer(const TextureStreamer &) = delete;
+  TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+  // Build the mip chains of model.images on pool and create a texture for
+  // each of model.textures: with its small levels only if streaming, else
+  // with every level (update() then does nothing). model must outlive the
+  // streamer, the finest level of each chain is read from its images.
+  void init(const tinygltf::Model &model, ThreadPool &pool, bool streaming);
+
+  bool streaming() const { return m_streaming; }
+  size_t size() const { return m_textures.size(); }
+
+  GLuint texture(size_t textureIndex) const
+  {
+    return m_textures[textureIndex].glId;
+  }
+
+  // textureIndex is used this frame by a primitive covering about pixelSize
+  // pixels on screen (assuming its texture coordinates span [0, 1] once)
+  void request(size_t textureIndex, float pixelSize);
+
+  // Called once per frame, after the requests: stream in the levels requested
+  // this frame (largest missing detail first) without uploading more than
+  // uploadBytes, while keeping the resident levels under budgetBytes by
+  // evicting those of the least recently used textures. Returns the number of
+  // textures that have been recreated.
+  size_t update(size_t budgetBytes, size_t uploadBytes);
+
+  // GPU memory used by the resident levels, and what it would be if every
+  // level was resident
+  size_t residentBytes() const { return m_residentBytes; }
+  size_t totalBytes() const { return m_totalBytes; }
+
+  // Number of levels uploaded and evicted since init
+  size_t streamedLevelCount() const { return m_streamedLevelCount; }
+  size_t evictedLevelCount() const { return m_evictedLevelCount; }
+
+private:
+  struct Level
+  {
+    GLsizei width;
+    GLsizei height;
+    const unsigned char *data;
+    size_t byteSize;
+  };
+
+  // Levels of an image, the first one points in the tinygltf image (all of
+  // them for KTX2 images)
+  struct MipChain
+  {
+    GLenum internalFormat = GL_RGBA8;
+    GLenum type = GL_UNSIGNED_BYTE;
+    bool compressed = false;
+    std::vector<Level> levels;
+    std::vector<unsigned char> storage; // Levels 1 and above
+  };
+
+  struct Texture
+  {
+    GLuint glId = 0;
+    size_t image = 0;
+    GLint minFilter = GL_LINEAR;
+    GLint magFilter = GL_LINEAR;
+    GLint wrapS = GL_REPEAT;
+    GLint wrapT = GL_REPEAT;
+    uint32_t residentLevel = 0; // Finest level on the GPU
+    uint32_t baseLevel = 0; // Coarsest streamed level, always resident
+    uint32_t requestedLevel = 0; // Finest level requested this frame
+    uint64_t lastUsedFrame = 0;
+  };
+
+  size_t levelRangeBytes(
+      const Texture &texture, uint32_t begin, uint32_t end) const;
+
+  // Replace the texture by one whose finest level is level, levels already
+  // on the GPU are copied from the previous texture
+  void setResidentLevel(Texture &texture, uint32_t level);
+
+  std::vector<MipChain> m_mipChains;
+  std::vector<Texture> m_textures;
+  bool m_streaming = false;
+  uint64_t m_frame = 1;
+  size_t m_residentBytes = 0;
+  size_t m_totalBytes = 0;
+  size_t m_streamedLevelCount = 0;
+  size_t m_evictedLevelCount = 0;
+};
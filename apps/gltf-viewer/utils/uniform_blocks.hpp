@@ -0,0 +1,90 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// C++ mirrors of the std140 uniform blocks of forward.vs.glsl,
+// forward_indirect.vs.glsl and pbr_directional_light.fs.glsl. Members are
+// ordered so that std140 adds no padding (vec3 are stored as vec4), any change
+// must be applied to both sides.
+
+// Binding points of the blocks, see glUniformBlockBinding
+#define UNIFORM_BLOCK_FRAME_BINDING 0
+#define UNIFORM_BLOCK_NODE_BINDING 1
+#define UNIFORM_BLOCK_MATERIAL_BINDING 2
+#define UNIFORM_BLOCK_ENVIRONMENT_BINDING 3
+#define UNIFORM_BLOCK_CLUSTER_BINDING 4
+
+// Binding point of the NodeTransforms shader storage block of
+// forward_indirect.vs.glsl, an array of NodeUniforms (std430 packs them
+// without padding)
+#define STORAGE_BLOCK_NODES_BINDING 0
+
+// Updated once per frame
+struct FrameUniforms
+{
+  glm::mat4 viewMatrix;
+  glm::mat4 projMatrix;
+  glm::mat4 viewProjMatrix;
+  glm::vec4 camDir; // xyz
+  glm::vec4 lightDirection; // xyz
+  glm::vec4 lightIntensity; // xyz
+  // Feature toggles of the GUI, 0 replaces the material factors with their
+  // neutral value
+  GLint metallicRoughnessEnabled;
+  GLint emissionEnabled;
+  GLint occlusionEnabled;
+  GLint normalMapEnabled;
+};
+
+// One per node with a mesh, updated when the scene graph changes
+struct NodeUniforms
+{
+  glm::mat4 modelMatrix;
+  glm::mat4 normalMatrix; // transpose(inverse(modelMatrix))
+};
+
+// One per material, uploaded at load time
+struct MaterialUniforms
+{
+  glm::vec4 baseColorFactor;
+  glm::vec4 emissiveFactor; // xyz
+  GLfloat metallicFactor;
+  GLfloat roughnessFactor;
+  GLfloat occlusionStrength;
+  GLfloat normalScale;
+};
+
+// Updated when the environment map changes
+struct EnvironmentUniforms
+{
+  glm::vec4 irradianceSH[9]; // xyz, see projectIrradianceSH in utils/ibl.hpp
+};
+
+// Updated once per frame with the light clusters, see LightClusters in
+// utils/lights.hpp
+struct ClusterUniforms
+{
+  glm::uvec4 gridSize; // xyz
+  // Slice of a view space depth: log(depth) * depthScale + depthBias
+  GLfloat depthScale;
+  GLfloat depthBias;
+  glm::vec2 tileSize; // In pixels
+};
+
+static_assert(sizeof(FrameUniforms) == 3 * 64 + 3 * 16 + 16, "std140 layout");
+static_assert(sizeof(NodeUniforms) == 2 * 64, "std140 layout");
+static_assert(sizeof(MaterialUniforms) == 3 * 16, "std140 layout");
+static_assert(sizeof(EnvironmentUniforms) == 9 * 16, "std140 layout");
+static_assert(sizeof(ClusterUniforms) == 2 * 16, "std140 layout");
+
+// Size of an element of an array of blocks selected with glBindBufferRange,
+// offsets must be multiples of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+inline GLsizeiptr getUniformBlockStride(size_t blockSize)
+{
+  GLint alignment = 0;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  alignment = alignment > 0 ? alignment : 256;
+
+  return GLsizeiptr((blockSize + alignment - 1) / alignment * alignment);
+}